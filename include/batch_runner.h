@@ -0,0 +1,65 @@
+#pragma once
+
+#include "rsurface_types.h"
+#include "flow_context.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace rsurfaces
+{
+    // Outcome of one scene of a batch.
+    struct BatchResult
+    {
+        std::string scene_file;
+        bool ok = false;
+        std::string error; // why the scene failed, if !ok
+        mint face_count = 0;
+        int steps = 0;
+        double initial_energy = 0.;
+        double final_energy = 0.;
+        double seconds = 0.; // wall time of the scene, including setup
+    };
+
+    // Runs many small, independent flows concurrently in one process, e.g. thousands of meshes with a few thousand faces.
+    //
+    // For meshes of that size the trees, block cluster trees and kernels are dominated by the fork/join overhead of their
+    // parallel regions. So instead of giving every flow all cores, the runner divides the cores into teams of team_size
+    // threads (see FlowContext::Partition) and lets every team work through the list of scenes, one flow at a time.
+    // With the default team_size of 1, all OpenMP regions and MKL calls of a flow run on a single thread.
+    //
+    // All flows start from the same settings (the defaults of the calling thread when the runner is created).
+    // A scene is either a scene file (.txt, .scene) or a mesh (.obj), which gets the default constraints of the GUI.
+    // Obstacles, implicit barriers, potentials and normal constraints are not supported here; such scenes fail.
+    // Not for several MPI ranks: Run throws if MPIContext::Active().
+    class BatchRunner
+    {
+    public:
+        // total_threads <= 0 means all cores.
+        BatchRunner(mint total_threads = 0, mint team_size = 1);
+
+        double theta = 0.5;
+        // Steps per scene if the scene has no iteration limit.
+        int default_steps = 100;
+        // If not empty, the final mesh of every scene is written to this directory (as <scene name>_<index>.obj).
+        std::string output_directory;
+        // Silences the per-step output of the flows while the batch runs. This redirects std::cout for the whole process,
+        // so only set it if nothing else prints meanwhile (as in the --batch mode of main).
+        bool quiet = false;
+
+        // Results in the order of scene_files.
+        std::vector<BatchResult> Run(const std::vector<std::string> &scene_files);
+
+        // Scene files listed one per line (empty lines and lines starting with # are skipped); relative paths are relative to the list.
+        static std::vector<std::string> ReadList(const std::string &filename);
+
+        static void PrintSummary(const std::vector<BatchResult> &results, double seconds, std::ostream &os);
+
+    private:
+        std::vector<FlowContext> teams;
+
+        BatchResult RunScene(const std::string &scene_file, size_t index);
+    }; // BatchRunner
+
+} // namespace rsurfaces
@@ -16,6 +16,7 @@
 #include "optimized_bct.h"
 //#include "optimized_cluster_tree.h"
 #include "sobolev/hs_operators.h"
+#include "geometry_cache.h"
 
 namespace rsurfaces
 {
@@ -29,8 +30,7 @@ namespace rsurfaces
         int vertex_count = mesh->nVertices();
         int primitive_count = mesh->nFaces();
         int primitive_length = 3;
-        FaceIndices fInds = mesh->getFaceIndices();
-        VertexIndices vInds = mesh->getVertexIndices();
+        const GeometryCache & G = GeometryCache::Get(geom);
 
         int dim = 3;
         int near_dim = 1 + dim + dim;
@@ -48,37 +48,30 @@ namespace rsurfaces
         std::vector<double> P_near(near_dim * primitive_count);
         std::vector<double> P_far (far_dim * primitive_count);
         
-        for (auto face : mesh->faces())
+        #pragma omp parallel for
+        for( int i = 0; i < primitive_count; ++i )
         {
-            int i = fInds[face];
-
             ordering[i] = i; // unless we know anything better, let's use the identity permutation.
-            if( static_cast<long long>(i) >= static_cast<long long>(primitive_count) )
-            {
-                eprint("mesh->getFaceIndices() must be corrupted.");
-            }
-            
-            GCHalfedge he = face.halfedge();
 
-            int i0 = vInds[he.vertex()];
-            int i1 = vInds[he.next().vertex()];
-            int i2 = vInds[he.next().next().vertex()];
+            int i0 = G.faceVertices[3 * i + 0];
+            int i1 = G.faceVertices[3 * i + 1];
+            int i2 = G.faceVertices[3 * i + 2];
             Vector3 p1 = geom->inputVertexPositions[i0];
             Vector3 p2 = geom->inputVertexPositions[i1];
             Vector3 p3 = geom->inputVertexPositions[i2];
 
-            P_coords[dim * i + 0] = athird * (p1.x + p2.x + p3.x);
-            P_coords[dim * i + 1] = athird * (p1.y + p2.y + p3.y);
-            P_coords[dim * i + 2] = athird * (p1.z + p2.z + p3.z);
+            P_coords[dim * i + 0] = G.faceBarycenters[3 * i + 0];
+            P_coords[dim * i + 1] = G.faceBarycenters[3 * i + 1];
+            P_coords[dim * i + 2] = G.faceBarycenters[3 * i + 2];
 
-            P_far[far_dim * i + 0] = P_near[near_dim * i + 0] = geom->faceAreas[face];
+            P_far[far_dim * i + 0] = P_near[near_dim * i + 0] = G.faceAreas[i];
             P_far[far_dim * i + 1] = P_near[near_dim * i + 1] = P_coords[dim * i + 0];
             P_far[far_dim * i + 2] = P_near[near_dim * i + 2] = P_coords[dim * i + 1];
             P_far[far_dim * i + 3] = P_near[near_dim * i + 3] = P_coords[dim * i + 2];
             
-            mreal n1 = geom->faceNormals[face].x;
-            mreal n2 = geom->faceNormals[face].y;
-            mreal n3 = geom->faceNormals[face].z;
+            mreal n1 = G.faceNormals[3 * i + 0];
+            mreal n2 = G.faceNormals[3 * i + 1];
+            mreal n3 = G.faceNormals[3 * i + 2];
             
             P_near[near_dim * i + 4] = n1;
             P_near[near_dim * i + 5] = n2;
@@ -147,8 +140,7 @@ namespace rsurfaces
         
         int vertex_count = mesh->nVertices();
         int primitive_count = mesh->nFaces();
-        FaceIndices fInds = mesh->getFaceIndices();
-        VertexIndices vInds = mesh->getVertexIndices();
+        const GeometryCache & G = GeometryCache::Get(geom);
         
         int dim = 3;
         int near_dim = 1 + dim + dim;
@@ -166,37 +158,30 @@ namespace rsurfaces
         std::vector<double> P_near(near_dim * primitive_count);
         std::vector<double> P_far (far_dim * primitive_count);
 
-        for (auto face : mesh->faces())
+        #pragma omp parallel for
+        for( int i = 0; i < primitive_count; ++i )
         {
-            int i = fInds[face];
-
             ordering[i] = i; // unless we know anything better, let's use the identity permutation.
-            if( static_cast<long long>(i) >= static_cast<long long>(primitive_count) )
-            {
-                eprint("mesh->getFaceIndices() must be corrupted.");
-            }
-
-            GCHalfedge he = face.halfedge();
 
-            int i0 = vInds[he.vertex()];
-            int i1 = vInds[he.next().vertex()];
-            int i2 = vInds[he.next().next().vertex()];
+            int i0 = G.faceVertices[3 * i + 0];
+            int i1 = G.faceVertices[3 * i + 1];
+            int i2 = G.faceVertices[3 * i + 2];
             Vector3 p1 = geom->inputVertexPositions[i0];
             Vector3 p2 = geom->inputVertexPositions[i1];
             Vector3 p3 = geom->inputVertexPositions[i2];
 
-            P_coords[3 * i + 0] = athird * (p1.x + p2.x + p3.x);
-            P_coords[3 * i + 1] = athird * (p1.y + p2.y + p3.y);
-            P_coords[3 * i + 2] = athird * (p1.z + p2.z + p3.z);
+            P_coords[3 * i + 0] = G.faceBarycenters[3 * i + 0];
+            P_coords[3 * i + 1] = G.faceBarycenters[3 * i + 1];
+            P_coords[3 * i + 2] = G.faceBarycenters[3 * i + 2];
 
-            P_far[far_dim * i + 0] = P_near[near_dim * i + 0] = geom->faceAreas[face];
+            P_far[far_dim * i + 0] = P_near[near_dim * i + 0] = G.faceAreas[i];
             P_far[far_dim * i + 1] = P_near[near_dim * i + 1] = P_coords[3 * i + 0];
             P_far[far_dim * i + 2] = P_near[near_dim * i + 2] = P_coords[3 * i + 1];
             P_far[far_dim * i + 3] = P_near[near_dim * i + 3] = P_coords[3 * i + 2];
 
-            mreal n1 = geom->faceNormals[face].x;
-            mreal n2 = geom->faceNormals[face].y;
-            mreal n3 = geom->faceNormals[face].z;
+            mreal n1 = G.faceNormals[3 * i + 0];
+            mreal n2 = G.faceNormals[3 * i + 1];
+            mreal n3 = G.faceNormals[3 * i + 2];
 
             P_far[far_dim * i + 4] = P_near[near_dim * i + 4] = n1;
             P_far[far_dim * i + 5] = P_near[near_dim * i + 5] = n2;
@@ -259,36 +244,23 @@ namespace rsurfaces
         
         mint nVertices = mesh->nVertices();
         mint nFaces = mesh->nFaces();
-        FaceIndices fInds = mesh->getFaceIndices();
-        VertexIndices vInds = mesh->getVertexIndices();
-
-        mreal athird = 1. / 3.;
+        const GeometryCache & G = GeometryCache::Get(geom);
 
         if( bvh->far_dim == 7 && bvh->near_dim == 7)
         {
             std::vector<mreal> P_near_(7 * nFaces);
             std::vector<mreal> P_far_(7 * nFaces);
             
-            for (auto face : mesh->faces())
+            #pragma omp parallel for
+            for( mint i = 0; i < nFaces; ++i )
             {
-                mint i = fInds[face];
-                
-                GCHalfedge he = face.halfedge();
-                
-                mint i0 = vInds[he.vertex()];
-                mint i1 = vInds[he.next().vertex()];
-                mint i2 = vInds[he.next().next().vertex()];
-                Vector3 p1 = geom->inputVertexPositions[i0];
-                Vector3 p2 = geom->inputVertexPositions[i1];
-                Vector3 p3 = geom->inputVertexPositions[i2];
-                
-                P_far_[7 * i + 0] = P_near_[7 * i + 0] = geom->faceAreas[face];
-                P_far_[7 * i + 1] = P_near_[7 * i + 1] = athird * (p1.x + p2.x + p3.x);
-                P_far_[7 * i + 2] = P_near_[7 * i + 2] = athird * (p1.y + p2.y + p3.y);
-                P_far_[7 * i + 3] = P_near_[7 * i + 3] = athird * (p1.z + p2.z + p3.z);
-                P_far_[7 * i + 4] = P_near_[7 * i + 4] = geom->faceNormals[face].x;
-                P_far_[7 * i + 5] = P_near_[7 * i + 5] = geom->faceNormals[face].y;
-                P_far_[7 * i + 6] = P_near_[7 * i + 6] = geom->faceNormals[face].z;
+                P_far_[7 * i + 0] = P_near_[7 * i + 0] = G.faceAreas[i];
+                P_far_[7 * i + 1] = P_near_[7 * i + 1] = G.faceBarycenters[3 * i + 0];
+                P_far_[7 * i + 2] = P_near_[7 * i + 2] = G.faceBarycenters[3 * i + 1];
+                P_far_[7 * i + 3] = P_near_[7 * i + 3] = G.faceBarycenters[3 * i + 2];
+                P_far_[7 * i + 4] = P_near_[7 * i + 4] = G.faceNormals[3 * i + 0];
+                P_far_[7 * i + 5] = P_near_[7 * i + 5] = G.faceNormals[3 * i + 1];
+                P_far_[7 * i + 6] = P_near_[7 * i + 6] = G.faceNormals[3 * i + 2];
             }
             bvh->SemiStaticUpdate( &P_near_[0], &P_far_[0] );
         }
@@ -299,27 +271,17 @@ namespace rsurfaces
                 std::vector<mreal> P_near_(10 * nFaces);
                 std::vector<mreal> P_far_(10 * nFaces);
                 
-                for (auto face : mesh->faces())
+                #pragma omp parallel for
+                for( mint i = 0; i < nFaces; ++i )
                 {
-                    mint i = fInds[face];
+                    P_far_[10 * i + 0] = P_near_[10 * i + 0] = G.faceAreas[i];
+                    P_far_[10 * i + 1] = P_near_[10 * i + 1] = G.faceBarycenters[3 * i + 0];
+                    P_far_[10 * i + 2] = P_near_[10 * i + 2] = G.faceBarycenters[3 * i + 1];
+                    P_far_[10 * i + 3] = P_near_[10 * i + 3] = G.faceBarycenters[3 * i + 2];
                     
-                    GCHalfedge he = face.halfedge();
-                    
-                    mint i0 = vInds[he.vertex()];
-                    mint i1 = vInds[he.next().vertex()];
-                    mint i2 = vInds[he.next().next().vertex()];
-                    Vector3 p1 = geom->inputVertexPositions[i0];
-                    Vector3 p2 = geom->inputVertexPositions[i1];
-                    Vector3 p3 = geom->inputVertexPositions[i2];
-                    
-                    P_far_[10 * i + 0] = P_near_[10 * i + 0] = geom->faceAreas[face];
-                    P_far_[10 * i + 1] = P_near_[10 * i + 1] = athird * (p1.x + p2.x + p3.x);
-                    P_far_[10 * i + 2] = P_near_[10 * i + 2] = athird * (p1.y + p2.y + p3.y);
-                    P_far_[10 * i + 3] = P_near_[10 * i + 3] = athird * (p1.z + p2.z + p3.z);
-                    
-                    mreal n1 = geom->faceNormals[face].x;
-                    mreal n2 = geom->faceNormals[face].y;
-                    mreal n3 = geom->faceNormals[face].z;
+                    mreal n1 = G.faceNormals[3 * i + 0];
+                    mreal n2 = G.faceNormals[3 * i + 1];
+                    mreal n3 = G.faceNormals[3 * i + 2];
                     
                     P_near_[10 * i + 4] = P_far_[10 * i + 4] = n1 * n1;
                     P_near_[10 * i + 5] = P_far_[10 * i + 5] = n1 * n2;
@@ -334,27 +296,17 @@ namespace rsurfaces
                 std::vector<mreal> P_near_(7 * nFaces);
                 std::vector<mreal> P_far_(10 * nFaces);
                 
-                for (auto face : mesh->faces())
+                #pragma omp parallel for
+                for( mint i = 0; i < nFaces; ++i )
                 {
-                    mint i = fInds[face];
-                    
-                    GCHalfedge he = face.halfedge();
-                    
-                    mint i0 = vInds[he.vertex()];
-                    mint i1 = vInds[he.next().vertex()];
-                    mint i2 = vInds[he.next().next().vertex()];
-                    Vector3 p1 = geom->inputVertexPositions[i0];
-                    Vector3 p2 = geom->inputVertexPositions[i1];
-                    Vector3 p3 = geom->inputVertexPositions[i2];
-                    
-                    P_far_[10 * i + 0] = P_near_[7 * i + 0] = geom->faceAreas[face];
-                    P_far_[10 * i + 1] = P_near_[7 * i + 1] = athird * (p1.x + p2.x + p3.x);
-                    P_far_[10 * i + 2] = P_near_[7 * i + 2] = athird * (p1.y + p2.y + p3.y);
-                    P_far_[10 * i + 3] = P_near_[7 * i + 3] = athird * (p1.z + p2.z + p3.z);
+                    P_far_[10 * i + 0] = P_near_[7 * i + 0] = G.faceAreas[i];
+                    P_far_[10 * i + 1] = P_near_[7 * i + 1] = G.faceBarycenters[3 * i + 0];
+                    P_far_[10 * i + 2] = P_near_[7 * i + 2] = G.faceBarycenters[3 * i + 1];
+                    P_far_[10 * i + 3] = P_near_[7 * i + 3] = G.faceBarycenters[3 * i + 2];
                     
-                    mreal n1 = geom->faceNormals[face].x;
-                    mreal n2 = geom->faceNormals[face].y;
-                    mreal n3 = geom->faceNormals[face].z;
+                    mreal n1 = G.faceNormals[3 * i + 0];
+                    mreal n2 = G.faceNormals[3 * i + 1];
+                    mreal n3 = G.faceNormals[3 * i + 2];
                     
                     P_near_[7 * i + 4] = n1;
                     P_near_[7 * i + 5] = n2;
@@ -373,6 +325,73 @@ namespace rsurfaces
         }
     } // UpdateOptimizedBVH
 
+    // For meshes whose vertices have moved (same connectivity): refits clustering coordinates, bounding boxes and
+    // all far and near field data of bvh bottom-up, without splitting the clusters anew. See OptimizedClusterTree::Refit.
+    template <typename MeshPtrT>
+    inline void RefitOptimizedBVH(OptimizedClusterTree * bvh, MeshPtrT &mesh, GeomPtr &geom)
+    {
+        geom->requireFaceAreas();
+        geom->requireFaceNormals();
+
+        mint nFaces = mesh->nFaces();
+        const GeometryCache & G = GeometryCache::Get(geom);
+
+        mint near_dim = bvh->near_dim;
+        mint far_dim = bvh->far_dim;
+
+        std::vector<mreal> P_coords(3 * nFaces);
+        std::vector<mreal> P_hull_coords(9 * nFaces);
+        std::vector<mreal> P_near(near_dim * nFaces);
+        std::vector<mreal> P_far(far_dim * nFaces);
+
+        // normal (7 entries per row) or projector (10 entries per row)
+        auto fill = [&]( mreal * row, const mint row_dim, const mint i )
+        {
+            row[0] = G.faceAreas[i];
+            row[1] = G.faceBarycenters[3 * i + 0];
+            row[2] = G.faceBarycenters[3 * i + 1];
+            row[3] = G.faceBarycenters[3 * i + 2];
+
+            mreal n1 = G.faceNormals[3 * i + 0];
+            mreal n2 = G.faceNormals[3 * i + 1];
+            mreal n3 = G.faceNormals[3 * i + 2];
+
+            if( row_dim == 7 )
+            {
+                row[4] = n1;
+                row[5] = n2;
+                row[6] = n3;
+            }
+            else
+            {
+                row[4] = n1 * n1;
+                row[5] = n1 * n2;
+                row[6] = n1 * n3;
+                row[7] = n2 * n2;
+                row[8] = n2 * n3;
+                row[9] = n3 * n3;
+            }
+        };
+
+        #pragma omp parallel for
+        for( mint i = 0; i < nFaces; ++i )
+        {
+            fill( &P_near[near_dim * i], near_dim, i );
+            fill( &P_far[far_dim * i], far_dim, i );
+
+            for( mint k = 0; k < 3; ++k )
+            {
+                P_coords[3 * i + k] = G.faceBarycenters[3 * i + k];
+                Vector3 p = geom->inputVertexPositions[G.faceVertices[3 * i + k]];
+                P_hull_coords[9 * i + 3 * k + 0] = p.x;
+                P_hull_coords[9 * i + 3 * k + 1] = p.y;
+                P_hull_coords[9 * i + 3 * k + 2] = p.z;
+            }
+        }
+
+        bvh->Refit( &P_coords[0], &P_hull_coords[0], &P_near[0], &P_far[0] );
+    } // RefitOptimizedBVH
+
     template <typename MeshPtrT>
     inline OptimizedClusterTree * CreateOptimizedBVH_Projectors(MeshPtrT &mesh, GeomPtr &geom, BVHSettings settings = BVHDefaultSettings)
     {
@@ -386,8 +405,7 @@ namespace rsurfaces
         int far_dim = 1 + dim + dim * (dim + 1)/2;
         int primitive_length = 3;
         
-        FaceIndices fInds = mesh->getFaceIndices();
-        VertexIndices vInds = mesh->getVertexIndices();
+        const GeometryCache & G = GeometryCache::Get(geom);
 
         double athird = 1. / primitive_length;
 
@@ -401,37 +419,30 @@ namespace rsurfaces
         std::vector<double> P_near(near_dim * primitive_count);
         std::vector<double> P_far (far_dim * primitive_count);
         
-        for (auto face : mesh->faces())
+        #pragma omp parallel for
+        for( int i = 0; i < primitive_count; ++i )
         {
-            int i = fInds[face];
-
             ordering[i] = i; // unless we know anything better, let's use the identity permutation.
-            if( static_cast<long long>(i) >= static_cast<long long>(primitive_count) )
-            {
-                eprint("mesh->getFaceIndices() must be corrupted.");
-            }
-
-            GCHalfedge he = face.halfedge();
 
-            int i0 = vInds[he.vertex()];
-            int i1 = vInds[he.next().vertex()];
-            int i2 = vInds[he.next().next().vertex()];
+            int i0 = G.faceVertices[3 * i + 0];
+            int i1 = G.faceVertices[3 * i + 1];
+            int i2 = G.faceVertices[3 * i + 2];
             Vector3 p1 = geom->inputVertexPositions[i0];
             Vector3 p2 = geom->inputVertexPositions[i1];
             Vector3 p3 = geom->inputVertexPositions[i2];
 
-            P_coords[dim * i + 0] = athird * (p1.x + p2.x + p3.x);
-            P_coords[dim * i + 1] = athird * (p1.y + p2.y + p3.y);
-            P_coords[dim * i + 2] = athird * (p1.z + p2.z + p3.z);
+            P_coords[dim * i + 0] = G.faceBarycenters[3 * i + 0];
+            P_coords[dim * i + 1] = G.faceBarycenters[3 * i + 1];
+            P_coords[dim * i + 2] = G.faceBarycenters[3 * i + 2];
 
-            P_far[far_dim * i + 0] = P_near[near_dim * i + 0] = geom->faceAreas[face];
+            P_far[far_dim * i + 0] = P_near[near_dim * i + 0] = G.faceAreas[i];
             P_far[far_dim * i + 1] = P_near[near_dim * i + 1] = P_coords[dim * i + 0];
             P_far[far_dim * i + 2] = P_near[near_dim * i + 2] = P_coords[dim * i + 1];
             P_far[far_dim * i + 3] = P_near[near_dim * i + 3] = P_coords[dim * i + 2];
             
-            mreal n1 = geom->faceNormals[face].x;
-            mreal n2 = geom->faceNormals[face].y;
-            mreal n3 = geom->faceNormals[face].z;
+            mreal n1 = G.faceNormals[3 * i + 0];
+            mreal n2 = G.faceNormals[3 * i + 1];
+            mreal n3 = G.faceNormals[3 * i + 2];
             
             P_far[far_dim * i + 4] = P_near[near_dim * i + 4] = n1 * n1;
             P_far[far_dim * i + 5] = P_near[near_dim * i + 5] = n1 * n2;
@@ -37,6 +37,8 @@ namespace rsurfaces
             return "H2-Projected";
         case GradientMethod::Willmore:
             return "Willmore";
+        case GradientMethod::HsNewtonKrylov:
+            return "Hs-Newton-Krylov";
         default:
             throw std::runtime_error("Unknown method type.");
         }
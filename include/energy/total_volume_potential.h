@@ -30,5 +30,8 @@ namespace rsurfaces
         // Return the separation parameter for this energy.
         // Return 0 if this energy doesn't do hierarchical approximation.
         virtual double GetTheta();
+        
+        // Copy on another geometry of the same mesh (see SurfaceEnergy::CopyFor).
+        virtual SurfaceEnergy *CopyFor(GeomPtr geom_);
     };
 }
\ No newline at end of file
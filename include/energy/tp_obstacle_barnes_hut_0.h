@@ -66,6 +66,17 @@ namespace rsurfaces
         // Return 0 if this energy doesn't do hierarchical approximation.
         virtual double GetTheta();
 
+        // Moves the obstacle by x -> R x + t (R a rotation) without rebuilding its BVH; see OptimizedClusterTree::RigidTransform.
+        // The motion is taken relative to the obstacle's positions at the first call, or at the last RefitObstacle.
+        void TransformObstacle(const Eigen::Matrix3d &R, const Vector3 &t);
+
+        // Refits the obstacle's BVH after the vertices of obsGeom have moved (obsMesh and obsGeom as handed to the constructor).
+        template <typename MeshPtrT>
+        void RefitObstacle(MeshPtrT &obsMesh, GeomPtr &obsGeom)
+        {
+            RefitOptimizedBVH(o_bvh, obsMesh, obsGeom);
+        }
+
         bool use_int = false;
 
     private:
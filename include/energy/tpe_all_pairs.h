@@ -57,6 +57,9 @@ namespace rsurfaces
         // Return 0 if this energy doesn't do hierarchical approximation.
         virtual double GetTheta();
         
+        // Copy on another geometry of the same mesh (see SurfaceEnergy::CopyFor).
+        virtual SurfaceEnergy *CopyFor(GeomPtr geom_);
+        
         OptimizedBlockClusterTree * GetBCT();
         
         bool use_int = false;
@@ -62,6 +62,19 @@ namespace rsurfaces
         // Return 0 if this energy doesn't do hierarchical approximation.
         virtual double GetTheta();
         
+        // Copy on another geometry of the same mesh (see SurfaceEnergy::CopyFor).
+        virtual SurfaceEnergy *CopyFor(GeomPtr geom_);
+        
+        // Copy on another geometry of the same mesh with a different theta (see SurfaceEnergy::CoarseCopyFor).
+        virtual SurfaceEnergy *CoarseCopyFor(GeomPtr geom_, double theta_);
+        
+        // If bct_ was built on the current BVH with the same theta, Value and Differential are
+        // evaluated on its block partition (as TPEnergyMultipole0) instead of traversing the tree again.
+        // This is a different approximation of the energy than the Barnes-Hut traversal.
+        // The block cluster tree is dropped by the next call to Update, and as soon as the positions change
+        // (see GeometryCache::PositionsChanged), since its admissibility only holds at the positions it was built for.
+        virtual void SetBlockClusterTree(BCTPtr bct_);
+        
         bool use_int = false;
         
     private:
@@ -70,6 +83,11 @@ namespace rsurfaces
         mreal theta = 0.5;
         
         OptimizedClusterTree* bvh;
+        BCTPtr bct;
+        unsigned long long bct_version = 0; // GeometryCache::Version of geom when bct was set
+        
+        // Drops bct if the positions have changed since it was set.
+        void CheckBlockClusterTree();
         
         template<typename T1, typename T2>
         mreal Energy(T1 alpha, T2 betahalf);
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "optimized_bct_types.h"
+#include "optimized_cluster_tree.h"
+#include "optimized_bct.h"
+
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace rsurfaces
+{
+    // Settings, profiler lane and thread budget of one flow, so that several independent flows can run in one process,
+    // each in its own thread (e.g. for a parameter sweep or in a service built on rsurfaces_core).
+    //
+    // Everything that sizes itself by omp_get_num_threads() (trees, kernels, MKL) picks up thread_count while a Scope
+    // of the context is alive in the calling thread. Trees and block cluster trees created in that time use bvh_settings
+    // and bct_settings as defaults. Changes to BVHDefaultSettings/BCTDefaultSettings made within the scope are kept in the context.
+    //
+    // Partition divides the cores among several flows, so that they do not oversubscribe the machine.
+    class FlowContext
+    {
+    public:
+        // thread_count <= 0 means all threads that OpenMP would use right now; first_core < 0 means no pinning.
+        FlowContext(mint thread_count_ = 0, mint first_core_ = -1);
+
+        BVHSettings bvh_settings;
+        BCTSettings bct_settings;
+        mint thread_count = 1;
+        mint first_core = -1; // if nonnegative, the flow's threads are pinned to the cores [first_core, first_core + thread_count)
+        int id = 0;           // process id of the flow's events in the trace (see Profiler::flow_id)
+
+        // flow_count contexts with disjoint, contiguous core ranges that cover total_threads cores (all cores if total_threads <= 0).
+        static std::vector<FlowContext> Partition(mint flow_count, mint total_threads = 0, bool pin = true);
+
+        // Makes the context current in the calling thread and restores the previous state on destruction.
+        class Scope
+        {
+        public:
+            Scope(FlowContext &context_);
+            ~Scope();
+            Scope(const Scope &) = delete;
+            Scope &operator=(const Scope &) = delete;
+
+        private:
+            FlowContext &context;
+            BVHSettings previous_bvh_settings;
+            BCTSettings previous_bct_settings;
+            int previous_omp_threads = 1;
+            int previous_mkl_threads = 0;
+            int previous_flow_id = 0;
+#ifdef __linux__
+            bool pinned = false;
+            cpu_set_t previous_affinity;
+#endif
+        }; // Scope
+    };
+
+} // namespace rsurfaces
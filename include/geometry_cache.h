@@ -0,0 +1,84 @@
+#pragma once
+
+#include "rsurface_types.h"
+#include "optimized_bct_types.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace rsurfaces
+{
+    // Derived geometric quantities of a VertexPositionGeometry (total area and volume,
+    // face areas, unit normals and barycenters, area-weighted vertex normals).
+    // They are computed in one parallel pass per position version and shared by
+    // energies, constraints and the BVH constructors.
+    //
+    // Everyone who moves vertices has to call GeometryCache::PositionsChanged(geom)
+    // afterwards (next to geom->refreshQuantities(), if that is called at all).
+    // Topology changes are detected by the element counts.
+    class GeometryCache
+    {
+    public:
+        mint vertex_count = 0;
+        mint face_count = 0;
+
+        mreal totalArea = 0.;
+        mreal totalVolume = 0.;
+
+        A_Vector<mint>  faceVertices;    // 3 * face_count, vertex indices of the corners
+        A_Vector<mreal> faceAreas;       // face_count
+        A_Vector<mreal> faceNormals;     // 3 * face_count, unit normals
+        A_Vector<mreal> faceBarycenters; // 3 * face_count
+        A_Vector<mreal> vertexNormals;   // 3 * vertex_count, area-weighted normals of interior faces
+
+        // Returns the quantities for the current positions of geom; recomputes them if necessary.
+        static const GeometryCache & Get(const GeomPtr & geom);
+
+        // Marks the cached quantities of geom as outdated.
+        static void PositionsChanged(const GeomPtr & geom);
+
+        // Counter that changes whenever the positions of geom have changed; for caches of other derived data.
+        static unsigned long long Version(const GeomPtr & geom);
+
+        // Drops the cache entry of geom.
+        static void Release(const GeomPtr & geom);
+
+        inline Vector3 FaceNormal(mint i) const
+        {
+            return Vector3{faceNormals[3 * i], faceNormals[3 * i + 1], faceNormals[3 * i + 2]};
+        }
+
+        inline Vector3 FaceBarycenter(mint i) const
+        {
+            return Vector3{faceBarycenters[3 * i], faceBarycenters[3 * i + 1], faceBarycenters[3 * i + 2]};
+        }
+
+        inline Vector3 VertexNormal(mint i) const
+        {
+            return Vector3{vertexNormals[3 * i], vertexNormals[3 * i + 1], vertexNormals[3 * i + 2]};
+        }
+
+    private:
+        // The registry lock only guards lookup and insertion; the recomputation of an entry holds that entry's own lock,
+        // so that flows in different threads (see FlowContext) do not wait for each other's geometry passes.
+        struct Entry
+        {
+            std::weak_ptr<surface::VertexPositionGeometry> owner; // guarded by registry_mutex
+            std::atomic<unsigned long long> version{1};
+            std::mutex mutex;                                     // guards computed_version and data
+            unsigned long long computed_version = 0;
+            std::unique_ptr<GeometryCache> data;
+        };
+
+        void Compute(surface::VertexPositionGeometry & geom);
+
+        // Returns the entry of geom, creating it if necessary.
+        static std::shared_ptr<Entry> Lookup(const GeomPtr & geom);
+
+        static std::mutex registry_mutex;
+        static std::unordered_map<const surface::VertexPositionGeometry *, std::shared_ptr<Entry>> registry;
+    }; // GeometryCache
+
+} // namespace rsurfaces
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "rsurface_types.h"
+#include "geometry_cache.h"
 #include <vector>
 #include <unordered_set>
 #include <chrono>
@@ -125,6 +126,7 @@ namespace rsurfaces
             Vector3 disp = geom->inputVertexPositions[v] - center;
             geom->inputVertexPositions[v] = center + scale * disp;
         }
+        GeometryCache::PositionsChanged(geom);
     }
 
     inline void translateMesh(GeomPtr &geom, MeshPtr &mesh, Vector3 offset)
@@ -133,6 +135,7 @@ namespace rsurfaces
         {
             geom->inputVertexPositions[v] += offset;
         }
+        GeometryCache::PositionsChanged(geom);
     }
 
     inline void translatePoints(GeomPtr &geom, MeshPtr &mesh, Vector3 offset, std::vector<GCVertex> &points)
@@ -141,6 +144,7 @@ namespace rsurfaces
         {
             geom->inputVertexPositions[v] += offset;
         }
+        GeometryCache::PositionsChanged(geom);
     }
 
     inline double MeanCurvature(GCVertex v, const MeshPtr &mesh, const GeomPtr &geom)
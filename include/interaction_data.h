@@ -2,6 +2,8 @@
 
 #include "optimized_bct_types.h"
 
+#include <mutex>
+
 namespace rsurfaces
 {
 
@@ -59,6 +61,10 @@ public:
     void Prepare_CSR( mint b_m_, mint * b_row_ptr_, mint b_n_, mint * b_col_ptr_ );      // Allocates nonzero values  for blocked matrix (typically near field).
     void Prepare_VBSR( mint b_m_, mint * b_row_ptr_, mint b_n_, mint * b_col_ptr_ );     // Allocates nonzero values  for blocked matrix (typically near field).
 
+    // Drops all blocks in block rows b_i with keep[b_i] == 0; the row count b_m stays the same, so the dropped rows simply become empty.
+    // Used to give each MPI rank only its share of the rows. Must be called before Prepare_CSR/Prepare_VBSR.
+    void RestrictBlockRows( const mint * keep );
+
     
     inline void ApplyKernel( BCTKernelType type, mreal * T_input, mreal * S_output, mint cols, mreal factor = 1., NearFieldMultiplicationAlgorithm mult_alg = NearFieldMultiplicationAlgorithm::MKL_CSR)
     {
@@ -152,6 +158,15 @@ public:
     mint * job_ptr = nullptr;
     mint max_row_counter = 0;
     
+    // If rebalance_by_measured_costs is set, ApplyKernel_Hybrid measures the run time of each block row. If the threads were
+    // busy for very different times (max / mean > rebalance_threshold), the block rows are split anew according to these costs,
+    // and the following calls of ApplyKernel_Hybrid use that split. job_ptr, which the other kernels use, is never changed.
+    // Off by default: the timings are noisy and cost two omp_get_wtime calls per block row.
+    bool rebalance_by_measured_costs = false;
+    mreal rebalance_threshold = 1.2;
+    A_Vector<mint> hybrid_job_ptr; // thread_count + 1 entries; empty until the first rebalance
+    std::mutex hybrid_mutex;       // guards hybrid_job_ptr against concurrent products
+    
     void ApplyKernel_VBSR     ( mreal * values, mreal * T_input, mreal * S_output, mint cols, mreal factor = 1. );
     void ApplyKernel_CSR_MKL  ( mreal * values, mreal * T_input, mreal * S_output, mint cols, mreal factor = 1. );
     void ApplyKernel_CSR_Eigen( mreal * values, mreal * T_input, mreal * S_output, mint cols, mreal factor = 1. );
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "rsurface_types.h"
+#include "optimized_cluster_tree.h"
+
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace rsurfaces
+{
+    struct IntersectionReport
+    {
+        std::vector<std::pair<mint, mint>> intersecting_pairs; // face indices, first < second, sorted
+        // smallest distance between two faces without a common vertex; 0 if some intersect, infinity if none are closer than the cutoff
+        mreal min_separation = std::numeric_limits<mreal>::infinity();
+        std::pair<mint, mint> closest_pair{-1, -1};
+        long long tested_pairs = 0; // triangle pairs that survived the box tests
+
+        // Contacts that are not reported as intersections.
+        static const char *Exemptions()
+        {
+            return "contact at a shared vertex or edge, folds around a shared vertex within one plane, coplanar overlaps of faces without a common vertex";
+        }
+
+        inline bool IntersectionFree() const
+        {
+            return intersecting_pairs.empty();
+        }
+    }; // IntersectionReport
+
+    // In-process check that a triangle mesh is free of self-intersections, e.g. for certifying output frames.
+    //
+    // Candidate pairs come from a dual traversal of an OptimizedClusterTree over the faces, pruned by its bounding boxes
+    // and by the smallest separation found so far; the traversal runs in parallel with TreeTaskScheduler. Surviving
+    // triangle pairs get an exact segment-triangle intersection test and a triangle-triangle distance. Neighbouring faces
+    // are tested as well: with one common vertex, the edges opposite to it against the other face; with a common edge,
+    // whether the faces are folded onto each other. They are left out of the separation. Coplanar overlaps are not
+    // detected otherwise (see IntersectionReport::Exemptions).
+    //
+    // The tree is kept between calls and only refit (see RefitOptimizedBVH), unless the number of faces has changed.
+    class IntersectionValidator
+    {
+    public:
+        // Separations above cutoff are not resolved, which prunes most of the traversal; the default finds the global minimum.
+        IntersectionValidator(mreal cutoff_ = std::numeric_limits<mreal>::infinity());
+        ~IntersectionValidator();
+
+        IntersectionValidator(const IntersectionValidator &) = delete;
+        IntersectionValidator &operator=(const IntersectionValidator &) = delete;
+
+        IntersectionReport Check(MeshPtr &mesh, GeomPtr &geom);
+
+        mreal cutoff;
+
+    private:
+        OptimizedClusterTree *bvh = nullptr;
+    }; // IntersectionValidator
+
+} // namespace rsurfaces
@@ -28,7 +28,32 @@ namespace rsurfaces
     class LineSearch
     {
         public:
-        LineSearch(MeshPtr mesh_, GeomPtr geom_, std::vector<SurfaceEnergy*> energies_, double maxStep_=-1.);
+        // Coarse geometry and energies of the multi-fidelity search (see below). A caller that keeps one across
+        // steps (see SurfaceFlow) saves copying the geometry and building the coarse trees in every step: the coarse
+        // BVHs are only refit to the new positions. Release it whenever the mesh or the set of energies changes.
+        struct CoarseState
+        {
+            GeomPtr geom;
+            std::vector<SurfaceEnergy*> energies;
+            double energy = 0;
+            // whether the last search backtracked; the coarse phase only pays off for searches that do
+            bool backtracked = true;
+
+            ~CoarseState();
+            void Release();
+        };
+
+        // With speculativeProbes_ > 1, each round evaluates the step sizes delta, delta/2, ..., delta/2^(speculativeProbes_-1)
+        // concurrently, on private copies of the geometry and the energies, and accepts the largest one that satisfies the Armijo condition.
+        // This needs every energy to support SurfaceEnergy::CopyFor; otherwise the search falls back to one probe at a time.
+        //
+        // With coarseTheta_ > 0, the search first backtracks on coarse copies of the energies (SurfaceEnergy::CoarseCopyFor
+        // with this theta) on a private geometry. Only the candidate step found there is evaluated at full accuracy;
+        // if it fails the Armijo condition, the search continues from it at full accuracy as usual. With coarseState_, the
+        // coarse copies live in the given state and survive the search; the coarse phase is then skipped if the previous
+        // search accepted its first step, since it would only add the coarse evaluations to the single fine one.
+        LineSearch(MeshPtr mesh_, GeomPtr geom_, std::vector<SurfaceEnergy*> energies_, double maxStep_=-1., int speculativeProbes_ = 1, double coarseTheta_ = 0., CoarseState *coarseState_ = nullptr);
+        ~LineSearch();
         double BacktrackingLineSearch(Eigen::MatrixXd &gradient, double initGuess, double gradDot, bool negativeIsForward = true);
         
         private:
@@ -37,10 +62,32 @@ namespace rsurfaces
         std::vector<SurfaceEnergy*> energies;
         Eigen::MatrixXd origPositions;
         double maxStep;
+        int speculativeProbes;
+        double coarseTheta;
+
+        // private geometry and energies of one speculative probe
+        struct Probe
+        {
+            GeomPtr geom;
+            std::vector<SurfaceEnergy*> energies;
+            double energy = 0;
+        };
+        std::vector<Probe> probes;
+        // geometry and coarse energies of the multi-fidelity search; points to ownCoarse unless the caller passed a state
+        CoarseState ownCoarse;
+        CoarseState *coarse;
 
         void SaveCurrentPositions();
         void RestorePositions();
         void SetGradientStep(Eigen::MatrixXd &gradient, double delta);
+        void SetPositions(GeomPtr &target, Eigen::MatrixXd &gradient, double delta);
+        void DropBlockClusterTrees();
+        void RequireProbes();
+        void ReleaseProbes();
+        int SpeculativeRound(Eigen::MatrixXd &gradient, double delta, bool negativeIsForward, double initialEnergy, double armijoSlope);
+        bool RequireCoarse();
+        void MoveCoarse(Eigen::MatrixXd &gradient, double delta);
+        double CoarseCandidate(Eigen::MatrixXd &gradient, double delta, bool negativeIsForward, double initialEnergy, double armijoSlope, int &numBacktracks);
     };
 }
 
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "rsurface_types.h"
+#include "surface_flow.h"
+#include "energy/tpe_barnes_hut_0.h"
+#include "energy/tp_obstacle_barnes_hut_0.h"
+
+#include <vector>
+
+namespace rsurfaces
+{
+    // Flow restricted to a region of interest, for interactive editing of large meshes (Ctrl-drag in the GUI).
+    //
+    // The region consists of all vertices within geodesic distance margin (along edges) of the seed vertices.
+    // Its faces are copied into a small mesh that is flowed on its own: only its BVH, block cluster tree and
+    // saddle point system are rebuilt per step. The rest of the surface is frozen and acts as an obstacle on it,
+    // whose BVH is built once in the constructor (the cached far field). The vertices on the seam between the
+    // two are pinned, so the local flow cannot tear the surface apart.
+    //
+    // Other energies, potentials and constraints of the global flow are not seen by the local one.
+    class LocalFlowRegion
+    {
+    public:
+        // Throws std::runtime_error if the region is empty, covers the whole mesh, or its faces do not form a manifold mesh.
+        LocalFlowRegion(MeshPtr mesh_, GeomPtr geom_, const std::vector<GCVertex> &seeds, double margin,
+                        double alpha, double beta, double theta);
+        ~LocalFlowRegion();
+
+        LocalFlowRegion(const LocalFlowRegion &) = delete;
+        LocalFlowRegion &operator=(const LocalFlowRegion &) = delete;
+
+        // Copies the positions of the region's vertices from the global geometry (e.g. after they have been dragged).
+        void PullPositions();
+        // One H^s projected gradient step of the region.
+        void Step();
+        // Writes the positions of the region's vertices back to the global geometry; the caller refreshes its derived quantities.
+        void PushPositions();
+
+        size_t nVertices() const { return localToGlobal.size(); }
+        size_t nFaces() const { return localFaceCount; }
+
+    private:
+        MeshPtr mesh;
+        GeomPtr geom;
+
+        MeshPtr localMesh;
+        GeomPtr localGeom;
+        std::vector<size_t> localToGlobal; // global index of each vertex of localMesh
+        size_t localFaceCount = 0;
+
+        std::shared_ptr<surface::SurfaceMesh> farMesh;
+        GeomPtr farGeom;
+
+        TPEnergyBarnesHut0 *energy = nullptr;
+        TPObstacleBarnesHut0 *farField = nullptr;
+        SurfaceFlow *flow = nullptr;
+    }; // LocalFlowRegion
+
+} // namespace rsurfaces
@@ -10,6 +10,9 @@
 #include "geometrycentral/surface/meshio.h"
 
 #include "energy/squared_error.h"
+#include "local_flow.h"
+#include "obstacle_animation.h"
+#include "intersection_validator.h"
 
 #include <mkl.h>
 #include "optimized_bct.h"
@@ -53,7 +56,8 @@ namespace rsurfaces
         void HandlePicking();
 
         void TakeOptimizationStep(bool remeshAfter, bool showAreaRatios);
-        void AddObstacle(std::string filename, double weight, bool recenter, bool asPointCloud);
+        IntersectionReport ValidateIntersections();
+        void AddObstacle(std::string filename, double weight, bool recenter, bool asPointCloud, const scene::ObstacleData *motion = 0);
         void AddPotential(scene::PotentialType pType, double weight, double targetValue);
         void AddImplicitBarrier(scene::ImplicitBarrierData &implicitBarrier);
 
@@ -67,6 +71,8 @@ namespace rsurfaces
         
         polyscope::SurfaceMesh *psMesh;
         std::vector<polyscope::SurfaceMesh *> obstacles;
+        // moved to their scheduled pose before every step
+        std::vector<std::pair<AnimatedObstacle *, polyscope::SurfaceMesh *>> animatedObstacles;
         std::string meshName;
         int stepLimit;
         int realTimeLimit;
@@ -89,6 +95,16 @@ namespace rsurfaces
         scene::SceneData sceneData;
         bool exitWhenDone;
         double totalObstacleVolume;
+        // if true, Ctrl-drag flows only the dragged region plus localDragMargin (see LocalFlowRegion) instead of the whole mesh
+        bool localDrag;
+        double localDragMargin;
+        // if positive, the mesh is checked for self-intersections after every validateEvery-th step
+        int validateEvery;
+
+        inline bool LocalDragActive() const
+        {
+            return localRegion != nullptr;
+        }
 
     private:
         int implicitCount = 0;
@@ -102,5 +118,7 @@ namespace rsurfaces
         bool ctrlMouseDown;
         Vector3 initialPickedPosition;
         bool hasPickedVertex;
+        LocalFlowRegion *localRegion;
+        IntersectionValidator validator;
     };
 } // namespace rsurfaces
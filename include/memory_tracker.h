@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+namespace rsurfaces
+{
+    // Byte accounting for the heap storage of the large data structures.
+    // Activated by defining MEMORY_ACCOUNTING. safe_alloc/safe_free and the allocator behind A_Vector/A_Deque
+    // report every block here; the block is charged to the owner tag that is active when it is allocated (see MemoryOwner).
+    // The bytes are counted per thread and merged when a report is requested. The peaks are the sums of the per-thread
+    // peaks: exact while one thread allocates at a time, an upper bound otherwise.
+    // Storage that we do not allocate ourselves (Eigen factorizations, dense Schur blocks, Krylov bases) is
+    // reported with SetExternal/RemoveExternal.
+    class MemoryTracker
+    {
+    public:
+        static void Allocated(const void *ptr, size_t bytes);
+        static void Freed(const void *ptr);
+
+        // Charges bytes to owner for storage held by key (usually the holding object). Calling it again for the same key replaces the old size.
+        static void SetExternal(const void *key, const char *owner, size_t bytes);
+        static void RemoveExternal(const void *key);
+
+        // tracked bytes (own blocks plus external storage)
+        static size_t CurrentBytes();
+        static size_t PeakBytes();
+        // Restarts the high-water mark (of the totals and of every owner) at the current value.
+        static void ResetPeak();
+
+        // resident set size of the process as reported by the OS; 0 if unavailable
+        static size_t CurrentRSS();
+        static size_t PeakRSS();
+        // Restarts the OS high-water mark (Linux only, via /proc/self/clear_refs). Returns false if that is not possible.
+        static bool ResetPeakRSS();
+
+        // Per owner: current bytes, peak bytes and number of live blocks.
+        static void WriteSummary(std::ostream &os);
+
+        static const char *CurrentOwner();
+        static void SetCurrentOwner(const char *owner);
+    };
+
+    // Charges all tracked allocations of the calling thread in its lifetime to the given tag. Scopes nest; the innermost one wins.
+    // The tag is thread local, so that concurrent flows (see FlowContext) do not charge each other's storage;
+    // the per-thread scratch that the worker threads of a tagged function allocate counts as untagged.
+    class MemoryOwner
+    {
+    public:
+        explicit MemoryOwner(const char *owner) : previous(MemoryTracker::CurrentOwner())
+        {
+            MemoryTracker::SetCurrentOwner(owner);
+        }
+
+        ~MemoryOwner()
+        {
+            MemoryTracker::SetCurrentOwner(previous);
+        }
+
+        MemoryOwner(const MemoryOwner &) = delete;
+        MemoryOwner &operator=(const MemoryOwner &) = delete;
+
+    private:
+        const char *previous;
+    };
+
+    // Predicted footprint of one flow step, computed from the problem size alone (no allocation happens).
+    // The block cluster counts are heuristics for well-shaped closed surfaces and may be off by a factor of two.
+    struct MemoryEstimate
+    {
+        size_t clusterTree = 0;     // primitive and cluster data, pre/post operators, buffers
+        size_t interactionData = 0; // near and far field matrices of the block cluster tree
+        size_t sparseFactor = 0;    // SimplicialLDLT factor of the sparse Hs metric
+        size_t schurComplement = 0; // dense constraint blocks
+        size_t krylovBasis = 0;     // GMRES basis
+        size_t total = 0;
+
+        void Print(std::ostream &os) const;
+    };
+
+    MemoryEstimate EstimateMemoryFootprint(long face_count, double theta, int thread_count,
+                                           long split_threshold = 8, long constraint_rows = 4, long gmres_restart = 30);
+
+} // namespace rsurfaces
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "optimized_bct_types.h"
+
+namespace rsurfaces
+{
+    // Thin wrapper around MPI_COMM_WORLD for distributing the block cluster tree over several processes.
+    // Compiled in with RSURFACES_MPI (CMake option WITH_MPI). Without it, or as long as MPI has not been
+    // initialized, there is exactly one rank and all collectives are no-ops. So code paths that are only
+    // relevant for several ranks can be guarded with Active().
+    class MPIContext
+    {
+    public:
+        // Initializes MPI unless that has been done already. Safe to call without mpirun (one rank).
+        static void Init(int *argc, char ***argv);
+        // Finalizes MPI if Init has initialized it.
+        static void Finalize();
+
+        static mint Rank();
+        static mint Size();
+        // true if MPI is initialized and there is more than one rank
+        static bool Active();
+
+        // This rank's contiguous share [begin, end) of count items; [0, count) for a single rank.
+        // Used to split the target leaves of the Barnes-Hut traversals, which are in tree order and thus spatially coherent.
+        static void LocalRange(mint count, mint &begin, mint &end);
+
+        // In-place sum over all ranks.
+        static void AllreduceSum(mreal *data, mint count);
+        static mreal AllreduceSum(mreal value);
+        static long long AllreduceSum(long long value);
+        static mreal AllreduceMax(mreal value);
+        // Copies count values from root to all other ranks.
+        static void Broadcast(mreal *data, mint count, mint root = 0);
+        static void Barrier();
+
+        // While an instance exists, this process behaves as if it were the only rank (Active() is false),
+        // e.g. to compute an undistributed reference on every rank.
+        class LocalScope
+        {
+        public:
+            LocalScope() { ++local_depth; }
+            ~LocalScope() { --local_depth; }
+            LocalScope(const LocalScope &) = delete;
+            LocalScope &operator=(const LocalScope &) = delete;
+        };
+
+    private:
+        static int local_depth;
+    };
+
+} // namespace rsurfaces
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "rsurface_types.h"
+#include "scene_file.h"
+#include "energy/tp_obstacle_barnes_hut_0.h"
+
+#include <Eigen/Dense>
+
+namespace rsurfaces
+{
+    // Moves a mesh obstacle along the schedule of its scene file entry (see obstacle_keyframe and obstacle_frames in scenes/FORMAT.txt).
+    //
+    // Rigid motions are applied to the obstacle's cluster tree analytically (OptimizedClusterTree::RigidTransform), so the
+    // hierarchy is never rebuilt. Deforming obstacles get their tree refit bottom-up (OptimizedClusterTree::Refit) instead.
+    class AnimatedObstacle
+    {
+    public:
+        // offset is the translation that was applied to the loaded obstacle (e.g. for recentering); it is applied to the frames as well.
+        AnimatedObstacle(TPObstacleBarnesHut0 *energy_, std::shared_ptr<surface::SurfaceMesh> mesh_, GeomPtr geom_,
+                         const scene::ObstacleData &data, Vector3 offset = Vector3{0, 0, 0});
+
+        // Moves the obstacle to where it is at the given iteration of the flow. Returns true if it has moved.
+        bool Advance(long iteration);
+
+        std::shared_ptr<surface::SurfaceMesh> mesh;
+        GeomPtr geom;
+
+    private:
+        TPObstacleBarnesHut0 *energy;
+        std::vector<scene::ObstacleKeyframe> keyframes;
+        std::vector<std::vector<Vector3>> frames; // frames[0] holds the initial positions
+        long iterationsPerFrame = 1;
+
+        // current rigid pose, relative to the positions of the current frame
+        Eigen::Matrix3d R;
+        Vector3 t;
+        // pose baked into the rest pose of the obstacle's tree (at construction or at the last refit); rigid motions are applied relative to it
+        Eigen::Matrix3d R_rest;
+        Vector3 t_rest;
+        long frameIteration = 0; // iteration of the vertex animation the positions belong to
+
+        void Pose(long iteration, Eigen::Matrix3d &R_, Vector3 &t_) const;
+        // position of vertex i in the vertex animation at iteration it, before the rigid pose
+        Vector3 FramePosition(long it, size_t i) const;
+    }; // AnimatedObstacle
+
+} // namespace rsurfaces
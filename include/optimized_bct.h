@@ -30,12 +30,28 @@ namespace rsurfaces
         mreal near_lo_modifier = 1.;
         mreal near_hi_modifier = 1.;
         
+        // With more than one MPI rank (see MPIContext), each rank keeps only its share of the block rows of near and far.
+        // The cluster trees stay replicated; the products are summed over the ranks after the kernels have been applied.
+        bool distribute_over_ranks = true;
+        
+        // Block clusters whose two clusters have fewer primitives together are split by a single task (see TreeTaskScheduler::Grain).
+        mint min_task_grain = 512;
+        
+        // If true, SplitBlockCluster accepts a block by an estimate of its relative far field error instead of the fixed
+        // criterion max(r_i, r_j) < theta * dist (see OptimizedBlockClusterTree::admissibleByErrorEstimate).
+        bool adaptive_admissibility = false;
+        // Relative error budget of a block; if <= 0, it is derived from theta such that clusters of uniform density are accepted as before.
+        mreal admissibility_tolerance = 0.;
+        // Blocks with max(r_i, r_j) >= admissibility_max_theta * dist are never accepted, whatever the estimate says;
+        // if <= 0, the theta of the fixed criterion is used. Larger values let the estimate accept blocks the fixed criterion would split.
+        mreal admissibility_max_theta = 0.;
+        
 //        BCTSettings();
 //        ~BCTSettings();
     };
 
-    // a global instance to store default settings
-    extern BCTSettings BCTDefaultSettings;
+    // an instance per thread to store default settings; FlowContext::Scope swaps in the settings of the flow running in this thread
+    extern thread_local BCTSettings BCTDefaultSettings;
 
     
     class OptimizedBlockClusterTree
@@ -102,6 +118,13 @@ namespace rsurfaces
         mreal theta2 = 0.25;
         mint thread_count = 1;
         mint tree_thread_count = 1;
+        mint build_grain = 1; // see BCTSettings::min_task_grain
+        
+        // constants of the error estimate for BCTSettings::adaptive_admissibility; set by the constructor
+        mreal admissibility_c2 = 0.;
+        mreal admissibility_cn = 0.;
+        mreal admissibility_tol = 0.;
+        mreal admissibility_max_theta2 = 1.;
         mreal alpha = 6.0;
         mreal beta = 12.0;
         mreal exp_s = 2.0 - 1.0 / 3.0; // differentiability of the energy space
@@ -126,6 +149,16 @@ namespace rsurfaces
         bool block_clusters_initialized = false;
         bool metrics_initialized = false;
         bool is_symmetric = false;
+        
+        // Range of leaf clusters of S (and the primitives they contain) whose near field rows this rank owns.
+        // A far field row is owned by the rank that owns the first primitive of its cluster.
+        // Without distribution, the whole range belongs to rank 0.
+        bool distributed = false;
+        mint rank_leaf_begin = 0;
+        mint rank_leaf_end = 0;
+        mint rank_primitive_begin = 0;
+        mint rank_primitive_end = 0;
+        
         std::shared_ptr<InteractionData> far;  // far and near are data containers for far and near field, respectively.
         std::shared_ptr<InteractionData> near; // They also perform the matrix-vector products.
         
@@ -159,10 +192,13 @@ namespace rsurfaces
             A_Vector<A_Deque<mint>> &nsep_i, //  |
             A_Vector<A_Deque<mint>> &nsep_j, //  +
             const mint i,                    //  <-- index of first  cluster in the block cluster
-            const mint j,                    //  <-- index of second cluster in the block cluster
-            const mint free_thread_count     //  <-- helps to manage task creation
+            const mint j                     //  <-- index of second cluster in the block cluster
         );
 
+        bool admissibleByErrorEstimate(const mint i, const mint j, const mreal h2, const mreal R2) const;
+
+        void DistributeBlockRows(); // Restricts near and far to the block rows owned by this MPI rank.
+        
         void RequireMetrics();
         
         void FarFieldInteraction(); // Compute nonzero values of sparse far field interaction matrices.
@@ -174,6 +210,13 @@ namespace rsurfaces
         void NearFieldInteraction_VBSR(); // Compute nonzero values of sparse near field interaction matrices in VBSR format.
         
         void InternalMultiply(BCTKernelType type) const;
+        
+        void ReduceOverRanks(const mint cols) const; // Sums S->P_out and S->C_out over the MPI ranks.
+        
+        // For energies that traverse near and far directly: each rank sees only its own block rows,
+        // so values and derivatives have to be summed over the ranks. No-ops if the tree is not distributed.
+        mreal SumOverRanks(mreal value) const;
+        void SumOverRanks(mreal * data, mint count) const;
 
         void ComputeDiagonals();
         
@@ -3,6 +3,10 @@
 #define EIGEN_NO_DEBUG
 #define MKL_DIRECT_CALL_SEQ_JIT
 //#define PROFILING
+//#define PERF_COUNTERS // hardware counters per ptic/ptoc tag (Linux only, requires PROFILING); summary goes to ./PerfCounters.tsv
+//#define LOAD_BALANCE_STATS // per-thread busy time and work counts of the parallel leaf loops; summary goes to ./LoadBalance.tsv
+//#define MEMORY_ACCOUNTING // byte accounting per owner structure for safe_alloc and A_Vector/A_Deque; see memory_tracker.h
+//#define SCALAR_POW // If defined, mypow(mreal, mreal) calls std::exp2 and std::log2 instead of the vectorizable simd_exp2 and simd_log2.
 
 #define CACHE_LINE_WIDTH 64    // length of cache line measured in bytes
 #define CACHE_LINE_LENGHT 8    // length of cache line measured in number of doubles
@@ -12,6 +16,7 @@
 #define ALIGN CACHE_LINE_WIDTH // MKL suggests 64-byte alignment
 #define CHUNK_SIZE CACHE_LINE_LENGHT
 #define RAGGED_SCHEDULE schedule( guided, CHUNK_SIZE)
+#define SIMD_TILE_WIDTH CACHE_LINE_LENGHT // number of primitives per tile in leaf-tiled (AoSoA) data; one row of a tile fills exactly one cache line
 
 #define SAFE_ALLOCATE_WARNINGS
 
@@ -20,6 +25,9 @@
 #include <mkl.h>
 #include <tbb/cache_aligned_allocator.h>
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <omp.h>
 #include <deque>
 #include <vector>
@@ -33,6 +41,7 @@
 #include <iostream>
 #include "bct_kernel_type.h"
 #include "profiler.h"
+#include "memory_tracker.h"
 
 
 
@@ -45,9 +54,10 @@ namespace rsurfaces
     class Timers
     {
         public:
-        static std::deque<std::chrono::time_point<std::chrono::steady_clock>> time_stack;
-        static std::chrono::time_point<std::chrono::steady_clock> start_time;
-        static std::chrono::time_point<std::chrono::steady_clock> stop_time;
+        // one stack per thread, so that flows running concurrently in different threads do not mix up their tic/toc pairs
+        static thread_local std::deque<std::chrono::time_point<std::chrono::steady_clock>> time_stack;
+        static thread_local std::chrono::time_point<std::chrono::steady_clock> start_time;
+        static thread_local std::chrono::time_point<std::chrono::steady_clock> stop_time;
     };
 
     inline void print(std::string s)
@@ -157,7 +167,14 @@ namespace rsurfaces
     int safe_free( T * &  ptr )
     {
         int wasallocated = (ptr != nullptr);
-        if( wasallocated ){ mkl_free(ptr); ptr = nullptr; }
+        if( wasallocated )
+        {
+#ifdef MEMORY_ACCOUNTING
+            MemoryTracker::Freed(ptr);
+#endif
+            mkl_free(ptr);
+            ptr = nullptr;
+        }
         return !wasallocated;
     }
     
@@ -173,6 +190,9 @@ namespace rsurfaces
             safe_free(ptr);
         }
         ptr = (T *) mkl_malloc ( size * sizeof(T), ALIGN );
+#ifdef MEMORY_ACCOUNTING
+        MemoryTracker::Allocated(ptr, size * sizeof(T));
+#endif
         
         return wasallocated;
     }
@@ -215,11 +235,60 @@ namespace rsurfaces
     typedef Eigen::MatrixXd EigenMatrixCM;
 
     // I am not that knowledgable about allocators; tbb::cache_aligned_allocator seemed to work well for allocating thread-owned vectors. And I simply used it for the rest, too, because should also provide good alignment for SIMD instructions (used in MKL routines). DO NOT USE A_Vector OR A_Deque FOR MANY SMALL ARRAYS. I typically allicate only very large arrays, so the exrta memory consumption should not be an issue.
+#ifdef MEMORY_ACCOUNTING
+    // tbb::cache_aligned_allocator that reports its blocks to the MemoryTracker.
+    template <typename T>
+    class tracking_allocator : public tbb::cache_aligned_allocator<T>
+    {
+    public:
+        typedef tbb::cache_aligned_allocator<T> base_type;
+        typedef T value_type;
+        typedef T * pointer;
+        typedef std::size_t size_type;
+
+        template <typename U>
+        struct rebind
+        {
+            typedef tracking_allocator<U> other;
+        };
+
+        tracking_allocator() throw() {}
+        tracking_allocator( const tracking_allocator & ) throw() {}
+        template <typename U>
+        tracking_allocator( const tracking_allocator<U> & ) throw() {}
+
+        pointer allocate( size_type n, const void * hint = 0 )
+        {
+            pointer ptr = base_type::allocate( n );
+            MemoryTracker::Allocated( ptr, n * sizeof(T) );
+            return ptr;
+        }
+
+        void deallocate( pointer ptr, size_type n )
+        {
+            MemoryTracker::Freed( ptr );
+            base_type::deallocate( ptr, n );
+        }
+    };
+
+    template <typename T, typename U>
+    inline bool operator==( const tracking_allocator<T> &, const tracking_allocator<U> & ) { return true; }
+
+    template <typename T, typename U>
+    inline bool operator!=( const tracking_allocator<T> &, const tracking_allocator<U> & ) { return false; }
+
+    template <typename T>
+    using A_Vector = std::vector<T, tracking_allocator<T>>;
+
+    template <typename T>
+    using A_Deque = std::deque<T, tracking_allocator<T>>;
+#else
     template <typename T>
     using A_Vector = std::vector<T, tbb::cache_aligned_allocator<T>>;
 
     template <typename T>
     using A_Deque = std::deque<T, tbb::cache_aligned_allocator<T>>;
+#endif
 
     //template <typename T>
     //using A_Vector = std::vector<T>;   // about 10% more performance with cache-alined storage
@@ -944,11 +1013,98 @@ namespace rsurfaces
 
 
 
+    // Unless the compiler links a vector math library (SVML, libmvec with -ffast-math), calls to std::log2 and std::exp2
+    // stay scalar and keep the "omp simd" kernel loops from vectorizing. The following two only use arithmetic, bit
+    // manipulation and selects, so they vectorize (on AVX2 this needs -fno-trapping-math, see CMakeLists.txt).
+    // Each is accurate to a few ulp; in mypow, the rounding error of exponent * log2(base) dominates, as with std::exp2/std::log2.
+
+    // log2 for positive normal x (subnormals are treated as 2^-1023).
+    #pragma omp declare simd
+    inline mreal simd_log2( mreal x )
+    {
+        std::uint64_t bits;
+        std::memcpy( &bits, &x, sizeof(mreal) );
+        mreal e = static_cast<mreal>( static_cast<std::int32_t>( (bits >> 52) & 0x7ff ) - 1023 );
+        
+        // mantissa m in [1, 2), then moved to [sqrt(1/2), sqrt(2))
+        bits = (bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL;
+        mreal m;
+        std::memcpy( &m, &bits, sizeof(mreal) );
+        // (arithmetic instead of a branch, so that targets without masked vector instructions can vectorize it as well)
+        mreal big = static_cast<mreal>( m > 1.4142135623730951 );
+        m *= 1. - 0.5 * big;
+        e += big;
+        
+        // log(m) = 2 s (1 + s^2/3 + s^4/5 + ...) with s = (m-1)/(m+1), |s| < 0.172; twelve terms are below double precision
+        mreal s  = (m - 1.) / (m + 1.);
+        mreal s2 = s * s;
+        mreal p = 1./23.;
+        p = p * s2 + 1./21.;
+        p = p * s2 + 1./19.;
+        p = p * s2 + 1./17.;
+        p = p * s2 + 1./15.;
+        p = p * s2 + 1./13.;
+        p = p * s2 + 1./11.;
+        p = p * s2 + 1./9.;
+        p = p * s2 + 1./7.;
+        p = p * s2 + 1./5.;
+        p = p * s2 + 1./3.;
+        p = p * s2 + 1.;
+        
+        // 2/log(2)
+        return e + 2.8853900817779268 * s * p;
+    } // simd_log2
+
+    // 2^y; 0 below 2^-1022 and infinity above 2^1023.
+    #pragma omp declare simd
+    inline mreal simd_exp2( mreal y )
+    {
+        mreal z = std::min( std::max( y, -1022. ), 1023. );
+        // Adding 1.5 * 2^52 rounds z to the nearest integer n, which then sits in the low bits of the mantissa.
+        // This avoids std::floor and float-to-int conversions, which GCC does not vectorize under the default floating-point
+        // semantics. Do not compile with -ffast-math, which would cancel the two additions.
+        mreal t = z + 6755399441055744.;
+        std::uint64_t t_bits;
+        std::memcpy( &t_bits, &t, sizeof(mreal) );
+        mreal n = t - 6755399441055744.;
+        // 2^(z-n) = exp(f) with |f| <= log(2)/2; Taylor polynomial of degree 13
+        mreal f = (z - n) * 0.6931471805599453;
+        mreal p = 1./6227020800.;
+        p = p * f + 1./479001600.;
+        p = p * f + 1./39916800.;
+        p = p * f + 1./3628800.;
+        p = p * f + 1./362880.;
+        p = p * f + 1./40320.;
+        p = p * f + 1./5040.;
+        p = p * f + 1./720.;
+        p = p * f + 1./120.;
+        p = p * f + 1./24.;
+        p = p * f + 1./6.;
+        p = p * f + 0.5;
+        p = p * f + 1.;
+        p = p * f + 1.;
+        
+        // the low 12 bits of t_bits + 1023 are the biased exponent n + 1023 of 2^n
+        std::uint64_t bits = (t_bits + 1023) << 52;
+        mreal scale;
+        std::memcpy( &scale, &bits, sizeof(mreal) );
+        mreal r = p * scale;
+        r = (y < -1022.) ? 0. : r;
+        r = (y > 1023.) ? HUGE_VAL : r;
+        return r;
+    } // simd_exp2
+
     #pragma omp declare simd
     inline mreal mypow ( mreal base, mreal exponent )
     {
-        // Warning: Use only for positive base! This is basically pow with certain checks and cases deactivated
+        // Warning: Use only for nonnegative base! This is basically pow with certain checks and cases deactivated
+#ifdef SCALAR_POW
         return std::exp2( exponent * std::log2(base) );
+#else
+        // log2(0) = -infinity, so that 0^exponent comes out as with std::log2, e.g. for |rCosPhi| = 0 in the kernels
+        mreal l = (base > 0.) ? simd_log2(base) : -HUGE_VAL;
+        return simd_exp2( exponent * l );
+#endif
     } // mypow
 
 //    #pragma omp declare simd
@@ -1028,7 +1184,7 @@ namespace rsurfaces
                     return b4 * b4 * b4;
 
                 default:
-                    return mypow(base, exponent);
+                    return mypow(base, static_cast<mreal>(exponent));
             }
         }
         else
@@ -1057,6 +1213,9 @@ namespace rsurfaces
     // The cost of the k-th thread goes from job no job_ptr[k] to job no job_ptr[k+1] (as always in C/C++, job_ptr[k+1] points _after_ the last job.
     void BalanceWorkLoad( mint job_count, mint * job_acc_costs, mint thread_count, mint * & job_ptr );
     
+    // Same as above, but reads the (not accumulated) cost of each job, e.g., measured run times from a previous execution.
+    void BalanceWorkLoad( mint job_count, const mreal * job_costs, mint thread_count, mint * & job_ptr );
+    
     
     
     enum class TreePercolationAlgorithm
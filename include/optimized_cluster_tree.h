@@ -2,6 +2,7 @@
 
 #include "bct_kernel_type.h"
 #include "optimized_bct_types.h"
+#include "task_scheduler.h"
 
 namespace rsurfaces
 {
@@ -9,14 +10,19 @@ namespace rsurfaces
     struct BVHSettings
     {
         mint split_threshold = 8;
+        // Subtrees with fewer primitives are built by a single task (see TreeTaskScheduler::Grain); larger ones may be stolen by idle threads.
+        mint min_task_grain = 256;
+        // If true, Pre applies the pre-processing operator, accumulates the leaves and percolates up in one tree traversal,
+        // and Post percolates down and distributes the leaves to the primitives in another one (instead of separate full passes).
+        bool fused_prepost = true;
 //        bool use_old_prepost = false;
         //    TreePercolationAlgorithm tree_perc_alg = TreePercolationAlgorithm::Chunks;
         //    TreePercolationAlgorithm tree_perc_alg = TreePercolationAlgorithm::Tasks;
         TreePercolationAlgorithm tree_perc_alg = TreePercolationAlgorithm::Sequential;
     };
 
-    // a global instance to store default settings
-    extern BVHSettings BVHDefaultSettings;
+    // an instance per thread to store default settings; FlowContext::Scope swaps in the settings of the flow running in this thread
+    extern thread_local BVHSettings BVHDefaultSettings;
     
     struct Cluster2 // slim POD container to hold only the data relevant for the construction phase in the tree, before it is serialized
     {
@@ -71,6 +77,7 @@ namespace rsurfaces
         mint hull_count = 3;
         mint tree_thread_count = 1;
         mint thread_count = 1;
+        mint build_grain = 1; // primitives; subtrees above this size are split into parallel tasks during construction
 
         mint primitive_count = 0;
         mint cluster_count = 0;
@@ -119,11 +126,20 @@ namespace rsurfaces
         //        mreal * restrict C_moment_buffer = nullptr;
 
         mreal *restrict C_squared_radius = nullptr;
+        mreal *restrict C_squared_spread = nullptr; // weighted mean of the squared distances of the primitives' points from C_coords
+        mreal *restrict P_squared_spread = nullptr; // mean squared distance of the points of each primitive (a simplex) from its center
 
         mint *restrict leaf_clusters = nullptr;
         mint *restrict leaf_cluster_lookup = nullptr;
         mint *restrict leaf_cluster_ptr = nullptr; // point to __end__ of each leaf cluster
 
+        // Leaf-tiled copy of P_near in Array of Structures of Arrays fashion: every leaf cluster is padded to whole tiles of SIMD_TILE_WIDTH primitives.
+        // Tile t occupies near_dim * SIMD_TILE_WIDTH consecutive doubles starting at P_near_tiled[ near_dim * SIMD_TILE_WIDTH * t ]; row k of the tile holds the k-th near field component.
+        // Padding lanes repeat the last primitive of the leaf with weight 0, so that kernels can run over full tiles and only need to mask the tail.
+        mreal *restrict P_near_tiled = nullptr;
+        mint *restrict leaf_tile_ptr = nullptr; // leaf cluster k owns the tiles leaf_tile_ptr[k], ..., leaf_tile_ptr[k+1]-1
+        mint tile_count = 0;
+
         A_Vector<A_Vector<mreal>> P_D_near;
         A_Vector<A_Vector<mreal>> P_D_far;
         A_Vector<A_Vector<mreal>> C_D_far;
@@ -258,6 +274,16 @@ namespace rsurfaces
                         safe_free(C_squared_radius);
                     }
 
+                    #pragma omp task
+                    {
+                        safe_free(C_squared_spread);
+                    }
+
+                    #pragma omp task
+                    {
+                        safe_free(P_squared_spread);
+                    }
+
                     #pragma omp task
                     {
                         safe_free(leaf_clusters);
@@ -267,6 +293,16 @@ namespace rsurfaces
                     {
                         safe_free(leaf_cluster_lookup);
                     }
+                    
+                    #pragma omp task
+                    {
+                        safe_free(leaf_tile_ptr);
+                    }
+                    
+                    #pragma omp task
+                    {
+                        safe_free(P_near_tiled);
+                    }
                     #pragma omp task
 
                     {
@@ -323,9 +359,9 @@ namespace rsurfaces
             ptoc("~OptimizedClusterTree");
         };
 
-        void SplitCluster(Cluster2 * const C, const mint free_thread_count);
+        void SplitCluster(Cluster2 * const C);
 
-        void Serialize(Cluster2 * const C, const mint ID, const mint leaf_before_count, const mint free_thread_count);
+        void Serialize(Cluster2 * const C, const mint ID, const mint leaf_before_count);
 
         void ComputePrimitiveData(
             const mreal * restrict const P_hull_coords_,
@@ -336,6 +372,8 @@ namespace rsurfaces
 
         void ComputeClusterData();
 
+        void ComputeTiles(); // (re)fills P_near_tiled from P_near; allocates the tiles on first call
+
         void RequireBuffers(const mint cols);
 
         void ComputePrePost(MKLSparseMatrix &DiffOp, MKLSparseMatrix &AvOp);
@@ -380,6 +418,14 @@ namespace rsurfaces
         // TODO: use a stack for recursion instead of the program stack?
         // sequential, recursive algorithm
         void PercolateDown_Seq(const mint C);
+        
+        // fused passes (see BVHSettings::fused_prepost), parallelized by TreeTaskScheduler
+        // P_in = pre * input and C_in = leaf sums of P_in, percolated up
+        void PercolateUp_Fused(const mreal * const input, const mint cols, const MKLSparseMatrix & pre);
+        void percolateUp_Fused(const mint C, const mreal * const input, const mint cols, const MKLSparseMatrix & pre);
+        // C_out percolated down, and P_out += C_out of the leaf of each primitive
+        void PercolateDown_Fused();
+        void percolateDown_Fused(const mint C);
 
         void CollectDerivatives( mreal * restrict const P_D_near_output ); // collect only near field data
         
@@ -389,12 +435,43 @@ namespace rsurfaces
         // All data related to clustering or multipole acceptance criteria remain are unchanged, as well
         // as the preprocessor and postprocessor matrices (that are needed for matrix-vector multiplies of the BCT.)
         void SemiStaticUpdate( const mreal * restrict const P_near_, const mreal * restrict const P_far_ );
-        
+
+        // Moves all primitives by the rigid motion x -> A x + b (A: dim x dim, row major, orthogonal) without rebuilding anything.
+        // Centers are transformed, normals and projectors are rotated, and bounding boxes are replaced by the boxes around the rotated ones.
+        // Cluster radii are invariant. Block cluster trees that contain this tree have to be rebuilt or updated afterwards.
+        // The motion is applied to the rest pose, i.e., the state of the tree at the first call after construction, Refit or SemiStaticUpdate,
+        // so successive calls do not compound: pass the whole motion since the rest pose. Otherwise the boxes would grow with every call.
+        void RigidTransform( const mreal * restrict const A, const mreal * restrict const b );
+
+        // Like SemiStaticUpdate, but also recomputes clustering coordinates, bounding boxes and radii bottom-up (same arguments as the constructor).
+        // The cluster hierarchy is kept, so the tree stays valid but may become less efficient if the primitives move far.
+        void Refit( const mreal * restrict const P_coords_, const mreal * restrict const P_hull_coords_, const mreal * restrict const P_near_, const mreal * restrict const P_far_ );
+
         void PrintToFile(std::string filename = "./OptimizedClusterTree.tsv");
         
     private:
         
-        void computeClusterData(const mint C, const mint free_thread_count); // helper function for ComputeClusterData
+        void computeClusterData(const mint C); // helper function for ComputeClusterData
+
+        // copies of the data that RigidTransform changes, taken at its first call; empty while there is no rest pose
+        A_Vector<A_Vector<mreal>> rest_P_near;
+        A_Vector<A_Vector<mreal>> rest_P_far;
+        A_Vector<A_Vector<mreal>> rest_C_far;
+        A_Vector<A_Vector<mreal>> rest_P_coords;
+        A_Vector<A_Vector<mreal>> rest_P_min;
+        A_Vector<A_Vector<mreal>> rest_P_max;
+        A_Vector<A_Vector<mreal>> rest_C_coords;
+        A_Vector<A_Vector<mreal>> rest_C_min;
+        A_Vector<A_Vector<mreal>> rest_C_max;
+
+        // helper functions for RigidTransform; the first one copies the current data into the rest pose, the second one
+        // copies the rest pose back, and the third one forgets it (after the data have been changed otherwise)
+        void storeRestPose();
+        void restoreRestPose();
+        void dropRestPose();
+
+        // helper function for RigidTransform; data are near or far field data: weight, center, and normal or packed projector
+        void transformData( A_Vector<mreal *> & data, const mint data_dim, const mint count, const mreal * restrict const A, const mreal * restrict const b );
 
         bool requireChunks( mint C, mint last, mint thread);
 
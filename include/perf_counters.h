@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace rsurfaces
+{
+    // Hardware performance counters (Linux perf_event_open) attached to the ptic/ptoc tags.
+    // Activated by defining PERF_COUNTERS (together with PROFILING).
+    // Every thread that does work gets its own counter group, opened the first time the thread is seen: the OpenMP threads
+    // on the first ptic, the TBB workers of the tree builds when they enter the arena (see TreeTaskScheduler::Run).
+    // ptic/ptoc take snapshots of all groups opened so far, so the per-tag totals are inclusive and can be broken down by thread.
+    class PerfCounters
+    {
+    public:
+        enum Event
+        {
+            Cycles = 0,
+            Instructions,
+            LLCMisses,
+            FlopsScalarDouble,   // Intel FP_ARITH_INST_RETIRED; unavailable elsewhere
+            Flops128PackedDouble,
+            Flops256PackedDouble,
+            Flops512PackedDouble,
+            EventCount
+        };
+
+        struct Record
+        {
+            long long calls = 0;
+            std::vector<uint64_t> totals; // thread_count * EventCount
+        };
+
+        // Opens the counters for the calling thread and its OpenMP threads. Called lazily by Begin.
+        static bool Init();
+        // Opens the counters for the calling thread, unless it has them already.
+        static void AttachThread();
+
+        static void Begin();
+        static void End(const std::string &tag);
+        static void Reset();
+
+        // Per tag: cycles, instructions, IPC, LLC misses, DRAM bytes (64 per LLC miss), flops and bytes per flop;
+        // then cycles and instructions per thread.
+        static void WriteSummary(std::ostream &os);
+
+        static bool initialized;
+        static bool available;
+        static int thread_count;            // number of counter groups, in the order the threads were attached
+        static std::vector<int> fds;        // thread_count * EventCount, -1 if the event could not be opened
+        static thread_local int thread_slot; // group of the calling thread, -1 if not attached yet
+        static std::mutex mutex;            // guards initialized, available, thread_count and fds
+        // per thread, like the stacks of the Profiler, so that concurrent flows nest their regions independently
+        static thread_local std::deque<std::vector<uint64_t>> snapshot_stack;
+        static std::map<std::string, Record> records; // guarded by Profiler::mutex
+
+    private:
+        static void Snapshot(std::vector<uint64_t> &values);
+    };
+
+} // namespace rsurfaces
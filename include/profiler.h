@@ -10,6 +10,11 @@
 #include <chrono>
 #include <iostream>
 #include <fstream>
+#include <atomic>
+#include <mutex>
+#include <omp.h>
+
+#include "perf_counters.h"
 
 namespace rsurfaces
 {
@@ -17,14 +22,71 @@ namespace rsurfaces
     class Profiler
     {
         public:
-        static int id_counter;
+        static std::atomic<int> id_counter;
         static std::ofstream os;
         static std::chrono::time_point<std::chrono::steady_clock> init_time;
-        static std::deque<std::chrono::time_point<std::chrono::steady_clock>> time_stack;
-        static std::deque<int> id_stack;
-        static std::deque<std::string> tag_stack;
-        static std::deque<int> parent_stack;
+        // The stacks are per thread, so that flows running concurrently in different threads (see FlowContext) nest their regions independently.
+        static thread_local std::deque<std::chrono::time_point<std::chrono::steady_clock>> time_stack;
+        static thread_local std::deque<int> id_stack;
+        static thread_local std::deque<std::string> tag_stack;
+        static thread_local std::deque<int> parent_stack;
+        // Flow that the calling thread works for; used as process id in the trace, so that each flow gets its own group of tracks.
+        static thread_local int flow_id;
+        // serializes the writes to os and trace_os
+        static std::mutex mutex;
+        // Stable id of the calling thread in the trace, assigned on first use. omp_get_thread_num() would be 0 on every thread
+        // outside of an OpenMP team (TBB workers, std::threads), so their events would end up on the same track.
+        static std::atomic<int> thread_counter;
+        static int ThreadId()
+        {
+            thread_local int id = thread_counter++;
+            return id;
+        }
+
+        // Chrome trace-event JSON (open in https://ui.perfetto.dev or chrome://tracing), written next to the TSV.
+        static std::ofstream trace_os;
+        static bool trace_empty;
     };
+
+    // Escapes the characters in tag that are not allowed within a JSON string.
+    inline std::string TraceEscape(const std::string & tag)
+    {
+        std::string s;
+        s.reserve(tag.size());
+        for( char c : tag )
+        {
+            if( c == '"' || c == '\\' )
+            {
+                s.push_back('\\');
+            }
+            s.push_back( static_cast<unsigned char>(c) < 0x20 ? ' ' : c );
+        }
+        return s;
+    }
+
+    inline void TraceWrite(const std::string & event)
+    {
+        std::lock_guard<std::mutex> lock(Profiler::mutex);
+        Profiler::trace_os << (Profiler::trace_empty ? "[\n" : ",\n") << event;
+        Profiler::trace_empty = false;
+    }
+
+    // Opens the trace file. The closing bracket is written by TraceClose; Perfetto also accepts a trace without it.
+    inline void TraceOpen(std::string filename)
+    {
+        Profiler::trace_os.open(filename);
+        Profiler::trace_empty = true;
+        TraceWrite("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"rsurfaces\"}}");
+    }
+
+    inline void TraceClose()
+    {
+        if( Profiler::trace_os.is_open() )
+        {
+            Profiler::trace_os << "\n]" << std::endl;
+            Profiler::trace_os.close();
+        }
+    }
     
     
 #ifdef PROFILING
@@ -34,7 +96,9 @@ namespace rsurfaces
         Profiler::parent_stack.push_back(Profiler::id_stack.back());
         Profiler::tag_stack.push_back(tag);
         Profiler::id_stack.push_back(++Profiler::id_counter);
-        
+#ifdef PERF_COUNTERS
+        PerfCounters::Begin();
+#endif
     }
     
     inline void ptoc(std::string tag)
@@ -46,15 +110,31 @@ namespace rsurfaces
                 double start_time = std::chrono::duration<double>( Profiler::time_stack.back()     - Profiler::init_time ).count();
                 double stop_time  = std::chrono::duration<double>( std::chrono::steady_clock::now() - Profiler::init_time ).count();
                 
-                Profiler::os
-                    << Profiler::id_stack.back() <<  "\t"
-                    << Profiler::tag_stack.back() << "\t"
-                    << Profiler::parent_stack.back() << "\t"
-                    << start_time << "\t"
-                    << stop_time << "\t"
-                    << stop_time-start_time << "\t"
-                    << Profiler::tag_stack.size()-1
-                    << std::endl;
+                {
+                    std::lock_guard<std::mutex> lock(Profiler::mutex);
+                    Profiler::os
+                        << Profiler::id_stack.back() <<  "\t"
+                        << Profiler::tag_stack.back() << "\t"
+                        << Profiler::parent_stack.back() << "\t"
+                        << start_time << "\t"
+                        << stop_time << "\t"
+                        << stop_time-start_time << "\t"
+                        << Profiler::tag_stack.size()-1
+                        << std::endl;
+                }
+
+                // complete event; timestamps in microseconds
+                TraceWrite(
+                    "{\"name\":\"" + TraceEscape(tag)
+                    + "\",\"ph\":\"X\",\"pid\":" + std::to_string(Profiler::flow_id) + ",\"tid\":" + std::to_string(Profiler::ThreadId())
+                    + ",\"ts\":" + std::to_string(1e6 * start_time)
+                    + ",\"dur\":" + std::to_string(1e6 * (stop_time - start_time))
+                    + ",\"args\":{\"id\":" + std::to_string(Profiler::id_stack.back())
+                    + ",\"depth\":" + std::to_string(Profiler::tag_stack.size()-1) + "}}"
+                );
+#ifdef PERF_COUNTERS
+                PerfCounters::End(tag);
+#endif
                 
                 Profiler::id_stack.pop_back();
                 Profiler::time_stack.pop_back();
@@ -74,11 +154,29 @@ namespace rsurfaces
         }
     }
 
+    // Records value as a counter track in the trace (e.g. GMRES iterations, nonzeros, energy). Call it from serial code only.
+    inline void ptcounter(std::string name, double value)
+    {
+        double time = std::chrono::duration<double>( std::chrono::steady_clock::now() - Profiler::init_time ).count();
+        TraceWrite(
+            "{\"name\":\"" + TraceEscape(name)
+            + "\",\"ph\":\"C\",\"pid\":" + std::to_string(Profiler::flow_id) + ",\"ts\":" + std::to_string(1e6 * time)
+            + ",\"args\":{\"value\":" + std::to_string(value) + "}}"
+        );
+    }
+
+    // Restarts both files and the calling thread's stacks; call it while no other flow is running.
     inline void ClearProfile(std::string filename)
     {
         Profiler::os.close();
         Profiler::os.open(filename);
         std::cout << "Profile will be written to " << filename << "." << std::endl;
+        size_t slash = filename.find_last_of('/');
+        size_t dot = filename.find_last_of('.');
+        std::string tracename = ( dot != std::string::npos && (slash == std::string::npos || dot > slash) ? filename.substr(0, dot) : filename ) + ".json";
+        TraceClose();
+        TraceOpen(tracename);
+        std::cout << "Trace will be written to " << tracename << "." << std::endl;
 //        Profiler::os << "ID" << "\t" << "Tag" << "\t" << "From" << "\t" << "Tic" << "\t" << "Toc" << "\t" << "Duration" << "\t" << "Depth" << std::endl;
         Profiler::init_time = std::chrono::steady_clock::now();
         Profiler::time_stack.clear();
@@ -90,10 +188,14 @@ namespace rsurfaces
         Profiler::id_stack.clear();
         Profiler::id_stack.push_back(0);
         Profiler::id_counter = 0;
+#ifdef PERF_COUNTERS
+        PerfCounters::Reset();
+#endif
     }
 #else
     inline void ptic(std::string tag){};
     inline void ptoc(std::string tag){};
+    inline void ptcounter(std::string name, double value){};
     inline void ClearProfile(std::string filename){}
 #endif
     
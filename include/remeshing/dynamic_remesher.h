@@ -32,22 +32,61 @@ namespace rsurfaces
             Degree
         };
 
+        // Cheap mesh-quality indicators; an element counts as bad if it violates
+        // one of the thresholds of the DynamicRemesher.
+        struct MeshQuality
+        {
+            size_t longEdges = 0;
+            size_t shortEdges = 0;
+            size_t nonDelaunayEdges = 0;
+            size_t smallAngleFaces = 0;
+            size_t distortedFaces = 0;
+
+            double maxLengthRatio = 0;
+            double minLengthRatio = 0;
+            double minAngle = 0;
+            double maxAreaDistortion = 0;
+
+            inline size_t badElements() const
+            {
+                return longEdges + shortEdges + nonDelaunayEdges + smallAngleFaces + distortedFaces;
+            }
+        };
+
         class DynamicRemesher
         {
         public:
             DynamicRemesher(MeshPtr mesh_, GeomPtr geom_, GeomPtr geomOrig_);
             void SetModes(RemeshingMode rMode, SmoothingMode sMode, FlippingMode fMode);
             bool Remesh(int numIters, bool changeTopology);
+
+            // Measures the mesh quality and marks the vertices of all bad elements (plus one ring) in region.
+            MeshQuality MeasureQuality(VertexData<bool> &region);
+
+            // Remeshes the regions around bad elements, but only if the fraction of bad elements exceeds
+            // triggerFraction. Sets remeshed to whether anything was done; returns whether the
+            // vertex set changed, like Remesh.
+            bool RemeshIfNeeded(int numIters, bool &remeshed);
             void KeepVertexDataUpdated(VertexDataWrapper *data);
             bool curvatureAdaptive;
 
+            // if false, RemeshIfNeeded remeshes the whole mesh in every call
+            bool qualityTriggered;
+            double maxLengthRatio;    // relative to the target edge length
+            double minLengthRatio;
+            double minAngle;          // in radians
+            double maxAreaDistortion; // relative face area change against geomOrig, both ways
+            double triggerFraction;   // fraction of bad elements among edges + faces
+            bool verbose;             // if true, RemeshIfNeeded prints the measured quality
+
             SmoothingMode smoothingMode;
             RemeshingMode remeshingMode;
             FlippingMode flippingMode;
 
         private:
-            void flipEdges();
-            void smoothVertices();
+            bool remeshRegion(int numIters, bool changeTopology, VertexData<bool> *region);
+            void flipEdges(VertexData<bool> *region);
+            void smoothVertices(VertexData<bool> *region);
 
             MeshPtr mesh;
             GeomPtr geom;
@@ -55,6 +94,7 @@ namespace rsurfaces
             double initialAverageLength;
             double initialHWeightedLength;
             double epsilon;
+            double areaOrig; // total area of geomOrig; negative if it has to be recomputed
             std::vector<VertexDataWrapper *> vectorData;
         };
     } // namespace remeshing
@@ -26,21 +26,26 @@ namespace rsurfaces
         
         void collapseEdge(MeshPtr const &mesh, GeomPtr const &geometry, Edge e);
         
-        void adjustVertexDegrees(MeshPtr const &mesh, GeomPtr const &geometry);
+        // The remeshing operations below act on the whole mesh if region is null; otherwise
+        // only on the marked vertices and the edges touching them. Vertices created by edge splits
+        // inside the region are added to it.
+        void adjustVertexDegrees(MeshPtr const &mesh, GeomPtr const &geometry, VertexData<bool> *region = nullptr);
 
         bool isDelaunay(GeomPtr const &geometry, Edge e);
 
-        void fixDelaunay(MeshPtr const &mesh, GeomPtr const &geometry);
+        void fixDelaunay(MeshPtr const &mesh, GeomPtr const &geometry, VertexData<bool> *region = nullptr);
 
-        void smoothByLaplacian(MeshPtr const &mesh, GeomPtr const &geometry);
+        void smoothByLaplacian(MeshPtr const &mesh, GeomPtr const &geometry, VertexData<bool> *region = nullptr);
 
         Vector3 findCircumcenter(Vector3 p1, Vector3 p2, Vector3 p3);
 
         Vector3 findCircumcenter(GeomPtr const &geometry, Face f);
 
-        void smoothByCircumcenter(MeshPtr const &mesh, GeomPtr const &geometry);
+        void smoothByCircumcenter(MeshPtr const &mesh, GeomPtr const &geometry, VertexData<bool> *region = nullptr);
+
+        double findMeanTargetL(MeshPtr const &mesh, GeomPtr const &geometry, Edge e, double flatLength, double epsilon);
         
-        bool adjustEdgeLengths(MeshPtr const &mesh, GeomPtr const &geometry, GeomPtr const &geometryOriginal, double flatLength, double epsilon, double minLength, bool curvatureAdaptive = true);
+        bool adjustEdgeLengths(MeshPtr const &mesh, GeomPtr const &geometry, GeomPtr const &geometryOriginal, double flatLength, double epsilon, double minLength, bool curvatureAdaptive = true, VertexData<bool> *region = nullptr);
         
         Vector3 findBarycenter(Vector3 p1, Vector3 p2, Vector3 p3);
 
@@ -77,7 +77,8 @@ namespace rsurfaces
         H1_LBFGS,
         BQN_LBFGS,
         H2Projected,
-        Willmore
+        Willmore,
+        HsNewtonKrylov
     };
 
     struct MassNormalPoint
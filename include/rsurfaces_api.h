@@ -0,0 +1,67 @@
+#pragma once
+
+// C interface of the rsurfaces_core library, for embedding the flow in other programs without Polyscope.
+//
+// Vertex positions live in an array owned by the caller (vertex_count x 3 doubles, row major). The flow keeps a pointer to it:
+// every call reads the current positions from it, and rsurfaces_flow_step writes the new positions back into it.
+// So the array has to stay alive (and must not move) until rsurfaces_flow_destroy. Faces (face_count x 3 ints, zero based)
+// are only read during rsurfaces_flow_create. All other outputs are written to caller-provided arrays as well.
+//
+// Functions returning int return 0 on success and nonzero on failure; rsurfaces_last_error describes the failure.
+//
+// Different flows may be used concurrently from different threads (one thread per flow at a time). Each flow has its own
+// settings and thread budget; see rsurfaces_flow_set_threads.
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct rsurfaces_flow rsurfaces_flow;
+
+    typedef enum
+    {
+        RSURFACES_HS_PROJECTED = 0,           // sparse Hs gradient with Schur complement constraint projection (default in the GUI)
+        RSURFACES_HS_PROJECTED_ITERATIVE = 1, // same, solved with GMRES on the block cluster tree
+        RSURFACES_HS_NEWTON_KRYLOV = 2,
+        RSURFACES_H1_PROJECTED = 3,
+        RSURFACES_L2_PROJECTED = 4
+    } rsurfaces_method;
+
+    typedef enum
+    {
+        RSURFACES_BARYCENTER = 0,
+        RSURFACES_TOTAL_AREA = 1,
+        RSURFACES_TOTAL_VOLUME = 2
+    } rsurfaces_constraint;
+
+    // Creates a tangent-point flow with exponents alpha and beta; theta is the Barnes-Hut parameter (0 means exact all pairs).
+    // Returns NULL on failure.
+    rsurfaces_flow *rsurfaces_flow_create(double *vertices, int vertex_count, const int *faces, int face_count,
+                                          double alpha, double beta, double theta);
+    void rsurfaces_flow_destroy(rsurfaces_flow *flow);
+
+    // Number of threads the flow may use (default: all); if first_core >= 0, its threads are pinned to the cores
+    // [first_core, first_core + thread_count). Give concurrent flows disjoint core ranges to avoid oversubscription.
+    int rsurfaces_flow_set_threads(rsurfaces_flow *flow, int thread_count, int first_core);
+
+    // Keeps the constraint fixed at its current value, or moves it to target_multiplier times its current value within iterations steps.
+    // target_multiplier and iterations are ignored for RSURFACES_BARYCENTER.
+    int rsurfaces_flow_add_constraint(rsurfaces_flow *flow, rsurfaces_constraint type, double target_multiplier, int iterations);
+
+    // Takes one step (including line search) and writes the new positions to the vertex array.
+    int rsurfaces_flow_step(rsurfaces_flow *flow, rsurfaces_method method);
+
+    // Energy of the current positions.
+    int rsurfaces_flow_energy(rsurfaces_flow *flow, double *energy);
+    // L2 differential of the energy with respect to the vertex positions; differential has vertex_count x 3 entries, row major.
+    int rsurfaces_flow_differential(rsurfaces_flow *flow, double *differential);
+    // Product of the (unconstrained) Hs metric with input; both have vertex_count x 3 entries, row major.
+    int rsurfaces_flow_metric_product(rsurfaces_flow *flow, const double *input, double *output);
+
+    // Message of the last failure in this thread; empty if there was none.
+    const char *rsurfaces_last_error(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
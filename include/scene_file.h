@@ -50,12 +50,32 @@ namespace rsurfaces
             double targetAddition;
         };
 
+        // Rigid pose of an animated obstacle at the given iteration, relative to its initial position:
+        // rotation by angle (in degrees) about axis through the origin, followed by the translation.
+        struct ObstacleKeyframe
+        {
+            long iteration;
+            Vector3 translation;
+            Vector3 axis;
+            double angle;
+        };
+
         struct ObstacleData
         {
             std::string obstacleName;
             double weight;
             bool recenter = false;
             bool asPointCloud = false;
+            // rigid motion; poses are interpolated between keyframes and held before the first and after the last one
+            std::vector<ObstacleKeyframe> keyframes;
+            // vertex animation; meshes with the same connectivity as the obstacle, iterationsPerFrame iterations apart
+            std::vector<std::string> frameNames;
+            long iterationsPerFrame = 1;
+
+            inline bool isAnimated() const
+            {
+                return !keyframes.empty() || !frameNames.empty();
+            }
         };
 
         enum class ImplicitType
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "sobolev/constraints.h"
+
+namespace rsurfaces
+{
+    namespace Constraints
+    {
+        // Jacobian of a single constraint (nRows x 3 * nVertices) in CSR format with fixed sparsity.
+        //
+        // The pattern is built once from addTriplets, together with a map from the triplets to the
+        // CSR entries (duplicates are summed, as in setFromTriplets). After the positions have moved
+        // (see GeometryCache::PositionsChanged), only the values are refreshed in place: either by the
+        // constraint's refreshTripletValues, or by calling addTriplets into a reused buffer. The gather
+        // into the CSR values runs in parallel.
+        //
+        // The cache lives inside the constraint, so all consumers (the sparse Laplacians of the flows,
+        // HsMetric::GetConstraintBlock, the dense rows of addEntriesToSymmetric, ...) share it. The pattern is rebuilt when the vertex count or
+        // nRows changes, when addTriplets produces a different pattern, or after JacobianStructureChanged.
+        class ConstraintJacobian
+        {
+        public:
+            // Returns the Jacobian of cs at the current positions of geom; refreshes it if necessary.
+            static const ConstraintJacobian &Get(ConstraintBase &cs, const MeshPtr &mesh, const GeomPtr &geom);
+
+            // Assembles the Jacobian of the stacked constraints (rows in list order) without going through triplets.
+            template <typename Constraint>
+            static Eigen::SparseMatrix<double, Eigen::RowMajor> Stack(const std::vector<Constraint *> &constraints, const MeshPtr &mesh, const GeomPtr &geom)
+            {
+                std::vector<const ConstraintJacobian *> blocks;
+                blocks.reserve(constraints.size());
+                for (Constraint *cs : constraints)
+                {
+                    blocks.push_back(&Get(*cs, mesh, geom));
+                }
+                return stack(blocks, 3 * mesh->nVertices());
+            }
+
+            // Appends the entries shifted down by baseRow; if symmetric, also the transposed entries.
+            void AddTriplets(std::vector<Triplet> &triplets, size_t baseRow, bool symmetric) const;
+
+            size_t rows = 0;
+            size_t cols = 0;
+            std::vector<int> outer;     // rows + 1
+            std::vector<int> inner;     // column indices, sorted within each row
+            std::vector<double> values;
+
+        private:
+            const void *geom_ptr = nullptr;
+            unsigned long long version = 0;
+            bool dirty = true;
+
+            // The triplets of addTriplets, in their order.
+            std::vector<int> triplet_rows;
+            std::vector<int> triplet_cols;
+            std::vector<double> triplet_values;
+            // CSR entry k sums triplet_values[gather[gather_begin[k]]], ..., triplet_values[gather[gather_begin[k + 1] - 1]].
+            std::vector<int> gather_begin;
+            std::vector<int> gather;
+
+            std::vector<Triplet> buffer;
+
+            void Build(ConstraintBase &cs, const MeshPtr &mesh, const GeomPtr &geom);
+            bool Refresh(ConstraintBase &cs, const MeshPtr &mesh, const GeomPtr &geom);
+            void Gather();
+
+            static Eigen::SparseMatrix<double, Eigen::RowMajor> stack(const std::vector<const ConstraintJacobian *> &blocks, size_t cols);
+
+            friend class ConstraintBase;
+        }; // ConstraintJacobian
+
+    } // namespace Constraints
+} // namespace rsurfaces
@@ -3,19 +3,39 @@
 #include "rsurface_types.h"
 #include "matrix_utils.h"
 
+#include <memory>
+
 namespace rsurfaces
 {
     namespace Constraints
     {
+        class ConstraintJacobian;
+
         class ConstraintBase
         {
         public:
-            virtual ~ConstraintBase() {}
+            ConstraintBase();
+            virtual ~ConstraintBase();
             virtual void ResetFunction(const MeshPtr &mesh, const GeomPtr &geom) = 0;
             virtual void addTriplets(std::vector<Triplet> &triplets, const MeshPtr &mesh, const GeomPtr &geom, int baseRow) = 0;
             virtual void addEntries(Eigen::MatrixXd &M, const MeshPtr &mesh, const GeomPtr &geom, int baseRow) = 0;
             virtual void addErrorValues(Eigen::VectorXd &V, const MeshPtr &mesh, const GeomPtr &geom, int baseRow) = 0;
             virtual size_t nRows() = 0;
+
+            // Optional fast path for ConstraintJacobian: overwrites the values of the triplets that addTriplets
+            // would produce, in the same order. Returns false if not implemented.
+            virtual bool refreshTripletValues(double *values, const MeshPtr &mesh, const GeomPtr &geom)
+            {
+                return false;
+            }
+
+            // Has to be called whenever the sparsity of addTriplets changes for other reasons than
+            // the vertex count or nRows (e.g. when the set of pinned vertices changes).
+            void JacobianStructureChanged();
+
+        private:
+            friend class ConstraintJacobian;
+            std::unique_ptr<ConstraintJacobian> jacobian;
         };
 
         void addEntriesToSymmetric(ConstraintBase &cs, Eigen::MatrixXd &M, const MeshPtr &mesh, const GeomPtr &geom, int baseRow);
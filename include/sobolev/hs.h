@@ -25,6 +25,13 @@ namespace rsurfaces
             Eigen::MatrixXd C;
             Eigen::MatrixXd M_A;
             Eigen::MatrixXd Ainv_CT;
+
+            ~SchurComplement()
+            {
+#ifdef MEMORY_ACCOUNTING
+                MemoryTracker::RemoveExternal(this);
+#endif
+            }
         };
 
         Vector3 HatGradientOnTriangle(GCFace face, GCVertex vert, GeomPtr &geom);
@@ -205,32 +212,44 @@ namespace rsurfaces
                     }
                     // Now this tells the BCT to multiply the metrics by the energy's weight.
                     optBCT = CreateOptimizedBCTFromBVH(bvh, exps.x, exps.y, bh_theta, energy->GetWeight(), settings);
+                }
 
-
-                    if (obstacleEnergy)
+                if (obstacleEnergy && !obstacleBCT)
+                {
+                    Vector2 exps = energy->GetExponents();
+                    std::cout << "    * Building obstacle BCT" << std::endl;
+                    OptimizedClusterTree* obstacleBVH = obstacleEnergy->GetBVH();
+                    std::cout << "    * Got obstacle BVH " << obstacleBVH << " (" << obstacleBVH->cluster_count << " clusters)" << std::endl;
+                    BCTSettings settings;
+                    if (disableNearField)
                     {
-                        std::cout << "    * Building obstacle BCT" << std::endl;
-                        OptimizedClusterTree* obstacleBVH = obstacleEnergy->GetBVH();
-                        std::cout << "    * Got obstacle BVH " << obstacleBVH << " (" << obstacleBVH->cluster_count << " clusters)" << std::endl;
-                        BCTSettings settings;
-                        if (disableNearField)
-                        {
-                            settings.near_lo_modifier = 0.;
-                            settings.far_lo_modifier = 0.;
-                            std::cout << "    * Low-order near-field interactions in obstacle BCT are disabled." << std::endl;
-                        }
-                        // Now this tells the BCT to multiply the metrics by the obstacleEnergy's weight.
-                        // Should be useful for regularization/penalty scenarios in which one wants to apply extremely large weights.
-                        obstacleBCT = std::make_shared<OptimizedBlockClusterTree>(bvh, obstacleBVH, exps.x, exps.y, bh_theta, obstacleEnergy->GetWeight(), settings);
-                        std::cout << "    * Built obstacle BCT" << std::endl;
-                        optBCT->AddObstacleCorrection(obstacleBCT);
-                        std::cout << "    * Added obstacle correction" << std::endl;
+                        settings.near_lo_modifier = 0.;
+                        settings.far_lo_modifier = 0.;
+                        std::cout << "    * Low-order near-field interactions in obstacle BCT are disabled." << std::endl;
                     }
-
+                    // Now this tells the BCT to multiply the metrics by the obstacleEnergy's weight.
+                    // Should be useful for regularization/penalty scenarios in which one wants to apply extremely large weights.
+                    obstacleBCT = std::make_shared<OptimizedBlockClusterTree>(bvh, obstacleBVH, exps.x, exps.y, bh_theta, obstacleEnergy->GetWeight(), settings);
+                    std::cout << "    * Built obstacle BCT" << std::endl;
+                    optBCT->AddObstacleCorrection(obstacleBCT);
+                    std::cout << "    * Added obstacle correction" << std::endl;
                 }
                 return optBCT;
             }
 
+            // Use a block cluster tree that was built elsewhere on this metric's BVH (e.g., the one
+            // the energy is evaluated on) instead of building a new one. Obstacle corrections are
+            // still added to it, so the same instance must not be handed to more than one metric.
+            inline void SetBlockClusterTree(BCTPtr bct_)
+            {
+                if (bct_ && (bct_->S != bvh || bct_->T != bvh))
+                {
+                    wprint("HsMetric::SetBlockClusterTree: Block cluster tree was not built on the metric's BVH. Ignoring it.");
+                    return;
+                }
+                optBCT = bct_;
+            }
+
         private:
             void addSimpleConstraintEntries(Eigen::MatrixXd &M) const;
             void addSimpleConstraintTriplets(std::vector<Triplet> &triplets) const;
@@ -374,6 +393,9 @@ namespace rsurfaces
 
             // Now we've multiplied A^{-1} C^T, so just multiply this with C and negate it
             dest.M_A = -dest.C * dest.Ainv_CT;
+#ifdef MEMORY_ACCOUNTING
+            MemoryTracker::SetExternal(&dest, "SchurComplement", sizeof(double) * (dest.C.size() + dest.M_A.size() + dest.Ainv_CT.size()));
+#endif
             
             ptoc("GetSchurComplement");
         }
@@ -32,8 +32,17 @@ namespace rsurfaces
             Eigen::VectorXd temp;
             temp.setZero(gradient.rows());
             cg.setTolerance(1e-4);
+#ifdef MEMORY_ACCOUNTING
+            // GMRES keeps restart + 1 basis vectors and the Hessenberg matrix while it runs.
+            size_t restart = cg.get_restart();
+            MemoryTracker::SetExternal(&cg, "KrylovBasis", sizeof(double) * (restart + 1) * (gradient.rows() + restart));
+#endif
             temp = cg.solveWithGuess(gradient, temp);
+#ifdef MEMORY_ACCOUNTING
+            MemoryTracker::RemoveExternal(&cg);
+#endif
             std::cout << "  * GMRES converged in " << cg.iterations() << " iterations, final residual = " << cg.error() << std::endl;
+            ptcounter("GMRES iterations", cg.iterations());
 
             dest = temp;
             
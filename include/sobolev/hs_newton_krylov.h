@@ -0,0 +1,54 @@
+#pragma once
+
+#include "sobolev/hs.h"
+#include "sobolev/hs_schur.h"
+
+namespace rsurfaces
+{
+    namespace Hs
+    {
+        // Truncated Newton (Newton-Krylov) solver. The Newton system (D^2 E) x = dE is solved
+        // approximately by conjugate gradients, preconditioned by the sparse Hs metric.
+        // Hessian-vector products are directional derivatives of the energy differentials,
+        // evaluated by central differences. For the whole solve, the cluster tree is only refit (never rebuilt) and the
+        // energy is evaluated on one block cluster tree built at the initial positions, so both differences see the
+        // same partition and the approximation error does not get divided by the tiny step.
+        class HsNewtonKrylov
+        {
+        public:
+            HsNewtonKrylov(MeshPtr mesh_, GeomPtr geom_, std::vector<SurfaceEnergy *> &energies_);
+            ~HsNewtonKrylov() {}
+
+            // Writes the approximate Newton direction for the L2 differential l2diff to dest.
+            // Returns the number of CG iterations; 0 means the preconditioned gradient was used.
+            size_t SolveNewtonSystem(const Eigen::MatrixXd &l2diff, const HsMetric &hs, Eigen::MatrixXd &dest);
+
+            // dest = (D^2 E) v, approximated by differentiating the energy differentials in direction v.
+            // Only valid between BeginProducts and EndProducts.
+            void HessianProduct(const Eigen::MatrixXd &v, Eigen::MatrixXd &dest);
+
+            // Saves the current positions and freezes the block partition of the first energy for the following products.
+            void BeginProducts();
+            // Restores the saved positions and releases the frozen partition.
+            void EndProducts();
+
+            size_t maxIterations = 25;
+            // upper bound for the relative residual of the inner CG solve
+            double forcingTerm = 0.5;
+            // finite difference step relative to the average edge length
+            double relativeStep = 1e-4;
+
+        private:
+            MeshPtr mesh;
+            GeomPtr geom;
+            std::vector<SurfaceEnergy *> &energies;
+            Eigen::MatrixXd origPositions;
+            // block partition at origPositions; null if the first energy has no BVH
+            BCTPtr frozenBCT;
+
+            void SetPositions(const Eigen::MatrixXd &positions);
+        };
+
+    } // namespace Hs
+
+} // namespace rsurfaces
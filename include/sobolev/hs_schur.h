@@ -103,6 +103,7 @@ namespace rsurfaces
                     Vector3 vertCorr{correction(base), correction(base + 1), correction(base + 2)};
                     hs.geom->inputVertexPositions[v] += vertCorr;
                 }
+                GeometryCache::PositionsChanged(hs.geom);
 
                 vals.setZero();
                 curRow = 0;
@@ -1,7 +1,7 @@
 #pragma once
 
 #include "rsurface_types.h"
-#include "profiler.h"
+#include "optimized_bct_types.h"
 
 namespace rsurfaces
 {
@@ -11,12 +11,24 @@ namespace rsurfaces
         size_t nRows = 0;
         bool initialized = false;
 
+        ~SparseFactorization()
+        {
+#ifdef MEMORY_ACCOUNTING
+            MemoryTracker::RemoveExternal(this);
+#endif
+        }
+
         inline void Compute(Eigen::SparseMatrix<double> M)
         {
             ptic("SparseFactorization::Compute");
             nRows = M.rows();
             initialized = true;
             factor.compute(M);
+#ifdef MEMORY_ACCOUNTING
+            // L is stored in compressed column format; D and the permutation are vectors.
+            size_t nnz = factor.info() == Eigen::Success ? factor.matrixL().nestedExpression().nonZeros() : 0;
+            MemoryTracker::SetExternal(this, "SimplicialLDLT", nnz * (sizeof(double) + sizeof(int)) + nRows * (sizeof(double) + 3 * sizeof(int)));
+#endif
             ptoc("SparseFactorization::Compute");
         }
 
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "rsurface_types.h"
+#include "optimized_bct.h"
+#include "surface_energy.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace rsurfaces
+{
+    // Snapshot of the inputs of one solver step, for benchmarking single kernels on a real state without rerunning the flow.
+    //
+    // Holds the mesh and positions, the settings, the arrays of the OptimizedClusterTree, the block structure and values
+    // of near and far InteractionData, and the right-hand sides handed to the metric solve. Written and read in a
+    // compact binary format (native byte order; a header guards against mismatching mint/mreal and settings layouts).
+    //
+    // Replay rebuilds tree and block cluster tree from the captured mesh and settings, checks that they agree with the
+    // captured arrays, loads the captured matrix values into them and then times the kernels in isolation.
+    class SolverCapture
+    {
+    public:
+        struct Interaction
+        {
+            mint b_m = 0;
+            mint b_n = 0;
+            mint b_nnz = 0;
+            mint m = 0;
+            mint n = 0;
+            mint nnz = 0;
+            mreal hi_factor = 1.;
+            mreal lo_factor = 1.;
+            mreal fr_factor = 1.;
+            std::vector<mint> b_outer; // b_m + 1
+            std::vector<mint> b_inner; // b_nnz
+            std::vector<mint> outer;   // m + 1; empty if the matrix is not blocked
+            std::vector<mint> inner;   // nnz
+            std::vector<mreal> hi_values;
+            std::vector<mreal> lo_values;
+            std::vector<mreal> fr_values;
+
+            void From(const InteractionData &data);
+            bool SameStructure(const InteractionData &data) const;
+            // Overwrites values and factors of data, which must have the same structure.
+            void Into(InteractionData &data) const;
+        }; // Interaction
+
+        long step = 0;
+        mreal alpha = 6.;
+        mreal beta = 12.;
+        mreal theta = 0.5;
+        mreal weight = 1.;
+        BVHSettings bvh_settings;
+        BCTSettings bct_settings;
+
+        std::vector<mint> faces;      // 3 * face count
+        std::vector<mreal> positions; // 3 * vertex count
+
+        mint primitive_count = 0;
+        mint cluster_count = 0;
+        mint near_dim = 0;
+        mint far_dim = 0;
+        std::vector<mint> P_ext_pos;
+        std::vector<mint> C_begin;
+        std::vector<mint> C_end;
+        std::vector<mint> C_left;
+        std::vector<mint> C_right;
+        std::vector<mreal> P_near; // near_dim x primitive_count
+        std::vector<mreal> P_far;  // far_dim x primitive_count
+        std::vector<mreal> C_far;  // far_dim x cluster_count
+
+        Interaction near;
+        Interaction far;
+
+        std::vector<Eigen::VectorXd> rhs;
+
+        // Takes the state of a step whose tangent-point energy is energy (it needs a BVH) and whose metric uses bct.
+        static SolverCapture Take(long step_, const MeshPtr &mesh, const GeomPtr &geom, SurfaceEnergy *energy, BCTPtr bct,
+                                  const std::vector<Eigen::VectorXd> &rhs_);
+
+        void Write(const std::string &filename) const;
+        static SolverCapture Read(const std::string &filename);
+
+        // Largest deviation of the real arrays of bvh from the captured ones; infinity if the integer arrays differ.
+        mreal TreeDeviation(const OptimizedClusterTree *bvh) const;
+
+        // Times ApplyKernel_* of near and far field, FarFieldInteraction, NearFieldInteraction_CSR, the Barnes-Hut
+        // differential and ProjectSparse on the captured state; prints the best and mean time of each over the repetitions.
+        // Returns false if the rebuilt state does not match the capture (then nothing is timed).
+        bool Replay(int repetitions, std::ostream &os) const;
+    }; // SolverCapture
+
+} // namespace rsurfaces
@@ -56,6 +56,27 @@ namespace rsurfaces
             return 0;
         }
         
+        // Hand over a block cluster tree that was built on this energy's BVH, so that the energy
+        // can be evaluated on the same partition as the metric. Energies that do not use
+        // hierarchical approximation ignore it.
+        virtual void SetBlockClusterTree(BCTPtr bct_) {}
+        
+        // Returns a new energy of the same kind and with the same parameters that is evaluated on geom_
+        // (a geometry of the same mesh), e.g. for the private probes of the speculative line search.
+        // Returns 0 if the energy cannot be evaluated independently of its own geometry (the default).
+        virtual SurfaceEnergy *CopyFor(GeomPtr geom_)
+        {
+            return 0;
+        }
+        
+        // Like CopyFor, but with the separation parameter theta_ (a cheaper approximation if theta_ is larger),
+        // e.g. for the coarse probes of the multi-fidelity line search. Energies without hierarchical approximation
+        // ignore theta_.
+        virtual SurfaceEnergy *CoarseCopyFor(GeomPtr geom_, double theta_)
+        {
+            return CopyFor(geom_);
+        }
+        
         virtual double GetWeight()
         {
             return weight;
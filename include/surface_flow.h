@@ -9,6 +9,7 @@
 #include "surface_energy.h"
 #include "line_search.h"
 #include "sobolev/hs_ncg.h"
+#include "sobolev/hs_newton_krylov.h"
 #include "sobolev/lbfgs.h"
 #include "profiler.h"
 
@@ -31,6 +32,7 @@ namespace rsurfaces
         void StepH1ProjGrad();
         void StepAQP(double invKappa);
         void StepH2Projected();
+        void StepNewtonKrylov();
 
         SurfaceEnergy *BaseEnergy();
 
@@ -103,6 +105,24 @@ namespace rsurfaces
         // take steps larger than the given value
         double maxStepSize = -1.;
 
+        // if larger than 1, the line search evaluates this many step sizes per round
+        // concurrently (see LineSearch); useful when one energy evaluation does not fill the machine
+        int speculativeProbes = 1;
+
+        // if positive, the line search first looks for a step with the energies evaluated at this (larger) theta
+        // and checks only that candidate at full accuracy (see LineSearch)
+        double lineSearchCoarseTheta = 0.;
+
+        // if true, the sparse Hs steps build a single block cluster tree per step,
+        // from which both the tangent-point energy and the metric are evaluated; the energy
+        // and its differential at the start of the step are then the multipole approximation on
+        // that partition instead of the Barnes-Hut traversal (see TPEnergyBarnesHut0::SetBlockClusterTree)
+        bool shareBlockClusterTree = false;
+
+        // if positive, the sparse Hs steps write their solver state at this step to captureFile (see SolverCapture)
+        long captureStep = -1;
+        std::string captureFile = "./Capture.rscap";
+
     private:
         std::vector<SurfaceEnergy *> energies;
         MeshPtr mesh;
@@ -116,6 +136,13 @@ namespace rsurfaces
         Constraints::BarycenterComponentsConstraint *secretBarycenter;
         LBFGSOptimizer* lbfgs;
         SurfaceEnergy* obstacleEnergy;
+        BCTPtr sharedBCT;
+        // coarse probe state of the multi-fidelity line search, kept across steps (see LineSearch::CoarseState)
+        LineSearch::CoarseState lineSearchCoarse;
+
+        void BuildSharedBlockClusterTree();
+        LineSearch::CoarseState *CoarseLineSearchState();
+        void captureState(const Hs::HsMetric &hs, const Eigen::MatrixXd &l2diff);
 
         size_t addConstraintTriplets(std::vector<Triplet> &triplets, bool includeSchur);
         
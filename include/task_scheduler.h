@@ -0,0 +1,82 @@
+#pragma once
+
+#include "optimized_bct_types.h"
+
+#include <initializer_list>
+#include <tbb/task_arena.h>
+#include <tbb/parallel_invoke.h>
+#ifdef PERF_COUNTERS
+#include <tbb/task_scheduler_observer.h>
+#include "perf_counters.h"
+#endif
+
+namespace rsurfaces
+{
+    // Work-stealing fork-join for the recursive tree constructions (SplitCluster, Serialize, computeClusterData, SplitBlockCluster).
+    // The recursion runs inside a TBB arena with thread_count slots; idle threads steal the oldest (i.e. largest) pending subtrees,
+    // so unbalanced trees do not leave threads waiting. Subtrees below the grain size are processed by the calling task itself.
+    class TreeTaskScheduler
+    {
+#ifdef PERF_COUNTERS
+        // The workers of the arena do not call ptic themselves; they get their hardware counters when they enter the arena.
+        class CounterObserver : public tbb::task_scheduler_observer
+        {
+        public:
+            CounterObserver(tbb::task_arena &arena) : tbb::task_scheduler_observer(arena)
+            {
+                observe(true);
+            }
+
+            ~CounterObserver()
+            {
+                observe(false);
+            }
+
+            void on_scheduler_entry(bool is_worker) override
+            {
+                PerfCounters::AttachThread();
+            }
+        };
+#endif
+
+    public:
+        // Runs body in an arena with thread_count threads; ThreadIndex() is in [0, thread_count) inside of it.
+        template <typename F>
+        static void Run(const mint thread_count, F &&body)
+        {
+            tbb::task_arena arena(static_cast<int>(std::max(static_cast<mint>(1), thread_count)));
+#ifdef PERF_COUNTERS
+            CounterObserver observer(arena);
+#endif
+            arena.execute(body);
+        }
+
+        // Slot of the calling thread in the current arena; use it to index per-thread containers.
+        static inline mint ThreadIndex()
+        {
+            return static_cast<mint>(tbb::this_task_arena::current_thread_index());
+        }
+
+        // Smallest amount of work (in primitives) for which a subtree is handed to the scheduler.
+        // It adapts to the problem: about tasks_per_thread tasks per thread, but never fewer than min_grain primitives per task.
+        static inline mint Grain(const mint work, const mint thread_count, const mint min_grain, const mint tasks_per_thread = 16)
+        {
+            return std::max(min_grain, work / std::max(static_cast<mint>(1), tasks_per_thread * thread_count));
+        }
+
+        // Calls all bodies, in parallel if spawn is true and one after another otherwise.
+        template <typename... F>
+        static inline void ForkJoin(const bool spawn, F &&... bodies)
+        {
+            if (spawn)
+            {
+                tbb::parallel_invoke(std::forward<F>(bodies)...);
+            }
+            else
+            {
+                (void)std::initializer_list<int>{(bodies(), 0)...};
+            }
+        }
+    }; // TreeTaskScheduler
+
+} // namespace rsurfaces
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "optimized_bct_types.h"
+
+#include <map>
+
+namespace rsurfaces
+{
+    // Per-thread busy time and work counts of one execution of a parallel loop.
+    // Activated by defining LOAD_BALANCE_STATS; otherwise all members are no-ops.
+    // Usage: create one ThreadLoad before the parallel region, let each thread report its iterations with Add,
+    // and the destructor folds the execution into a per-tag record. The records are written to ./LoadBalance.tsv at exit.
+    class ThreadLoad
+    {
+    public:
+        // padded to one cache line, so that threads do not share slots
+        struct Slot
+        {
+            alignas(CACHE_LINE_WIDTH) mreal busy = 0.;
+            long long work = 0;
+        };
+
+        struct Record
+        {
+            long long calls = 0;
+            mreal imbalance_sum = 0.;   // sum over calls of max busy / mean busy
+            mreal imbalance_max = 0.;
+            std::vector<mreal> busy;    // per thread, summed over calls
+            std::vector<long long> work;
+        };
+
+#ifdef LOAD_BALANCE_STATS
+        ThreadLoad(const std::string &tag_, mint thread_count) : tag(tag_), slots(thread_count) {}
+
+        ~ThreadLoad()
+        {
+            Commit();
+        }
+
+        static inline mreal Now()
+        {
+            return omp_get_wtime();
+        }
+
+        inline void Add(mint thread, mreal seconds, long long work)
+        {
+            slots[thread].busy += seconds;
+            slots[thread].work += work;
+        }
+
+        // max busy / mean busy of this execution; 1 means perfect balance
+        mreal Imbalance() const;
+
+        static std::map<std::string, Record> records;
+#else
+        ThreadLoad(const std::string &tag_, mint thread_count) {}
+
+        static inline mreal Now()
+        {
+            return 0.;
+        }
+
+        inline void Add(mint thread, mreal seconds, long long work) {}
+
+        mreal Imbalance() const
+        {
+            return 1.;
+        }
+#endif
+
+        // Per tag: calls, mean and worst imbalance, work imbalance; then busy time and work per thread.
+        static void WriteSummary(std::ostream &os);
+
+    private:
+#ifdef LOAD_BALANCE_STATS
+        std::string tag;
+        A_Vector<Slot> slots;
+
+        void Commit();
+#endif
+    };
+
+} // namespace rsurfaces
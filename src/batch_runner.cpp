@@ -0,0 +1,325 @@
+#include "batch_runner.h"
+
+#include "surface_flow.h"
+#include "energy/tpe_barnes_hut_0.h"
+#include "energy/tpe_all_pairs.h"
+#include "geometry_cache.h"
+#include "scene_file.h"
+#include "obj_writer.h"
+#include "mpi_context.h"
+
+#include <atomic>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <thread>
+
+namespace rsurfaces
+{
+    namespace
+    {
+        // Swallows everything; stands in for std::cout while a quiet batch runs.
+        class NullBuffer : public std::streambuf
+        {
+        protected:
+            int overflow(int c) override
+            {
+                return c;
+            }
+        };
+
+        std::string DirectoryOf(const std::string &path)
+        {
+            size_t slash = path.find_last_of("/\\");
+            return (slash == std::string::npos) ? std::string() : path.substr(0, slash + 1);
+        }
+
+        std::string StemOf(const std::string &path)
+        {
+            size_t slash = path.find_last_of("/\\");
+            std::string name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+            size_t dot = name.find_last_of('.');
+            return (dot == std::string::npos) ? name : name.substr(0, dot);
+        }
+
+        // Same scene as the GUI uses for a bare mesh (see defaultScene in main.cpp).
+        scene::SceneData MeshScene(const std::string &mesh_file)
+        {
+            scene::SceneData data;
+            data.meshName = mesh_file;
+            data.alpha = 6;
+            data.beta = 12;
+            data.constraints = std::vector<scene::ConstraintData>({scene::ConstraintData{scene::ConstraintType::Barycenter, 1, 0, 0},
+                                                                   scene::ConstraintData{scene::ConstraintType::TotalArea, 1, 0, 0},
+                                                                   scene::ConstraintData{scene::ConstraintType::TotalVolume, 1, 0, 0}});
+            return data;
+        }
+
+        void AddConstraints(SurfaceFlow *flow, MeshPtr &mesh, GeomPtr &geom, scene::SceneData &data)
+        {
+            // All pins go into the same constraint, as in setUpFlow of main.cpp.
+            Constraints::VertexPinConstraint *pinC = 0;
+
+            for (scene::ConstraintData &c : data.constraints)
+            {
+                switch (c.type)
+                {
+                case scene::ConstraintType::Barycenter:
+                    flow->addSimpleConstraint<Constraints::BarycenterConstraint3X>(mesh, geom);
+                    break;
+                case scene::ConstraintType::TotalArea:
+                    flow->addSchurConstraint<Constraints::TotalAreaConstraint>(mesh, geom, c.targetMultiplier, c.numIterations, c.targetAddition);
+                    break;
+                case scene::ConstraintType::TotalVolume:
+                    flow->addSchurConstraint<Constraints::TotalVolumeConstraint>(mesh, geom, c.targetMultiplier, c.numIterations, c.targetAddition);
+                    break;
+                case scene::ConstraintType::BoundaryPins:
+                {
+                    if (!pinC)
+                    {
+                        pinC = flow->addSimpleConstraint<Constraints::VertexPinConstraint>(mesh, geom);
+                    }
+                    std::vector<size_t> boundaryInds;
+                    VertexIndices inds = mesh->getVertexIndices();
+                    for (GCVertex v : mesh->vertices())
+                    {
+                        if (v.isBoundary())
+                        {
+                            boundaryInds.push_back(inds[v]);
+                        }
+                    }
+                    pinC->pinVertices(mesh, geom, boundaryInds);
+                }
+                break;
+                case scene::ConstraintType::VertexPins:
+                {
+                    if (!pinC)
+                    {
+                        pinC = flow->addSimpleConstraint<Constraints::VertexPinConstraint>(mesh, geom);
+                    }
+                    pinC->pinVertices(mesh, geom, data.vertexPins);
+                    data.vertexPins.clear();
+                }
+                break;
+                default:
+                    throw std::runtime_error("BatchRunner: normal constraints are not supported in batch mode");
+                }
+            }
+        }
+
+        void TakeStep(SurfaceFlow *flow, GradientMethod method)
+        {
+            switch (method)
+            {
+            case GradientMethod::HsProjected:
+                flow->StepProjectedGradient();
+                break;
+            case GradientMethod::HsProjectedIterative:
+                flow->StepProjectedGradientIterative();
+                break;
+            case GradientMethod::HsExactProjected:
+                flow->StepProjectedGradientExact();
+                break;
+            case GradientMethod::H1Projected:
+                flow->StepH1ProjGrad();
+                break;
+            case GradientMethod::L2Unconstrained:
+                flow->StepL2Unconstrained();
+                break;
+            case GradientMethod::L2Projected:
+                flow->StepL2Projected();
+                break;
+            case GradientMethod::HsNewtonKrylov:
+                flow->StepNewtonKrylov();
+                break;
+            default:
+                throw std::runtime_error("BatchRunner: the scene's method is not supported in batch mode");
+            }
+        }
+    } // namespace
+
+    BatchRunner::BatchRunner(mint total_threads, mint team_size)
+    {
+        if (total_threads <= 0)
+        {
+            total_threads = omp_get_num_procs();
+        }
+        team_size = std::max(static_cast<mint>(1), std::min(team_size, total_threads));
+        // Every team gets a copy of the current default settings; the flows never write back to them.
+        teams = FlowContext::Partition(total_threads / team_size, total_threads, true);
+    } // Constructor
+
+    std::vector<BatchResult> BatchRunner::Run(const std::vector<std::string> &scene_files)
+    {
+        // The team threads would call the energies' MPI collectives concurrently, which the communicator does not allow.
+        if (MPIContext::Active())
+        {
+            throw std::runtime_error("BatchRunner::Run: batch mode does not support several MPI ranks");
+        }
+        ptic("BatchRunner::Run");
+        std::vector<BatchResult> results(scene_files.size());
+        std::atomic<size_t> next{0};
+
+        NullBuffer null_buffer;
+        std::streambuf *previous = quiet ? std::cout.rdbuf(&null_buffer) : nullptr;
+
+        // No more teams than scenes; the teams pull scenes until the list is exhausted, so that they stay busy even if the meshes differ in size.
+        size_t team_count = std::min(teams.size(), scene_files.size());
+        std::vector<std::thread> threads;
+        for (size_t k = 0; k < team_count; ++k)
+        {
+            threads.emplace_back([this, &scene_files, &results, &next, k]() {
+                FlowContext::Scope scope(teams[k]);
+                for (size_t i = next++; i < scene_files.size(); i = next++)
+                {
+                    results[i] = RunScene(scene_files[i], i);
+                }
+            });
+        }
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+
+        if (quiet)
+        {
+            std::cout.rdbuf(previous);
+        }
+        ptoc("BatchRunner::Run");
+        return results;
+    } // Run
+
+    BatchResult BatchRunner::RunScene(const std::string &scene_file, size_t index)
+    {
+        BatchResult result;
+        result.scene_file = scene_file;
+        double start = omp_get_wtime();
+
+        try
+        {
+            scene::SceneData data;
+            if (endsWith(scene_file, ".txt") || endsWith(scene_file, ".scene"))
+            {
+                data = scene::parseScene(scene_file);
+            }
+            else if (endsWith(scene_file, ".obj"))
+            {
+                data = MeshScene(scene_file);
+            }
+            else
+            {
+                throw std::runtime_error("BatchRunner: unknown file extension of " + scene_file);
+            }
+            if (!data.obstacles.empty() || !data.implicitBarriers.empty() || !data.potentials.empty())
+            {
+                throw std::runtime_error("BatchRunner: obstacles, implicit barriers and potentials are not supported in batch mode");
+            }
+
+            MeshUPtr u_mesh;
+            GeomUPtr u_geom;
+            std::tie(u_mesh, u_geom) = readMesh(data.meshName);
+            MeshPtr mesh = std::move(u_mesh);
+            GeomPtr geom = std::move(u_geom);
+            geom->requireFaceNormals();
+            geom->requireFaceAreas();
+            geom->requireVertexNormals();
+            geom->requireVertexDualAreas();
+            geom->requireVertexGaussianCurvatures();
+            result.face_count = mesh->nFaces();
+
+            std::unique_ptr<SurfaceEnergy> energy;
+            if (theta <= 0)
+            {
+                energy.reset(new TPEnergyAllPairs(mesh, geom, data.alpha, data.beta));
+            }
+            else
+            {
+                energy.reset(new TPEnergyBarnesHut0(mesh, geom, data.alpha, data.beta, theta));
+            }
+            std::unique_ptr<SurfaceFlow> flow(new SurfaceFlow(energy.get()));
+            flow->allowBarycenterShift = data.allowBarycenterShift;
+            flow->disableNearField = data.disableNearField;
+            AddConstraints(flow.get(), mesh, geom, data);
+
+            flow->UpdateEnergies();
+            result.initial_energy = flow->evaluateEnergy();
+
+            int steps = (data.iterationLimit > 0) ? data.iterationLimit : default_steps;
+            for (int s = 0; s < steps; ++s)
+            {
+                TakeStep(flow.get(), data.defaultMethod);
+                result.steps++;
+            }
+
+            flow->UpdateEnergies();
+            result.final_energy = flow->evaluateEnergy();
+
+            if (!output_directory.empty())
+            {
+                std::string output = output_directory + "/" + StemOf(scene_file) + "_" + std::to_string(index) + ".obj";
+                writeMeshToOBJ(mesh, geom, geom, false, output);
+            }
+
+            flow.reset();
+            energy.reset();
+            GeometryCache::Release(geom);
+            result.ok = true;
+        }
+        catch (const std::exception &e)
+        {
+            result.error = e.what();
+        }
+        catch (...)
+        {
+            result.error = "BatchRunner: unknown error";
+        }
+
+        result.seconds = omp_get_wtime() - start;
+        return result;
+    } // RunScene
+
+    std::vector<std::string> BatchRunner::ReadList(const std::string &filename)
+    {
+        std::ifstream file(filename);
+        if (!file)
+        {
+            throw std::runtime_error("BatchRunner::ReadList: cannot open " + filename);
+        }
+        std::string directory = DirectoryOf(filename);
+
+        std::vector<std::string> scene_files;
+        for (std::string line; std::getline(file, line);)
+        {
+            // trim trailing whitespace, e.g. from Windows line ends
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            if (line.empty() || line[0] == '#')
+            {
+                continue;
+            }
+            bool absolute = (line[0] == '/');
+            scene_files.push_back(absolute ? line : directory + line);
+        }
+        return scene_files;
+    } // ReadList
+
+    void BatchRunner::PrintSummary(const std::vector<BatchResult> &results, double seconds, std::ostream &os)
+    {
+        size_t ok = 0;
+        double face_steps = 0.;
+        for (const BatchResult &r : results)
+        {
+            if (r.ok)
+            {
+                ++ok;
+                face_steps += static_cast<double>(r.face_count) * r.steps;
+            }
+            else
+            {
+                os << "  * " << r.scene_file << " failed: " << r.error << std::endl;
+            }
+        }
+        os << ok << " of " << results.size() << " scenes finished in " << seconds << " s ("
+           << ok / seconds << " scenes/s, " << face_steps / seconds << " face steps/s)" << std::endl;
+    } // PrintSummary
+
+} // namespace rsurfaces
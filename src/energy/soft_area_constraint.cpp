@@ -1,6 +1,7 @@
 #include "energy/soft_area_constraint.h"
 #include "matrix_utils.h"
 #include "surface_derivatives.h"
+#include "geometry_cache.h"
 
 namespace rsurfaces
 {
@@ -9,12 +10,12 @@ namespace rsurfaces
         mesh = mesh_;
         geom = geom_;
         weight = weight_;
-        initialArea = totalArea(geom, mesh);
+        initialArea = GeometryCache::Get(geom).totalArea;
     }
 
     inline double areaDeviation(MeshPtr mesh, GeomPtr geom, double initialArea)
     {
-        return (totalArea(geom, mesh) - initialArea) / initialArea;
+        return (GeometryCache::Get(geom).totalArea - initialArea) / initialArea;
     }
 
     // Returns the current value of the energy.
@@ -70,4 +71,12 @@ namespace rsurfaces
         return 0;
     }
 
+    SurfaceEnergy *SoftAreaConstraint::CopyFor(GeomPtr geom_)
+    {
+        // keeps the target of this energy
+        SoftAreaConstraint *copy = new SoftAreaConstraint(*this);
+        copy->geom = geom_;
+        return copy;
+    }
+
 } // namespace rsurfaces
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "energy/soft_volume_constraint.h"
 #include "matrix_utils.h"
 #include "surface_derivatives.h"
+#include "geometry_cache.h"
 
 namespace rsurfaces
 {
@@ -9,12 +10,12 @@ namespace rsurfaces
         mesh = mesh_;
         geom = geom_;
         weight = weight_;
-        initialVolume = totalVolume(geom, mesh);
+        initialVolume = GeometryCache::Get(geom).totalVolume;
     }
 
     inline double volumeDeviation(MeshPtr mesh, GeomPtr geom, double initialValue)
     {
-        return (totalVolume(geom, mesh) - initialValue) / initialValue;
+        return (GeometryCache::Get(geom).totalVolume - initialValue) / initialValue;
     }
 
     // Returns the current value of the energy.
@@ -30,13 +31,14 @@ namespace rsurfaces
     void SoftVolumeConstraint::Differential(Eigen::MatrixXd &output)
     {
         double volDev = volumeDeviation(mesh, geom, initialVolume);
+        const GeometryCache & G = GeometryCache::Get(geom);
 
         VertexIndices inds = mesh->getVertexIndices();
         for (size_t i = 0; i < mesh->nVertices(); i++)
         {
             GCVertex v_i = mesh->vertex(i);
             // Derivative of local volume is just the area weighted normal
-            Vector3 deriv_v = areaWeightedNormal(geom, v_i);
+            Vector3 deriv_v = G.VertexNormal(inds[v_i]);
             // Derivative of V^2 = 2 V (dV/dx)
             deriv_v = 2 * volDev * deriv_v / initialVolume;
 
@@ -64,4 +66,12 @@ namespace rsurfaces
         return 0;
     }
 
+    SurfaceEnergy *SoftVolumeConstraint::CopyFor(GeomPtr geom_)
+    {
+        // keeps the target of this energy
+        SoftVolumeConstraint *copy = new SoftVolumeConstraint(*this);
+        copy->geom = geom_;
+        return copy;
+    }
+
 } // namespace rsurfaces
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "energy/total_area_potential.h"
 #include "matrix_utils.h"
 #include "surface_derivatives.h"
+#include "geometry_cache.h"
 
 namespace rsurfaces
 {
@@ -14,7 +15,7 @@ namespace rsurfaces
     // Returns the current value of the energy.
     double TotalAreaPotential::Value()
     {
-        double a = totalArea(geom, mesh);
+        double a = GeometryCache::Get(geom).totalArea;
         return weight * a * a;
     }
 
@@ -24,7 +25,7 @@ namespace rsurfaces
     void TotalAreaPotential::Differential(Eigen::MatrixXd &output)
     {
         VertexIndices inds = mesh->getVertexIndices();
-        double a = totalArea(geom, mesh);
+        double a = GeometryCache::Get(geom).totalArea;
 
         for (size_t i = 0; i < mesh->nVertices(); i++)
         {
@@ -60,4 +61,11 @@ namespace rsurfaces
         return 0;
     }
 
+    SurfaceEnergy *TotalAreaPotential::CopyFor(GeomPtr geom_)
+    {
+        TotalAreaPotential *copy = new TotalAreaPotential(*this);
+        copy->geom = geom_;
+        return copy;
+    }
+
 } // namespace rsurfaces
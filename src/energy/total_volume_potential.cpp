@@ -1,6 +1,7 @@
 #include "energy/total_volume_potential.h"
 #include "matrix_utils.h"
 #include "surface_derivatives.h"
+#include "geometry_cache.h"
 
 namespace rsurfaces
 {
@@ -14,7 +15,7 @@ namespace rsurfaces
     // Returns the current value of the energy.
     double TotalVolumePotential::Value()
     {
-        double v = totalVolume(geom, mesh);
+        double v = GeometryCache::Get(geom).totalVolume;
         return weight * v * v;
     }
 
@@ -23,12 +24,13 @@ namespace rsurfaces
     // respect to the corresponding vertex.
     void TotalVolumePotential::Differential(Eigen::MatrixXd &output)
     {
-        double v = totalVolume(geom, mesh);
+        const GeometryCache & G = GeometryCache::Get(geom);
+        double v = G.totalVolume;
         VertexIndices inds = mesh->getVertexIndices();
         for (size_t i = 0; i < mesh->nVertices(); i++)
         {
             GCVertex v_i = mesh->vertex(i);
-            Vector3 deriv_v =  areaWeightedNormal(geom, v_i);
+            Vector3 deriv_v = G.VertexNormal(inds[v_i]);
             // Derivative of V^2 = V * (deriv V) = V * (area normal)
             MatrixUtils::addToRow(output, inds[v_i], weight * v * deriv_v);
         }
@@ -54,4 +56,11 @@ namespace rsurfaces
         return 0;
     }
 
+    SurfaceEnergy *TotalVolumePotential::CopyFor(GeomPtr geom_)
+    {
+        TotalVolumePotential *copy = new TotalVolumePotential(*this);
+        copy->geom = geom_;
+        return copy;
+    }
+
 } // namespace rsurfaces
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "energy/tp_obstacle_barnes_hut_0.h"
+#include "mpi_context.h"
 
 namespace rsurfaces
 {
@@ -67,8 +68,13 @@ namespace rsurfaces
 
             A_Vector<A_Vector<mint>> thread_stack(nthreads);
 
+            // With several MPI ranks, each rank handles only its share of the target leaves.
+            mint leaf_begin = 0;
+            mint leaf_end = 0;
+            MPIContext::LocalRange(S->leaf_cluster_count, leaf_begin, leaf_end);
+
             #pragma omp parallel for num_threads(nthreads) reduction(+ : sum)
-            for (mint k = 0; k < S->leaf_cluster_count; ++k)
+            for (mint k = leaf_begin; k < leaf_end; ++k)
             {
                 mint thread = omp_get_thread_num();
 
@@ -249,8 +255,13 @@ namespace rsurfaces
 
             A_Vector<A_Vector<mint>> thread_stack(nthreads);
 
+            // With several MPI ranks, each rank handles only its share of the target leaves.
+            mint leaf_begin = 0;
+            mint leaf_end = 0;
+            MPIContext::LocalRange(S->leaf_cluster_count, leaf_begin, leaf_end);
+
             #pragma omp parallel for num_threads(nthreads) reduction(+ : sum)
-            for (mint k = 0; k < S->leaf_cluster_count; ++k)
+            for (mint k = leaf_begin; k < leaf_end; ++k)
             {
                 mint thread = omp_get_thread_num();
 
@@ -451,8 +462,13 @@ namespace rsurfaces
 
             A_Vector<A_Vector<mint>> thread_stack(nthreads);
 
+            // With several MPI ranks, each rank handles only its share of the target leaves.
+            mint leaf_begin = 0;
+            mint leaf_end = 0;
+            MPIContext::LocalRange(S->leaf_cluster_count, leaf_begin, leaf_end);
+
             #pragma omp parallel for num_threads(nthreads) reduction(+ : sum)
-            for (mint k = 0; k < S->leaf_cluster_count; ++k)
+            for (mint k = leaf_begin; k < leaf_end; ++k)
             {
                 mint thread = omp_get_thread_num();
 
@@ -702,8 +718,13 @@ namespace rsurfaces
             
             A_Vector<A_Vector<mint>> thread_stack(nthreads);
             
+            // With several MPI ranks, each rank handles only its share of the target leaves.
+            mint leaf_begin = 0;
+            mint leaf_end = 0;
+            MPIContext::LocalRange(S->leaf_cluster_count, leaf_begin, leaf_end);
+
             #pragma omp parallel for num_threads(nthreads) reduction(+ : sum)
-            for (mint k = 0; k < S->leaf_cluster_count; ++k)
+            for (mint k = leaf_begin; k < leaf_end; ++k)
             {
                 mint thread = omp_get_thread_num();
                 
@@ -911,12 +932,14 @@ namespace rsurfaces
             mint int_alpha = std::round(alpha);
             mint int_betahalf = std::round(beta / 2);
             value = weight * Energy(int_alpha, int_betahalf);
+            value = MPIContext::AllreduceSum(value);
         }
         else
         {
             mreal real_alpha = alpha;
             mreal real_betahalf = beta / 2;
             value = weight * Energy(real_alpha, real_betahalf);
+            value = MPIContext::AllreduceSum(value);
         }
         
         ptoc("TPObstacleBarnesHut0::Value");
@@ -959,6 +982,8 @@ namespace rsurfaces
         }
 
         bvh->CollectDerivatives( P_D_near_.data(), P_D_far_.data() );
+        MPIContext::AllreduceSum( P_D_near_.data(), P_D_near_.size() );
+        MPIContext::AllreduceSum( P_D_far_.data(), P_D_far_.size() );
 
         AssembleDerivativeFromACNData( mesh, geom, P_D_near_, output, weight );
 
@@ -993,6 +1018,15 @@ namespace rsurfaces
         ptoc("TPObstacleBarnesHut0::Update");
     }
     
+    void TPObstacleBarnesHut0::TransformObstacle(const Eigen::Matrix3d &R, const Vector3 &t)
+    {
+        ptic("TPObstacleBarnesHut0::TransformObstacle");
+        Eigen::Matrix<mreal, 3, 3, Eigen::RowMajor> A = R;
+        mreal b[3] = {t.x, t.y, t.z};
+        o_bvh->RigidTransform(A.data(), b);
+        ptoc("TPObstacleBarnesHut0::TransformObstacle");
+    }
+
     // Get the exponents of this energy; only applies to tangent-point energies.
     Vector2 TPObstacleBarnesHut0::GetExponents()
     {
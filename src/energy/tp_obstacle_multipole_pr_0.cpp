@@ -554,13 +554,13 @@ namespace rsurfaces
         {
             mint int_alphahalf = std::round(alpha/2);
             mint int_betahalf = std::round(beta/2);
-            return weight * (FarField( int_alphahalf, int_betahalf ) + NearField (int_alphahalf, int_betahalf ));
+            return bct->SumOverRanks( weight * (FarField( int_alphahalf, int_betahalf ) + NearField (int_alphahalf, int_betahalf )) );
         }
         else
         {
             mreal real_alphahalf = alpha/2;
             mreal real_betahalf = beta/2;
-            return weight * (FarField( real_alphahalf, real_betahalf ) + NearField( real_alphahalf, real_betahalf ));
+            return bct->SumOverRanks( weight * (FarField( real_alphahalf, real_betahalf ) + NearField( real_alphahalf, real_betahalf )) );
         }
     } // Value
 
@@ -609,6 +609,8 @@ namespace rsurfaces
         EigenMatrixRM P_D_far_ ( bct->S->primitive_count , bct->S->far_dim );
         
         bct->S->CollectDerivatives( P_D_near_.data(), P_D_far_.data() );
+        bct->SumOverRanks( P_D_near_.data(), P_D_near_.size() );
+        bct->SumOverRanks( P_D_far_.data(), P_D_far_.size() );
         
         AssembleDerivativeFromACPData( mesh, geom, P_D_near_, output, weight );
         AssembleDerivativeFromACPData( mesh, geom, P_D_far_, output, weight );
@@ -327,4 +327,10 @@ namespace rsurfaces
         return 0.;
     }
 
+    SurfaceEnergy *TPEnergyAllPairs::CopyFor(GeomPtr geom_)
+    {
+        // builds its own BVH on geom_
+        return new TPEnergyAllPairs(mesh, geom_, alpha, beta, weight);
+    }
+
 } // namespace rsurfaces
@@ -1,5 +1,9 @@
 #include "energy/tpe_barnes_hut_0.h"
+#include "energy/tpe_multipole_0.h"
 #include "bct_constructors.h"
+#include "thread_load.h"
+#include "mpi_context.h"
+#include "geometry_cache.h"
 
 namespace rsurfaces
 {
@@ -43,15 +47,32 @@ namespace rsurfaces
         mreal const * restrict const C_r2    = bvh->C_squared_radius;
         
         mint  const * restrict const leaf = bvh->leaf_clusters;
+        mint  const * restrict const leaf_lookup = bvh->leaf_cluster_lookup;
+        mint  const * restrict const tile_ptr = bvh->leaf_tile_ptr;
+        
+        // leaf-tiled copy of P_near; used for the leaf-leaf interactions
+        mreal const * restrict const P_T = bvh->P_near_tiled;
+        const mint W = SIMD_TILE_WIDTH;
+        const mint tile_size = bvh->near_dim * W;
         
         A_Vector<A_Vector<mint>> thread_stack ( nthreads );
         
+        // With several MPI ranks, each rank handles only its share of the target leaves.
+        mint leaf_begin = 0;
+        mint leaf_end = 0;
+        MPIContext::LocalRange( bvh->leaf_cluster_count, leaf_begin, leaf_end );
+        
+        ThreadLoad load ("TPEnergyBarnesHut0::Energy", nthreads);
         
         #pragma omp parallel for num_threads( nthreads ) reduction( + : sum ) RAGGED_SCHEDULE
-        for( mint k = 0; k < bvh->leaf_cluster_count; ++k )
+        for( mint k = leaf_begin; k < leaf_end; ++k )
         {
             mint thread = omp_get_thread_num();
             
+            // work = number of kernel evaluations
+            mreal start = ThreadLoad::Now();
+            long long work = 0;
+            
             A_Vector<mint> * stack = &thread_stack[thread];
             
             stack->clear();
@@ -99,6 +120,8 @@ namespace rsurfaces
 
                 if( h2 < theta2 * R2 )
                 {
+                    work += i_end - i_begin;
+                    
                     mreal b  = C_A [C];
                     mreal y1 = C_X1[C];
                     mreal y2 = C_X2[C];
@@ -144,38 +167,53 @@ namespace rsurfaces
                         // near field loop
                         mint j_begin = C_begin[C];
                         mint j_end   = C_end[C];
+                        work += (i_end - i_begin) * (j_end - j_begin);
+                        mint t_begin = tile_ptr[ leaf_lookup[C]     ];
+                        mint t_end   = tile_ptr[ leaf_lookup[C] + 1 ];
 
                         mreal local_local_sum = 0.;
                         
-                        #pragma omp simd aligned( P_A, P_X1, P_X2, P_X3, P_N1, P_N2, P_N3 : ALIGN ) collapse(2) reduction( + : local_local_sum )
                         for( mint i = i_begin; i < i_end; ++i )
                         {
-                            for( mint j = j_begin; j < j_end; ++j )
+                            mreal a  = P_A [i];
+                            mreal x1 = P_X1[i];
+                            mreal x2 = P_X2[i];
+                            mreal x3 = P_X3[i];
+                            mreal n1 = P_N1[i];
+                            mreal n2 = P_N2[i];
+                            mreal n3 = P_N3[i];
+                            
+                            mreal i_sum = 0.;
+                            
+                            for( mint t = t_begin; t < t_end; ++t )
                             {
-                                mreal delta_ij = (i == j);
-                                
-                                mreal a  = P_A [i];
-                                mreal x1 = P_X1[i];
-                                mreal x2 = P_X2[i];
-                                mreal x3 = P_X3[i];
-                                mreal n1 = P_N1[i];
-                                mreal n2 = P_N2[i];
-                                mreal n3 = P_N3[i];
+                                mreal const * restrict const tile = P_T + tile_size * t;
+                                mint j_0 = j_begin + W * (t - t_begin);
                                 
-                                mreal b  = P_A [j];
-                                mreal y1 = P_X1[j];
-                                mreal y2 = P_X2[j];
-                                mreal y3 = P_X3[j];
-                                
-                                mreal v1 = y1 - x1;
-                                mreal v2 = y2 - x2;
-                                mreal v3 = y3 - x3;
-                                
-                                mreal rCosPhi = v1 * n1 + v2 * n2 + v3 * n3;
-                                mreal r2 = v1 * v1 + v2 * v2 + v3 * v3 + delta_ij;
-                                
-                                local_local_sum += a *  (1. - delta_ij) * mypow( fabs(rCosPhi), alpha ) * mypow( r2, minus_betahalf ) * b;
+                                // fixed trip count, so that the compiler can emit full vector instructions; the tail is masked out
+                                #pragma omp simd aligned( tile : ALIGN ) reduction( + : i_sum )
+                                for( mint lane = 0; lane < W; ++lane )
+                                {
+                                    mint j = j_0 + lane;
+                                    mreal mask = static_cast<mreal>( (j < j_end) && (j != i) );
+                                    
+                                    mreal b  = tile[ W * 0 + lane ];
+                                    mreal y1 = tile[ W * 1 + lane ];
+                                    mreal y2 = tile[ W * 2 + lane ];
+                                    mreal y3 = tile[ W * 3 + lane ];
+                                    
+                                    mreal v1 = y1 - x1;
+                                    mreal v2 = y2 - x2;
+                                    mreal v3 = y3 - x3;
+                                    
+                                    mreal rCosPhi = v1 * n1 + v2 * n2 + v3 * n3;
+                                    mreal r2 = v1 * v1 + v2 * v2 + v3 * v3 + (1. - mask);
+                                    
+                                    i_sum += mask * mypow( fabs(rCosPhi), alpha ) * mypow( r2, minus_betahalf ) * b;
+                                }
                             }
+                            
+                            local_local_sum += a * i_sum;
                         }
                         
                         local_sum += local_local_sum;
@@ -184,6 +222,8 @@ namespace rsurfaces
             }
             
             sum += local_sum;
+            
+            load.Add( thread, ThreadLoad::Now() - start, work );
         }
         
         ptoc("TPEnergyBarnesHut0::Energy");
@@ -239,14 +279,32 @@ namespace rsurfaces
         mreal const * restrict const C_r2    = bvh->C_squared_radius;
         
         mint  const * restrict const leaf = bvh->leaf_clusters;
+        mint  const * restrict const leaf_lookup = bvh->leaf_cluster_lookup;
+        mint  const * restrict const tile_ptr = bvh->leaf_tile_ptr;
+        
+        // leaf-tiled copy of P_near; used for the leaf-leaf interactions
+        mreal const * restrict const P_T = bvh->P_near_tiled;
+        const mint W = SIMD_TILE_WIDTH;
+        const mint tile_size = bvh->near_dim * W;
         
         A_Vector<A_Vector<mint>> thread_stack ( nthreads );
         
+        // With several MPI ranks, each rank handles only its share of the target leaves.
+        mint leaf_begin = 0;
+        mint leaf_end = 0;
+        MPIContext::LocalRange( bvh->leaf_cluster_count, leaf_begin, leaf_end );
+        
+        ThreadLoad load ("TPEnergyBarnesHut0::DEnergy", nthreads);
+        
         #pragma omp parallel for num_threads( nthreads ) reduction( + : sum ) RAGGED_SCHEDULE
-        for( mint k = 0; k < bvh->leaf_cluster_count; ++k )
+        for( mint k = leaf_begin; k < leaf_end; ++k )
         {
             mint thread = omp_get_thread_num();
             
+            // work = number of kernel evaluations
+            mreal start = ThreadLoad::Now();
+            long long work = 0;
+            
             A_Vector<mint> * stack = &thread_stack[thread];
             
             mreal * restrict const P_U = &bvh->P_D_near[thread][0];
@@ -295,6 +353,8 @@ namespace rsurfaces
 
                 if( h2 < theta2 * R2 )
                 {
+                    work += i_end - i_begin;
+                    
                     mreal b  = C_A [C];
                     mreal y1 = C_X1[C];
                     mreal y2 = C_X2[C];
@@ -367,15 +427,20 @@ namespace rsurfaces
                         // near field loop
                         mint j_begin = C_begin[C];
                         mint j_end   = C_end[C];
+                        work += (i_end - i_begin) * (j_end - j_begin);
+                        mint t_begin = tile_ptr[ leaf_lookup[C]     ];
+                        mint t_end   = tile_ptr[ leaf_lookup[C] + 1 ];
                         
-// SIMD seems to be counterproductive here
-                        #pragma omp simd aligned( P_A, P_X1, P_X2, P_X3, P_N1, P_N2, P_N3, P_U : ALIGN ) collapse(2) reduction( + : sum )
-                        for( mint i = i_begin; i < i_end; ++i )
+                        for( mint t = t_begin; t < t_end; ++t )
                         {
-                            for( mint j = j_begin; j < j_end; ++j )
+                            mreal const * restrict const tile = P_T + tile_size * t;
+                            mint j_0 = j_begin + W * (t - t_begin);
+                            
+                            // contributions to the primitives of the tile are accumulated here and written to P_U only once per tile
+                            mreal U_j [4 * SIMD_TILE_WIDTH] = {};
+                            
+                            for( mint i = i_begin; i < i_end; ++i )
                             {
-                                mreal delta_ij = (i == j);
-                                
                                 mreal a  = P_A [i];
                                 mreal x1 = P_X1[i];
                                 mreal x2 = P_X2[i];
@@ -384,55 +449,92 @@ namespace rsurfaces
                                 mreal n2 = P_N2[i];
                                 mreal n3 = P_N3[i];
                                 
-                                mreal b  = P_A [j];
-                                mreal y1 = P_X1[j];
-                                mreal y2 = P_X2[j];
-                                mreal y3 = P_X3[j];
-                                
-                                mreal v1 = y1 - x1;
-                                mreal v2 = y2 - x2;
-                                mreal v3 = y3 - x3;
-                                
-                                mreal rCosPhi = v1 * n1 + v2 * n2 + v3 * n3;
-                                mreal r2      = v1 * v1 + v2 * v2 + v3 * v3 + delta_ij;
-                                
-                                mreal rBetaMinus2 = (1. - delta_ij) * mypow( r2, minus_betahalf_minus_1 );
-                                mreal rBeta = (1. - delta_ij) * rBetaMinus2 * r2;
-                                
-                                mreal rCosPhiAlphaMinus1 = mypow( fabs(rCosPhi), alpha_minus_2 ) * rCosPhi;
-                                mreal rCosPhiAlpha = rCosPhiAlphaMinus1 * rCosPhi;
-                                
-                                mreal Num = rCosPhiAlpha;
-                                mreal factor0 = rBeta * alpha;
-                                mreal density = rBeta * Num;
-                                sum += a * b * density;
-                                
-                                mreal F = factor0 * rCosPhiAlphaMinus1;
-                                mreal H = beta * rBetaMinus2 * Num;
-                                
-                                mreal bF = b * F;
-                                
-                                mreal Z1 = ( - n1 * F + v1 * H );
-                                mreal Z2 = ( - n2 * F + v2 * H );
-                                mreal Z3 = ( - n3 * F + v3 * H );
+                                mreal U_i0 = 0.;
+                                mreal U_i1 = 0.;
+                                mreal U_i2 = 0.;
+                                mreal U_i3 = 0.;
+                                mreal U_i4 = 0.;
+                                mreal U_i5 = 0.;
+                                mreal U_i6 = 0.;
                                 
-                                P_U[ 7 * i + 0 ] += b * ( density + F * ( n1 * (x1 - v1) + n2 * (x2 - v2) + n3 * (x3 - v3) ) - H * ( v1 * x1 + v2 * x2 + v3 * x3 ) );
-                                P_U[ 7 * i + 1 ] += b  * Z1;
-                                P_U[ 7 * i + 2 ] += b  * Z2;
-                                P_U[ 7 * i + 3 ] += b  * Z3;
-                                P_U[ 7 * i + 4 ] += bF * v1;
-                                P_U[ 7 * i + 5 ] += bF * v2;
-                                P_U[ 7 * i + 6 ] += bF * v3;
+                                // fixed trip count, so that the compiler can emit full vector instructions; the tail is masked out
+                                #pragma omp simd aligned( tile : ALIGN ) reduction( + : sum, U_i0, U_i1, U_i2, U_i3, U_i4, U_i5, U_i6 )
+                                for( mint lane = 0; lane < W; ++lane )
+                                {
+                                    mint j = j_0 + lane;
+                                    mreal mask = static_cast<mreal>( (j < j_end) && (j != i) );
+                                    
+                                    mreal b  = tile[ W * 0 + lane ];
+                                    mreal y1 = tile[ W * 1 + lane ];
+                                    mreal y2 = tile[ W * 2 + lane ];
+                                    mreal y3 = tile[ W * 3 + lane ];
+                                    
+                                    mreal v1 = y1 - x1;
+                                    mreal v2 = y2 - x2;
+                                    mreal v3 = y3 - x3;
+                                    
+                                    mreal rCosPhi = v1 * n1 + v2 * n2 + v3 * n3;
+                                    mreal r2      = v1 * v1 + v2 * v2 + v3 * v3 + (1. - mask);
+                                    
+                                    mreal rBetaMinus2 = mask * mypow( r2, minus_betahalf_minus_1 );
+                                    mreal rBeta = rBetaMinus2 * r2;
+                                    
+                                    mreal rCosPhiAlphaMinus1 = mypow( fabs(rCosPhi), alpha_minus_2 ) * rCosPhi;
+                                    mreal rCosPhiAlpha = rCosPhiAlphaMinus1 * rCosPhi;
+                                    
+                                    mreal Num = rCosPhiAlpha;
+                                    mreal factor0 = rBeta * alpha;
+                                    mreal density = rBeta * Num;
+                                    sum += a * b * density;
+                                    
+                                    mreal F = factor0 * rCosPhiAlphaMinus1;
+                                    mreal H = beta * rBetaMinus2 * Num;
+                                    
+                                    mreal bF = b * F;
+                                    
+                                    mreal Z1 = ( - n1 * F + v1 * H );
+                                    mreal Z2 = ( - n2 * F + v2 * H );
+                                    mreal Z3 = ( - n3 * F + v3 * H );
+                                    
+                                    U_i0 += b * ( density + F * ( n1 * (x1 - v1) + n2 * (x2 - v2) + n3 * (x3 - v3) ) - H * ( v1 * x1 + v2 * x2 + v3 * x3 ) );
+                                    U_i1 += b  * Z1;
+                                    U_i2 += b  * Z2;
+                                    U_i3 += b  * Z3;
+                                    U_i4 += bF * v1;
+                                    U_i5 += bF * v2;
+                                    U_i6 += bF * v3;
+                                    
+                                    U_j[ W * 0 + lane ] += a * ( density - F * ( n1 * y1 + n2 * y2 + n3 * y3 ) + H * ( v1 * y1 + v2 * y2 + v3 * y3 ) );
+                                    U_j[ W * 1 + lane ] -= a  * Z1;
+                                    U_j[ W * 2 + lane ] -= a  * Z2;
+                                    U_j[ W * 3 + lane ] -= a  * Z3;
+                                }
                                 
-                                P_U[ 7 * j + 0 ] += a * ( density - F * ( n1 * y1 + n2 * y2 + n3 * y3 ) + H * ( v1 * y1 + v2 * y2 + v3 * y3 ) );
-                                P_U[ 7 * j + 1 ] -= a  * Z1;
-                                P_U[ 7 * j + 2 ] -= a  * Z2;
-                                P_U[ 7 * j + 3 ] -= a  * Z3;
+                                P_U[ 7 * i + 0 ] += U_i0;
+                                P_U[ 7 * i + 1 ] += U_i1;
+                                P_U[ 7 * i + 2 ] += U_i2;
+                                P_U[ 7 * i + 3 ] += U_i3;
+                                P_U[ 7 * i + 4 ] += U_i4;
+                                P_U[ 7 * i + 5 ] += U_i5;
+                                P_U[ 7 * i + 6 ] += U_i6;
+                            }
+                            
+                            // write back only the lanes that hold actual primitives
+                            mint lane_end = std::min( W, j_end - j_0 );
+                            for( mint lane = 0; lane < lane_end; ++lane )
+                            {
+                                mint j = j_0 + lane;
+                                P_U[ 7 * j + 0 ] += U_j[ W * 0 + lane ];
+                                P_U[ 7 * j + 1 ] += U_j[ W * 1 + lane ];
+                                P_U[ 7 * j + 2 ] += U_j[ W * 2 + lane ];
+                                P_U[ 7 * j + 3 ] += U_j[ W * 3 + lane ];
                             }
                         }
                     }
                 }
             }
+            
+            load.Add( thread, ThreadLoad::Now() - start, work );
         }
         
         ptoc("TPEnergyBarnesHut0::DEnergy");
@@ -445,17 +547,27 @@ namespace rsurfaces
         
         mreal value = 0.;
         
-        if( use_int )
+        CheckBlockClusterTree();
+        if( bct )
+        {
+            // evaluate on the block partition that is shared with the metric
+            TPEnergyMultipole0 multipole( mesh, geom, bct.get(), alpha, beta, weight );
+            multipole.use_int = use_int;
+            value = multipole.Value();
+        }
+        else if( use_int )
         {
             mint int_alpha = std::round(alpha);
             mint int_betahalf = std::round(beta/2);
             value = weight * Energy( int_alpha, int_betahalf );
+            value = MPIContext::AllreduceSum( value );
         }
         else
         {
             mreal real_alpha = alpha;
             mreal real_betahalf = beta/2;
             value = weight * Energy( real_alpha, real_betahalf );
+            value = MPIContext::AllreduceSum( value );
         }
         ptoc("TPEnergyBarnesHut0::Value");
         
@@ -465,6 +577,18 @@ namespace rsurfaces
     void TPEnergyBarnesHut0::Differential( Eigen::MatrixXd &output )
     {
         ptic("TPEnergyBarnesHut0::Differential");
+        
+        CheckBlockClusterTree();
+        if( bct )
+        {
+            // evaluate on the block partition that is shared with the metric
+            TPEnergyMultipole0 multipole( mesh, geom, bct.get(), alpha, beta, weight );
+            multipole.use_int = use_int;
+            multipole.Differential( output );
+            ptoc("TPEnergyBarnesHut0::Differential");
+            return;
+        }
+        
         if( bvh->near_dim != 7)
         {
             eprint("in TPEnergyBarnesHut0::Differential: near_dim != 7");
@@ -491,6 +615,8 @@ namespace rsurfaces
         }
 
         bvh->CollectDerivatives( P_D_near.data(), P_D_far.data() );
+        MPIContext::AllreduceSum( P_D_near.data(), P_D_near.size() );
+        MPIContext::AllreduceSum( P_D_far.data(), P_D_far.size() );
 
         AssembleDerivativeFromACNData( mesh, geom, P_D_near, output, weight );
 
@@ -511,6 +637,8 @@ namespace rsurfaces
     void TPEnergyBarnesHut0::Update()
     {
         ptic("TPEnergyBarnesHut0::Update");
+        // A block cluster tree from the previous step refers to the old BVH.
+        bct = nullptr;
         if (bvh)
         {
             delete bvh;
@@ -541,5 +669,58 @@ namespace rsurfaces
         return theta;
     }
 
+    SurfaceEnergy *TPEnergyBarnesHut0::CopyFor(GeomPtr geom_)
+    {
+        // builds its own BVH on geom_
+        TPEnergyBarnesHut0 *copy = new TPEnergyBarnesHut0(mesh, geom_, alpha, beta, theta, weight);
+        // same power evaluation as this energy, so that the values are comparable
+        copy->use_int = use_int;
+        return copy;
+    }
+    
+    SurfaceEnergy *TPEnergyBarnesHut0::CoarseCopyFor(GeomPtr geom_, double theta_)
+    {
+        // never more accurate than this energy itself
+        TPEnergyBarnesHut0 *copy = new TPEnergyBarnesHut0(mesh, geom_, alpha, beta, std::max(theta, mreal(theta_)), weight);
+        copy->use_int = use_int;
+        return copy;
+    }
+    
+    void TPEnergyBarnesHut0::SetBlockClusterTree(BCTPtr bct_)
+    {
+        bct = nullptr;
+        if( !bct_ )
+        {
+            return;
+        }
+        if( bct_->S != bvh || bct_->T != bvh )
+        {
+            wprint("TPEnergyBarnesHut0::SetBlockClusterTree: Block cluster tree was not built on the current BVH. Falling back to Barnes-Hut traversal.");
+            return;
+        }
+        if( std::abs( std::sqrt(bct_->theta2) - theta ) > 1e-12 * theta )
+        {
+            // The partition would not match the accuracy this energy was configured with.
+            wprint("TPEnergyBarnesHut0::SetBlockClusterTree: Block cluster tree uses a different theta. Falling back to Barnes-Hut traversal.");
+            return;
+        }
+        if( bvh->near_dim != 7 || bvh->far_dim != 10 )
+        {
+            // TPEnergyMultipole0 needs normals on primitives and projectors on clusters.
+            return;
+        }
+        bct = bct_;
+        bct_version = GeometryCache::Version(geom);
+    }
+    
+    void TPEnergyBarnesHut0::CheckBlockClusterTree()
+    {
+        // e.g. line search probes, which only refit the BVH
+        if( bct && GeometryCache::Version(geom) != bct_version )
+        {
+            bct = nullptr;
+        }
+    }
+
 
 } // namespace rsurfaces
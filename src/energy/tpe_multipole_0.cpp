@@ -592,7 +592,7 @@ namespace rsurfaces
         
         ptoc("TPEnergyMultipole0::Value");
         
-        return weight * value;
+        return bct->SumOverRanks( weight * value );
     } // Value
 
     // Returns the current differential of the energy, stored in the given
@@ -650,6 +650,8 @@ namespace rsurfaces
         EigenMatrixRM P_D_far ( bct->S->primitive_count, bct->S->far_dim );
         
         bct->S->CollectDerivatives( P_D_near.data(), P_D_far.data() );
+        bct->SumOverRanks( P_D_near.data(), P_D_near.size() );
+        bct->SumOverRanks( P_D_far.data(), P_D_far.size() );
                 
         AssembleDerivativeFromACNData( mesh, geom, P_D_near, output, weight );
         AssembleDerivativeFromACPData( mesh, geom, P_D_far, output, weight );
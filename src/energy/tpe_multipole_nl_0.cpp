@@ -534,13 +534,13 @@ namespace rsurfaces
         {
             mint int_alpha = std::round(alpha);
             mint int_betahalf = std::round(beta/2);
-            return weight * (FarField( int_alpha, int_betahalf ) + NearField (int_alpha, int_betahalf ));
+            return bct->SumOverRanks( weight * (FarField( int_alpha, int_betahalf ) + NearField (int_alpha, int_betahalf )) );
         }
         else
         {
             mreal real_alpha = alpha;
             mreal real_betahalf = beta/2;
-            return weight * (FarField( real_alpha, real_betahalf ) + NearField( real_alpha, real_betahalf ));
+            return bct->SumOverRanks( weight * (FarField( real_alpha, real_betahalf ) + NearField( real_alpha, real_betahalf )) );
         }
     } // Value
 
@@ -581,6 +581,8 @@ namespace rsurfaces
         }
         
         bct->S->CollectDerivatives( P_D_near.data(), P_D_far.data() );
+        bct->SumOverRanks( P_D_near.data(), P_D_near.size() );
+        bct->SumOverRanks( P_D_far.data(), P_D_far.size() );
                 
         AssembleDerivativeFromACNData( mesh, geom, P_D_near, output, weight );
         AssembleDerivativeFromACNData( mesh, geom, P_D_far, output, weight );
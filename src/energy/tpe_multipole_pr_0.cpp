@@ -599,13 +599,13 @@ namespace rsurfaces
         {
             mint int_alphahalf = std::round(alpha/2);
             mint int_betahalf = std::round(beta/2);
-            return weight * (FarField( int_alphahalf, int_betahalf ) + NearField (int_alphahalf, int_betahalf ));
+            return bct->SumOverRanks( weight * (FarField( int_alphahalf, int_betahalf ) + NearField (int_alphahalf, int_betahalf )) );
         }
         else
         {
             mreal real_alphahalf = alpha/2;
             mreal real_betahalf = beta/2;
-            return weight * (FarField( real_alphahalf, real_betahalf ) + NearField( real_alphahalf, real_betahalf ));
+            return bct->SumOverRanks( weight * (FarField( real_alphahalf, real_betahalf ) + NearField( real_alphahalf, real_betahalf )) );
         }
     } // Value
 
@@ -654,6 +654,8 @@ namespace rsurfaces
         }
         
         bct->S->CollectDerivatives( P_D_near.data(), P_D_far.data() );
+        bct->SumOverRanks( P_D_near.data(), P_D_near.size() );
+        bct->SumOverRanks( P_D_far.data(), P_D_far.size() );
                 
         AssembleDerivativeFromACPData( mesh, geom, P_D_near, output, weight );
         AssembleDerivativeFromACPData( mesh, geom, P_D_far, output, weight );
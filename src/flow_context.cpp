@@ -0,0 +1,95 @@
+#include "flow_context.h"
+
+#include <atomic>
+
+namespace rsurfaces
+{
+    static std::atomic<int> flow_id_counter{0};
+
+    FlowContext::FlowContext(mint thread_count_, mint first_core_)
+    {
+        // Copies of the defaults of the creating thread, e.g. including the command line choices of main.
+        bvh_settings = BVHDefaultSettings;
+        bct_settings = BCTDefaultSettings;
+        thread_count = (thread_count_ > 0) ? thread_count_ : static_cast<mint>(omp_get_max_threads());
+        first_core = first_core_;
+        id = ++flow_id_counter;
+    } // Constructor
+
+    std::vector<FlowContext> FlowContext::Partition(mint flow_count, mint total_threads, bool pin)
+    {
+        flow_count = std::max(static_cast<mint>(1), flow_count);
+        if (total_threads <= 0)
+        {
+            total_threads = omp_get_num_procs();
+        }
+        // At least one thread per flow; with more flows than cores, they have to share.
+        bool share = (flow_count > total_threads);
+
+        std::vector<FlowContext> contexts;
+        contexts.reserve(flow_count);
+        mint begin = 0;
+        for (mint k = 0; k < flow_count; ++k)
+        {
+            mint end = (total_threads * (k + 1)) / flow_count;
+            mint count = std::max(static_cast<mint>(1), end - begin);
+            contexts.emplace_back(count, (pin && !share) ? begin : -1);
+            begin = end;
+        }
+        return contexts;
+    } // Partition
+
+    FlowContext::Scope::Scope(FlowContext &context_) : context(context_)
+    {
+        previous_bvh_settings = BVHDefaultSettings;
+        previous_bct_settings = BCTDefaultSettings;
+        BVHDefaultSettings = context.bvh_settings;
+        BCTDefaultSettings = context.bct_settings;
+
+        // Both are per-thread settings, so other flows are not affected.
+        previous_omp_threads = omp_get_max_threads();
+        omp_set_num_threads(static_cast<int>(context.thread_count));
+        previous_mkl_threads = mkl_set_num_threads_local(static_cast<int>(context.thread_count));
+
+        previous_flow_id = Profiler::flow_id;
+        Profiler::flow_id = context.id;
+
+#ifdef __linux__
+        // OpenMP threads created by this thread afterwards inherit the mask.
+        if (context.first_core >= 0 && sched_getaffinity(0, sizeof(cpu_set_t), &previous_affinity) == 0)
+        {
+            cpu_set_t mask;
+            CPU_ZERO(&mask);
+            for (mint core = context.first_core; core < context.first_core + context.thread_count && core < CPU_SETSIZE; ++core)
+            {
+                CPU_SET(core, &mask);
+            }
+            pinned = (sched_setaffinity(0, sizeof(cpu_set_t), &mask) == 0);
+            if (!pinned)
+            {
+                wprint("FlowContext: could not pin flow " + std::to_string(context.id) + " to its cores.");
+            }
+        }
+#endif
+    } // Scope
+
+    FlowContext::Scope::~Scope()
+    {
+#ifdef __linux__
+        if (pinned)
+        {
+            sched_setaffinity(0, sizeof(cpu_set_t), &previous_affinity);
+        }
+#endif
+        Profiler::flow_id = previous_flow_id;
+
+        mkl_set_num_threads_local(previous_mkl_threads);
+        omp_set_num_threads(previous_omp_threads);
+
+        context.bvh_settings = BVHDefaultSettings;
+        context.bct_settings = BCTDefaultSettings;
+        BVHDefaultSettings = previous_bvh_settings;
+        BCTDefaultSettings = previous_bct_settings;
+    } // ~Scope
+
+} // namespace rsurfaces
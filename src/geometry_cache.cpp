@@ -0,0 +1,171 @@
+#include "geometry_cache.h"
+
+namespace rsurfaces
+{
+    std::mutex GeometryCache::registry_mutex;
+    std::unordered_map<const surface::VertexPositionGeometry *, std::shared_ptr<GeometryCache::Entry>> GeometryCache::registry;
+
+    std::shared_ptr<GeometryCache::Entry> GeometryCache::Lookup(const GeomPtr & geom)
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+
+        std::shared_ptr<Entry> & entry = registry[geom.get()];
+        if( !entry )
+        {
+            entry = std::make_shared<Entry>();
+        }
+
+        // The address might have been reused by a new geometry after the old one died.
+        if( entry->owner.lock() != geom )
+        {
+            entry->owner = geom;
+            entry->version++;
+        }
+        return entry;
+    } // Lookup
+
+    const GeometryCache & GeometryCache::Get(const GeomPtr & geom)
+    {
+        std::shared_ptr<Entry> entry = Lookup(geom);
+
+        std::lock_guard<std::mutex> lock(entry->mutex);
+
+        if( !entry->data )
+        {
+            entry->data = std::unique_ptr<GeometryCache>(new GeometryCache());
+        }
+
+        GeometryCache & C = *entry->data;
+
+        unsigned long long version = entry->version;
+        if( entry->computed_version != version
+           || C.vertex_count != static_cast<mint>(geom->mesh.nVertices())
+           || C.face_count   != static_cast<mint>(geom->mesh.nFaces())
+        )
+        {
+            C.Compute(*geom);
+            entry->computed_version = version;
+        }
+        return C;
+    } // Get
+
+    void GeometryCache::PositionsChanged(const GeomPtr & geom)
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+
+        auto it = registry.find(geom.get());
+        if( it != registry.end() )
+        {
+            it->second->version++;
+        }
+    } // PositionsChanged
+
+    unsigned long long GeometryCache::Version(const GeomPtr & geom)
+    {
+        return Lookup(geom)->version;
+    } // Version
+
+    void GeometryCache::Release(const GeomPtr & geom)
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        registry.erase(geom.get());
+    } // Release
+
+    void GeometryCache::Compute(surface::VertexPositionGeometry & geom)
+    {
+        ptic("GeometryCache::Compute");
+
+        surface::SurfaceMesh & mesh = geom.mesh;
+
+        vertex_count = mesh.nVertices();
+        face_count = mesh.nFaces();
+
+        VertexIndices vInds = mesh.getVertexIndices();
+
+        // Flat copies of the connectivity, so that the passes below can run in parallel.
+        std::vector<GCFace> faces;
+        faces.reserve(face_count);
+        for (GCFace f : mesh.faces())
+        {
+            faces.push_back(f);
+        }
+        std::vector<GCVertex> vertices;
+        vertices.reserve(vertex_count);
+        for (GCVertex v : mesh.vertices())
+        {
+            vertices.push_back(v);
+        }
+
+        faceVertices = A_Vector<mint>(3 * face_count);
+        faceAreas = A_Vector<mreal>(face_count);
+        faceNormals = A_Vector<mreal>(3 * face_count);
+        faceBarycenters = A_Vector<mreal>(3 * face_count);
+        vertexNormals = A_Vector<mreal>(3 * vertex_count);
+
+        mreal athird = 1. / 3.;
+        mreal area = 0.;
+        mreal volume = 0.;
+
+        #pragma omp parallel for reduction( + : area, volume )
+        for( mint i = 0; i < face_count; ++i )
+        {
+            GCHalfedge he = faces[i].halfedge();
+
+            faceVertices[3 * i + 0] = vInds[he.vertex()];
+            faceVertices[3 * i + 1] = vInds[he.next().vertex()];
+            faceVertices[3 * i + 2] = vInds[he.next().next().vertex()];
+
+            Vector3 p1 = geom.inputVertexPositions[he.vertex()];
+            Vector3 p2 = geom.inputVertexPositions[he.next().vertex()];
+            Vector3 p3 = geom.inputVertexPositions[he.next().next().vertex()];
+
+            Vector3 N = cross(p2 - p1, p3 - p1);
+            mreal twice_area = norm(N);
+            mreal scale = twice_area > 0. ? 1. / twice_area : 0.;
+
+            faceAreas[i] = 0.5 * twice_area;
+
+            faceNormals[3 * i + 0] = scale * N.x;
+            faceNormals[3 * i + 1] = scale * N.y;
+            faceNormals[3 * i + 2] = scale * N.z;
+
+            faceBarycenters[3 * i + 0] = athird * (p1.x + p2.x + p3.x);
+            faceBarycenters[3 * i + 1] = athird * (p1.y + p2.y + p3.y);
+            faceBarycenters[3 * i + 2] = athird * (p1.z + p2.z + p3.z);
+
+            area += 0.5 * twice_area;
+            volume += dot(cross(p1, p2), p3) / 6.;
+        }
+
+        totalArea = area;
+        totalVolume = volume;
+
+        FaceIndices fInds = mesh.getFaceIndices();
+
+        #pragma omp parallel for
+        for( mint j = 0; j < vertex_count; ++j )
+        {
+            mreal n1 = 0.;
+            mreal n2 = 0.;
+            mreal n3 = 0.;
+            for (GCFace f : vertices[j].adjacentFaces())
+            {
+                if (f.isBoundaryLoop())
+                {
+                    continue;
+                }
+                mint i = fInds[f];
+                n1 += faceAreas[i] * faceNormals[3 * i + 0];
+                n2 += faceAreas[i] * faceNormals[3 * i + 1];
+                n3 += faceAreas[i] * faceNormals[3 * i + 2];
+            }
+            mint k = vInds[vertices[j]];
+            vertexNormals[3 * k + 0] = n1;
+            vertexNormals[3 * k + 1] = n2;
+            vertexNormals[3 * k + 2] = n3;
+        }
+
+        ptoc("GeometryCache::Compute");
+    } // Compute
+
+} // namespace rsurfaces
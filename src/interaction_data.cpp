@@ -1,4 +1,5 @@
 #include "interaction_data.h"
+#include "thread_load.h"
 
 namespace rsurfaces
 {
@@ -7,6 +8,7 @@ namespace rsurfaces
     InteractionData::InteractionData( A_Vector<A_Deque<mint>> & idx, A_Vector<A_Deque<mint>> & jdx, const mint m_, const mint n_, bool upper_triangular_ )
     {
         ptic("InteractionData::InteractionData");
+        MemoryOwner memory_owner("InteractionData");
         thread_count = std::min( idx.size(), jdx.size());
         upper_triangular = upper_triangular_;
         b_m = m = m_;
@@ -101,10 +103,46 @@ namespace rsurfaces
     }; // InteractionData Constructor
 
 
+    void InteractionData::RestrictBlockRows( const mint * keep )
+    {
+        ptic("InteractionData::RestrictBlockRows");
+        MemoryOwner memory_owner("InteractionData");
+        
+        mint * new_outer = nullptr;
+        safe_alloc( new_outer, 1 + b_m );
+        new_outer[0] = 0;
+        for( mint b_i = 0; b_i < b_m; ++b_i )
+        {
+            new_outer[b_i+1] = new_outer[b_i] + ( keep[b_i] ? b_outer[b_i+1] - b_outer[b_i] : 0 );
+        }
+        
+        mint new_nnz = new_outer[b_m];
+        mint * new_inner = nullptr;
+        safe_alloc( new_inner, new_nnz );
+        
+        #pragma omp parallel for num_threads(thread_count) RAGGED_SCHEDULE
+        for( mint b_i = 0; b_i < b_m; ++b_i )
+        {
+            if( keep[b_i] )
+            {
+                std::copy( b_inner + b_outer[b_i], b_inner + b_outer[b_i+1], new_inner + new_outer[b_i] );
+            }
+        }
+        
+        safe_free( b_outer );
+        safe_free( b_inner );
+        b_outer = new_outer;
+        b_inner = new_inner;
+        b_nnz = nnz = new_nnz;
+        
+        ptoc("InteractionData::RestrictBlockRows");
+    } // RestrictBlockRows
+
     // Allocate nonzero values for CSR matrices
     void InteractionData::Prepare_CSR()
     {
         ptic("InteractionData::Prepare_CSR");
+        MemoryOwner memory_owner("InteractionData");
         
         #pragma omp parallel
         {
@@ -138,6 +176,7 @@ namespace rsurfaces
     void InteractionData::Prepare_CSR( mint b_m_, mint * b_row_ptr_, mint b_n_, mint * b_col_ptr_ )
     {
         ptic("InteractionData::Prepare_CSR( mint b_m_, mint * b_row_ptr_, mint b_n_, mint * b_col_ptr_ )");
+        MemoryOwner memory_owner("InteractionData");
         b_m = b_m_;
         b_n = b_n_;
         
@@ -319,6 +358,7 @@ namespace rsurfaces
     void InteractionData::Prepare_VBSR( mint b_m_, mint * b_row_ptr_, mint b_n_, mint * b_col_ptr_ )
     {
         ptic("InteractionData::Prepare_VBSR( mint b_m_, mint * b_row_ptr_, mint b_n_, mint * b_col_ptr_ )");
+        MemoryOwner memory_owner("InteractionData");
         b_m = b_m_;
         b_n = b_n_;
         
@@ -660,6 +700,20 @@ namespace rsurfaces
         
         if( nnz > 0 && factor != 0. )
         {
+            ThreadLoad load ("InteractionData::ApplyKernel_Hybrid", thread_count);
+            bool measure = rebalance_by_measured_costs;
+            A_Vector<mreal> row_costs ( measure ? b_m : 0 );
+            // The split is copied, so that a concurrent product may replace hybrid_job_ptr meanwhile.
+            A_Vector<mint> split ( job_ptr, job_ptr + thread_count + 1 );
+            if( measure )
+            {
+                std::lock_guard<std::mutex> lock( hybrid_mutex );
+                if( hybrid_job_ptr.size() == static_cast<size_t>(thread_count + 1) && hybrid_job_ptr.back() == b_m )
+                {
+                    split = hybrid_job_ptr;
+                }
+            }
+            A_Vector<ThreadLoad::Slot> thread_busy ( thread_count );
             
             auto thread_input_buffers = A_Vector<A_Vector<mreal>> (thread_count);
 
@@ -674,11 +728,15 @@ namespace rsurfaces
                 mint thread = omp_get_thread_num();
                 mreal * v = &thread_input_buffers[thread][0];
                 
-                mint b_i_begin = job_ptr[ thread ];
-                mint b_i_end   = job_ptr[ thread + 1 ];
+                mint b_i_begin = split[ thread ];
+                mint b_i_end   = split[ thread + 1 ];
+                
+                mreal thread_start = omp_get_wtime();
                 
                 for( mint b_i = b_i_begin; b_i < b_i_end; ++ b_i)
                 {
+                    mreal row_start = measure ? omp_get_wtime() : 0.;
+                    
                     mint i_begin = b_row_ptr[ b_i ];
                     mint i_end   = b_row_ptr[ b_i + 1 ];
                     
@@ -709,7 +767,41 @@ namespace rsurfaces
                     mint mi = i_end - i_begin;
                     mreal * ui = S_output + cols * i_begin;
                     mint row_nnz = b_row_counters[b_i];
-                    cblas_dgemm( CblasRowMajor, CblasNoTrans, CblasNoTrans, mi, cols, row_nnz, factor, values + outer[i_begin], row_nnz, v, cols, 0., ui, cols );
+                    // Rows without blocks (e.g. those owned by other MPI ranks) are already zero; dgemm would reject lda = 0.
+                    if( row_nnz > 0 )
+                    {
+                        cblas_dgemm( CblasRowMajor, CblasNoTrans, CblasNoTrans, mi, cols, row_nnz, factor, values + outer[i_begin], row_nnz, v, cols, 0., ui, cols );
+                    }
+                    
+                    if( measure )
+                    {
+                        row_costs[b_i] = omp_get_wtime() - row_start;
+                    }
+                }
+                
+                thread_busy[thread].busy = omp_get_wtime() - thread_start;
+                thread_busy[thread].work = outer[ b_row_ptr[b_i_end] ] - outer[ b_row_ptr[b_i_begin] ];
+                load.Add( thread, thread_busy[thread].busy, thread_busy[thread].work );
+            }
+            
+            if( measure )
+            {
+                mreal busy_max = 0.;
+                mreal busy_sum = 0.;
+                for( mint thread = 0; thread < thread_count; ++thread )
+                {
+                    busy_max = std::max( busy_max, thread_busy[thread].busy );
+                    busy_sum += thread_busy[thread].busy;
+                }
+                if( busy_sum > 0. && busy_max * thread_count > rebalance_threshold * busy_sum )
+                {
+                    mint * balanced = nullptr;
+                    BalanceWorkLoad( b_m, &row_costs[0], thread_count, balanced );
+                    {
+                        std::lock_guard<std::mutex> lock( hybrid_mutex );
+                        hybrid_job_ptr.assign( balanced, balanced + thread_count + 1 );
+                    }
+                    safe_free( balanced );
                 }
             }
         }
@@ -0,0 +1,400 @@
+#include "intersection_validator.h"
+#include "bct_constructors.h"
+#include "geometry_cache.h"
+#include "task_scheduler.h"
+
+#include <atomic>
+
+namespace rsurfaces
+{
+    namespace
+    {
+        inline mreal clamp01(mreal x)
+        {
+            return std::min(static_cast<mreal>(1.), std::max(static_cast<mreal>(0.), x));
+        }
+
+        // Does the segment pq cross the triangle abc? (Moeller-Trumbore, restricted to the segment)
+        inline bool segmentCrossesTriangle(const Vector3 &p, const Vector3 &q, const Vector3 &a, const Vector3 &b, const Vector3 &c)
+        {
+            Vector3 d = q - p;
+            Vector3 e1 = b - a;
+            Vector3 e2 = c - a;
+            Vector3 h = cross(d, e2);
+            mreal det = dot(e1, h);
+            // segment parallel to the triangle's plane; coplanar overlaps are not detected
+            if (std::abs(det) <= 1e-14 * norm(d) * norm(e1) * norm(e2))
+            {
+                return false;
+            }
+            mreal inv = 1. / det;
+            Vector3 s = p - a;
+            mreal u = inv * dot(s, h);
+            if (u < 0. || u > 1.)
+            {
+                return false;
+            }
+            Vector3 r = cross(s, e1);
+            mreal v = inv * dot(d, r);
+            if (v < 0. || u + v > 1.)
+            {
+                return false;
+            }
+            mreal t = inv * dot(e2, r);
+            return (t >= 0. && t <= 1.);
+        }
+
+        // squared distance from p to the triangle abc (Ericson, Real-Time Collision Detection, 5.1.5)
+        inline mreal pointTriangleDistance2(const Vector3 &p, const Vector3 &a, const Vector3 &b, const Vector3 &c)
+        {
+            Vector3 ab = b - a, ac = c - a, ap = p - a;
+            mreal d1 = dot(ab, ap), d2 = dot(ac, ap);
+            if (d1 <= 0. && d2 <= 0.)
+                return norm2(p - a);
+
+            Vector3 bp = p - b;
+            mreal d3 = dot(ab, bp), d4 = dot(ac, bp);
+            if (d3 >= 0. && d4 <= d3)
+                return norm2(p - b);
+
+            mreal vc = d1 * d4 - d3 * d2;
+            if (vc <= 0. && d1 >= 0. && d3 <= 0.)
+                return norm2(p - (a + (d1 / (d1 - d3)) * ab));
+
+            Vector3 cp = p - c;
+            mreal d5 = dot(ab, cp), d6 = dot(ac, cp);
+            if (d6 >= 0. && d5 <= d6)
+                return norm2(p - c);
+
+            mreal vb = d5 * d2 - d1 * d6;
+            if (vb <= 0. && d2 >= 0. && d6 <= 0.)
+                return norm2(p - (a + (d2 / (d2 - d6)) * ac));
+
+            mreal va = d3 * d6 - d5 * d4;
+            if (va <= 0. && (d4 - d3) >= 0. && (d5 - d6) >= 0.)
+                return norm2(p - (b + ((d4 - d3) / ((d4 - d3) + (d5 - d6))) * (c - b)));
+
+            mreal denom = 1. / (va + vb + vc);
+            return norm2(p - (a + (vb * denom) * ab + (vc * denom) * ac));
+        }
+
+        // squared distance between the segments p1q1 and p2q2 (Ericson, 5.1.9)
+        inline mreal segmentSegmentDistance2(const Vector3 &p1, const Vector3 &q1, const Vector3 &p2, const Vector3 &q2)
+        {
+            Vector3 d1 = q1 - p1, d2 = q2 - p2, r = p1 - p2;
+            mreal a = dot(d1, d1), e = dot(d2, d2), f = dot(d2, r);
+            mreal s, t;
+            if (a <= 1e-300 && e <= 1e-300)
+                return norm2(r);
+            if (a <= 1e-300)
+            {
+                s = 0.;
+                t = clamp01(f / e);
+            }
+            else
+            {
+                mreal c = dot(d1, r);
+                if (e <= 1e-300)
+                {
+                    t = 0.;
+                    s = clamp01(-c / a);
+                }
+                else
+                {
+                    mreal b = dot(d1, d2);
+                    mreal denom = a * e - b * b;
+                    s = (denom != 0.) ? clamp01((b * f - c * e) / denom) : 0.;
+                    t = (b * s + f) / e;
+                    if (t < 0.)
+                    {
+                        t = 0.;
+                        s = clamp01(-c / a);
+                    }
+                    else if (t > 1.)
+                    {
+                        t = 1.;
+                        s = clamp01((b - c) / a);
+                    }
+                }
+            }
+            return norm2((p1 + s * d1) - (p2 + t * d2));
+        }
+
+        struct Traversal
+        {
+            const OptimizedClusterTree *T;
+            const mint *faceVertices;
+            const std::vector<Vector3> *positions;
+            std::atomic<mreal> best2; // squared smallest separation found so far (or squared cutoff)
+
+            // per thread slot of the arena
+            std::vector<std::vector<std::pair<mint, mint>>> pairs;
+            std::vector<mreal> closest2;
+            std::vector<std::pair<mint, mint>> closest;
+            std::vector<long long> tested;
+
+            inline mreal BoxDistance2(const mreal *const *min1, const mreal *const *max1, mint i,
+                                      const mreal *const *min2, const mreal *const *max2, mint j) const
+            {
+                mreal d2 = 0.;
+                for (mint k = 0; k < 3; ++k)
+                {
+                    mreal gap = std::max(static_cast<mreal>(0.), std::max(min1[k][i] - max2[k][j], min2[k][j] - max1[k][i]));
+                    d2 += gap * gap;
+                }
+                return d2;
+            }
+
+            inline void LowerBest(mreal d2)
+            {
+                mreal current = best2.load();
+                while (d2 < current && !best2.compare_exchange_weak(current, d2))
+                {
+                }
+            }
+
+            void TestPrimitives(mint i, mint j)
+            {
+                const mreal *const *P_min = T->P_min.data();
+                const mreal *const *P_max = T->P_max.data();
+                if (BoxDistance2(P_min, P_max, i, P_min, P_max, j) > best2.load())
+                {
+                    return;
+                }
+
+                mint f = T->P_ext_pos[i];
+                mint g = T->P_ext_pos[j];
+                const mint *u = faceVertices + 3 * f;
+                const mint *v = faceVertices + 3 * g;
+                // shared[k] is the corner of g that coincides with corner k of f, or -1
+                mint shared[3] = {-1, -1, -1};
+                mint shared_count = 0;
+                for (mint k = 0; k < 3; ++k)
+                {
+                    for (mint l = 0; l < 3; ++l)
+                    {
+                        if (u[k] == v[l])
+                        {
+                            shared[k] = l;
+                            shared_count++;
+                        }
+                    }
+                }
+
+                const std::vector<Vector3> &x = *positions;
+                const Vector3 a[3] = {x[u[0]], x[u[1]], x[u[2]]};
+                const Vector3 b[3] = {x[v[0]], x[v[1]], x[v[2]]};
+
+                mint thread = TreeTaskScheduler::ThreadIndex();
+                tested[thread]++;
+
+                if (shared_count > 0)
+                {
+                    // Neighbours touch at the common vertex or edge anyway, so they do not count for the separation.
+                    if (AdjacentIntersect(a, b, shared, shared_count))
+                    {
+                        pairs[thread].emplace_back(std::min(f, g), std::max(f, g));
+                    }
+                    return;
+                }
+
+                bool intersecting = false;
+                for (mint k = 0; k < 3 && !intersecting; ++k)
+                {
+                    intersecting = segmentCrossesTriangle(a[k], a[(k + 1) % 3], b[0], b[1], b[2]) ||
+                                   segmentCrossesTriangle(b[k], b[(k + 1) % 3], a[0], a[1], a[2]);
+                }
+
+                mreal d2 = 0.;
+                if (intersecting)
+                {
+                    pairs[thread].emplace_back(std::min(f, g), std::max(f, g));
+                }
+                else
+                {
+                    // Without an intersection, the distance is attained at a vertex or between two edges.
+                    d2 = std::numeric_limits<mreal>::infinity();
+                    for (mint k = 0; k < 3; ++k)
+                    {
+                        d2 = std::min(d2, pointTriangleDistance2(a[k], b[0], b[1], b[2]));
+                        d2 = std::min(d2, pointTriangleDistance2(b[k], a[0], a[1], a[2]));
+                        for (mint l = 0; l < 3; ++l)
+                        {
+                            d2 = std::min(d2, segmentSegmentDistance2(a[k], a[(k + 1) % 3], b[l], b[(l + 1) % 3]));
+                        }
+                    }
+                }
+
+                if (d2 < closest2[thread])
+                {
+                    closest2[thread] = d2;
+                    closest[thread] = std::make_pair(std::min(f, g), std::max(f, g));
+                }
+                LowerBest(d2);
+            }
+
+            // Faces a and b share shared_count corners (shared as in TestPrimitives).
+            static bool AdjacentIntersect(const Vector3 *a, const Vector3 *b, const mint *shared, mint shared_count)
+            {
+                if (shared_count == 1)
+                {
+                    // The intersection of the two triangles is a segment starting at the common vertex; unless it is just
+                    // that vertex, it leaves one of the triangles through the edge opposite to the common vertex.
+                    mint k = (shared[0] >= 0) ? 0 : (shared[1] >= 0) ? 1 : 2;
+                    mint l = shared[k];
+                    return segmentCrossesTriangle(a[(k + 1) % 3], a[(k + 2) % 3], b[0], b[1], b[2]) ||
+                           segmentCrossesTriangle(b[(l + 1) % 3], b[(l + 2) % 3], a[0], a[1], a[2]);
+                }
+                if (shared_count == 2)
+                {
+                    // Two faces with a common edge only overlap if they are folded onto each other: the opposite
+                    // vertices lie in one plane with the edge and on the same side of it.
+                    mint k = (shared[0] < 0) ? 0 : (shared[1] < 0) ? 1 : 2;
+                    mint l = 3 - shared[(k + 1) % 3] - shared[(k + 2) % 3];
+                    const Vector3 &p = a[(k + 1) % 3];
+                    Vector3 e = a[(k + 2) % 3] - p;
+                    Vector3 na = cross(e, a[k] - p);
+                    Vector3 nb = cross(e, b[l] - p);
+                    return dot(na, nb) > 0. && norm(cross(na, nb)) <= 1e-8 * norm(na) * norm(nb);
+                }
+                // the same face twice
+                return false;
+            }
+
+            void Visit(mint C1, mint C2)
+            {
+                const mreal *const *C_min = T->C_min.data();
+                const mreal *const *C_max = T->C_max.data();
+                if (C1 != C2 && BoxDistance2(C_min, C_max, C1, C_min, C_max, C2) > best2.load())
+                {
+                    return;
+                }
+
+                mint L1 = T->C_left[C1], R1 = T->C_right[C1];
+                mint L2 = T->C_left[C2], R2 = T->C_right[C2];
+                bool leaf1 = (L1 < 0 || R1 < 0);
+                bool leaf2 = (L2 < 0 || R2 < 0);
+                mint n1 = T->C_end[C1] - T->C_begin[C1];
+                mint n2 = T->C_end[C2] - T->C_begin[C2];
+                bool spawn = (C1 == C2 ? n1 : n1 + n2) > T->build_grain;
+
+                if (C1 == C2)
+                {
+                    if (leaf1)
+                    {
+                        for (mint i = T->C_begin[C1]; i < T->C_end[C1]; ++i)
+                        {
+                            for (mint j = i + 1; j < T->C_end[C1]; ++j)
+                            {
+                                TestPrimitives(i, j);
+                            }
+                        }
+                    }
+                    else
+                    {
+                        TreeTaskScheduler::ForkJoin(spawn,
+                            [=] { Visit(L1, L1); },
+                            [=] { Visit(R1, R1); },
+                            [=] { Visit(L1, R1); });
+                    }
+                }
+                else if (leaf1 && leaf2)
+                {
+                    for (mint i = T->C_begin[C1]; i < T->C_end[C1]; ++i)
+                    {
+                        for (mint j = T->C_begin[C2]; j < T->C_end[C2]; ++j)
+                        {
+                            TestPrimitives(i, j);
+                        }
+                    }
+                }
+                else if (leaf2 || (!leaf1 && n1 >= n2))
+                {
+                    TreeTaskScheduler::ForkJoin(spawn,
+                        [=] { Visit(L1, C2); },
+                        [=] { Visit(R1, C2); });
+                }
+                else
+                {
+                    TreeTaskScheduler::ForkJoin(spawn,
+                        [=] { Visit(C1, L2); },
+                        [=] { Visit(C1, R2); });
+                }
+            }
+        }; // Traversal
+    } // namespace
+
+    IntersectionValidator::IntersectionValidator(mreal cutoff_)
+    {
+        cutoff = cutoff_;
+    }
+
+    IntersectionValidator::~IntersectionValidator()
+    {
+        delete bvh;
+    }
+
+    IntersectionReport IntersectionValidator::Check(MeshPtr &mesh, GeomPtr &geom)
+    {
+        ptic("IntersectionValidator::Check");
+
+        if (bvh && bvh->primitive_count == static_cast<mint>(mesh->nFaces()))
+        {
+            RefitOptimizedBVH(bvh, mesh, geom);
+        }
+        else
+        {
+            delete bvh;
+            bvh = CreateOptimizedBVH(mesh, geom);
+        }
+
+        const GeometryCache &G = GeometryCache::Get(geom);
+
+        std::vector<Vector3> positions(mesh->nVertices());
+        #pragma omp parallel for
+        for (mint i = 0; i < static_cast<mint>(positions.size()); ++i)
+        {
+            positions[i] = geom->inputVertexPositions[i];
+        }
+
+        Traversal traversal;
+        traversal.T = bvh;
+        traversal.faceVertices = G.faceVertices.data();
+        traversal.positions = &positions;
+        traversal.best2 = (cutoff < std::numeric_limits<mreal>::infinity()) ? cutoff * cutoff : std::numeric_limits<mreal>::infinity();
+
+        mint thread_count = bvh->tree_thread_count;
+        traversal.pairs.resize(thread_count);
+        traversal.closest2.assign(thread_count, std::numeric_limits<mreal>::infinity());
+        traversal.closest.assign(thread_count, std::make_pair(mint(-1), mint(-1)));
+        traversal.tested.assign(thread_count, 0);
+
+        TreeTaskScheduler::Run(thread_count, [&] { traversal.Visit(0, 0); });
+
+        IntersectionReport report;
+        mreal closest2 = std::numeric_limits<mreal>::infinity();
+        for (mint thread = 0; thread < thread_count; ++thread)
+        {
+            report.intersecting_pairs.insert(report.intersecting_pairs.end(), traversal.pairs[thread].begin(), traversal.pairs[thread].end());
+            report.tested_pairs += traversal.tested[thread];
+            if (traversal.closest2[thread] < closest2)
+            {
+                closest2 = traversal.closest2[thread];
+                report.closest_pair = traversal.closest[thread];
+            }
+        }
+        std::sort(report.intersecting_pairs.begin(), report.intersecting_pairs.end());
+        if (closest2 <= cutoff * cutoff)
+        {
+            report.min_separation = std::sqrt(closest2);
+        }
+        else
+        {
+            report.closest_pair = std::make_pair(mint(-1), mint(-1));
+        }
+
+        ptoc("IntersectionValidator::Check");
+        return report;
+    } // Check
+
+} // namespace rsurfaces
@@ -2,14 +2,44 @@
 #include "matrix_utils.h"
 #include "spatial/bvh_6d.h"
 #include "bct_constructors.h"
+#include "mpi_context.h"
+#include "flow_context.h"
+
+#include <thread>
 
 namespace rsurfaces
 {
-    LineSearch::LineSearch(MeshPtr mesh_, GeomPtr geom_, std::vector<SurfaceEnergy*> energies_, double maxStep_)
-    : energies(energies_), maxStep(maxStep_)
+    LineSearch::CoarseState::~CoarseState()
+    {
+        Release();
+    }
+
+    void LineSearch::CoarseState::Release()
+    {
+        for (SurfaceEnergy *e : energies)
+        {
+            delete e;
+        }
+        energies.clear();
+        if (geom)
+        {
+            GeometryCache::Release(geom);
+            geom = 0;
+        }
+        backtracked = true;
+    }
+
+    LineSearch::LineSearch(MeshPtr mesh_, GeomPtr geom_, std::vector<SurfaceEnergy*> energies_, double maxStep_, int speculativeProbes_, double coarseTheta_, CoarseState *coarseState_)
+    : energies(energies_), maxStep(maxStep_), speculativeProbes(speculativeProbes_), coarseTheta(coarseTheta_)
     {
         mesh = mesh_;
         geom = geom_;
+        coarse = (coarseState_) ? coarseState_ : &ownCoarse;
+    }
+
+    LineSearch::~LineSearch()
+    {
+        ReleaseProbes();
     }
 
     void LineSearch::SaveCurrentPositions()
@@ -41,6 +71,8 @@ namespace rsurfaces
         }
 
         geom->refreshQuantities();
+        GeometryCache::PositionsChanged(geom);
+        DropBlockClusterTrees();
 
         if (energies[0]->GetBVH())
         {
@@ -50,7 +82,7 @@ namespace rsurfaces
         }
     }
 
-    void LineSearch::SetGradientStep(Eigen::MatrixXd &gradient, double delta)
+    void LineSearch::SetPositions(GeomPtr &target, Eigen::MatrixXd &gradient, double delta)
     {
         surface::VertexData<size_t> indices = mesh->getVertexIndices();
         for (GCVertex v : mesh->vertices())
@@ -60,10 +92,17 @@ namespace rsurfaces
             size_t ind_v = indices[v];
             Vector3 pos_v = GetRow(origPositions, ind_v);
             Vector3 grad_v = GetRow(gradient, ind_v);
-            geom->inputVertexPositions[v] = pos_v + delta * grad_v;
+            target->inputVertexPositions[v] = pos_v + delta * grad_v;
         }
 
-        geom->refreshQuantities();
+        target->refreshQuantities();
+        GeometryCache::PositionsChanged(target);
+    }
+
+    void LineSearch::SetGradientStep(Eigen::MatrixXd &gradient, double delta)
+    {
+        SetPositions(geom, gradient, delta);
+        DropBlockClusterTrees();
 
         if (energies[0]->GetBVH())
         {
@@ -74,12 +113,199 @@ namespace rsurfaces
         }
     }
 
+    void LineSearch::DropBlockClusterTrees()
+    {
+        // A shared block partition was built for the positions at the start of the step; the refit BVH below does not change it.
+        for (SurfaceEnergy *energy : energies)
+        {
+            energy->SetBlockClusterTree(BCTPtr());
+        }
+    }
+
+    void LineSearch::RequireProbes()
+    {
+        if (probes.empty())
+        {
+            probes.resize(speculativeProbes);
+            for (Probe &probe : probes)
+            {
+                probe.geom = geom->copy();
+            }
+        }
+    }
+
+    void LineSearch::ReleaseProbes()
+    {
+        for (Probe &probe : probes)
+        {
+            for (SurfaceEnergy *energy : probe.energies)
+            {
+                delete energy;
+            }
+            GeometryCache::Release(probe.geom);
+        }
+        probes.clear();
+    }
+
+    // Moves each probe k to the step delta / 2^k and evaluates all probes concurrently.
+    // Returns the first (i.e. largest) probe that satisfies the Armijo condition, -1 if there is none,
+    // and -2 if some energy cannot be copied (then the caller has to fall back to sequential probes).
+    int LineSearch::SpeculativeRound(Eigen::MatrixXd &gradient, double delta, bool negativeIsForward, double initialEnergy, double armijoSlope)
+    {
+        ptic("LineSearch::SpeculativeRound");
+        RequireProbes();
+        mint count = probes.size();
+
+        // Geometry-central containers register themselves with the shared mesh, so moving the copies and
+        // rebuilding their trees happens here, one probe after the other (each with all threads).
+        double step = delta;
+        for (Probe &probe : probes)
+        {
+            SetPositions(probe.geom, gradient, (negativeIsForward) ? -step : step);
+            if (probe.energies.empty())
+            {
+                for (SurfaceEnergy *energy : energies)
+                {
+                    SurfaceEnergy *copy = energy->CopyFor(probe.geom);
+                    if (!copy)
+                    {
+                        ReleaseProbes();
+                        ptoc("LineSearch::SpeculativeRound");
+                        return -2;
+                    }
+                    probe.energies.push_back(copy);
+                }
+            }
+            else
+            {
+                for (SurfaceEnergy *energy : probe.energies)
+                {
+                    energy->Update();
+                }
+            }
+            step /= 2;
+        }
+
+        // The evaluations only read the probes' own trees; each one runs in its own share of the threads.
+        std::vector<FlowContext> contexts = FlowContext::Partition(count, omp_get_max_threads(), false);
+        std::vector<std::thread> threads;
+        for (mint k = 0; k < count; ++k)
+        {
+            threads.emplace_back([this, &contexts, k]() {
+                FlowContext::Scope scope(contexts[k]);
+                probes[k].energy = GetEnergyValue(probes[k].energies);
+            });
+        }
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+
+        int accepted = -1;
+        step = delta;
+        for (mint k = 0; k < count && accepted < 0; ++k)
+        {
+            ptcounter("line search step", step);
+            ptcounter("energy", probes[k].energy);
+            if (step > LS_STEP_THRESHOLD && initialEnergy - probes[k].energy >= armijoSlope * step)
+            {
+                accepted = k;
+            }
+            step /= 2;
+        }
+        ptoc("LineSearch::SpeculativeRound");
+        return accepted;
+    }
+
+    // Moves the coarse geometry to the step delta and refits the coarse trees; the hierarchy built in RequireCoarse is kept.
+    void LineSearch::MoveCoarse(Eigen::MatrixXd &gradient, double delta)
+    {
+        SetPositions(coarse->geom, gradient, delta);
+        for (SurfaceEnergy *energy : coarse->energies)
+        {
+            if (energy->GetBVH())
+            {
+                RefitOptimizedBVH(energy->GetBVH(), mesh, coarse->geom);
+            }
+            else
+            {
+                energy->Update();
+            }
+        }
+    }
+
+    // Creates the coarse copies unless the state already holds them and evaluates them at the initial positions.
+    bool LineSearch::RequireCoarse()
+    {
+        if (!coarse->geom)
+        {
+            coarse->geom = geom->copy();
+            for (SurfaceEnergy *energy : energies)
+            {
+                SurfaceEnergy *copy = energy->CoarseCopyFor(coarse->geom, coarseTheta);
+                if (!copy)
+                {
+                    coarse->Release();
+                    return false;
+                }
+                coarse->energies.push_back(copy);
+            }
+        }
+        else
+        {
+            Eigen::MatrixXd noStep;
+            noStep.setZero(mesh->nVertices(), 3);
+            MoveCoarse(noStep, 0.);
+        }
+        coarse->energy = GetEnergyValue(coarse->energies);
+        return true;
+    }
+
+    // Backtracks from delta on the coarse energies and returns the first step they accept (or a step below LS_STEP_THRESHOLD).
+    // The coarse decrease is measured from the coarse value at the initial positions. Since that value differs from the
+    // accurate one by the approximation error, a step is only rejected here if it misses the Armijo condition by more than this error.
+    double LineSearch::CoarseCandidate(Eigen::MatrixXd &gradient, double delta, bool negativeIsForward, double initialEnergy, double armijoSlope, int &numBacktracks)
+    {
+        ptic("LineSearch::CoarseCandidate");
+        double margin = std::abs(coarse->energy - initialEnergy);
+        MPIContext::Broadcast(&margin, 1);
+
+        while (delta > LS_STEP_THRESHOLD)
+        {
+            ptic("LineSearch::CoarseProbe");
+            MoveCoarse(gradient, (negativeIsForward) ? -delta : delta);
+            double nextEnergy = GetEnergyValue(coarse->energies);
+            ptoc("LineSearch::CoarseProbe");
+            ptcounter("coarse line search step", delta);
+            ptcounter("coarse energy", nextEnergy);
+
+            double decrease = coarse->energy - nextEnergy;
+            MPIContext::Broadcast(&decrease, 1);
+            if (decrease + margin >= armijoSlope * delta)
+            {
+                break;
+            }
+            delta /= 2;
+            numBacktracks++;
+        }
+        ptoc("LineSearch::CoarseCandidate");
+        return delta;
+    }
+
     double LineSearch::BacktrackingLineSearch(Eigen::MatrixXd &gradient, double initGuess, double gradDot, bool negativeIsForward)
     {
+        double startTime = omp_get_wtime();
         double delta = initGuess;
         SaveCurrentPositions();
+        
+        // With several MPI ranks, every rank holds the whole mesh and moves it in lockstep: all ranks use the
+        // direction of rank 0, and the energies are summed over the ranks, so every probe sees the same value.
+        MPIContext::Broadcast(gradient.data(), gradient.size());
 
-        // Gather some initial data
+        // Gather some initial data. The probes (and the energies after SetGradientStep) evaluate by Barnes-Hut traversal,
+        // so the baseline must not use the multipole approximation on a shared block cluster tree; otherwise the Armijo test
+        // would compare two different approximations of the energy.
+        DropBlockClusterTrees();
         double initialEnergy = GetEnergyValue(energies);
         double gradNorm = gradient.norm();
         int numBacktracks = 0;
@@ -92,15 +318,67 @@ namespace rsurfaces
             return 0;
         }
 
+        // The probes evaluate concurrently from several threads, which does not mix with the MPI collectives in the energies.
+        bool speculate = (speculativeProbes > 1) && !MPIContext::Active();
+
+        // Multi-fidelity: skip the steps that the coarse energies already reject; the loop below verifies the candidate
+        // at full accuracy and, if the two disagree, keeps backtracking from there. If the previous search took its
+        // first step, this one most likely does too, and a single fine probe is cheaper than the coarse phase.
+        if (coarseTheta > 0 && coarse->backtracked && RequireCoarse())
+        {
+            int coarseBacktracks = 0;
+            delta = CoarseCandidate(gradient, delta, negativeIsForward, initialEnergy, sigma * gradNorm * gradDot, coarseBacktracks);
+            if (delta > LS_STEP_THRESHOLD)
+            {
+                numBacktracks += coarseBacktracks;
+                std::cout << "  * Coarse search (theta = " << coarseTheta << ") proposed step " << delta << " after " << coarseBacktracks << " backtracks" << std::endl;
+            }
+            else
+            {
+                // Nothing passed on the coarse level; do not trust that and search at full accuracy instead.
+                delta = initGuess;
+            }
+        }
+
         while (delta > LS_STEP_THRESHOLD)
         {
+            if (speculate)
+            {
+                int k = SpeculativeRound(gradient, delta, negativeIsForward, initialEnergy, sigma * gradNorm * gradDot);
+                if (k >= 0)
+                {
+                    delta = std::ldexp(delta, -k);
+                    numBacktracks += k;
+                    nextEnergy = probes[k].energy;
+                    // The probes have private trees; the actual geometry (and the shared BVH) follows the accepted step.
+                    SetGradientStep(gradient, (negativeIsForward) ? -delta : delta);
+                    std::cout << "  * Energy: " << initialEnergy << " -> " << nextEnergy << std::endl;
+                    break;
+                }
+                else if (k == -1)
+                {
+                    delta = std::ldexp(delta, -speculativeProbes);
+                    numBacktracks += speculativeProbes;
+                    continue;
+                }
+                // Some energy cannot be copied: continue one probe at a time.
+                speculate = false;
+            }
+
             // Take the gradient step
             double signedStep = (negativeIsForward) ? -delta : delta;
+            ptic("LineSearch::Probe");
             SetGradientStep(gradient, signedStep);
             
             nextEnergy = GetEnergyValue(energies);
+            ptoc("LineSearch::Probe");
+            ptcounter("line search step", delta);
+            ptcounter("energy", nextEnergy);
             double decrease = initialEnergy - nextEnergy;
             double targetDecrease = sigma * delta * gradNorm * gradDot;
+            // Guard against rounding differences between the ranks: rank 0 decides.
+            MPIContext::Broadcast(&decrease, 1);
+            MPIContext::Broadcast(&targetDecrease, 1);
 
             if (decrease < targetDecrease)
             {
@@ -124,16 +402,19 @@ namespace rsurfaces
            SetGradientStep(gradient, signedStep);
         }
 
+        coarse->backtracked = (numBacktracks > 0);
+        double searchTime = omp_get_wtime() - startTime;
+
         if (delta <= LS_STEP_THRESHOLD)
         {
-            std::cout << "  * Failed to find a non-trivial step after " << numBacktracks << " backtracks" << std::endl;
+            std::cout << "  * Failed to find a non-trivial step after " << numBacktracks << " backtracks (" << searchTime << " s)" << std::endl;
             // Restore initial positions if step size goes to 0
             RestorePositions();
             return 0;
         }
         else
         {
-            std::cout << "  * Took step of size " << delta << " after " << numBacktracks << " backtracks" << std::endl;
+            std::cout << "  * Took step of size " << delta << " after " << numBacktracks << " backtracks (" << searchTime << " s)" << std::endl;
             return delta;
         }
     }
@@ -0,0 +1,188 @@
+#include "local_flow.h"
+#include "geometry_cache.h"
+#include "sobolev/constraints/vertex_pin.h"
+
+#include "geometrycentral/surface/surface_mesh_factories.h"
+
+#include <cmath>
+#include <limits>
+#include <queue>
+
+namespace rsurfaces
+{
+    LocalFlowRegion::LocalFlowRegion(MeshPtr mesh_, GeomPtr geom_, const std::vector<GCVertex> &seeds, double margin,
+                                     double alpha, double beta, double theta)
+    {
+        ptic("LocalFlowRegion::LocalFlowRegion");
+        mesh = mesh_;
+        geom = geom_;
+
+        size_t nVerts = mesh->nVertices();
+        VertexIndices inds = mesh->getVertexIndices();
+
+        // Multi-source Dijkstra along edges, as in MainApp::GetFalloffWindow.
+        std::vector<double> dist(nVerts, std::numeric_limits<double>::infinity());
+        typedef std::pair<double, size_t> Entry;
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+        for (GCVertex v : seeds)
+        {
+            dist[inds[v]] = 0;
+            queue.push(Entry{0, inds[v]});
+        }
+        while (!queue.empty())
+        {
+            Entry next = queue.top();
+            queue.pop();
+            if (next.first > dist[next.second])
+            {
+                continue;
+            }
+            GCVertex v = mesh->vertex(next.second);
+            for (GCVertex neighbor : v.adjacentVertices())
+            {
+                double d = next.first + norm(geom->inputVertexPositions[v] - geom->inputVertexPositions[neighbor]);
+                size_t j = inds[neighbor];
+                if (d <= margin && d < dist[j])
+                {
+                    dist[j] = d;
+                    queue.push(Entry{d, j});
+                }
+            }
+        }
+
+        // A face belongs to the region if all of its vertices do; everything else is frozen.
+        std::vector<long> globalToLocal(nVerts, -1);
+        std::vector<long> globalToFar(nVerts, -1);
+        std::vector<bool> onSeam(nVerts, false);
+        std::vector<std::vector<size_t>> localPolygons, farPolygons;
+        std::vector<Vector3> farPositions;
+
+        for (GCFace f : mesh->faces())
+        {
+            bool inside = true;
+            for (GCVertex v : f.adjacentVertices())
+            {
+                inside = inside && std::isfinite(dist[inds[v]]);
+            }
+
+            std::vector<size_t> polygon;
+            for (GCVertex v : f.adjacentVertices())
+            {
+                size_t i = inds[v];
+                if (inside)
+                {
+                    if (globalToLocal[i] < 0)
+                    {
+                        globalToLocal[i] = localToGlobal.size();
+                        localToGlobal.push_back(i);
+                    }
+                    polygon.push_back(globalToLocal[i]);
+                }
+                else
+                {
+                    if (globalToFar[i] < 0)
+                    {
+                        globalToFar[i] = farPositions.size();
+                        farPositions.push_back(geom->inputVertexPositions[v]);
+                    }
+                    polygon.push_back(globalToFar[i]);
+                    onSeam[i] = true;
+                }
+            }
+            (inside ? localPolygons : farPolygons).push_back(polygon);
+        }
+
+        if (localPolygons.empty() || farPolygons.empty())
+        {
+            ptoc("LocalFlowRegion::LocalFlowRegion");
+            throw std::runtime_error("LocalFlowRegion: the region has " + std::to_string(localPolygons.size()) + " of " + std::to_string(mesh->nFaces()) + " faces; use the global flow instead.");
+        }
+        localFaceCount = localPolygons.size();
+
+        std::vector<Vector3> localPositions(localToGlobal.size());
+        std::vector<size_t> pinned;
+        for (size_t i = 0; i < localToGlobal.size(); ++i)
+        {
+            localPositions[i] = geom->inputVertexPositions[localToGlobal[i]];
+            if (onSeam[localToGlobal[i]])
+            {
+                pinned.push_back(i);
+            }
+        }
+
+        MeshUPtr u_mesh;
+        GeomUPtr u_geom;
+        // Throws if the region pinches off at a vertex.
+        std::tie(u_mesh, u_geom) = surface::makeManifoldSurfaceMeshAndGeometry(localPolygons, localPositions);
+        localMesh = std::move(u_mesh);
+        localGeom = std::move(u_geom);
+
+        localGeom->requireFaceNormals();
+        localGeom->requireFaceAreas();
+        localGeom->requireVertexNormals();
+        localGeom->requireVertexDualAreas();
+        localGeom->requireVertexGaussianCurvatures();
+
+        std::unique_ptr<surface::SurfaceMesh> u_farMesh;
+        GeomUPtr u_farGeom;
+        std::tie(u_farMesh, u_farGeom) = surface::makeSurfaceMeshAndGeometry(farPolygons, farPositions);
+        farMesh = std::move(u_farMesh);
+        farGeom = std::move(u_farGeom);
+
+        // as in MainApp::AddObstacle
+        farGeom->requireVertexDualAreas();
+        farGeom->requireVertexNormals();
+
+        energy = new TPEnergyBarnesHut0(localMesh, localGeom, alpha, beta, theta);
+        farField = new TPObstacleBarnesHut0(localMesh, localGeom, energy, farMesh, farGeom, alpha, beta, theta);
+
+        flow = new SurfaceFlow(energy);
+        flow->AddObstacleEnergy(farField);
+        flow->allowBarycenterShift = false;
+        flow->disableNearField = false;
+
+        Constraints::VertexPinConstraint *pinC = flow->addSimpleConstraint<Constraints::VertexPinConstraint>(localMesh, localGeom);
+        pinC->pinVertices(localMesh, localGeom, pinned);
+
+        std::cout << "Local flow region: " << localToGlobal.size() << " vertices (" << pinned.size() << " pinned), "
+                  << localFaceCount << " of " << mesh->nFaces() << " faces." << std::endl;
+        ptoc("LocalFlowRegion::LocalFlowRegion");
+    } // Constructor
+
+    LocalFlowRegion::~LocalFlowRegion()
+    {
+        delete flow;
+        delete farField;
+        delete energy;
+        GeometryCache::Release(localGeom);
+        GeometryCache::Release(farGeom);
+    } // Destructor
+
+    void LocalFlowRegion::PullPositions()
+    {
+        for (size_t i = 0; i < localToGlobal.size(); ++i)
+        {
+            localGeom->inputVertexPositions[i] = geom->inputVertexPositions[localToGlobal[i]];
+        }
+        localGeom->refreshQuantities();
+        GeometryCache::PositionsChanged(localGeom);
+    } // PullPositions
+
+    void LocalFlowRegion::Step()
+    {
+        ptic("LocalFlowRegion::Step");
+        flow->StepProjectedGradient();
+        ptoc("LocalFlowRegion::Step");
+    } // Step
+
+    void LocalFlowRegion::PushPositions()
+    {
+        for (size_t i = 0; i < localToGlobal.size(); ++i)
+        {
+            geom->inputVertexPositions[localToGlobal[i]] = localGeom->inputVertexPositions[i];
+        }
+        // No geom->refreshQuantities() here; that is a pass over the whole mesh, which the caller does once the editing ends.
+        GeometryCache::PositionsChanged(geom);
+    } // PushPositions
+
+} // namespace rsurfaces
@@ -31,6 +31,11 @@
 #include "energy/willmore_energy.h"
 
 #include "bct_constructors.h"
+#include "mpi_context.h"
+#include "solver_capture.h"
+#include "batch_runner.h"
+#include "sobolev/hs_newton_krylov.h"
+#include "geometry_cache.h"
 
 #include "remeshing/remeshing.h"
 
@@ -63,10 +68,24 @@ namespace rsurfaces
         referenceEnergy = 0;
         exitWhenDone = false;
         totalObstacleVolume = 0;
+        localDrag = false;
+        localDragMargin = 0.25;
+        localRegion = 0;
+        validateEvery = 0;
     }
 
     void MainApp::logPerformanceLine()
     {
+        // Memory high-water marks since the last logged line; read before the reference energy allocates anything.
+        double peakRSS = MemoryTracker::PeakRSS() / 1048576.;
+#ifdef MEMORY_ACCOUNTING
+        double peakTracked = MemoryTracker::PeakBytes() / 1048576.;
+        {
+            std::ofstream memfile("./MemoryFootprint.tsv");
+            MemoryTracker::WriteSummary(memfile);
+        }
+#endif
+
         // Regardless of thread setting, use multithreaded for the all-pairs energy
         omp_set_num_threads(defaultNumThreads);
 
@@ -75,15 +94,24 @@ namespace rsurfaces
         referenceEnergy->Update();
 
         geom->refreshQuantities();
+        GeometryCache::PositionsChanged(geom);
         std::ofstream outfile;
         outfile.open(sceneData.performanceLogFile, std::ios_base::app);
         double currentEnergy = referenceEnergy->Value();
-        std::cout << numSteps << ", " << timeSpentSoFar << ", " << currentEnergy << ", " << mesh->nFaces() << std::endl;
-        outfile << numSteps << ", " << timeSpentSoFar << ", " << currentEnergy << ", " << mesh->nFaces() << std::endl;
+#ifdef MEMORY_ACCOUNTING
+        std::cout << numSteps << ", " << timeSpentSoFar << ", " << currentEnergy << ", " << mesh->nFaces() << ", " << peakRSS << ", " << peakTracked << std::endl;
+        outfile << numSteps << ", " << timeSpentSoFar << ", " << currentEnergy << ", " << mesh->nFaces() << ", " << peakRSS << ", " << peakTracked << std::endl;
+#else
+        std::cout << numSteps << ", " << timeSpentSoFar << ", " << currentEnergy << ", " << mesh->nFaces() << ", " << peakRSS << std::endl;
+        outfile << numSteps << ", " << timeSpentSoFar << ", " << currentEnergy << ", " << mesh->nFaces() << ", " << peakRSS << std::endl;
+#endif
         outfile.close();
 
         delete referenceEnergy;
 
+        MemoryTracker::ResetPeak();
+        MemoryTracker::ResetPeakRSS();
+
         omp_set_num_threads(specifiedNumThreads);
         std::cout << "Switched back to " << specifiedNumThreads << " threads for flow" << std::endl;
 
@@ -100,6 +128,14 @@ namespace rsurfaces
 
         long beforeStep = currentTimeMilliseconds();
 
+        for (auto &obstacle : animatedObstacles)
+        {
+            if (obstacle.first->Advance(numSteps) && obstacle.second)
+            {
+                obstacle.second->updateVertexPositions(obstacle.first->geom->inputVertexPositions);
+            }
+        }
+
         ptic("Switch");
         switch (methodChoice)
         {
@@ -137,6 +173,9 @@ namespace rsurfaces
         case GradientMethod::Willmore:
             flow->StepH2Projected();
             break;
+        case GradientMethod::HsNewtonKrylov:
+            flow->StepNewtonKrylov();
+            break;
         default:
             throw std::runtime_error("Unknown gradient method type.");
         }
@@ -144,23 +183,33 @@ namespace rsurfaces
 
         if (remeshAfter)
         {
-            bool doCollapse = (numSteps % 1 == 0);
-            std::cout << "Applying remeshing..." << std::endl;
-            flow->verticesMutated = remesher.Remesh(5, doCollapse);
-            if (flow->verticesMutated)
+            bool remeshed = false;
+            flow->verticesMutated = remesher.RemeshIfNeeded(5, remeshed);
+            if (!remeshed)
             {
-                std::cout << "Vertices were mutated this step -- memory vectors are now invalid." << std::endl;
+                if (remesher.verbose)
+                {
+                    std::cout << "Mesh quality is fine; skipping remeshing." << std::endl;
+                }
+                MainApp::instance->updateMeshPositions();
             }
             else
             {
-                std::cout << "Vertices were not mutated this step." << std::endl;
+                if (flow->verticesMutated)
+                {
+                    std::cout << "Vertices were mutated this step -- memory vectors are now invalid." << std::endl;
+                }
+                else
+                {
+                    std::cout << "Vertices were not mutated this step." << std::endl;
+                }
+                ptic("mesh->compress()");
+                mesh->compress();
+                ptoc("mesh->compress()");
+                ptic("MainApp::instance->reregisterMesh();");
+                MainApp::instance->reregisterMesh();
+                ptoc("MainApp::instance->reregisterMesh();");
             }
-            ptic("mesh->compress()");
-            mesh->compress();
-            ptoc("mesh->compress()");
-            ptic("MainApp::instance->reregisterMesh();");
-            MainApp::instance->reregisterMesh();
-            ptoc("MainApp::instance->reregisterMesh();");
         }
         else
         {
@@ -171,8 +220,13 @@ namespace rsurfaces
         long timeForStep = afterStep - beforeStep;
         timeSpentSoFar += timeForStep;
         numSteps++;
-        std::cout << "  Mesh total volume = " << totalVolume(geom, mesh) << std::endl;
-        std::cout << "  Mesh total area = " << totalArea(geom, mesh) << std::endl;
+        if (validateEvery > 0 && numSteps % validateEvery == 0)
+        {
+            ValidateIntersections();
+        }
+        const GeometryCache & G = GeometryCache::Get(geom);
+        std::cout << "  Mesh total volume = " << G.totalVolume << std::endl;
+        std::cout << "  Mesh total area = " << G.totalArea << std::endl;
 
         if (logPerformance)
         {
@@ -192,6 +246,23 @@ namespace rsurfaces
         ptoc("MainApp::TakeOptimizationStep");
     }
 
+    IntersectionReport MainApp::ValidateIntersections()
+    {
+        long start = currentTimeMilliseconds();
+        IntersectionReport report = validator.Check(mesh, geom);
+        long end = currentTimeMilliseconds();
+
+        std::cout << "  Self-intersection check: " << report.intersecting_pairs.size() << " intersecting face pairs, minimum separation "
+                  << report.min_separation << " (faces " << report.closest_pair.first << ", " << report.closest_pair.second << "; "
+                  << report.tested_pairs << " exact tests, " << (end - start) << " ms)" << std::endl;
+        std::cout << "    not counted: " << IntersectionReport::Exemptions() << std::endl;
+        for (size_t k = 0; k < report.intersecting_pairs.size() && k < 10; k++)
+        {
+            std::cout << "    faces " << report.intersecting_pairs[k].first << " and " << report.intersecting_pairs[k].second << " intersect" << std::endl;
+        }
+        return report;
+    }
+
     void MainApp::updateMeshPositions()
     {
         if (normalizeView)
@@ -399,6 +470,24 @@ namespace rsurfaces
                     hasPickedVertex = true;
                     GetFalloffWindow(pickedVertex, 0.5, dragVertices);
 
+                    if (localDrag)
+                    {
+                        std::vector<GCVertex> seeds;
+                        for (PriorityVertex &v : dragVertices)
+                        {
+                            seeds.push_back(v.vertex);
+                        }
+                        try
+                        {
+                            localRegion = new LocalFlowRegion(mesh, geom, seeds, 0.5 + localDragMargin, kernel->alpha, kernel->beta, bh_theta);
+                        }
+                        catch (const std::exception &e)
+                        {
+                            wprint(std::string(e.what()) + " Falling back to the global flow.");
+                            localRegion = 0;
+                        }
+                    }
+
                     Vector3 screen = projectToScreenCoords3(geom->inputVertexPositions[pickedVertex], viewProj);
                     pickDepth = screen.z;
 
@@ -420,9 +509,20 @@ namespace rsurfaces
                         Vector3 newPos = v.position + v.priority * displacement;
                         geom->inputVertexPositions[v.vertex] = newPos;
                     }
+                    GeometryCache::PositionsChanged(geom);
 
-                    flow->ResetAllConstraints();
-                    flow->ResetAllPotentials();
+                    if (localRegion)
+                    {
+                        // Only the region is flowed; the global constraints and potentials are reset once the drag ends.
+                        localRegion->PullPositions();
+                        localRegion->Step();
+                        localRegion->PushPositions();
+                    }
+                    else
+                    {
+                        flow->ResetAllConstraints();
+                        flow->ResetAllPotentials();
+                    }
 
                     if (vertexPotential)
                     {
@@ -443,6 +543,15 @@ namespace rsurfaces
                 ctrlMouseDown = false;
                 hasPickedVertex = false;
                 dragVertices.clear();
+                if (localRegion)
+                {
+                    delete localRegion;
+                    localRegion = 0;
+                    geom->refreshQuantities();
+                    GeometryCache::PositionsChanged(geom);
+                    flow->ResetAllConstraints();
+                    flow->ResetAllPotentials();
+                }
                 // geom->inputVertexPositions[pickedVertex] = initialPickedPosition;
                 updateMeshPositions();
             }
@@ -463,6 +572,7 @@ namespace rsurfaces
         {
             geom->inputVertexPositions[v] = 2 * geom->inputVertexPositions[v];
         }
+        GeometryCache::PositionsChanged(geom);
     }
 
     Jacobian numericalNormalDeriv(GeomPtr &geom, GCVertex vert, GCVertex wrt)
@@ -473,18 +583,22 @@ namespace rsurfaces
         Vector3 origPos = geom->inputVertexPositions[wrt];
         geom->inputVertexPositions[wrt] = origPos + Vector3{h, 0, 0};
         geom->refreshQuantities();
+        GeometryCache::PositionsChanged(geom);
         Vector3 n_x = vertexAreaNormal(geom, vert);
 
         geom->inputVertexPositions[wrt] = origPos + Vector3{0, h, 0};
         geom->refreshQuantities();
+        GeometryCache::PositionsChanged(geom);
         Vector3 n_y = vertexAreaNormal(geom, vert);
 
         geom->inputVertexPositions[wrt] = origPos + Vector3{0, 0, h};
         geom->refreshQuantities();
+        GeometryCache::PositionsChanged(geom);
         Vector3 n_z = vertexAreaNormal(geom, vert);
 
         geom->inputVertexPositions[wrt] = origPos;
         geom->refreshQuantities();
+        GeometryCache::PositionsChanged(geom);
 
         Vector3 deriv_y = (n_y - origNormal) / h;
         Vector3 deriv_z = (n_z - origNormal) / h;
@@ -1594,6 +1708,7 @@ namespace rsurfaces
             }
 
             geom->refreshQuantities();
+            GeometryCache::PositionsChanged(geom);
 
             //            UpdateOptimizedBVH(mesh, geom, tpe->GetBVH());
             tpe->Update();
@@ -1649,7 +1764,7 @@ namespace rsurfaces
         }
     };
 
-    void MainApp::AddObstacle(std::string filename, double weight, bool recenter, bool asPointCloud)
+    void MainApp::AddObstacle(std::string filename, double weight, bool recenter, bool asPointCloud, const scene::ObstacleData *motion)
     {
         std::unique_ptr<surface::SurfaceMesh> obstacleMesh;
         GeomUPtr obstacleGeometry;
@@ -1659,9 +1774,11 @@ namespace rsurfaces
         obstacleGeometry->requireVertexDualAreas();
         obstacleGeometry->requireVertexNormals();
 
+        Vector3 offset{0, 0, 0};
         if (recenter)
         {
             Vector3 obstacleCenter = meshBarycenter(obstacleGeometry, obstacleMesh);
+            offset = -obstacleCenter;
             std::cout << "Recentering obstacle " << filename << " (offset " << obstacleCenter << ")" << std::endl;
             for (GCVertex v : obstacleMesh->vertices())
             {
@@ -1676,13 +1793,14 @@ namespace rsurfaces
             polyscope::PointCloud *pointCloud = polyscope::registerPointCloud(mesh_name, obstacleGeometry->inputVertexPositions);
         }
 
-        else
+        polyscope::SurfaceMesh *psObsMesh = 0;
+        if (!asPointCloud)
         {
-            polyscope::SurfaceMesh *psMesh = polyscope::registerSurfaceMesh(mesh_name, obstacleGeometry->inputVertexPositions,
-                                                                            obstacleMesh->getFaceVertexList(), polyscopePermutations(*obstacleMesh));
+            psObsMesh = polyscope::registerSurfaceMesh(mesh_name, obstacleGeometry->inputVertexPositions,
+                                                       obstacleMesh->getFaceVertexList(), polyscopePermutations(*obstacleMesh));
         }
 
-        std::unique_ptr<surface::SurfaceMesh> sharedObsMesh = std::move(obstacleMesh);
+        std::shared_ptr<surface::SurfaceMesh> sharedObsMesh = std::move(obstacleMesh);
         GeomPtr sharedObsGeom = std::move(obstacleGeometry);
 
         SurfaceEnergy *obstacleEnergy = 0;
@@ -1709,8 +1827,13 @@ namespace rsurfaces
 
         else
         {
-            obstacleEnergy = new TPObstacleBarnesHut0(mesh, geom, flow->BaseEnergy(), sharedObsMesh, sharedObsGeom,
-                                                      kernel->alpha, kernel->beta, bh_theta, weight);
+            TPObstacleBarnesHut0 *meshObstacle = new TPObstacleBarnesHut0(mesh, geom, flow->BaseEnergy(), sharedObsMesh, sharedObsGeom,
+                                                                          kernel->alpha, kernel->beta, bh_theta, weight);
+            if (motion && motion->isAnimated())
+            {
+                animatedObstacles.emplace_back(new AnimatedObstacle(meshObstacle, sharedObsMesh, sharedObsGeom, *motion, offset), psObsMesh);
+            }
+            obstacleEnergy = meshObstacle;
         }
 
         flow->AddObstacleEnergy(obstacleEnergy);
@@ -2005,6 +2128,10 @@ void customCallback()
     ImGui::Checkbox("Skip odd frames", &skipEveryOther);
     ImGui::SameLine(ITEM_WIDTH, 2 * INDENT);
     ImGui::Checkbox("Show area ratios", &areaRatios);
+    if (ImGui::Button("Check intersections", ImVec2{ITEM_WIDTH, 0}))
+    {
+        MainApp::instance->ValidateIntersections();
+    }
 
     const GradientMethod methods[] = {GradientMethod::HsProjectedIterative,
                                       GradientMethod::HsProjected,
@@ -2015,7 +2142,8 @@ void customCallback()
                                       GradientMethod::AQP,
                                       GradientMethod::H1_LBFGS,
                                       GradientMethod::BQN_LBFGS,
-                                      GradientMethod::H2Projected};
+                                      GradientMethod::H2Projected,
+                                      GradientMethod::HsNewtonKrylov};
 
     selectFromDropdown("Method", methods, IM_ARRAYSIZE(methods), MainApp::instance->methodChoice);
 
@@ -2037,6 +2165,11 @@ void customCallback()
     selectFromDropdown("Flipping mode", fModes, IM_ARRAYSIZE(fModes), MainApp::instance->remesher.flippingMode);
 
     ImGui::Checkbox("Curvature adaptive remeshing", &MainApp::instance->remesher.curvatureAdaptive);
+    ImGui::Checkbox("Quality-triggered remeshing", &MainApp::instance->remesher.qualityTriggered);
+
+    ImGui::Checkbox("Local drag flow", &MainApp::instance->localDrag);
+    ImGui::SameLine(ITEM_WIDTH, 2 * INDENT);
+    ImGui::InputDouble("Drag margin", &MainApp::instance->localDragMargin);
 
     rsurfaces::MainApp::instance->HandlePicking();
 
@@ -2054,7 +2187,8 @@ void customCallback()
     ImGui::SliderFloat( "Max step size", &maxStep, 0.001, 0.1 );
     rsurfaces::MainApp::instance->flow->maxStepSize = limitStep ? maxStep : -1.;
 
-    if (ImGui::Button("Take 1 step", ImVec2{ITEM_WIDTH, 0}) || run)
+    // While a local drag is active, the region is flowed by HandlePicking instead.
+    if ((ImGui::Button("Take 1 step", ImVec2{ITEM_WIDTH, 0}) || run) && !MainApp::instance->LocalDragActive())
     {
         MainApp::instance->TakeOptimizationStep(remesh, areaRatios);
         if (skipEveryOther)
@@ -2386,10 +2520,285 @@ rsurfaces::scene::SceneData defaultScene(std::string meshName)
     return data;
 }
 
+// Headless consistency check of the MPI distribution: run with mpirun -np <ranks>.
+// Every rank builds the undistributed and the distributed operators from the same mesh; rank 0 reports the largest
+// relative deviation of the metric products and of the tangent-point energy and its differential.
+int runDistributedCheck(std::string meshFile, double alpha, double beta, double theta)
+{
+    using namespace rsurfaces;
+
+    MeshUPtr u_mesh;
+    std::unique_ptr<VertexPositionGeometry> u_geometry;
+    std::unique_ptr<CornerData<Vector2>> uvs;
+    std::tie(u_mesh, u_geometry, uvs) = readParameterizedMesh(meshFile);
+    MeshPtr mesh = std::move(u_mesh);
+    GeomPtr geom = std::move(u_geometry);
+    geom->requireFaceNormals();
+    geom->requireFaceAreas();
+    geom->requireVertexNormals();
+    geom->requireVertexDualAreas();
+
+    TPEnergyBarnesHut0 tpe(mesh, geom, alpha, beta, theta);
+    OptimizedClusterTree *bvh = tpe.GetBVH();
+
+    BCTSettings local_settings = BCTDefaultSettings;
+    local_settings.distribute_over_ranks = false;
+    BCTSettings distributed_settings = BCTDefaultSettings;
+    distributed_settings.distribute_over_ranks = true;
+
+    BCTPtr local = CreateOptimizedBCTFromBVH(bvh, alpha, beta, theta, 1., local_settings);
+    BCTPtr distributed = CreateOptimizedBCTFromBVH(bvh, alpha, beta, theta, 1., distributed_settings);
+
+    mreal max_error = 0.;
+    auto report = [&](std::string what, mreal error) {
+        max_error = std::max(max_error, error);
+        if (MPIContext::Rank() == 0)
+        {
+            std::cout << what << ": relative max deviation = " << error << std::endl;
+        }
+    };
+    auto relative = [](const Eigen::MatrixXd &result, const Eigen::MatrixXd &expected) {
+        return (result - expected).lpNorm<Eigen::Infinity>() / std::max(expected.lpNorm<Eigen::Infinity>(), 1e-300);
+    };
+
+    // The same seed on all ranks gives the same input everywhere.
+    std::srand(1);
+    Eigen::VectorXd input = Eigen::VectorXd::Random(3 * mesh->nVertices());
+
+    for (BCTKernelType type : {BCTKernelType::FractionalOnly, BCTKernelType::HighOrder, BCTKernelType::LowOrder})
+    {
+        Eigen::VectorXd expected, result;
+        expected.setZero(input.size());
+        result.setZero(input.size());
+        local->Multiply(input, expected, 3, type);
+        distributed->Multiply(input, result, 3, type);
+        report("metric kernel " + std::to_string(static_cast<int>(type)), relative(result, expected));
+    }
+
+    // Barnes-Hut traversal (split over target leaves) and multipole evaluation on the shared block cluster tree (split over block rows).
+    for (BCTPtr shared : {BCTPtr(), distributed})
+    {
+        std::string what = shared ? "multipole energy" : "Barnes-Hut energy";
+        mreal expected_value, value;
+        Eigen::MatrixXd expected_diff, diff;
+        expected_diff.setZero(mesh->nVertices(), 3);
+        diff.setZero(mesh->nVertices(), 3);
+        {
+            MPIContext::LocalScope local_scope;
+            tpe.SetBlockClusterTree(shared ? local : BCTPtr());
+            expected_value = tpe.Value();
+            tpe.Differential(expected_diff);
+        }
+        tpe.SetBlockClusterTree(shared);
+        value = tpe.Value();
+        tpe.Differential(diff);
+
+        report(what, std::abs(value - expected_value) / std::max(std::abs(expected_value), 1e-300));
+        report(what + " differential", relative(diff, expected_diff));
+    }
+    tpe.SetBlockClusterTree(BCTPtr());
+
+    long long near_nnz = MPIContext::AllreduceSum(static_cast<long long>(distributed->near->nnz));
+    long long far_nnz = MPIContext::AllreduceSum(static_cast<long long>(distributed->far->nnz));
+    if (MPIContext::Rank() == 0)
+    {
+        std::cout << MPIContext::Size() << " ranks; near field nnz " << near_nnz << " (undistributed " << local->near->nnz << ")"
+                  << ", far field nnz " << far_nnz << " (undistributed " << local->far->nnz << ")" << std::endl;
+    }
+
+    return (max_error < 1e-10) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Headless check of the Hessian-vector products of the Newton-Krylov flow: compares the product of HsNewtonKrylov
+// (Barnes-Hut energy on the frozen block partition) with a central difference of the all-pairs differential in the
+// same direction and with the same step. Meant for small meshes; the all-pairs energy is quadratic in the face count.
+int runNewtonCheck(std::string meshFile, double alpha, double beta, double theta)
+{
+    using namespace rsurfaces;
+
+    MeshUPtr u_mesh;
+    GeomUPtr u_geom;
+    std::tie(u_mesh, u_geom) = readMesh(meshFile);
+    MeshPtr mesh = std::move(u_mesh);
+    GeomPtr geom = std::move(u_geom);
+    geom->requireFaceNormals();
+    geom->requireFaceAreas();
+    geom->requireVertexNormals();
+    geom->requireVertexDualAreas();
+
+    TPEnergyBarnesHut0 tpe(mesh, geom, alpha, beta, theta);
+    TPEnergyAllPairs exact(mesh, geom, alpha, beta);
+    std::vector<SurfaceEnergy *> energies{&tpe};
+    Hs::HsNewtonKrylov newton(mesh, geom, energies);
+
+    std::srand(1);
+    Eigen::MatrixXd v = Eigen::MatrixXd::Random(mesh->nVertices(), 3);
+
+    Eigen::MatrixXd product;
+    newton.BeginProducts();
+    newton.HessianProduct(v, product);
+    newton.EndProducts();
+
+    // reference with the step of HessianProduct
+    const GeometryCache &G = GeometryCache::Get(geom);
+    double eps = newton.relativeStep * sqrt(G.totalArea / G.face_count) / v.lpNorm<Eigen::Infinity>();
+    Eigen::MatrixXd positions(mesh->nVertices(), 3);
+    VertexIndices inds = mesh->getVertexIndices();
+    for (GCVertex w : mesh->vertices())
+    {
+        MatrixUtils::SetRowFromVector3(positions, inds[w], geom->inputVertexPositions[w]);
+    }
+    auto differentialAt = [&](const Eigen::MatrixXd &x) {
+        for (GCVertex w : mesh->vertices())
+        {
+            geom->inputVertexPositions[w] = MatrixUtils::GetRowAsVector3(x, inds[w]);
+        }
+        geom->refreshQuantities();
+        GeometryCache::PositionsChanged(geom);
+        exact.Update();
+        Eigen::MatrixXd diff;
+        diff.setZero(mesh->nVertices(), 3);
+        exact.Differential(diff);
+        return diff;
+    };
+    Eigen::MatrixXd expected = (differentialAt(positions + eps * v) - differentialAt(positions - eps * v)) / (2 * eps);
+    differentialAt(positions);
+
+    double error = (product - expected).norm() / std::max(expected.norm(), 1e-300);
+    std::cout << "Hessian-vector product (theta = " << theta << ") vs. all-pairs central difference: relative deviation = " << error << std::endl;
+    // The Barnes-Hut differential itself deviates by a few percent at theta = 0.5; noise from a changing partition would be orders of magnitude larger.
+    return (error < 0.1) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Headless check of the adaptive admissibility (BCTSettings::adaptive_admissibility): evaluates the Barnes-Hut energy and its
+// differential on block cluster trees built with the fixed criterion and with the error estimate, compares both with the
+// all-pairs energy and reports the number of far and near field entries. With the default admissibility_max_theta, the
+// estimate may only split blocks that the fixed criterion accepts, so it must not be less accurate. The variant with
+// admissibility_max_theta = 1 is reported for comparison. Meant for small meshes; the all-pairs energy is quadratic in the face count.
+int runAdmissibilityCheck(std::string meshFile, double alpha, double beta, double theta)
+{
+    using namespace rsurfaces;
+
+    MeshUPtr u_mesh;
+    GeomUPtr u_geom;
+    std::tie(u_mesh, u_geom) = readMesh(meshFile);
+    MeshPtr mesh = std::move(u_mesh);
+    GeomPtr geom = std::move(u_geom);
+    geom->requireFaceNormals();
+    geom->requireFaceAreas();
+    geom->requireVertexNormals();
+    geom->requireVertexDualAreas();
+
+    TPEnergyBarnesHut0 tpe(mesh, geom, alpha, beta, theta);
+    TPEnergyAllPairs exact(mesh, geom, alpha, beta);
+    OptimizedClusterTree *bvh = tpe.GetBVH();
+
+    exact.Update();
+    double expected_value = exact.Value();
+    Eigen::MatrixXd expected_diff;
+    expected_diff.setZero(mesh->nVertices(), 3);
+    exact.Differential(expected_diff);
+
+    BCTSettings fixed_settings = BCTDefaultSettings;
+    fixed_settings.distribute_over_ranks = false;
+    fixed_settings.adaptive_admissibility = false;
+    BCTSettings adaptive_settings = fixed_settings;
+    adaptive_settings.adaptive_admissibility = true;
+    BCTSettings loose_settings = adaptive_settings;
+    loose_settings.admissibility_max_theta = 1.;
+
+    // returns the larger of the relative errors of value and differential
+    auto evaluate = [&](std::string what, const BCTSettings &settings) {
+        BCTPtr bct = CreateOptimizedBCTFromBVH(bvh, alpha, beta, theta, 1., settings);
+        tpe.SetBlockClusterTree(bct);
+        double value = tpe.Value();
+        Eigen::MatrixXd diff;
+        diff.setZero(mesh->nVertices(), 3);
+        tpe.Differential(diff);
+        tpe.SetBlockClusterTree(BCTPtr());
+
+        double value_error = std::abs(value - expected_value) / std::max(std::abs(expected_value), 1e-300);
+        double diff_error = (diff - expected_diff).norm() / std::max(expected_diff.norm(), 1e-300);
+        std::cout << what << ": relative error of value = " << value_error << ", of differential = " << diff_error
+                  << "; far field nnz " << bct->far->nnz << ", near field nnz " << bct->near->nnz << std::endl;
+        return std::max(value_error, diff_error);
+    };
+
+    std::cout << mesh->nFaces() << " faces, theta = " << theta << std::endl;
+    double fixed_error = evaluate("fixed theta", fixed_settings);
+    double adaptive_error = evaluate("adaptive", adaptive_settings);
+    evaluate("adaptive, admissibility_max_theta = 1", loose_settings);
+
+    // small slack: splitting a block does not lower every signed error term
+    return (adaptive_error <= 1.05 * fixed_error + 1e-12) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Headless strong-scaling benchmark of the construction phases (cluster tree and block cluster tree) for
+// 1, 2, 4, ... up to max_threads threads. Reports the best of a few repetitions and the speedup over one thread.
+int runBuildBenchmark(std::string meshFile, double alpha, double beta, double theta, int max_threads)
+{
+    using namespace rsurfaces;
+
+    MeshUPtr u_mesh;
+    std::unique_ptr<VertexPositionGeometry> u_geometry;
+    std::unique_ptr<CornerData<Vector2>> uvs;
+    std::tie(u_mesh, u_geometry, uvs) = readParameterizedMesh(meshFile);
+    MeshPtr mesh = std::move(u_mesh);
+    GeomPtr geom = std::move(u_geometry);
+    geom->requireFaceNormals();
+    geom->requireFaceAreas();
+    geom->requireVertexNormals();
+    geom->requireVertexDualAreas();
+
+    std::vector<int> thread_counts;
+    for (int t = 1; t < max_threads; t *= 2)
+    {
+        thread_counts.push_back(t);
+    }
+    thread_counts.push_back(max_threads);
+
+    const int repetitions = 5;
+    double bvh_base = 0.;
+    double bct_base = 0.;
+
+    std::cout << mesh->nFaces() << " faces, theta = " << theta << std::endl;
+    std::cout << "threads\tbvh [s]\tbvh speedup\tbct [s]\tbct speedup" << std::endl;
+    for (int t : thread_counts)
+    {
+        omp_set_num_threads(t);
+        double bvh_time = std::numeric_limits<double>::max();
+        double bct_time = std::numeric_limits<double>::max();
+        for (int r = 0; r < repetitions; ++r)
+        {
+            double start = omp_get_wtime();
+            OptimizedClusterTree *bvh = CreateOptimizedBVH(mesh, geom);
+            double middle = omp_get_wtime();
+            BCTPtr bct = CreateOptimizedBCTFromBVH(bvh, alpha, beta, theta);
+            double end = omp_get_wtime();
+
+            bvh_time = std::min(bvh_time, middle - start);
+            bct_time = std::min(bct_time, end - middle);
+            bct.reset();
+            delete bvh;
+        }
+        if (t == 1)
+        {
+            bvh_base = bvh_time;
+            bct_base = bct_time;
+        }
+        std::cout << t << "\t" << bvh_time << "\t" << bvh_base / bvh_time << "\t" << bct_time << "\t" << bct_base / bct_time << std::endl;
+    }
+
+    return EXIT_SUCCESS;
+}
+
 int main(int argc, char **argv)
 {
     using namespace rsurfaces;
 
+    // Without mpirun (or without WITH_MPI), this is a single rank and nothing changes.
+    MPIContext::Init(&argc, &argv);
+
     // Configure the argument parser
     args::ArgumentParser parser("geometry-central & Polyscope example project");
     args::Positional<std::string> inputFilename(parser, "mesh", "A mesh file.");
@@ -2399,6 +2808,22 @@ int main(int argc, char **argv)
     args::Flag autologFlag(parser, "autolog", "Automatically start the flow, log performance, and exit when done.", {"autolog"});
     args::Flag coulombFlag(parser, "coulomb", "Use a coulomb energy instead of the tangent-point energy.", {"coulomb"});
     args::ValueFlag<int> threadFlag(parser, "threads", "How many threads to use in parallel.", {"threads"});
+    args::Flag estimateMemoryFlag(parser, "estimate_memory", "Print the predicted memory footprint for the given mesh, theta and thread count, then exit.", {"estimate_memory"});
+    args::Flag mpiCheckFlag(parser, "mpi_check", "Compare the distributed metric product, energy and differential against the undistributed ones (run with mpirun), then exit.", {"mpi_check"});
+    args::ValueFlag<int> speculativeProbesFlag(parser, "speculative_probes", "Number of line search step sizes to evaluate concurrently per round (default 1, i.e. one after another).", {"speculative_probes"});
+    args::ValueFlag<double> coarseThetaFlag(parser, "coarse_theta", "Let the line search find a candidate step with the Barnes-Hut energy at this (larger) theta and check only that one at full accuracy.", {"coarse_theta"});
+    args::ValueFlag<int> validateEveryFlag(parser, "validate_every", "Check the mesh for self-intersections after every N-th step and print the result.", {"validate_every"});
+    args::Flag benchmarkBuildFlag(parser, "benchmark_build", "Time the cluster tree and block cluster tree construction for 1, 2, 4, ... threads (up to --threads or all cores), then exit.", {"benchmark_build"});
+    args::ValueFlag<int> captureStepFlag(parser, "capture_step", "Write the solver state of the given step (mesh, trees, interaction matrices, right-hand side) to --capture_file.", {"capture_step"});
+    args::ValueFlag<std::string> captureFileFlag(parser, "capture_file", "File for --capture_step (default ./Capture.rscap).", {"capture_file"});
+    args::Flag batchFlag(parser, "batch", "Treat the input as a list of scene or mesh files (one per line) and run them concurrently without GUI, then exit.", {"batch"});
+    args::ValueFlag<int> batchTeamFlag(parser, "batch_team", "Threads per flow in --batch mode (default 1).", {"batch_team"});
+    args::ValueFlag<std::string> batchOutputFlag(parser, "batch_output", "Directory for the final meshes of --batch mode (default: none are written).", {"batch_output"});
+    args::Flag shareBCTFlag(parser, "share_bct", "Evaluate the tangent-point energy of the sparse Hs steps on the block cluster tree of the metric (multipole instead of Barnes-Hut approximation).", {"share_bct"});
+    args::Flag adaptiveAdmissibilityFlag(parser, "adaptive_admissibility", "Accept far field blocks by an estimate of their error from the cluster moments instead of the fixed theta criterion.", {"adaptive_admissibility"});
+    args::Flag admissibilityCheckFlag(parser, "admissibility_check", "Compare the accuracy of the Barnes-Hut energy with adaptive and fixed admissibility against the all-pairs energy (use a small mesh), then exit.", {"admissibility_check"});
+    args::Flag newtonCheckFlag(parser, "newton_check", "Compare a Hessian-vector product of the Newton-Krylov flow with a central difference of the all-pairs differential (use a small mesh), then exit.", {"newton_check"});
+    args::Flag replayFlag(parser, "replay", "Treat the input file as a capture written with --capture_step, time the individual kernels on it, then exit.", {"replay"});
 
     polyscope::options::programName = "Repulsive Surfaces";
     polyscope::options::groundPlaneEnabled = false;
@@ -2475,6 +2900,12 @@ int main(int argc, char **argv)
         std::cout << "Using default value \"Hybrid\" for near field matrix-vector product." << std::endl;
     }
 
+    if (adaptiveAdmissibilityFlag)
+    {
+        BCTDefaultSettings.adaptive_admissibility = true;
+        std::cout << "Using error-controlled admissibility for the block cluster trees." << std::endl;
+    }
+
     double theta = 0.5;
     if (!thetaFlag)
     {
@@ -2485,6 +2916,70 @@ int main(int argc, char **argv)
         theta = args::get(thetaFlag);
     }
 
+    if (mpiCheckFlag)
+    {
+        int status = runDistributedCheck(args::get(inputFilename), 6., 12., theta);
+        MPIContext::Finalize();
+        return status;
+    }
+
+    if (newtonCheckFlag)
+    {
+        int status = runNewtonCheck(args::get(inputFilename), 6., 12., theta);
+        MPIContext::Finalize();
+        return status;
+    }
+
+    if (admissibilityCheckFlag)
+    {
+        int status = runAdmissibilityCheck(args::get(inputFilename), 6., 12., theta);
+        MPIContext::Finalize();
+        return status;
+    }
+
+    if (replayFlag)
+    {
+        SolverCapture capture = SolverCapture::Read(args::get(inputFilename));
+        bool matches = capture.Replay(10, std::cout);
+        MPIContext::Finalize();
+        return matches ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (batchFlag)
+    {
+        if (MPIContext::Active())
+        {
+            std::cerr << "--batch cannot run under several MPI ranks; start it without mpirun." << std::endl;
+            MPIContext::Finalize();
+            return EXIT_FAILURE;
+        }
+        int total_threads = threadFlag ? args::get(threadFlag) : omp_get_num_procs();
+        BatchRunner runner(total_threads, batchTeamFlag ? args::get(batchTeamFlag) : 1);
+        runner.theta = theta;
+        // nothing else runs in this process
+        runner.quiet = true;
+        if (batchOutputFlag)
+        {
+            runner.output_directory = args::get(batchOutputFlag);
+        }
+        std::vector<std::string> scenes = BatchRunner::ReadList(args::get(inputFilename));
+        std::cout << "Running " << scenes.size() << " scenes on " << total_threads << " threads." << std::endl;
+        double start = omp_get_wtime();
+        std::vector<BatchResult> results = runner.Run(scenes);
+        BatchRunner::PrintSummary(results, omp_get_wtime() - start, std::cout);
+        MPIContext::Finalize();
+        bool all_ok = std::all_of(results.begin(), results.end(), [](const BatchResult &r) { return r.ok; });
+        return all_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (benchmarkBuildFlag)
+    {
+        int max_threads = threadFlag ? args::get(threadFlag) : omp_get_num_procs();
+        int status = runBuildBenchmark(args::get(inputFilename), 6., 12., theta, std::max(1, max_threads));
+        MPIContext::Finalize();
+        return status;
+    }
+
     // Initialize polyscope
     polyscope::init();
     // Set the callback function
@@ -2520,6 +3015,14 @@ int main(int argc, char **argv)
 
     MeshAndEnergy m = initTPEOnMesh(data.meshName, data.alpha, data.beta);
 
+    if (estimateMemoryFlag)
+    {
+        // Dry run: nothing beyond the mesh itself has been allocated yet.
+        MemoryEstimate estimate = EstimateMemoryFootprint(m.mesh->nFaces(), theta, MainApp::specifiedNumThreads, BVHDefaultSettings.split_threshold);
+        estimate.Print(std::cout);
+        return 0;
+    }
+
     EnergyOverride eo = EnergyOverride::TangentPoint;
     if (useCoulomb)
     {
@@ -2532,6 +3035,26 @@ int main(int argc, char **argv)
 
     SurfaceFlow *flow = setUpFlow(m, theta, data, eo);
     flow->disableNearField = data.disableNearField;
+    if (speculativeProbesFlag)
+    {
+        flow->speculativeProbes = std::max(1, args::get(speculativeProbesFlag));
+    }
+    if (shareBCTFlag)
+    {
+        flow->shareBlockClusterTree = true;
+    }
+    if (coarseThetaFlag)
+    {
+        flow->lineSearchCoarseTheta = args::get(coarseThetaFlag);
+    }
+    if (captureStepFlag)
+    {
+        flow->captureStep = args::get(captureStepFlag);
+    }
+    if (captureFileFlag)
+    {
+        flow->captureFile = args::get(captureFileFlag);
+    }
 
     MainApp::instance = new MainApp(m.mesh, m.geom, flow, m.psMesh, m.meshName);
     MainApp::instance->bh_theta = theta;
@@ -2541,6 +3064,10 @@ int main(int argc, char **argv)
     MainApp::instance->methodChoice = data.defaultMethod;
     MainApp::instance->sceneData = data;
     MainApp::instance->uvs = m.uvs;
+    if (validateEveryFlag)
+    {
+        MainApp::instance->validateEvery = args::get(validateEveryFlag);
+    }
 
     if (autologFlag)
     {
@@ -2559,7 +3086,7 @@ int main(int argc, char **argv)
     }
     for (scene::ObstacleData &obs : data.obstacles)
     {
-        MainApp::instance->AddObstacle(obs.obstacleName, obs.weight, obs.recenter, obs.asPointCloud);
+        MainApp::instance->AddObstacle(obs.obstacleName, obs.weight, obs.recenter, obs.asPointCloud, &obs);
     }
     for (scene::ImplicitBarrierData &barrierData : data.implicitBarriers)
     {
@@ -2578,5 +3105,6 @@ int main(int argc, char **argv)
     // Give control to the polyscope gui
     polyscope::show();
 
+    MPIContext::Finalize();
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,400 @@
+#include "memory_tracker.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+#include <sys/resource.h>
+
+namespace rsurfaces
+{
+    namespace
+    {
+        struct OwnerRecord
+        {
+            size_t current = 0;
+            size_t peak = 0;
+            size_t blocks = 0;
+        };
+
+        // Counters of the blocks allocated by one thread. Only that thread and the threads freeing its blocks touch them,
+        // so the mutex is practically never contended; reports merge the records of all threads.
+        struct ThreadRecord
+        {
+            std::mutex mutex;
+            std::unordered_map<const char *, OwnerRecord> owners;
+            size_t current = 0;
+            size_t peak = 0;
+        };
+
+        struct Block
+        {
+            size_t bytes;
+            const char *owner;
+            ThreadRecord *thread;
+        };
+
+        // The block table is split by address, so that threads allocating at the same time rarely wait for each other.
+        struct alignas(64) BlockShard
+        {
+            std::mutex mutex;
+            std::unordered_map<const void *, Block> blocks;
+        };
+
+        const int shard_count = 64;
+
+        struct TrackerState
+        {
+            BlockShard shards[shard_count];
+            // guards threads and externals
+            std::mutex mutex;
+            std::vector<ThreadRecord *> threads;
+            std::unordered_map<const void *, Block> externals;
+        };
+
+        // Never destroyed: A_Vectors with static storage duration may still free their blocks during exit.
+        TrackerState &State()
+        {
+            static TrackerState *state = new TrackerState();
+            return *state;
+        }
+
+        BlockShard &ShardOf(TrackerState &S, const void *ptr)
+        {
+            uintptr_t p = reinterpret_cast<uintptr_t>(ptr);
+            // The blocks are cache line aligned, so the lowest bits carry no information.
+            return S.shards[((p >> 6) ^ (p >> 16)) % shard_count];
+        }
+
+        // Owner tag of the calling thread; see MemoryOwner.
+        thread_local const char *current_owner = nullptr;
+
+        // Records outlive their threads, so that blocks can still be freed after the thread that allocated them is gone.
+        ThreadRecord *LocalRecord()
+        {
+            thread_local ThreadRecord *record = nullptr;
+            if (!record)
+            {
+                record = new ThreadRecord();
+                TrackerState &S = State();
+                std::lock_guard<std::mutex> lock(S.mutex);
+                S.threads.push_back(record);
+            }
+            return record;
+        }
+
+        const char *OwnerName(const char *owner)
+        {
+            return owner ? owner : "untagged";
+        }
+
+        void Charge(ThreadRecord *T, const char *owner, size_t bytes)
+        {
+            std::lock_guard<std::mutex> lock(T->mutex);
+            OwnerRecord &r = T->owners[owner];
+            r.current += bytes;
+            r.blocks++;
+            r.peak = std::max(r.peak, r.current);
+            T->current += bytes;
+            T->peak = std::max(T->peak, T->current);
+        }
+
+        void Discharge(const Block &b)
+        {
+            std::lock_guard<std::mutex> lock(b.thread->mutex);
+            OwnerRecord &r = b.thread->owners[b.owner];
+            r.current -= std::min(r.current, b.bytes);
+            r.blocks -= std::min<size_t>(r.blocks, 1);
+            b.thread->current -= std::min(b.thread->current, b.bytes);
+        }
+
+        // Sums the records of all threads per owner name. Expects S.mutex to be held.
+        std::map<std::string, OwnerRecord> MergeOwners(TrackerState &S)
+        {
+            std::map<std::string, OwnerRecord> merged;
+            for (ThreadRecord *T : S.threads)
+            {
+                std::lock_guard<std::mutex> lock(T->mutex);
+                for (auto &it : T->owners)
+                {
+                    OwnerRecord &r = merged[OwnerName(it.first)];
+                    r.current += it.second.current;
+                    r.peak += it.second.peak;
+                    r.blocks += it.second.blocks;
+                }
+            }
+            return merged;
+        }
+
+        // Reads a "Key:   value kB" line from /proc/self/status.
+        size_t ReadProcStatus(const std::string &key)
+        {
+            std::ifstream status("/proc/self/status");
+            std::string line;
+            while (std::getline(status, line))
+            {
+                if (line.compare(0, key.size(), key) == 0)
+                {
+                    return 1024 * std::stoul(line.substr(key.size() + 1));
+                }
+            }
+            return 0;
+        }
+    } // namespace
+
+    void MemoryTracker::Allocated(const void *ptr, size_t bytes)
+    {
+        if (!ptr)
+        {
+            return;
+        }
+        ThreadRecord *T = LocalRecord();
+        const char *owner = current_owner;
+        {
+            BlockShard &shard = ShardOf(State(), ptr);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.blocks[ptr] = Block{bytes, owner, T};
+        }
+        Charge(T, owner, bytes);
+    } // Allocated
+
+    void MemoryTracker::Freed(const void *ptr)
+    {
+        if (!ptr)
+        {
+            return;
+        }
+        Block b;
+        {
+            BlockShard &shard = ShardOf(State(), ptr);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto it = shard.blocks.find(ptr);
+            // Blocks allocated by MKL or before tracking was active are simply not known.
+            if (it == shard.blocks.end())
+            {
+                return;
+            }
+            b = it->second;
+            shard.blocks.erase(it);
+        }
+        Discharge(b);
+    } // Freed
+
+    void MemoryTracker::SetExternal(const void *key, const char *owner, size_t bytes)
+    {
+        ThreadRecord *T = LocalRecord();
+        TrackerState &S = State();
+        std::lock_guard<std::mutex> lock(S.mutex);
+        auto it = S.externals.find(key);
+        if (it != S.externals.end())
+        {
+            Discharge(it->second);
+        }
+        S.externals[key] = Block{bytes, owner, T};
+        Charge(T, owner, bytes);
+    } // SetExternal
+
+    void MemoryTracker::RemoveExternal(const void *key)
+    {
+        TrackerState &S = State();
+        std::lock_guard<std::mutex> lock(S.mutex);
+        auto it = S.externals.find(key);
+        if (it != S.externals.end())
+        {
+            Discharge(it->second);
+            S.externals.erase(it);
+        }
+    } // RemoveExternal
+
+    size_t MemoryTracker::CurrentBytes()
+    {
+        TrackerState &S = State();
+        std::lock_guard<std::mutex> lock(S.mutex);
+        size_t current = 0;
+        for (ThreadRecord *T : S.threads)
+        {
+            std::lock_guard<std::mutex> thread_lock(T->mutex);
+            current += T->current;
+        }
+        return current;
+    }
+
+    size_t MemoryTracker::PeakBytes()
+    {
+        TrackerState &S = State();
+        std::lock_guard<std::mutex> lock(S.mutex);
+        size_t peak = 0;
+        for (ThreadRecord *T : S.threads)
+        {
+            std::lock_guard<std::mutex> thread_lock(T->mutex);
+            peak += T->peak;
+        }
+        return peak;
+    }
+
+    void MemoryTracker::ResetPeak()
+    {
+        TrackerState &S = State();
+        std::lock_guard<std::mutex> lock(S.mutex);
+        for (ThreadRecord *T : S.threads)
+        {
+            std::lock_guard<std::mutex> thread_lock(T->mutex);
+            T->peak = T->current;
+            for (auto &it : T->owners)
+            {
+                it.second.peak = it.second.current;
+            }
+        }
+    } // ResetPeak
+
+    size_t MemoryTracker::CurrentRSS()
+    {
+#ifdef __linux__
+        return ReadProcStatus("VmRSS:");
+#else
+        return 0;
+#endif
+    }
+
+    size_t MemoryTracker::PeakRSS()
+    {
+#ifdef __linux__
+        size_t hwm = ReadProcStatus("VmHWM:");
+        if (hwm > 0)
+        {
+            return hwm;
+        }
+#endif
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+        {
+            return 0;
+        }
+#ifdef __APPLE__
+        return static_cast<size_t>(usage.ru_maxrss); // bytes on macOS
+#else
+        return 1024 * static_cast<size_t>(usage.ru_maxrss); // kilobytes on Linux
+#endif
+    } // PeakRSS
+
+    bool MemoryTracker::ResetPeakRSS()
+    {
+#ifdef __linux__
+        std::ofstream clear_refs("/proc/self/clear_refs");
+        if (clear_refs)
+        {
+            clear_refs << "5";
+            return static_cast<bool>(clear_refs.flush());
+        }
+#endif
+        return false;
+    } // ResetPeakRSS
+
+    void MemoryTracker::WriteSummary(std::ostream &os)
+    {
+        TrackerState &S = State();
+        std::lock_guard<std::mutex> lock(S.mutex);
+        std::map<std::string, OwnerRecord> owners = MergeOwners(S);
+        OwnerRecord total;
+        os << "Owner\tCurrentMB\tPeakMB\tBlocks" << std::endl;
+        for (auto &it : owners)
+        {
+            os << it.first << "\t"
+               << it.second.current / 1048576. << "\t"
+               << it.second.peak / 1048576. << "\t"
+               << it.second.blocks << std::endl;
+            total.current += it.second.current;
+            total.blocks += it.second.blocks;
+        }
+        for (ThreadRecord *T : S.threads)
+        {
+            std::lock_guard<std::mutex> thread_lock(T->mutex);
+            total.peak += T->peak;
+        }
+        os << "Total\t" << total.current / 1048576. << "\t" << total.peak / 1048576. << "\t" << total.blocks << std::endl;
+    } // WriteSummary
+
+    const char *MemoryTracker::CurrentOwner()
+    {
+        return current_owner;
+    }
+
+    void MemoryTracker::SetCurrentOwner(const char *owner)
+    {
+        current_owner = owner;
+    }
+
+    void MemoryEstimate::Print(std::ostream &os) const
+    {
+        const double MB = 1048576.;
+        os << "Estimated memory footprint:" << std::endl;
+        os << "  cluster tree         " << clusterTree / MB << " MB" << std::endl;
+        os << "  interaction data     " << interactionData / MB << " MB" << std::endl;
+        os << "  sparse LDLT factor   " << sparseFactor / MB << " MB" << std::endl;
+        os << "  Schur complement     " << schurComplement / MB << " MB" << std::endl;
+        os << "  Krylov basis         " << krylovBasis / MB << " MB" << std::endl;
+        os << "  total                " << total / MB << " MB" << std::endl;
+    } // Print
+
+    MemoryEstimate EstimateMemoryFootprint(long face_count, double theta, int thread_count,
+                                           long split_threshold, long constraint_rows, long gmres_restart)
+    {
+        const double F = static_cast<double>(std::max(face_count, 1L));
+        const double V = 0.5 * F + 2.;         // Euler characteristic of a closed surface of small genus
+        const double leaf_size = 0.5 * std::max(split_threshold, 2L);
+        const double leaves = std::ceil(F / leaf_size);
+        const double clusters = 2. * leaves - 1.;
+        const double d = sizeof(double);
+        const double i = sizeof(int);
+        const double T = std::max(thread_count, 1);
+
+        MemoryEstimate E;
+
+        // Per primitive: coordinates (3), hull (9), near (7), far (10), bounding boxes (6) and the tiled near data (7).
+        // Per cluster: far data (10), bounding boxes (6), coordinates (3), radius (1) and eight index arrays.
+        // Pre/post operators: averaging (3 nnz per face) and differential (27 nnz per face), each stored with its transpose.
+        // Buffers: input and output for up to 9 columns on primitives and clusters; per thread cluster scratch.
+        double tree = F * 42. * d
+                      + clusters * (20. * d + 8. * i)
+                      + 2. * 30. * F * (d + i)
+                      + 2. * 9. * (F + clusters) * d
+                      + T * clusters * 9. * d;
+        // Only one tree: the metric builds its block cluster tree on the BVH of the energy.
+        E.clusterTree = static_cast<size_t>(tree);
+
+        // A leaf interacts directly with the leaves within distance ~ diam/theta; on a surface, that count grows like 1/theta^2.
+        // theta = 0 means that everything is near field.
+        double near_nnz = F * F;
+        double far_blocks = 0.;
+        if (theta > 0.)
+        {
+            double k = 4. * (1. + 1. / theta) * (1. + 1. / theta);
+            near_nnz = std::min(F * F, F * leaf_size * k);
+            far_blocks = std::min(clusters * clusters, clusters * k);
+        }
+        // Three value arrays (high order, low order, fractional) and the column indices; the construction keeps
+        // both index lists per block, and thread interleaved counters per block row.
+        double interaction = near_nnz * (3. * d + i)
+                             + far_blocks * (3. * d + i)
+                             + 2. * (near_nnz / (leaf_size * leaf_size) + far_blocks) * i
+                             + T * (leaves + clusters) * i;
+        E.interactionData = static_cast<size_t>(interaction);
+
+        // Fill-in of a nested dissection LDLT on a surface mesh grows like V log V.
+        double factor_nnz = V * (6. + 2. * std::log2(V));
+        E.sparseFactor = static_cast<size_t>(factor_nnz * (d + i) + V * (d + 4. * i));
+
+        double n = 3. * V + constraint_rows;
+        E.schurComplement = static_cast<size_t>((2. * constraint_rows * n + constraint_rows * constraint_rows) * d);
+
+        E.krylovBasis = static_cast<size_t>(((gmres_restart + 1.) * n + (gmres_restart + 1.) * gmres_restart) * d);
+
+        E.total = E.clusterTree + E.interactionData + E.sparseFactor + E.schurComplement + E.krylovBasis;
+        return E;
+    } // EstimateMemoryFootprint
+
+} // namespace rsurfaces
@@ -0,0 +1,160 @@
+#include "mpi_context.h"
+
+#ifdef RSURFACES_MPI
+#include <mpi.h>
+#include <climits>
+#endif
+
+namespace rsurfaces
+{
+    int MPIContext::local_depth = 0;
+
+#ifdef RSURFACES_MPI
+
+    static bool mpi_initialized_here = false;
+
+    static bool Initialized()
+    {
+        int initialized = 0;
+        int finalized = 0;
+        MPI_Initialized(&initialized);
+        MPI_Finalized(&finalized);
+        return initialized && !finalized;
+    }
+
+    void MPIContext::Init(int *argc, char ***argv)
+    {
+        if (!Initialized())
+        {
+            // The ranks only communicate outside of parallel regions, so the master thread is enough.
+            int provided = 0;
+            MPI_Init_thread(argc, argv, MPI_THREAD_FUNNELED, &provided);
+            mpi_initialized_here = true;
+        }
+    } // Init
+
+    void MPIContext::Finalize()
+    {
+        if (mpi_initialized_here && Initialized())
+        {
+            MPI_Finalize();
+        }
+        mpi_initialized_here = false;
+    } // Finalize
+
+    mint MPIContext::Rank()
+    {
+        int rank = 0;
+        if (local_depth == 0 && Initialized())
+        {
+            MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+        }
+        return rank;
+    }
+
+    mint MPIContext::Size()
+    {
+        int size = 1;
+        if (local_depth == 0 && Initialized())
+        {
+            MPI_Comm_size(MPI_COMM_WORLD, &size);
+        }
+        return size;
+    }
+
+    bool MPIContext::Active()
+    {
+        return Size() > 1;
+    }
+
+    void MPIContext::LocalRange(mint count, mint &begin, mint &end)
+    {
+        long long rank = Rank();
+        long long size = Size();
+        begin = static_cast<mint>((count * rank) / size);
+        end = static_cast<mint>((count * (rank + 1)) / size);
+    } // LocalRange
+
+    void MPIContext::AllreduceSum(mreal *data, mint count)
+    {
+        if (!Active())
+        {
+            return;
+        }
+        ptic("MPIContext::AllreduceSum");
+        // MPI counts are ints; split very long buffers.
+        for (long long offset = 0; offset < count; offset += INT_MAX)
+        {
+            int chunk = static_cast<int>(std::min<long long>(count - offset, INT_MAX));
+            MPI_Allreduce(MPI_IN_PLACE, data + offset, chunk, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        }
+        ptoc("MPIContext::AllreduceSum");
+    } // AllreduceSum
+
+    mreal MPIContext::AllreduceSum(mreal value)
+    {
+        AllreduceSum(&value, 1);
+        return value;
+    }
+
+    long long MPIContext::AllreduceSum(long long value)
+    {
+        if (Active())
+        {
+            MPI_Allreduce(MPI_IN_PLACE, &value, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+        }
+        return value;
+    }
+
+    mreal MPIContext::AllreduceMax(mreal value)
+    {
+        if (Active())
+        {
+            MPI_Allreduce(MPI_IN_PLACE, &value, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+        }
+        return value;
+    }
+
+    void MPIContext::Broadcast(mreal *data, mint count, mint root)
+    {
+        if (!Active())
+        {
+            return;
+        }
+        for (long long offset = 0; offset < count; offset += INT_MAX)
+        {
+            int chunk = static_cast<int>(std::min<long long>(count - offset, INT_MAX));
+            MPI_Bcast(data + offset, chunk, MPI_DOUBLE, root, MPI_COMM_WORLD);
+        }
+    } // Broadcast
+
+    void MPIContext::Barrier()
+    {
+        if (Active())
+        {
+            MPI_Barrier(MPI_COMM_WORLD);
+        }
+    }
+
+#else
+
+    void MPIContext::Init(int *argc, char ***argv) {}
+    void MPIContext::Finalize() {}
+    mint MPIContext::Rank() { return 0; }
+    mint MPIContext::Size() { return 1; }
+    bool MPIContext::Active() { return false; }
+    void MPIContext::LocalRange(mint count, mint &begin, mint &end)
+    {
+        begin = 0;
+        end = count;
+    }
+    void MPIContext::AllreduceSum(mreal *data, mint count) {}
+    mreal MPIContext::AllreduceSum(mreal value) { return value; }
+    long long MPIContext::AllreduceSum(long long value) { return value; }
+    mreal MPIContext::AllreduceMax(mreal value) { return value; }
+    void MPIContext::Broadcast(mreal *data, mint count, mint root) {}
+    void MPIContext::Barrier() {}
+
+#endif
+
+} // namespace rsurfaces
@@ -0,0 +1,167 @@
+#include "obstacle_animation.h"
+#include "geometry_cache.h"
+
+#include <Eigen/Geometry>
+
+namespace rsurfaces
+{
+    namespace
+    {
+        inline Eigen::Vector3d toEigen(const Vector3 &v)
+        {
+            return Eigen::Vector3d(v.x, v.y, v.z);
+        }
+
+        inline Vector3 fromEigen(const Eigen::Vector3d &v)
+        {
+            return Vector3{v(0), v(1), v(2)};
+        }
+
+        inline Eigen::Quaterniond rotationOf(const scene::ObstacleKeyframe &key)
+        {
+            if (key.angle == 0 || norm(key.axis) == 0)
+            {
+                return Eigen::Quaterniond::Identity();
+            }
+            return Eigen::Quaterniond(Eigen::AngleAxisd(key.angle * M_PI / 180., toEigen(key.axis).normalized()));
+        }
+    } // namespace
+
+    AnimatedObstacle::AnimatedObstacle(TPObstacleBarnesHut0 *energy_, std::shared_ptr<surface::SurfaceMesh> mesh_, GeomPtr geom_,
+                                       const scene::ObstacleData &data, Vector3 offset)
+    {
+        energy = energy_;
+        mesh = mesh_;
+        geom = geom_;
+        keyframes = data.keyframes;
+        iterationsPerFrame = data.iterationsPerFrame;
+
+        size_t nVerts = mesh->nVertices();
+        frames.emplace_back(nVerts);
+        for (size_t i = 0; i < nVerts; i++)
+        {
+            frames[0][i] = geom->inputVertexPositions[i];
+        }
+
+        for (const std::string &name : data.frameNames)
+        {
+            std::unique_ptr<surface::SurfaceMesh> frameMesh;
+            GeomUPtr frameGeom;
+            std::tie(frameMesh, frameGeom) = readNonManifoldMesh(name);
+            if (frameMesh->nVertices() != nVerts || frameMesh->nFaces() != mesh->nFaces())
+            {
+                throw std::runtime_error("Obstacle frame " + name + " does not have the connectivity of " + data.obstacleName + ".");
+            }
+            frames.emplace_back(nVerts);
+            for (size_t i = 0; i < nVerts; i++)
+            {
+                frames.back()[i] = frameGeom->inputVertexPositions[i] + offset;
+            }
+        }
+
+        R.setIdentity();
+        t = Vector3{0, 0, 0};
+        R_rest.setIdentity();
+        t_rest = Vector3{0, 0, 0};
+        std::cout << "Animated obstacle " << data.obstacleName << ": " << keyframes.size() << " keyframes, "
+                  << frames.size() - 1 << " additional frames." << std::endl;
+    }
+
+    void AnimatedObstacle::Pose(long iteration, Eigen::Matrix3d &R_, Vector3 &t_) const
+    {
+        if (keyframes.empty())
+        {
+            R_.setIdentity();
+            t_ = Vector3{0, 0, 0};
+            return;
+        }
+        if (iteration <= keyframes.front().iteration)
+        {
+            R_ = rotationOf(keyframes.front()).toRotationMatrix();
+            t_ = keyframes.front().translation;
+            return;
+        }
+        if (iteration >= keyframes.back().iteration)
+        {
+            R_ = rotationOf(keyframes.back()).toRotationMatrix();
+            t_ = keyframes.back().translation;
+            return;
+        }
+
+        size_t k = 0;
+        while (keyframes[k + 1].iteration <= iteration)
+        {
+            k++;
+        }
+        const scene::ObstacleKeyframe &k0 = keyframes[k];
+        const scene::ObstacleKeyframe &k1 = keyframes[k + 1];
+        double s = double(iteration - k0.iteration) / double(k1.iteration - k0.iteration);
+
+        R_ = rotationOf(k0).slerp(s, rotationOf(k1)).toRotationMatrix();
+        t_ = (1 - s) * k0.translation + s * k1.translation;
+    }
+
+    Vector3 AnimatedObstacle::FramePosition(long it, size_t i) const
+    {
+        size_t f = it / iterationsPerFrame;
+        size_t next = std::min(f + 1, frames.size() - 1);
+        double s = double(it - long(f) * iterationsPerFrame) / double(iterationsPerFrame);
+        return (1 - s) * frames[f][i] + s * frames[next][i];
+    }
+
+    bool AnimatedObstacle::Advance(long iteration)
+    {
+        ptic("AnimatedObstacle::Advance");
+
+        Eigen::Matrix3d R_new;
+        Vector3 t_new;
+        Pose(iteration, R_new, t_new);
+
+        long lastFrameIteration = (long(frames.size()) - 1) * iterationsPerFrame;
+        long it = std::min(std::max(iteration, 0L), lastFrameIteration);
+
+        if (it != frameIteration)
+        {
+            // The shape changes, so the tree has to be refit; the rigid pose is simply baked into the positions.
+            for (size_t i = 0; i < frames[0].size(); i++)
+            {
+                geom->inputVertexPositions[i] = fromEigen(R_new * toEigen(FramePosition(it, i))) + t_new;
+            }
+            geom->refreshQuantities();
+            GeometryCache::PositionsChanged(geom);
+            energy->RefitObstacle(mesh, geom);
+
+            R = R_rest = R_new;
+            t = t_rest = t_new;
+            frameIteration = it;
+            ptoc("AnimatedObstacle::Advance");
+            return true;
+        }
+
+        if (R_new == R && t_new == t)
+        {
+            ptoc("AnimatedObstacle::Advance");
+            return false;
+        }
+
+        // The tree is transformed from its rest pose, whose positions carry the pose (R_rest, t_rest):
+        // x_new = R_new R_rest^T (x - t_rest) + t_new
+        Eigen::Matrix3d dR = R_new * R_rest.transpose();
+        Vector3 db = t_new - fromEigen(dR * toEigen(t_rest));
+
+        energy->TransformObstacle(dR, db);
+
+        // Only for display and for later users of the geometry; the tree is already up to date.
+        for (size_t i = 0; i < frames[0].size(); i++)
+        {
+            geom->inputVertexPositions[i] = fromEigen(R_new * toEigen(FramePosition(frameIteration, i))) + t_new;
+        }
+        GeometryCache::PositionsChanged(geom);
+
+        R = R_new;
+        t = t_new;
+        ptoc("AnimatedObstacle::Advance");
+        return true;
+    }
+
+} // namespace rsurfaces
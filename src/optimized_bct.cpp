@@ -1,12 +1,15 @@
 #include "optimized_bct.h"
+#include "thread_load.h"
+#include "mpi_context.h"
 
 namespace rsurfaces
 {
-    BCTSettings BCTDefaultSettings = BCTSettings();
+    thread_local BCTSettings BCTDefaultSettings = BCTSettings();
     
     OptimizedBlockClusterTree::OptimizedBlockClusterTree(OptimizedClusterTree* S_, OptimizedClusterTree* T_, const mreal alpha_, const mreal beta_, const mreal theta_, mreal weight_, BCTSettings settings_)
     {
         ptic("OptimizedBlockClusterTree::OptimizedBlockClusterTree");
+        MemoryOwner memory_owner("OptimizedBlockClusterTree");
         S = S_;
         T = T_;
         alpha = alpha_;
@@ -34,6 +37,16 @@ namespace rsurfaces
                                                             //    fr_exponent = - 0.5 * (2.0 * exp_s + intrinsic_dim); // from Chris' code
                                                             //    fr_exponent =  -0.5 * ( 2. (2. - exp_s) + intrinsic_dim); //shouldn't it be this?
 
+        // Decay rate of the kernels in the distance: beta - alpha for the energy, -2 * hi_exponent for the metric.
+        mreal decay = std::max(beta - alpha, -2.0 * hi_exponent);
+        admissibility_c2 = 0.5 * decay * (decay + 1.0);
+        admissibility_cn = std::abs(alpha * (alpha - 2.0)) / 8.0;
+        // For uniform flat clusters, C_squared_spread is a quarter to a half of C_squared_radius,
+        // so blocks at the fixed criterion get an estimate of at least about admissibility_c2 * theta2 / 2.
+        admissibility_tol = (settings.admissibility_tolerance > 0.) ? settings.admissibility_tolerance : 0.5 * admissibility_c2 * theta2;
+        // By default, the estimate may only tighten the fixed criterion.
+        admissibility_max_theta2 = (settings.admissibility_max_theta > 0.) ? settings.admissibility_max_theta * settings.admissibility_max_theta : theta2;
+
         #pragma omp parallel
         {
             thread_count = omp_get_num_threads();
@@ -41,11 +54,21 @@ namespace rsurfaces
         }
         
         RequireBlockClusters();
+        
+        rank_leaf_end = S->leaf_cluster_count;
+        rank_primitive_end = S->primitive_count;
+        if( settings.distribute_over_ranks && MPIContext::Active() )
+        {
+            DistributeBlockRows();
+        }
 
         // TODO: The following line should be moved to InternalMultiply in order to delay matrix creation to a time when it is actually needed. Otherwise, using the BCT for line search (evaluating only the energy), the time for creating the matrices would be wasted.
         
         RequireMetrics();
 
+        ptcounter("near field nnz", near->nnz);
+        ptcounter("far field nnz", far->nnz);
+
         ptoc("OptimizedBlockClusterTree::OptimizedBlockClusterTree");
     }; // Constructor
 
@@ -58,6 +81,7 @@ namespace rsurfaces
         if( !block_clusters_initialized )
         {
             ptic("RequireBlockClusters");
+            MemoryOwner memory_owner("OptimizedBlockClusterTree");
             auto thread_sep_idx = A_Vector<A_Deque<mint>>(tree_thread_count);
             auto thread_sep_jdx = A_Vector<A_Deque<mint>>(tree_thread_count);
             
@@ -66,13 +90,11 @@ namespace rsurfaces
             
             ptic("SplitBlockCluster");
             
-            #pragma omp parallel num_threads(tree_thread_count) shared(thread_sep_idx, thread_sep_jdx, thread_nonsep_idx, thread_nonsep_jdx)
-            {
-                #pragma omp single nowait
-                {
-                    SplitBlockCluster(thread_sep_idx, thread_sep_jdx, thread_nonsep_idx, thread_nonsep_jdx, 0, 0, tree_thread_count);
-                }
-            }
+            build_grain = TreeTaskScheduler::Grain( S->primitive_count + T->primitive_count, tree_thread_count, settings.min_task_grain );
+            
+            TreeTaskScheduler::Run( tree_thread_count, [&]{
+                SplitBlockCluster(thread_sep_idx, thread_sep_jdx, thread_nonsep_idx, thread_nonsep_jdx, 0, 0);
+            });
             
             mint sep_blockcluster_count = 0;
             mint nonsep_blockcluster_count = 0;
@@ -95,18 +117,69 @@ namespace rsurfaces
         }
     }; //RequireBlockClusters
 
+    namespace
+    {
+        // Spread of the normals of cluster C, from the averaged projector n n^T (or the averaged normal): 0 if all are parallel.
+        inline mreal normalVariance(const OptimizedClusterTree *tree, const mint C)
+        {
+            if (tree->far_dim == 10)
+            {
+                mreal xx = tree->C_far[4][C];
+                mreal xy = tree->C_far[5][C];
+                mreal xz = tree->C_far[6][C];
+                mreal yy = tree->C_far[7][C];
+                mreal yz = tree->C_far[8][C];
+                mreal zz = tree->C_far[9][C];
+                return std::max(0., 1. - (xx * xx + yy * yy + zz * zz + 2. * (xy * xy + xz * xz + yz * yz)));
+            }
+            if (tree->far_dim == 7)
+            {
+                mreal n1 = tree->C_far[4][C];
+                mreal n2 = tree->C_far[5][C];
+                mreal n3 = tree->C_far[6][C];
+                return std::max(0., 1. - (n1 * n1 + n2 * n2 + n3 * n3));
+            }
+            return 0.;
+        }
+    } // namespace
+
+    // Estimates the relative error of the far field approximation of the block (i, j) from the cluster moments.
+    // Expanding |x - y|^-decay about the cluster centers, the first order terms vanish because the centers are the
+    // weighted means; the second order term is about decay * (decay + 1) / 2 * (spread_i + spread_j) / |c_i - c_j|^2.
+    // Averaging the projectors is exact for alpha = 2 and for flat clusters; otherwise the error grows with the normal spread.
+    bool OptimizedBlockClusterTree::admissibleByErrorEstimate(const mint i, const mint j, const mreal h2, const mreal R2) const
+    {
+        // also rejects touching bounding boxes
+        if (!(h2 < admissibility_max_theta2 * R2))
+        {
+            return false;
+        }
+
+        // The centers lie in the boxes, so d2 >= R2 > 0.
+        mreal d2 = 0.;
+        for (mint k = 0; k < dim; ++k)
+        {
+            mreal delta = S->C_coords[k][i] - T->C_coords[k][j];
+            d2 += delta * delta;
+        }
+
+        mreal estimate = admissibility_c2 * (S->C_squared_spread[i] + T->C_squared_spread[j]) / d2
+                       + admissibility_cn * std::max(normalVariance(S, i), normalVariance(T, j));
+
+        return estimate <= admissibility_tol;
+    } // admissibleByErrorEstimate
+
     void OptimizedBlockClusterTree::SplitBlockCluster(
         A_Vector<A_Deque<mint>> &sep_i,
         A_Vector<A_Deque<mint>> &sep_j,
         A_Vector<A_Deque<mint>> &nsep_i,
         A_Vector<A_Deque<mint>> &nsep_j,
         const mint i,
-        const mint j,
-        const mint free_thread_count
+        const mint j
     )
     {
         //    std::pair<mint,mint> minmax;
-        mint thread = omp_get_thread_num();
+        mint thread = TreeTaskScheduler::ThreadIndex();
 
         mreal r2i = S->C_squared_radius[i];
         mreal r2j = T->C_squared_radius[j];
@@ -128,7 +201,9 @@ namespace rsurfaces
             R2 += dk * dk;
         }
 
-        if (h2 > theta2 * R2)
+        bool admissible = settings.adaptive_admissibility ? admissibleByErrorEstimate(i, j, h2, R2) : !(h2 > theta2 * R2);
+
+        if (!admissible)
         {
 
             mint lefti = S->C_left[i];
@@ -140,6 +215,8 @@ namespace rsurfaces
             // Warning: This assumes that either both children are defined or empty.
             if ((lefti >= 0) || (leftj >= 0))
             {
+                // The block cluster's subtree is roughly proportional to the number of primitives of both clusters.
+                bool spawn = (S->C_end[i] - S->C_begin[i]) + (T->C_end[j] - T->C_begin[j]) > build_grain;
 
                 mreal scorei = (lefti >= 0) ? r2i : 0.;
                 mreal scorej = (leftj >= 0) ? r2j : 0.;
@@ -153,35 +230,24 @@ namespace rsurfaces
                     if ((settings.exploit_symmetry) && (i == j))
                     {
                         //                mma::print(" Creating 3 blockcluster children.");
-                        mint spawncount = free_thread_count / 3;
-                        mint remainder = free_thread_count % 3;
-
 // TODO: These many arguments in the function calls might excert quite a pressure on the stack. Is there a better way to share sep_i, sep_j, nsep_i, nsep_j among all threads other than making them members of the class?
-                        #pragma omp task final(free_thread_count < 1) firstprivate(lefti, leftj, spawncount, remainder) shared(sep_i, sep_j, nsep_i, nsep_j)
-                        SplitBlockCluster(sep_i, sep_j, nsep_i, nsep_j, lefti, leftj, spawncount + (remainder > 0));
-                        #pragma omp task final(free_thread_count < 1) firstprivate(lefti, rightj, spawncount, remainder) shared(sep_i, sep_j, nsep_i, nsep_j)
-                        SplitBlockCluster(sep_i, sep_j, nsep_i, nsep_j, lefti, rightj, spawncount + (remainder > 2));
-                        #pragma omp task final(free_thread_count < 1) firstprivate(righti, rightj, spawncount, remainder) shared(sep_i, sep_j, nsep_i, nsep_j)
-                        SplitBlockCluster(sep_i, sep_j, nsep_i, nsep_j, righti, rightj, spawncount);
-                        //                    #pragma omp taskwait
+                        TreeTaskScheduler::ForkJoin( spawn,
+                            [&]{ SplitBlockCluster(sep_i, sep_j, nsep_i, nsep_j, lefti, leftj); },
+                            [&]{ SplitBlockCluster(sep_i, sep_j, nsep_i, nsep_j, lefti, rightj); },
+                            [&]{ SplitBlockCluster(sep_i, sep_j, nsep_i, nsep_j, righti, rightj); }
+                        );
                     }
                     else
                     {
                         // In case of settings.exploit_symmetry !=0, this is a very seldom case; still requird to preserve symmetry.
                         // This happens only if i and j represent _diffent clusters with same radii.
 
-                        mint spawncount = free_thread_count / 4;
-                        mint remainder = free_thread_count % 4;
-
-                        #pragma omp task final(free_thread_count < 1) firstprivate(lefti, leftj, spawncount, remainder) shared(sep_i, sep_j, nsep_i, nsep_j)
-                        SplitBlockCluster(sep_i, sep_j, nsep_i, nsep_j, lefti, leftj, spawncount + (remainder > 0));
-                        #pragma omp task final(free_thread_count < 1) firstprivate(righti, leftj, spawncount, remainder) shared(sep_i, sep_j, nsep_i, nsep_j)
-                        SplitBlockCluster(sep_i, sep_j, nsep_i, nsep_j, righti, leftj, spawncount + (remainder > 1));
-                        #pragma omp task final(free_thread_count < 1) firstprivate(lefti, rightj, spawncount, remainder) shared(sep_i, sep_j, nsep_i, nsep_j)
-                        SplitBlockCluster(sep_i, sep_j, nsep_i, nsep_j, lefti, rightj, spawncount + (remainder > 2));
-                        #pragma omp task final(free_thread_count < 1) firstprivate(righti, rightj, spawncount) shared(sep_i, sep_j, nsep_i, nsep_j)
-                        SplitBlockCluster(sep_i, sep_j, nsep_i, nsep_j, righti, rightj, spawncount);
-                        //                    #pragma omp taskwait
+                        TreeTaskScheduler::ForkJoin( spawn,
+                            [&]{ SplitBlockCluster(sep_i, sep_j, nsep_i, nsep_j, lefti, leftj); },
+                            [&]{ SplitBlockCluster(sep_i, sep_j, nsep_i, nsep_j, righti, leftj); },
+                            [&]{ SplitBlockCluster(sep_i, sep_j, nsep_i, nsep_j, lefti, rightj); },
+                            [&]{ SplitBlockCluster(sep_i, sep_j, nsep_i, nsep_j, righti, rightj); }
+                        );
                     }
                 }
                 else
@@ -190,20 +256,18 @@ namespace rsurfaces
                     if (scorei > scorej)
                     {
                         //split cluster i
-                        #pragma omp task final(free_thread_count < 1) firstprivate(lefti) shared(sep_i, sep_j, nsep_i, nsep_j)
-                        SplitBlockCluster(sep_i, sep_j, nsep_i, nsep_j, lefti, j, free_thread_count / 2);
-                        #pragma omp task final(free_thread_count < 1) firstprivate(righti) shared(sep_i, sep_j, nsep_i, nsep_j)
-                        SplitBlockCluster(sep_i, sep_j, nsep_i, nsep_j, righti, j, free_thread_count - free_thread_count / 2);
-                        //                    #pragma omp taskwait
+                        TreeTaskScheduler::ForkJoin( spawn,
+                            [&]{ SplitBlockCluster(sep_i, sep_j, nsep_i, nsep_j, lefti, j); },
+                            [&]{ SplitBlockCluster(sep_i, sep_j, nsep_i, nsep_j, righti, j); }
+                        );
                     }
                     else //scorei < scorej
                     {
 //split cluster j
-                        #pragma omp task final(free_thread_count < 1) firstprivate(leftj) shared(sep_i, sep_j, nsep_i, nsep_j)
-                        SplitBlockCluster(sep_i, sep_j, nsep_i, nsep_j, i, leftj, free_thread_count / 2);
-                        #pragma omp task final(free_thread_count < 1) firstprivate(rightj) shared(sep_i, sep_j, nsep_i, nsep_j)
-                        SplitBlockCluster(sep_i, sep_j, nsep_i, nsep_j, i, rightj, free_thread_count - free_thread_count / 2);
-                        //                    #pragma omp taskwait
+                        TreeTaskScheduler::ForkJoin( spawn,
+                            [&]{ SplitBlockCluster(sep_i, sep_j, nsep_i, nsep_j, i, leftj); },
+                            [&]{ SplitBlockCluster(sep_i, sep_j, nsep_i, nsep_j, i, rightj); }
+                        );
                     }
                 }
             }
@@ -295,6 +359,59 @@ namespace rsurfaces
     }; //SplitBlockCluster
 
 
+    void OptimizedBlockClusterTree::DistributeBlockRows()
+    {
+        ptic("OptimizedBlockClusterTree::DistributeBlockRows");
+        MemoryOwner memory_owner("OptimizedBlockClusterTree");
+        
+        mint rank = MPIContext::Rank();
+        mint rank_count = MPIContext::Size();
+        
+        // The work of a near field block row is proportional to the number of primitive pairs in it.
+        mint leaf_count = S->leaf_cluster_count;
+        A_Vector<mreal> costs ( leaf_count );
+        for( mint b_i = 0; b_i < leaf_count; ++b_i )
+        {
+            mint rows = S->leaf_cluster_ptr[b_i+1] - S->leaf_cluster_ptr[b_i];
+            mint cols = 0;
+            for( mint k = near->b_outer[b_i]; k < near->b_outer[b_i+1]; ++k )
+            {
+                mint b_j = near->b_inner[k];
+                cols += T->leaf_cluster_ptr[b_j+1] - T->leaf_cluster_ptr[b_j];
+            }
+            costs[b_i] = static_cast<mreal>(rows) * cols + 1.;
+        }
+        
+        // Every rank computes the same partition from the same (replicated) data.
+        mint * rank_ptr = nullptr;
+        BalanceWorkLoad( leaf_count, &costs[0], rank_count, rank_ptr );
+        rank_leaf_begin = rank_ptr[rank];
+        rank_leaf_end   = rank_ptr[rank+1];
+        rank_primitive_begin = S->leaf_cluster_ptr[rank_leaf_begin];
+        rank_primitive_end   = S->leaf_cluster_ptr[rank_leaf_end];
+        safe_free( rank_ptr );
+        
+        A_Vector<mint> keep_near ( near->b_m, 0 );
+        for( mint b_i = rank_leaf_begin; b_i < rank_leaf_end; ++b_i )
+        {
+            keep_near[b_i] = 1;
+        }
+        
+        A_Vector<mint> keep_far ( far->b_m, 0 );
+        for( mint i = 0; i < far->b_m; ++i )
+        {
+            mint first = S->C_begin[i];
+            keep_far[i] = ( rank_primitive_begin <= first ) && ( first < rank_primitive_end );
+        }
+        
+        near->RestrictBlockRows( &keep_near[0] );
+         far->RestrictBlockRows( &keep_far[0] );
+        
+        distributed = true;
+        
+        ptoc("OptimizedBlockClusterTree::DistributeBlockRows");
+    }; // DistributeBlockRows
+
     //######################################################################################################################################
     //      Initialization of metrics
     //######################################################################################################################################
@@ -303,6 +420,7 @@ namespace rsurfaces
     void OptimizedBlockClusterTree::RequireMetrics()
     {
         ptic("OptimizedBlockClusterTree::RequireMetrics");
+        MemoryOwner memory_owner("OptimizedBlockClusterTree");
         if( !metrics_initialized )
         {
             far->Prepare_CSR();
@@ -364,6 +482,7 @@ namespace rsurfaces
         mreal t1 = intrinsic_dim == 1;
         mreal t2 = intrinsic_dim == 2;
         
+        ThreadLoad load ("OptimizedBlockClusterTree::FarFieldInteraction", thread_count);
         
         if( S->far_dim == 10 && T->far_dim == 10 )
         {
@@ -404,6 +523,8 @@ namespace rsurfaces
                 mreal p23 = P23[i];
                 mreal p33 = P33[i];
                 
+                mreal start = ThreadLoad::Now();
+                
                 mint k_begin = b_outer[i];
                 mint k_end = b_outer[i+1];
                 // This loop can be SIMDized straight-forwardly (horizontal SIMDization).
@@ -418,6 +539,8 @@ namespace rsurfaces
                                          t1, t2, hi_exponent,
                                          fr_values[k], lo_values[k], hi_values[k] );
                 }
+                
+                load.Add( omp_get_thread_num(), ThreadLoad::Now() - start, k_end - k_begin );
             }
         }
         else
@@ -450,6 +573,8 @@ namespace rsurfaces
                 mreal n2 = N2[i];
                 mreal n3 = N3[i];
 
+                mreal start = ThreadLoad::Now();
+                
                 mint k_begin = b_outer[i];
                 mint k_end = b_outer[i+1];
                 // This loop can be SIMDized straight-forwardly (horizontal SIMDization).
@@ -464,6 +589,8 @@ namespace rsurfaces
                                          t1, t2, hi_exponent,
                                          fr_values[k], lo_values[k], hi_values[k] );
                 }
+                
+                load.Add( omp_get_thread_num(), ThreadLoad::Now() - start, k_end - k_begin );
             }
         }
         ptoc("OptimizedBlockClusterTree::FarFieldInteraction");
@@ -496,6 +623,8 @@ namespace rsurfaces
 
             mreal regularization = is_symmetric ? 1. : 0.;
             
+            ThreadLoad load ("OptimizedBlockClusterTree::NearFieldInteraction_CSR", thread_count);
+            
             if( S->near_dim == 10 && T->near_dim == 10 )
             {
                 // using projectors on primitives (correct, but normals are more efficient)
@@ -531,6 +660,8 @@ namespace rsurfaces
                     mint b_i_begin = near->job_ptr[ thread ];
                     mint b_i_end   = near->job_ptr[ thread + 1 ];
                     
+                    mreal start = ThreadLoad::Now();
+                    
                     for( mint b_i = b_i_begin; b_i < b_i_end; ++ b_i)
                     {
                         mint k_begin = b_outer[b_i];
@@ -578,6 +709,8 @@ namespace rsurfaces
                             }
                         }
                     }
+                    
+                    load.Add( thread, ThreadLoad::Now() - start, outer[ b_row_ptr[b_i_end] ] - outer[ b_row_ptr[b_i_begin] ] );
                 }
             }
             else
@@ -593,12 +726,11 @@ namespace rsurfaces
                 mreal const * restrict const N2 = &S->P_near[5][0];
                 mreal const * restrict const N3 = &S->P_near[6][0];
                 
-                mreal const * restrict const Y1 = &T->P_near[1][0];
-                mreal const * restrict const Y2 = &T->P_near[2][0];
-                mreal const * restrict const Y3 = &T->P_near[3][0];
-                mreal const * restrict const M1 = &T->P_near[4][0];
-                mreal const * restrict const M2 = &T->P_near[5][0];
-                mreal const * restrict const M3 = &T->P_near[6][0];
+                // The target side is read from the leaf-tiled copy of T->P_near, so that the innermost loop has a fixed trip count of SIMD_TILE_WIDTH.
+                mreal const * restrict const Y_tiled = T->P_near_tiled;
+                mint const * restrict const tile_ptr = T->leaf_tile_ptr;
+                const mint W = SIMD_TILE_WIDTH;
+                const mint tile_size = T->near_dim * W;
                 
                 // Using b_i and b_j for block (leaf cluster) positions.
                 // Using i and j for primitive positions.
@@ -609,6 +741,8 @@ namespace rsurfaces
                     mint b_i_begin = near->job_ptr[ thread ];
                     mint b_i_end   = near->job_ptr[ thread + 1 ];
                     
+                    mreal start = ThreadLoad::Now();
+                    
                     for( mint b_i = b_i_begin; b_i < b_i_end; ++ b_i)
                     {
                         mint k_begin = b_outer[b_i];
@@ -639,21 +773,44 @@ namespace rsurfaces
                                 mint j_begin = b_col_ptr[b_j];
                                 mint j_end = b_col_ptr[b_j + 1];
                                 
-                                #pragma omp simd aligned( Y1, Y2, Y3, M1, M2, M3 : ALIGN )
-                                for (mint j = j_begin; j < j_end; ++j)
+                                for( mint t = tile_ptr[b_j]; t < tile_ptr[b_j + 1]; ++t )
                                 {
-                                    ComputeInteraction( x1, x2, x3, n1, n2, n3,
-                                                         Y1[j], Y2[j], Y3[j], M1[j], M2[j], M3[j],
-                                                         t1, t2, hi_exponent,
-                                                         fr_values[ptr], lo_values[ptr], hi_values[ptr],
-                                                         (i == j) * regularization );
-                                                                        
-                                    // Increment ptr, so that the next value is written to the next position.
-                                    ++ptr;
+                                    mreal const * restrict const tile = Y_tiled + tile_size * t;
+                                    mint j_0 = j_begin + W * (t - tile_ptr[b_j]);
+                                    
+                                    mreal fr [SIMD_TILE_WIDTH];
+                                    mreal lo [SIMD_TILE_WIDTH];
+                                    mreal hi [SIMD_TILE_WIDTH];
+                                    
+                                    #pragma omp simd aligned( tile : ALIGN )
+                                    for( mint lane = 0; lane < W; ++lane )
+                                    {
+                                        mint j = j_0 + lane;
+                                        // Padding lanes get regularized like the diagonal; their values are discarded below.
+                                        mreal pad = static_cast<mreal>( j >= j_end );
+                                        ComputeInteraction( x1, x2, x3, n1, n2, n3,
+                                                             tile[ W * 1 + lane ], tile[ W * 2 + lane ], tile[ W * 3 + lane ],
+                                                             tile[ W * 4 + lane ], tile[ W * 5 + lane ], tile[ W * 6 + lane ],
+                                                             t1, t2, hi_exponent,
+                                                             fr[lane], lo[lane], hi[lane],
+                                                             pad + (1. - pad) * (i == j) * regularization );
+                                    }
+                                    
+                                    mint lane_end = std::min( W, j_end - j_0 );
+                                    for( mint lane = 0; lane < lane_end; ++lane )
+                                    {
+                                        fr_values[ptr] = fr[lane];
+                                        lo_values[ptr] = lo[lane];
+                                        hi_values[ptr] = hi[lane];
+                                        // Increment ptr, so that the next value is written to the next position.
+                                        ++ptr;
+                                    }
                                 }
                             }
                         }
                     }
+                    
+                    load.Add( thread, ThreadLoad::Now() - start, outer[ b_row_ptr[b_i_end] ] - outer[ b_row_ptr[b_i_begin] ] );
                 }
             }
         }
@@ -881,6 +1038,8 @@ namespace rsurfaces
         near->ApplyKernel( type, T->P_in, S->P_out, cols, -2.0, settings.mult_alg);
          far->ApplyKernel( type, T->C_in, S->C_out, cols, -2.0, settings.mult_alg);
         
+        ReduceOverRanks( cols );
+        
         // I know, this looks awful... hash tables with keys from BCTKernelType would be nicer.
         switch (type)
         {
@@ -933,10 +1092,36 @@ namespace rsurfaces
         ptoc("OptimizedBlockClusterTree::InternalMultiply");
     }; // InternalMultiply
 
+    void OptimizedBlockClusterTree::ReduceOverRanks(const mint cols) const
+    {
+        // Each rank has applied only its own block rows; the rows of the other ranks are zero.
+        if( distributed )
+        {
+            ptic("OptimizedBlockClusterTree::ReduceOverRanks");
+            MPIContext::AllreduceSum( S->P_out, S->primitive_count * cols );
+            MPIContext::AllreduceSum( S->C_out, S->cluster_count * cols );
+            ptoc("OptimizedBlockClusterTree::ReduceOverRanks");
+        }
+    }; // ReduceOverRanks
+
+    mreal OptimizedBlockClusterTree::SumOverRanks(mreal value) const
+    {
+        return distributed ? MPIContext::AllreduceSum( value ) : value;
+    }
+
+    void OptimizedBlockClusterTree::SumOverRanks(mreal * data, mint count) const
+    {
+        if( distributed )
+        {
+            MPIContext::AllreduceSum( data, count );
+        }
+    }
+
     // TODO: Needs to be adjusted when S and T are not the same!!!
     void OptimizedBlockClusterTree::ComputeDiagonals()
     {
         ptic("OptimizedBlockClusterTree::ComputeDiagonals");
+        MemoryOwner memory_owner("OptimizedBlockClusterTree");
         if( true )
         {
             mint cols = 1;
@@ -968,9 +1153,17 @@ namespace rsurfaces
             // The factor of 2. in the last argument stems from the symmetry of the kernel
              far->ApplyKernel( BCTKernelType::FractionalOnly, T->C_in, S->C_out, cols, 2., settings.mult_alg);
             near->ApplyKernel( BCTKernelType::FractionalOnly, T->P_in, S->P_out, cols, 2., settings.mult_alg);
+            ReduceOverRanks( cols );
             
-            S->PercolateDown();
-            S->C_to_P.Multiply( S->C_out, S->P_out, cols, true);
+            if( S->settings.fused_prepost )
+            {
+                S->PercolateDown_Fused();
+            }
+            else
+            {
+                S->PercolateDown();
+                S->C_to_P.Multiply( S->C_out, S->P_out, cols, true);
+            }
             
 
             // TODO: Explain the hack of dividing by S->P_near[0][i] here to a future self so that he won't change this later.
@@ -991,9 +1184,17 @@ namespace rsurfaces
             
              far->ApplyKernel( BCTKernelType::HighOrder, T->C_in, S->C_out, cols, 2., settings.mult_alg);
             near->ApplyKernel( BCTKernelType::HighOrder, T->P_in, S->P_out, cols, 2., settings.mult_alg);
+            ReduceOverRanks( cols );
             
-            S->PercolateDown();
-            S->C_to_P.Multiply( S->C_out, S->P_out, cols, true);
+            if( S->settings.fused_prepost )
+            {
+                S->PercolateDown_Fused();
+            }
+            else
+            {
+                S->PercolateDown();
+                S->C_to_P.Multiply( S->C_out, S->P_out, cols, true);
+            }
             
             #pragma omp parallel for simd aligned( ainv, hi_diag, data : ALIGN)
             for( mint i = 0; i < m; ++i )
@@ -1003,9 +1204,17 @@ namespace rsurfaces
              
              far->ApplyKernel( BCTKernelType::LowOrder, T->C_in, S->C_out, cols, 2., settings.mult_alg);
             near->ApplyKernel( BCTKernelType::LowOrder, T->P_in, S->P_out, cols, 2., settings.mult_alg);
+            ReduceOverRanks( cols );
             
-            S->PercolateDown();
-            S->C_to_P.Multiply( S->C_out, S->P_out, cols, true);
+            if( S->settings.fused_prepost )
+            {
+                S->PercolateDown_Fused();
+            }
+            else
+            {
+                S->PercolateDown();
+                S->C_to_P.Multiply( S->C_out, S->P_out, cols, true);
+            }
             
             #pragma omp parallel for simd aligned( ainv, lo_diag, data : ALIGN)
             for( mint i = 0; i < m; ++i )
@@ -2,9 +2,9 @@
 
 namespace rsurfaces
 {
-    std::deque<std::chrono::time_point<std::chrono::steady_clock>> Timers::time_stack;
-    std::chrono::time_point<std::chrono::steady_clock> Timers::start_time;
-    std::chrono::time_point<std::chrono::steady_clock> Timers::stop_time;
+    thread_local std::deque<std::chrono::time_point<std::chrono::steady_clock>> Timers::time_stack;
+    thread_local std::chrono::time_point<std::chrono::steady_clock> Timers::start_time;
+    thread_local std::chrono::time_point<std::chrono::steady_clock> Timers::stop_time;
 
     
     void BalanceWorkLoad( mint job_count, mint * job_acc_costs, mint thread_count, mint * & job_ptr )
@@ -91,4 +91,31 @@ namespace rsurfaces
         ptoc("BalanceWorkLoad");
     } // BalanceWorkLoad
     
+    void BalanceWorkLoad( mint job_count, const mreal * job_costs, mint thread_count, mint * & job_ptr )
+    {
+        ptic("BalanceWorkLoad (measured)");
+        safe_alloc( job_ptr, thread_count + 1);
+        job_ptr[0] = 0;
+        job_ptr[ thread_count ] = job_count;
+        
+        A_Vector<mreal> job_acc_costs ( job_count + 1 );
+        job_acc_costs[0] = 0.;
+        for( mint i = 0; i < job_count; ++i )
+        {
+            job_acc_costs[i+1] = job_acc_costs[i] + job_costs[i];
+        }
+        
+        mreal per_thread_cost = job_acc_costs[job_count] / thread_count;
+        
+        // first job whose accumulated cost reaches the target; job_acc_costs is sorted, so a binary search suffices
+        for( mint thread = 0; thread < thread_count - 1; ++thread)
+        {
+            mreal target = per_thread_cost * (thread + 1);
+            job_ptr[thread + 1] = std::lower_bound( job_acc_costs.begin(), job_acc_costs.end(), target ) - job_acc_costs.begin();
+            job_ptr[thread + 1] = std::max( job_ptr[thread], std::min( job_count, job_ptr[thread + 1] ) );
+        }
+        
+        ptoc("BalanceWorkLoad (measured)");
+    } // BalanceWorkLoad
+    
 } // namespace rsurfaces
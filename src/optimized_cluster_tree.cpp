@@ -3,7 +3,7 @@
 namespace rsurfaces
 {
     
-    BVHSettings BVHDefaultSettings = BVHSettings();
+    thread_local BVHSettings BVHDefaultSettings = BVHSettings();
 
     Cluster2::Cluster2(mint begin_, mint end_, mint depth_)
     {
@@ -37,6 +37,7 @@ namespace rsurfaces
     )
     {
         ptic("OptimizedClusterTree::OptimizedClusterTree");
+        MemoryOwner memory_owner("OptimizedClusterTree");
         
         primitive_count = primitive_count_;
         hull_count = hull_count_;
@@ -58,6 +59,7 @@ namespace rsurfaces
              thread_count = std::max( static_cast<mint>(1), nthreads );
         
         settings.split_threshold = std::max( static_cast<mint>(1), settings.split_threshold );
+        build_grain = TreeTaskScheduler::Grain( primitive_count, tree_thread_count, std::max( settings.split_threshold, settings.min_task_grain ) );
 
         P_coords = A_Vector<mreal * >( dim, nullptr );
 
@@ -84,13 +86,7 @@ namespace rsurfaces
 
         Cluster2 * root = new Cluster2 ( 0, primitive_count, 0 );
 
-        #pragma omp parallel num_threads(tree_thread_count)  shared( root, P_coords, P_ext_pos, tree_thread_count)
-        {
-            #pragma omp single nowait
-            {
-                SplitCluster( root, tree_thread_count );
-            }
-        }
+        TreeTaskScheduler::Run( tree_thread_count, [&]{ SplitCluster( root ); } );
         ptoc("SplitCluster");
 
         ptic("Bunch of allocations");
@@ -150,13 +146,7 @@ namespace rsurfaces
 
         ptic("Serialize");
         
-        #pragma omp parallel num_threads(tree_thread_count)
-        {
-            #pragma omp single nowait
-            {
-                Serialize( root, 0, 0, tree_thread_count );
-            }
-        }
+        TreeTaskScheduler::Run( tree_thread_count, [&]{ Serialize( root, 0, 0 ); } );
 
         delete root;
         
@@ -179,7 +169,7 @@ namespace rsurfaces
     }; //Constructor
 
 
-    void OptimizedClusterTree::SplitCluster( Cluster2 * const C, const mint free_thread_count )
+    void OptimizedClusterTree::SplitCluster( Cluster2 * const C )
     {
         
         mint begin = C->begin;
@@ -231,16 +221,11 @@ namespace rsurfaces
             // create new nodes...
             C->left  = new Cluster2 ( begin, splitindex, C->depth+1 );
             C->right = new Cluster2 ( splitindex, end, C->depth+1 );
-            // ... and split them in parallel
-            #pragma omp task final(free_thread_count<1)  shared(C, free_thread_count)
-            {
-                SplitCluster( C->left, free_thread_count/2 );
-            }
-            #pragma omp task final(free_thread_count<1)  shared(C, free_thread_count)
-            {
-                SplitCluster( C->right, free_thread_count - free_thread_count/2 );
-            }
-            #pragma omp taskwait
+            // ... and split them in parallel, unless the cluster is too small to be worth a task
+            TreeTaskScheduler::ForkJoin( cpcount > build_grain,
+                [=]{ SplitCluster( C->left ); },
+                [=]{ SplitCluster( C->right ); }
+            );
             
             // collecting statistics for the later serialization
             // counting ourselves as descendant, too!
@@ -258,7 +243,7 @@ namespace rsurfaces
     }; //SplitCluster
 
 
-    void OptimizedClusterTree::Serialize( Cluster2 * C, mint ID, mint leaf_before_count, mint free_thread_count )
+    void OptimizedClusterTree::Serialize( Cluster2 * C, mint ID, mint leaf_before_count )
     {
         // enumeration in depth-first order
         C_begin[ID] = C->begin;
@@ -270,16 +255,11 @@ namespace rsurfaces
         {
             C_left [ID] = ID + 1;
             C_right[ID] = ID + 1 + C->left->descendant_count;
-    //
-            #pragma omp task final(free_thread_count<1)  shared( C, ID, C_left, C_right ) firstprivate( free_thread_count, leaf_before_count )
-            {
-                Serialize( C->left, C_left[ID], leaf_before_count, free_thread_count/2 );
-            }
-            #pragma omp task final(free_thread_count<1)  shared( C, ID, C_left, C_right ) firstprivate( free_thread_count, leaf_before_count )
-            {
-                Serialize( C->right, C_right[ID], leaf_before_count + C->left->descendant_leaf_count, free_thread_count - free_thread_count/2 );
-            }
-            #pragma omp taskwait
+
+            TreeTaskScheduler::ForkJoin( C->end - C->begin > build_grain,
+                [=]{ Serialize( C->left, C_left[ID], leaf_before_count ); },
+                [=]{ Serialize( C->right, C_right[ID], leaf_before_count + C->left->descendant_leaf_count ); }
+            );
             
             delete C->left;
             delete C->right;
@@ -295,6 +275,27 @@ namespace rsurfaces
     }; //Serialize
 
 
+    // Mean squared distance of the points of the simplex with the given corners from its barycenter: sum_i |v_i - g|^2 / (n (n + 1)) for n corners.
+    static inline mreal simplexSquaredSpread( const mreal * restrict const corners, const mint corner_count, const mint dim )
+    {
+        mreal spread = 0.;
+        for( mint k = 0; k < dim; ++k )
+        {
+            mreal g = 0.;
+            for( mint h = 0; h < corner_count; ++h )
+            {
+                g += corners[ dim * h + k ];
+            }
+            g /= corner_count;
+            for( mint h = 0; h < corner_count; ++h )
+            {
+                mreal delta = corners[ dim * h + k ] - g;
+                spread += delta * delta;
+            }
+        }
+        return spread / ( corner_count * ( corner_count + 1 ) );
+    }
+
     void OptimizedClusterTree::ComputePrimitiveData(
                                            const mreal * restrict const P_hull_coords_,
                                            const mreal * restrict const  P_near_,
@@ -303,6 +304,7 @@ namespace rsurfaces
                                            ) // reordering and computing bounding boxes
     {
         ptic("OptimizedClusterTree::ComputePrimitiveData");
+        MemoryOwner memory_owner("OptimizedClusterTree");
         
         P_near = A_Vector<mreal * > ( near_dim, nullptr );
         for( mint k = 0; k < near_dim; ++ k )
@@ -324,6 +326,8 @@ namespace rsurfaces
             safe_alloc( P_max[k], primitive_count );
         }
         
+        safe_alloc( P_squared_spread, primitive_count );
+        
         P_D_near = A_Vector<A_Vector<mreal>> ( thread_count );
         P_D_far  = A_Vector<A_Vector<mreal>> ( thread_count );
         
@@ -376,15 +380,74 @@ namespace rsurfaces
                 P_min[k][i] = min;
                 P_max[k][i] = max;
             }
+            
+            P_squared_spread[i] = simplexSquaredSpread( P_hull_coords_ + hull_size * j, hull_count, dim );
         }
         
+        ComputeTiles();
+        
         ptoc("OptimizedClusterTree::ComputePrimitiveData");
     } //ComputePrimitiveData
 
+    void OptimizedClusterTree::ComputeTiles()
+    {
+        ptic("OptimizedClusterTree::ComputeTiles");
+        MemoryOwner memory_owner("OptimizedClusterTree");
+        
+        const mint W = SIMD_TILE_WIDTH;
+        const mint tile_size = near_dim * W;
+        
+        if( leaf_tile_ptr == nullptr )
+        {
+            safe_alloc( leaf_tile_ptr, leaf_cluster_count + 1 );
+            leaf_tile_ptr[0] = 0;
+            
+            #pragma omp parallel for
+            for( mint k = 0; k < leaf_cluster_count; ++k )
+            {
+                mint leaf = leaf_clusters[k];
+                leaf_tile_ptr[k + 1] = ( C_end[leaf] - C_begin[leaf] + W - 1 ) / W;
+            }
+            partial_sum( leaf_tile_ptr, leaf_tile_ptr + leaf_cluster_count + 1 );
+            
+            tile_count = leaf_tile_ptr[leaf_cluster_count];
+            safe_alloc( P_near_tiled, tile_count * tile_size );
+        }
+        
+        #pragma omp parallel for RAGGED_SCHEDULE
+        for( mint k = 0; k < leaf_cluster_count; ++k )
+        {
+            mint leaf    = leaf_clusters[k];
+            mint i_begin = C_begin[leaf];
+            mint i_end   = C_end  [leaf];
+            
+            for( mint t = leaf_tile_ptr[k]; t < leaf_tile_ptr[k + 1]; ++t )
+            {
+                mreal * restrict const tile = P_near_tiled + tile_size * t;
+                mint i_0 = i_begin + W * ( t - leaf_tile_ptr[k] );
+                
+                for( mint lane = 0; lane < W; ++lane )
+                {
+                    // padding lanes repeat the last primitive of the leaf...
+                    mint i = std::min( i_0 + lane, i_end - 1 );
+                    for( mint j = 0; j < near_dim; ++j )
+                    {
+                        tile[ W * j + lane ] = P_near[j][i];
+                    }
+                    // ... but carry no weight
+                    tile[lane] *= static_cast<mreal>( i_0 + lane < i_end );
+                }
+            }
+        }
+        
+        ptoc("OptimizedClusterTree::ComputeTiles");
+    } // ComputeTiles
+
     void OptimizedClusterTree::ComputeClusterData()
     {
         
         ptic("OptimizedClusterTree::ComputeClusterData");
+        MemoryOwner memory_owner("OptimizedClusterTree");
         
 //        scratch = A_Vector<A_Vector<mreal>> ( thread_count );
 //        for( mint thread = 0; thread < thread_count; ++thread )
@@ -409,6 +472,7 @@ namespace rsurfaces
         }
         
         safe_alloc( C_squared_radius, cluster_count );
+        safe_alloc( C_squared_spread, cluster_count );
         
 //        C_moments = A_Vector<mreal * restrict> ( moment_count, nullptr );
 //        for( mint k = 0; k < moment_count; ++ k )
@@ -424,37 +488,25 @@ namespace rsurfaces
         }
         
         // using the already serialized cluster tree
-        #pragma omp parallel shared( thread_count )
-        {
-            #pragma omp single nowait
-            {
-                computeClusterData( 0, thread_count );
-            }
-        }
+        TreeTaskScheduler::Run( tree_thread_count, [&]{ computeClusterData( 0 ); } );
         
         ptoc("OptimizedClusterTree::ComputeClusterData");
     }; //ComputeClusterData
 
 
-    void OptimizedClusterTree::computeClusterData( const mint C, const mint free_thread_count ) // helper function for ComputeClusterData
+    void OptimizedClusterTree::computeClusterData( const mint C ) // helper function for ComputeClusterData
     {
         
-        mint thread = omp_get_thread_num();
         mint L = C_left [C];
         mint R = C_right[C];
         
         if( L >= 0 && R >= 0 ){
             //C points to interior node.
 
-            #pragma omp task final(free_thread_count<1)  shared( L, free_thread_count ) //firstprivate(free_thread_count)
-            {
-                computeClusterData( L, free_thread_count/2 );
-            }
-            #pragma omp task final(free_thread_count<1)  shared( R, free_thread_count )// firstprivate(free_thread_count)
-            {
-                computeClusterData( R, free_thread_count-free_thread_count/2 );
-            }
-            #pragma omp taskwait
+            TreeTaskScheduler::ForkJoin( C_end[C] - C_begin[C] > build_grain,
+                [=]{ computeClusterData( L ); },
+                [=]{ computeClusterData( R ); }
+            );
 
             //weight
             mreal L_weight = C_far[0][L];
@@ -477,6 +529,18 @@ namespace rsurfaces
                 C_min[k][C] = mymin( C_min[k][L], C_min[k][R] );
                 C_max[k][C] = mymax( C_max[k][L], C_max[k][R] );
             }
+
+            // second moment about the new center (parallel axis theorem)
+            mreal L_shift2 = 0.;
+            mreal R_shift2 = 0.;
+            for( mint k = 0, last = dim; k < last; ++k )
+            {
+                mreal L_shift = C_coords[k][L] - C_coords[k][C];
+                mreal R_shift = C_coords[k][R] - C_coords[k][C];
+                L_shift2 += L_shift * L_shift;
+                R_shift2 += R_shift * R_shift;
+            }
+            C_squared_spread[C] = L_weight * ( C_squared_spread[L] + L_shift2 ) + R_weight * ( C_squared_spread[R] + R_shift2 );
             
 //            ShiftMoments( L, C_far, C_moments, C, C_far, C_moments, &scratch[thread][0] );
 //            ShiftMoments( R, C_far, C_moments, C, C_far, C_moments, &scratch[thread][0] );
@@ -512,6 +576,21 @@ namespace rsurfaces
                 }
             }
             
+            // parallel axis theorem: each primitive's own spread plus the squared distance of its center
+            mreal spread = 0.;
+            for( mint i = begin; i < end; ++i )
+            {
+                mreal P_weight = P_far[0][i] * C_invmass;
+                mreal P_spread = P_squared_spread[i];
+                for( mint k = 0; k < dim; ++k )
+                {
+                    mreal delta = P_coords[k][i] - C_coords[k][C];
+                    P_spread += delta * delta;
+                }
+                spread += P_weight * P_spread;
+            }
+            C_squared_spread[C] = spread;
+            
 //            // moments
 //            for( mint i = begin; i < end; ++i )
 //            {
@@ -626,6 +705,7 @@ namespace rsurfaces
     void OptimizedClusterTree::RequireBuffers( const mint cols )
     {
         ptic("RequireBuffers");
+        MemoryOwner memory_owner("OptimizedClusterTree");
         // TODO: parallelize allocation
         if( cols > max_buffer_dim )
         {
@@ -771,6 +851,7 @@ namespace rsurfaces
     {
         
         ptic("RequireChunks");
+        MemoryOwner memory_owner("OptimizedClusterTree");
         if( !chunks_prepared )
         {
             //TODO: This partitioning strategy may cause that some threads will stay idle during the percolation passes. This is caused by our requirement that each chunks is at least as long as cache line in order to mend false sharing. Should happen only for really cause meshes for which parallelization won't scale anyways.
@@ -1082,6 +1163,132 @@ namespace rsurfaces
     }; // PercolateDown_Tasks
 
 
+    void OptimizedClusterTree::PercolateUp_Fused( const mreal * const input, const mint cols, const MKLSparseMatrix & pre )
+    {
+        ptic("PercolateUp_Fused");
+        TreeTaskScheduler::Run( thread_count, [&]{ percolateUp_Fused( 0, input, cols, pre ); } );
+        ptoc("PercolateUp_Fused");
+    }; // PercolateUp_Fused
+
+    void OptimizedClusterTree::percolateUp_Fused( const mint C, const mreal * const input, const mint cols, const MKLSparseMatrix & pre )
+    {
+        // C = cluster index
+        
+        mint L = C_left [C];
+        mint R = C_right[C];
+        
+        mreal * restrict const C_row = C_in + buffer_dim * C;
+        
+        if( (L >= 0) && (R >= 0) )
+        {
+            TreeTaskScheduler::ForkJoin( C_end[C] - C_begin[C] > build_grain,
+                [=,&pre]{ percolateUp_Fused( L, input, cols, pre ); },
+                [=,&pre]{ percolateUp_Fused( R, input, cols, pre ); }
+            );
+            
+            mreal const * restrict const L_row = C_in + buffer_dim * L;
+            mreal const * restrict const R_row = C_in + buffer_dim * R;
+            #pragma omp simd
+            for( mint k = 0; k < buffer_dim; ++k )
+            {
+                // Overwrite, not add-into. Thus cleansing is not required.
+                C_row[k] = L_row[k] + R_row[k];
+            }
+        }
+        else
+        {
+            // Leaf: the primitives of the cluster are contiguous. Each one owns buffer_dim / cols consecutive rows of pre
+            // (more than one for the derivative operator), and thus buffer_dim consecutive entries of P_in.
+            #pragma omp simd
+            for( mint k = 0; k < buffer_dim; ++k )
+            {
+                C_row[k] = 0.;
+            }
+            
+            const mint rows_per_primitive = buffer_dim / cols;
+            
+            for( mint i = C_begin[C], last = C_end[C]; i < last; ++i )
+            {
+                mreal * restrict const P_row = P_in + buffer_dim * i;
+                
+                for( mint r = 0; r < rows_per_primitive; ++r )
+                {
+                    mreal * restrict const y = P_row + cols * r;
+                    const mint row = rows_per_primitive * i + r;
+                    
+                    for( mint c = 0; c < cols; ++c )
+                    {
+                        y[c] = 0.;
+                    }
+                    for( mint l = pre.outer[row]; l < pre.outer[row + 1]; ++l )
+                    {
+                        const mreal a = pre.values[l];
+                        mreal const * restrict const x = input + cols * pre.inner[l];
+                        #pragma omp simd
+                        for( mint c = 0; c < cols; ++c )
+                        {
+                            y[c] += a * x[c];
+                        }
+                    }
+                }
+                
+                // accumulate while P_row is still in cache
+                #pragma omp simd
+                for( mint k = 0; k < buffer_dim; ++k )
+                {
+                    C_row[k] += P_row[k];
+                }
+            }
+        }
+    }; // percolateUp_Fused
+
+    void OptimizedClusterTree::PercolateDown_Fused()
+    {
+        ptic("PercolateDown_Fused");
+        TreeTaskScheduler::Run( thread_count, [&]{ percolateDown_Fused( 0 ); } );
+        ptoc("PercolateDown_Fused");
+    }; // PercolateDown_Fused
+
+    void OptimizedClusterTree::percolateDown_Fused( const mint C )
+    {
+        // C = cluster index
+        
+        mint L = C_left [C];
+        mint R = C_right[C];
+        
+        mreal const * restrict const C_row = C_out + buffer_dim * C;
+        
+        if( ( L >= 0 ) && ( R >= 0 ) )
+        {
+            mreal * restrict const L_row = C_out + buffer_dim * L;
+            mreal * restrict const R_row = C_out + buffer_dim * R;
+            #pragma omp simd
+            for( mint k = 0; k < buffer_dim; ++k )
+            {
+                L_row[k] += C_row[k];
+                R_row[k] += C_row[k];
+            }
+            
+            TreeTaskScheduler::ForkJoin( C_end[C] - C_begin[C] > build_grain,
+                [=]{ percolateDown_Fused( L ); },
+                [=]{ percolateDown_Fused( R ); }
+            );
+        }
+        else
+        {
+            // Leaf: add its value to each of its primitives (what C_to_P does).
+            for( mint i = C_begin[C], last = C_end[C]; i < last; ++i )
+            {
+                mreal * restrict const P_row = P_out + buffer_dim * i;
+                #pragma omp simd
+                for( mint k = 0; k < buffer_dim; ++k )
+                {
+                    P_row[k] += C_row[k];
+                }
+            }
+        }
+    }; // percolateDown_Fused
+
     void OptimizedClusterTree::Pre( Eigen::MatrixXd & input, BCTKernelType type )
     {
         ptic("OptimizedClusterTree::Pre( Eigen::MatrixXd & input, BCTKernelType type )");
@@ -1127,18 +1334,25 @@ namespace rsurfaces
             }
         }
         
-        // Caution: Some magic is going on here high order term...
-        ptic("pre->Multiply");
-    //     Apply diff/averaging operate, reorder and multiply by weights.
-        pre->Multiply( input, P_in, cols );
-        ptoc("pre->Multiply");
-        
-        ptic("P_to_C.Multiply");
-        // Accumulate into leaf clusters.
-        P_to_C.Multiply( P_in, C_in, buffer_dim );  // Beware: The derivative operator increases the number of columns!
-        ptoc("P_to_C.Multiply");
-        
-        PercolateUp();
+        if( settings.fused_prepost )
+        {
+            PercolateUp_Fused( input, cols, *pre );
+        }
+        else
+        {
+            // Caution: Some magic is going on here high order term...
+            ptic("pre->Multiply");
+        //     Apply diff/averaging operate, reorder and multiply by weights.
+            pre->Multiply( input, P_in, cols );
+            ptoc("pre->Multiply");
+            
+            ptic("P_to_C.Multiply");
+            // Accumulate into leaf clusters.
+            P_to_C.Multiply( P_in, C_in, buffer_dim );  // Beware: The derivative operator increases the number of columns!
+            ptoc("P_to_C.Multiply");
+            
+            PercolateUp();
+        }
     
         ptoc("Pre");
     }; // Pre
@@ -1205,12 +1419,19 @@ namespace rsurfaces
             wprint("Expected number of columns  = " + std::to_string( expected_dim ) + " is greater than requested number of columns " + std::to_string( cols ) + ". Truncating output. Result is very likely unexpected." );
         }
         
-        PercolateDown();
-        
-        // Add data from leaf clusters into data on primitives
-        ptic("C_to_P.Multiply");
-        C_to_P.Multiply( C_out, P_out, buffer_dim, true );  // Beware: The derivative operator increases the number of columns!
-        ptoc("C_to_P.Multiply");
+        if( settings.fused_prepost )
+        {
+            PercolateDown_Fused();
+        }
+        else
+        {
+            PercolateDown();
+            
+            // Add data from leaf clusters into data on primitives
+            ptic("C_to_P.Multiply");
+            C_to_P.Multiply( C_out, P_out, buffer_dim, true );  // Beware: The derivative operator increases the number of columns!
+            ptoc("C_to_P.Multiply");
+        }
         
         // Multiply by weights, restore external ordering, and apply transpose of diff/averaging operator.
         ptic("post->Multiply");
@@ -1315,6 +1536,8 @@ namespace rsurfaces
         
         ptic("OptimizedClusterTree::SemiStaticUpdate");
         
+        dropRestPose();
+        
         RequireBuffers( far_dim );
         
         #pragma omp parallel for shared( P_near, P_far , P_ext_pos, P_near_, P_far_, P_in, near_dim, far_dim )
@@ -1341,6 +1564,8 @@ namespace rsurfaces
             }
         }
         
+        ComputeTiles();
+        
         // accumulate primitive input buffers in leaf clusters
         ptic("P_to_C.Multiply");
         P_to_C.Multiply(P_in, C_in, far_dim);
@@ -1365,8 +1590,263 @@ namespace rsurfaces
         }
         
         ptoc("OptimizedClusterTree::SemiStaticUpdate");
-        
+
     } // SemiStaticUpdate
+
+    void OptimizedClusterTree::transformData( A_Vector<mreal *> & data, const mint data_dim, const mint count, const mreal * restrict const A, const mreal * restrict const b )
+    {
+        // data[0] is the weight, data[1],...,data[dim] the center; the rest is either a normal (dim entries)
+        // or the upper triangle of a symmetric projector P (dim * (dim + 1)/2 entries, row by row), which becomes A P A^T.
+        const bool projector = ( data_dim == 1 + dim + dim * (dim + 1)/2 );
+
+        #pragma omp parallel for
+        for( mint i = 0; i < count; ++i )
+        {
+            mreal x [3];
+            mreal y [3];
+
+            for( mint k = 0; k < dim; ++k )
+            {
+                x[k] = data[1 + k][i];
+            }
+            for( mint k = 0; k < dim; ++k )
+            {
+                y[k] = b[k];
+                for( mint l = 0; l < dim; ++l )
+                {
+                    y[k] += A[dim * k + l] * x[l];
+                }
+                data[1 + k][i] = y[k];
+            }
+
+            if( projector )
+            {
+                mreal P [3][3];
+                mreal AP [3][3];
+                for( mint k = 0, pos = 1 + dim; k < dim; ++k )
+                {
+                    for( mint l = k; l < dim; ++l, ++pos )
+                    {
+                        P[k][l] = P[l][k] = data[pos][i];
+                    }
+                }
+                for( mint k = 0; k < dim; ++k )
+                {
+                    for( mint l = 0; l < dim; ++l )
+                    {
+                        AP[k][l] = 0.;
+                        for( mint m = 0; m < dim; ++m )
+                        {
+                            AP[k][l] += A[dim * k + m] * P[m][l];
+                        }
+                    }
+                }
+                for( mint k = 0, pos = 1 + dim; k < dim; ++k )
+                {
+                    for( mint l = k; l < dim; ++l, ++pos )
+                    {
+                        mreal z = 0.;
+                        for( mint m = 0; m < dim; ++m )
+                        {
+                            z += AP[k][m] * A[dim * l + m];
+                        }
+                        data[pos][i] = z;
+                    }
+                }
+            }
+            else
+            {
+                for( mint k = 0; k < dim; ++k )
+                {
+                    x[k] = data[1 + dim + k][i];
+                }
+                for( mint k = 0; k < dim; ++k )
+                {
+                    y[k] = 0.;
+                    for( mint l = 0; l < dim; ++l )
+                    {
+                        y[k] += A[dim * k + l] * x[l];
+                    }
+                    data[1 + dim + k][i] = y[k];
+                }
+            }
+        }
+    } // transformData
+
+    void OptimizedClusterTree::storeRestPose()
+    {
+        auto store = [&]( const A_Vector<mreal *> & data, A_Vector<A_Vector<mreal>> & rest, const mint count )
+        {
+            rest.resize( data.size() );
+            for( size_t k = 0; k < data.size(); ++k )
+            {
+                rest[k].assign( data[k], data[k] + count );
+            }
+        };
+
+        store( P_near,   rest_P_near,   primitive_count );
+        store( P_far,    rest_P_far,    primitive_count );
+        store( C_far,    rest_C_far,    cluster_count );
+        store( P_coords, rest_P_coords, primitive_count );
+        store( P_min,    rest_P_min,    primitive_count );
+        store( P_max,    rest_P_max,    primitive_count );
+        store( C_coords, rest_C_coords, cluster_count );
+        store( C_min,    rest_C_min,    cluster_count );
+        store( C_max,    rest_C_max,    cluster_count );
+    } // storeRestPose
+
+    void OptimizedClusterTree::restoreRestPose()
+    {
+        auto restore = [&]( A_Vector<mreal *> & data, const A_Vector<A_Vector<mreal>> & rest )
+        {
+            for( size_t k = 0; k < data.size(); ++k )
+            {
+                std::copy( rest[k].begin(), rest[k].end(), data[k] );
+            }
+        };
+
+        restore( P_near,   rest_P_near );
+        restore( P_far,    rest_P_far );
+        restore( C_far,    rest_C_far );
+        restore( P_coords, rest_P_coords );
+        restore( P_min,    rest_P_min );
+        restore( P_max,    rest_P_max );
+        restore( C_coords, rest_C_coords );
+        restore( C_min,    rest_C_min );
+        restore( C_max,    rest_C_max );
+    } // restoreRestPose
+
+    void OptimizedClusterTree::dropRestPose()
+    {
+        for( A_Vector<A_Vector<mreal>> * rest : { &rest_P_near, &rest_P_far, &rest_C_far, &rest_P_coords, &rest_P_min, &rest_P_max, &rest_C_coords, &rest_C_min, &rest_C_max } )
+        {
+            rest->clear();
+        }
+    } // dropRestPose
+
+    void OptimizedClusterTree::RigidTransform( const mreal * restrict const A, const mreal * restrict const b )
+    {
+        ptic("OptimizedClusterTree::RigidTransform");
+
+        if( dim > 3 )
+        {
+            eprint("OptimizedClusterTree::RigidTransform: only implemented for dim <= 3.");
+            ptoc("OptimizedClusterTree::RigidTransform");
+            return;
+        }
+
+        // Always start from the rest pose: bounding the rotated boxes of already rotated boxes would let them grow without bound.
+        if( rest_P_coords.empty() )
+        {
+            storeRestPose();
+        }
+        else
+        {
+            restoreRestPose();
+        }
+
+        transformData( P_near, near_dim, primitive_count, A, b );
+        transformData( P_far,  far_dim,  primitive_count, A, b );
+        transformData( C_far,  far_dim,  cluster_count,   A, b );
+
+        // clustering coordinates and boxes; the box around the rotated box has center A c + b and half widths |A| h.
+        auto transform_points = [&]( A_Vector<mreal *> & coords, A_Vector<mreal *> & min, A_Vector<mreal *> & max, const mint count )
+        {
+            #pragma omp parallel for
+            for( mint i = 0; i < count; ++i )
+            {
+                mreal x [3];
+                mreal c [3];
+                mreal h [3];
+                for( mint k = 0; k < dim; ++k )
+                {
+                    x[k] = coords[k][i];
+                    c[k] = 0.5 * ( max[k][i] + min[k][i] );
+                    h[k] = 0.5 * ( max[k][i] - min[k][i] );
+                }
+                for( mint k = 0; k < dim; ++k )
+                {
+                    mreal y = b[k];
+                    mreal z = b[k];
+                    mreal r = 0.;
+                    for( mint l = 0; l < dim; ++l )
+                    {
+                        y += A[dim * k + l] * x[l];
+                        z += A[dim * k + l] * c[l];
+                        r += std::abs( A[dim * k + l] ) * h[l];
+                    }
+                    coords[k][i] = y;
+                    min[k][i] = z - r;
+                    max[k][i] = z + r;
+                }
+            }
+        };
+
+        transform_points( P_coords, P_min, P_max, primitive_count );
+        transform_points( C_coords, C_min, C_max, cluster_count );
+
+        // C_squared_radius bounds the distance from C_coords to the rest pose's box, which is invariant under rigid motions.
+
+        ComputeTiles();
+
+        ptoc("OptimizedClusterTree::RigidTransform");
+    } // RigidTransform
+
+    void OptimizedClusterTree::Refit( const mreal * restrict const P_coords_, const mreal * restrict const P_hull_coords_, const mreal * restrict const P_near_, const mreal * restrict const P_far_ )
+    {
+        ptic("OptimizedClusterTree::Refit");
+
+        dropRestPose();
+
+        mint hull_size = hull_count * dim;
+
+        #pragma omp parallel for
+        for( mint i = 0; i < primitive_count; ++i )
+        {
+            mint j = P_ext_pos[i];
+            for( mint k = 0; k < near_dim; ++k )
+            {
+                P_near[k][i] = P_near_[ near_dim * j + k];
+            }
+            for( mint k = 0; k < far_dim; ++k )
+            {
+                P_far [k][i] = P_far_ [ far_dim  * j + k];
+            }
+            for( mint k = 0; k < dim; ++k )
+            {
+                P_coords[k][i] = P_coords_[ dim * j + k ];
+
+                mreal min, max;
+                min = max = P_hull_coords_[ hull_size * j + k];
+                for( mint h = 1; h < hull_count; ++h )
+                {
+                    mreal x = P_hull_coords_[ hull_size * j + dim * h + k];
+                    min = mymin( min , x );
+                    max = mymax( max , x );
+                }
+                P_min[k][i] = min;
+                P_max[k][i] = max;
+            }
+            P_squared_spread[i] = simplexSquaredSpread( P_hull_coords_ + hull_size * j, hull_count, dim );
+        }
+
+        ComputeTiles();
+
+        // computeClusterData accumulates into the leaves.
+        for( mint k = 0; k < far_dim; ++k )
+        {
+            std::fill( C_far[k], C_far[k] + cluster_count, 0. );
+        }
+        for( mint k = 0; k < dim; ++k )
+        {
+            std::fill( C_coords[k], C_coords[k] + cluster_count, 0. );
+        }
+
+        // bottom-up, on the existing hierarchy
+        TreeTaskScheduler::Run( tree_thread_count, [&]{ computeClusterData( 0 ); } );
+
+        ptoc("OptimizedClusterTree::Refit");
+    } // Refit
     
     
     
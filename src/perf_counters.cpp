@@ -0,0 +1,238 @@
+#include "optimized_bct_types.h"
+#include "perf_counters.h"
+#include "profiler.h"
+
+#if defined(PERF_COUNTERS) && defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#include <fstream>
+#endif
+
+namespace rsurfaces
+{
+    bool PerfCounters::initialized = false;
+    bool PerfCounters::available = false;
+    int PerfCounters::thread_count = 0;
+    std::vector<int> PerfCounters::fds;
+    thread_local int PerfCounters::thread_slot = -1;
+    std::mutex PerfCounters::mutex;
+    thread_local std::deque<std::vector<uint64_t>> PerfCounters::snapshot_stack;
+    std::map<std::string, PerfCounters::Record> PerfCounters::records;
+
+#if defined(PERF_COUNTERS) && defined(__linux__)
+
+    static int OpenCounter(uint32_t type, uint64_t config)
+    {
+        struct perf_event_attr pe;
+        memset(&pe, 0, sizeof(struct perf_event_attr));
+        pe.type = type;
+        pe.size = sizeof(struct perf_event_attr);
+        pe.config = config;
+        pe.disabled = 0;
+        pe.exclude_kernel = 1;
+        pe.exclude_hv = 1;
+        // pid = 0, cpu = -1: count the calling thread on any cpu
+        return static_cast<int>(syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0));
+    }
+
+    void PerfCounters::AttachThread()
+    {
+        if (thread_slot >= 0)
+        {
+            return;
+        }
+        int f[EventCount];
+        f[Cycles] = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        f[Instructions] = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        f[LLCMisses] = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+        // FP_ARITH_INST_RETIRED (event 0xC7) with umasks for scalar/128/256/512 bit double precision.
+        f[FlopsScalarDouble] = OpenCounter(PERF_TYPE_RAW, 0x01C7);
+        f[Flops128PackedDouble] = OpenCounter(PERF_TYPE_RAW, 0x04C7);
+        f[Flops256PackedDouble] = OpenCounter(PERF_TYPE_RAW, 0x10C7);
+        f[Flops512PackedDouble] = OpenCounter(PERF_TYPE_RAW, 0x40C7);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!initialized)
+        {
+            // The first thread decides whether the counters are usable at all.
+            initialized = true;
+            available = (f[Cycles] >= 0);
+            if (!available)
+            {
+                wprint("PerfCounters::Init: perf_event_open failed (check /proc/sys/kernel/perf_event_paranoid). Hardware counters are disabled.");
+            }
+        }
+        thread_slot = thread_count++;
+        fds.insert(fds.end(), f, f + EventCount);
+    }
+
+    bool PerfCounters::Init()
+    {
+        if (thread_slot >= 0)
+        {
+            return available;
+        }
+        AttachThread();
+        // Workers of the calling thread's OpenMP pool do not call ptic themselves, so attach them here.
+        #pragma omp parallel
+        {
+            AttachThread();
+        }
+        return available;
+    }
+
+    void PerfCounters::Snapshot(std::vector<uint64_t> &values)
+    {
+        // Threads may be attached meanwhile, so fds can grow.
+        std::lock_guard<std::mutex> lock(mutex);
+        values.assign(fds.size(), 0);
+        for (size_t k = 0; k < fds.size(); ++k)
+        {
+            uint64_t v = 0;
+            if (fds[k] >= 0 && read(fds[k], &v, sizeof(uint64_t)) == sizeof(uint64_t))
+            {
+                values[k] = v;
+            }
+        }
+    }
+
+    void PerfCounters::Begin()
+    {
+        if (!Init())
+        {
+            return;
+        }
+        snapshot_stack.emplace_back();
+        Snapshot(snapshot_stack.back());
+    }
+
+    void PerfCounters::End(const std::string &tag)
+    {
+        if (!available || snapshot_stack.empty())
+        {
+            return;
+        }
+        std::vector<uint64_t> now;
+        Snapshot(now);
+
+        std::vector<uint64_t> &before = snapshot_stack.back();
+        {
+            std::lock_guard<std::mutex> lock(Profiler::mutex);
+            Record &r = records[tag];
+            if (r.totals.size() < now.size())
+            {
+                r.totals.resize(now.size(), 0);
+            }
+            r.calls++;
+            // Groups opened after Begin started from zero.
+            for (size_t k = 0; k < now.size(); ++k)
+            {
+                r.totals[k] += now[k] - (k < before.size() ? before[k] : 0);
+            }
+        }
+        snapshot_stack.pop_back();
+    }
+
+    void PerfCounters::Reset()
+    {
+        snapshot_stack.clear();
+        std::lock_guard<std::mutex> lock(Profiler::mutex);
+        records.clear();
+    }
+
+    void PerfCounters::WriteSummary(std::ostream &os)
+    {
+        if (!available)
+        {
+            return;
+        }
+        bool haveFlops = (fds[FlopsScalarDouble] >= 0);
+        std::lock_guard<std::mutex> lock(Profiler::mutex);
+
+        os << "Tag\tCalls\tCycles\tInstructions\tIPC\tLLCMisses\tBytes\tFlops\tBytesPerFlop" << std::endl;
+        for (auto &it : records)
+        {
+            const Record &r = it.second;
+            int threads = static_cast<int>(r.totals.size()) / EventCount;
+            uint64_t sum[EventCount] = {};
+            for (int t = 0; t < threads; ++t)
+            {
+                for (int e = 0; e < EventCount; ++e)
+                {
+                    sum[e] += r.totals[t * EventCount + e];
+                }
+            }
+            double bytes = static_cast<double>(CACHE_LINE_WIDTH) * sum[LLCMisses];
+            double flops = sum[FlopsScalarDouble] + 2. * sum[Flops128PackedDouble] + 4. * sum[Flops256PackedDouble] + 8. * sum[Flops512PackedDouble];
+
+            os << it.first << "\t"
+               << r.calls << "\t"
+               << sum[Cycles] << "\t"
+               << sum[Instructions] << "\t"
+               << (sum[Cycles] > 0 ? static_cast<double>(sum[Instructions]) / sum[Cycles] : 0.) << "\t"
+               << sum[LLCMisses] << "\t"
+               << bytes << "\t";
+            if (haveFlops)
+            {
+                os << flops << "\t" << (flops > 0 ? bytes / flops : 0.) << std::endl;
+            }
+            else
+            {
+                os << "n/a\tn/a" << std::endl;
+            }
+        }
+
+        os << std::endl;
+        os << "Tag\tThread\tCycles\tInstructions\tIPC\tLLCMisses" << std::endl;
+        for (auto &it : records)
+        {
+            const Record &r = it.second;
+            int threads = static_cast<int>(r.totals.size()) / EventCount;
+            for (int t = 0; t < threads; ++t)
+            {
+                const uint64_t *v = &r.totals[t * EventCount];
+                os << it.first << "\t" << t << "\t"
+                   << v[Cycles] << "\t"
+                   << v[Instructions] << "\t"
+                   << (v[Cycles] > 0 ? static_cast<double>(v[Instructions]) / v[Cycles] : 0.) << "\t"
+                   << v[LLCMisses] << std::endl;
+            }
+        }
+    }
+
+    // Writes the summary next to the profile when the program exits.
+    static struct PerfCounterSummaryWriter
+    {
+        ~PerfCounterSummaryWriter()
+        {
+            if (PerfCounters::available)
+            {
+                std::ofstream file("./PerfCounters.tsv");
+                PerfCounters::WriteSummary(file);
+                for (int fd : PerfCounters::fds)
+                {
+                    if (fd >= 0)
+                    {
+                        close(fd);
+                    }
+                }
+            }
+        }
+    } perfCounterSummaryWriter;
+
+#else
+
+    bool PerfCounters::Init() { return false; }
+    void PerfCounters::AttachThread() {}
+    void PerfCounters::Begin() {}
+    void PerfCounters::End(const std::string &tag) {}
+    void PerfCounters::Reset() {}
+    void PerfCounters::WriteSummary(std::ostream &os) {}
+    void PerfCounters::Snapshot(std::vector<uint64_t> &values) {}
+
+#endif
+
+} // namespace rsurfaces
@@ -4,9 +4,29 @@ namespace rsurfaces
 {
     std::ofstream Profiler::os ( "./Profile.tsv");
     std::chrono::time_point<std::chrono::steady_clock> Profiler::init_time = std::chrono::steady_clock::now();
-    std::deque<std::chrono::time_point<std::chrono::steady_clock>> Profiler::time_stack;
-    std::deque<std::string> Profiler::tag_stack(1,"root");
-    std::deque<int> Profiler::parent_stack (1, -0);
-    std::deque<int> Profiler::id_stack (1,0);
-    int Profiler::id_counter = 0;
+    thread_local std::deque<std::chrono::time_point<std::chrono::steady_clock>> Profiler::time_stack;
+    thread_local std::deque<std::string> Profiler::tag_stack(1,"root");
+    thread_local std::deque<int> Profiler::parent_stack (1, -0);
+    thread_local std::deque<int> Profiler::id_stack (1,0);
+    thread_local int Profiler::flow_id = 0;
+    std::atomic<int> Profiler::id_counter {0};
+    std::atomic<int> Profiler::thread_counter {0};
+    std::mutex Profiler::mutex;
+    std::ofstream Profiler::trace_os;
+    bool Profiler::trace_empty = true;
+
+#ifdef PROFILING
+    // Opens ./Profile.json at startup and terminates the JSON array at exit.
+    static struct TraceFileGuard
+    {
+        TraceFileGuard()
+        {
+            TraceOpen("./Profile.json");
+        }
+        ~TraceFileGuard()
+        {
+            TraceClose();
+        }
+    } traceFileGuard;
+#endif
 } // namespace rsurfaces
@@ -1,4 +1,5 @@
 #include "remeshing/dynamic_remesher.h"
+#include "geometry_cache.h"
 
 namespace rsurfaces
 {
@@ -40,6 +41,15 @@ namespace rsurfaces
             flippingMode = FlippingMode::Delaunay;
 
             curvatureAdaptive = false;
+
+            qualityTriggered = true;
+            maxLengthRatio = 1.5;
+            minLengthRatio = 0.5;
+            minAngle = PI / 12;
+            maxAreaDistortion = 4;
+            triggerFraction = 0.01;
+            verbose = false;
+            areaOrig = -1;
             
             ptoc("DynamicRemesher");
         }
@@ -60,15 +70,221 @@ namespace rsurfaces
         bool DynamicRemesher::Remesh(int numIters, bool changeTopology)
         {
             ptic("DynamicRemesher::Remesh");
-            
+
+            bool didSplitOrCollapse = remeshRegion(numIters, changeTopology, nullptr);
+
+            ptoc("DynamicRemesher::Remesh");
+
+            return didSplitOrCollapse;
+        }
+
+        MeshQuality DynamicRemesher::MeasureQuality(VertexData<bool> &region)
+        {
+            ptic("DynamicRemesher::MeasureQuality");
+
+            MeshQuality q;
+            double l = (curvatureAdaptive) ? initialHWeightedLength : initialAverageLength;
+
+            // Flat element lists, so that the scans below can run in parallel; they only read the geometry.
+            std::vector<Edge> edges;
+            edges.reserve(mesh->nEdges());
+            for (Edge e : mesh->edges())
+            {
+                edges.push_back(e);
+            }
+            std::vector<Face> faces;
+            faces.reserve(mesh->nFaces());
+            for (Face f : mesh->faces())
+            {
+                faces.push_back(f);
+            }
+            std::vector<char> edgeBad(edges.size(), 0);
+            std::vector<char> faceBad(faces.size(), 0);
+
+            size_t longEdges = 0;
+            size_t shortEdges = 0;
+            size_t nonDelaunayEdges = 0;
+            double maxLength = 0;
+            double minLength = std::numeric_limits<double>::infinity();
+            mint edgeCount = edges.size();
+
+            #pragma omp parallel for reduction(+ : longEdges, shortEdges, nonDelaunayEdges) reduction(max : maxLength) reduction(min : minLength)
+            for (mint i = 0; i < edgeCount; ++i)
+            {
+                Edge e = edges[i];
+                double target = (curvatureAdaptive) ? findMeanTargetL(mesh, geom, e, l, epsilon) : l;
+                double ratio = geom->edgeLength(e) / target;
+                maxLength = fmax(maxLength, ratio);
+                minLength = fmin(minLength, ratio);
+
+                bool bad = false;
+                if (ratio > maxLengthRatio)
+                {
+                    longEdges++;
+                    bad = true;
+                }
+                if (ratio < minLengthRatio)
+                {
+                    shortEdges++;
+                    bad = true;
+                }
+                if (flippingMode == FlippingMode::Delaunay && !e.isBoundary() && !isDelaunay(geom, e))
+                {
+                    nonDelaunayEdges++;
+                    bad = true;
+                }
+                edgeBad[i] = bad;
+            }
+
+            // Face areas are compared relative to the total area, so that uniform scaling does not count as distortion.
+            // The total of the original geometry only changes when remeshing splits or collapses edges.
+            double area = GeometryCache::Get(geom).totalArea;
+            if (areaOrig <= 0)
+            {
+                areaOrig = 0;
+                for (Face f : faces)
+                {
+                    areaOrig += geomOrig->faceArea(f);
+                }
+            }
+            double origTotal = areaOrig;
+
+            size_t smallAngleFaces = 0;
+            size_t distortedFaces = 0;
+            double minAngleFound = PI;
+            double maxDistortion = 0;
+            mint faceCount = faces.size();
+
+            #pragma omp parallel for reduction(+ : smallAngleFaces, distortedFaces) reduction(min : minAngleFound) reduction(max : maxDistortion)
+            for (mint i = 0; i < faceCount; ++i)
+            {
+                Face f = faces[i];
+                bool bad = false;
+
+                double fMinAngle = PI;
+                for (Corner c : f.adjacentCorners())
+                {
+                    fMinAngle = fmin(fMinAngle, geom->cornerAngle(c));
+                }
+                minAngleFound = fmin(minAngleFound, fMinAngle);
+                if (fMinAngle < minAngle)
+                {
+                    smallAngleFaces++;
+                    bad = true;
+                }
+
+                double a = geom->faceArea(f) / area;
+                double a0 = geomOrig->faceArea(f) / origTotal;
+                double distortion = (a > 0 && a0 > 0) ? fmax(a / a0, a0 / a) : std::numeric_limits<double>::infinity();
+                maxDistortion = fmax(maxDistortion, distortion);
+                if (distortion > maxAreaDistortion)
+                {
+                    distortedFaces++;
+                    bad = true;
+                }
+                faceBad[i] = bad;
+            }
+
+            q.longEdges = longEdges;
+            q.shortEdges = shortEdges;
+            q.nonDelaunayEdges = nonDelaunayEdges;
+            q.smallAngleFaces = smallAngleFaces;
+            q.distortedFaces = distortedFaces;
+            q.maxLengthRatio = maxLength;
+            q.minLengthRatio = minLength;
+            q.minAngle = minAngleFound;
+            q.maxAreaDistortion = maxDistortion;
+
+            VertexData<bool> seeds(*mesh, false);
+            for (mint i = 0; i < edgeCount; ++i)
+            {
+                if (edgeBad[i])
+                {
+                    seeds[edges[i].firstVertex()] = true;
+                    seeds[edges[i].secondVertex()] = true;
+                }
+            }
+            for (mint i = 0; i < faceCount; ++i)
+            {
+                if (faceBad[i])
+                {
+                    for (Vertex v : faces[i].adjacentVertices())
+                    {
+                        seeds[v] = true;
+                    }
+                }
+            }
+
+            // Grow the marked set by one ring, so that flips and smoothing have some room.
+            region = VertexData<bool>(*mesh, false);
+            for (Vertex v : mesh->vertices())
+            {
+                if (seeds[v])
+                {
+                    region[v] = true;
+                    for (Vertex w : v.adjacentVertices())
+                    {
+                        region[w] = true;
+                    }
+                }
+            }
+
+            ptoc("DynamicRemesher::MeasureQuality");
+
+            return q;
+        }
+
+        bool DynamicRemesher::RemeshIfNeeded(int numIters, bool &remeshed)
+        {
+            if (!qualityTriggered)
+            {
+                remeshed = true;
+                return Remesh(numIters, true);
+            }
+
+            ptic("DynamicRemesher::RemeshIfNeeded");
+
+            VertexData<bool> region;
+            MeshQuality q = MeasureQuality(region);
+            double badFraction = (double)q.badElements() / (double)(mesh->nEdges() + mesh->nFaces());
+
+            if (verbose)
+            {
+                std::cout << "Mesh quality: edge length ratio in [" << q.minLengthRatio << ", " << q.maxLengthRatio
+                          << "], min angle = " << q.minAngle << ", max area distortion = " << q.maxAreaDistortion << std::endl;
+                std::cout << "  " << q.longEdges << " long edges, " << q.shortEdges << " short edges, "
+                          << q.nonDelaunayEdges << " non-Delaunay edges, " << q.smallAngleFaces << " small-angle faces, "
+                          << q.distortedFaces << " distorted faces (" << 100 * badFraction << "% bad)" << std::endl;
+            }
+
+            if (badFraction <= triggerFraction)
+            {
+                remeshed = false;
+                ptoc("DynamicRemesher::RemeshIfNeeded");
+                return false;
+            }
+
+            remeshed = true;
+            bool changeTopology = (q.longEdges + q.shortEdges > 0);
+            bool didSplitOrCollapse = remeshRegion(numIters, changeTopology, &region);
+
+            ptoc("DynamicRemesher::RemeshIfNeeded");
+
+            return didSplitOrCollapse;
+        }
+
+        bool DynamicRemesher::remeshRegion(int numIters, bool changeTopology, VertexData<bool> *region)
+        {
             bool didSplitOrCollapse = false;
+            // Splits and collapses also change geomOrig.
+            areaOrig = -1;
             switch (remeshingMode)
             {
             case RemeshingMode::FlipOnly:
             {
                 for (int i = 0; i < numIters; i++)
                 {
-                    flipEdges();
+                    flipEdges(region);
                 }
                 didSplitOrCollapse = false;
                 break;
@@ -77,8 +293,8 @@ namespace rsurfaces
             {
                 for (int i = 0; i < numIters; i++)
                 {
-                    smoothVertices();
-                    flipEdges();
+                    smoothVertices(region);
+                    flipEdges(region);
                 }
                 didSplitOrCollapse = false;
                 break;
@@ -91,14 +307,15 @@ namespace rsurfaces
                     double l = (curvatureAdaptive) ? initialHWeightedLength : initialAverageLength;
                     double l_min = (curvatureAdaptive) ? initialAverageLength * 0.9 : initialAverageLength * 0.5;
 
-                    didSplitOrCollapse = adjustEdgeLengths(mesh, geom, geomOrig, l, epsilon, l_min, curvatureAdaptive);
+                    didSplitOrCollapse = adjustEdgeLengths(mesh, geom, geomOrig, l, epsilon, l_min, curvatureAdaptive, region);
                 }
                 geom->refreshQuantities();
+                GeometryCache::PositionsChanged(geom);
 
                 for (int i = 0; i < numIters; i++)
                 {
-                    smoothVertices();
-                    flipEdges();
+                    smoothVertices(region);
+                    flipEdges(region);
                 }
                 break;
             }
@@ -107,21 +324,20 @@ namespace rsurfaces
                 break;
             }
             geom->refreshQuantities();
-            
-            ptoc("DynamicRemesher::Remesh");
+            GeometryCache::PositionsChanged(geom);
             
             return didSplitOrCollapse;
         }
 
-        void DynamicRemesher::flipEdges()
+        void DynamicRemesher::flipEdges(VertexData<bool> *region)
         {
             switch (flippingMode)
             {
             case FlippingMode::Delaunay:
-                fixDelaunay(mesh, geom);
+                fixDelaunay(mesh, geom, region);
                 break;
             case FlippingMode::Degree:
-                adjustVertexDegrees(mesh, geom);
+                adjustVertexDegrees(mesh, geom, region);
                 break;
             default:
                 throw std::runtime_error("Unknown flipping mode.");
@@ -129,15 +345,15 @@ namespace rsurfaces
             }
         }
 
-        void DynamicRemesher::smoothVertices()
+        void DynamicRemesher::smoothVertices(VertexData<bool> *region)
         {
             switch (smoothingMode)
             {
             case SmoothingMode::Laplacian:
-                smoothByLaplacian(mesh, geom);
+                smoothByLaplacian(mesh, geom, region);
                 break;
             case SmoothingMode::Circumcenter:
-                smoothByCircumcenter(mesh, geom);
+                smoothByCircumcenter(mesh, geom, region);
                 break;
             default:
                 throw std::runtime_error("Unknown smoothing mode.");
@@ -1,4 +1,5 @@
 #include "remeshing/remeshing.h"
+#include "geometry_cache.h"
 
 namespace rsurfaces
 {
@@ -399,11 +400,16 @@ namespace rsurfaces
         
         // non-debug functions from here
         
-        void adjustVertexDegrees(MeshPtr const &mesh, GeomPtr const &geometry)
+        inline bool inRegion(VertexData<bool> *region, Edge e)
+        {
+            return !region || (*region)[e.firstVertex()] || (*region)[e.secondVertex()];
+        }
+
+        void adjustVertexDegrees(MeshPtr const &mesh, GeomPtr const &geometry, VertexData<bool> *region)
         {
             for(Edge e : mesh->edges())
             {
-                if(!e.isBoundary() && shouldFlip(mesh, geometry, e))
+                if(!e.isBoundary() && inRegion(region, e) && shouldFlip(mesh, geometry, e))
                 {
                     //checkDegree(mesh);
                     mesh->flip(e);
@@ -411,17 +417,20 @@ namespace rsurfaces
             }
         }
 
-        void fixDelaunay(MeshPtr const &mesh, GeomPtr const &geometry)
+        void fixDelaunay(MeshPtr const &mesh, GeomPtr const &geometry, VertexData<bool> *region)
         {
             // queue of edges to check if Delaunay
             queue<Edge> toCheck;
             // true if edge is currently in toCheck
-            EdgeData<bool> inQueue(*mesh);
-            // start with all edges
+            EdgeData<bool> inQueue(*mesh, false);
+            // start with all edges (of the region)
             for (Edge e : mesh->edges())
             {
-                toCheck.push(e);
-                inQueue[e] = true;
+                if (inRegion(region, e))
+                {
+                    toCheck.push(e);
+                    inQueue[e] = true;
+                }
             }
             // counter and limit for number of flips
             int flipMax = 100 * mesh->nVertices();
@@ -466,13 +475,13 @@ namespace rsurfaces
             }
         }
 
-        void smoothByLaplacian(MeshPtr const &mesh, GeomPtr const &geometry)
+        void smoothByLaplacian(MeshPtr const &mesh, GeomPtr const &geometry, VertexData<bool> *region)
         {
             // smoothed vertex positions
             VertexData<Vector3> newVertexPosition(*mesh);
             for (Vertex v : mesh->vertices())
             {
-                if(v.isBoundary())
+                if(v.isBoundary() || (region && !(*region)[v]))
                 {
                     newVertexPosition[v] = geometry->inputVertexPositions[v];
                 }
@@ -538,7 +547,7 @@ namespace rsurfaces
            return false;
         }
 
-        void smoothByCircumcenter(MeshPtr const &mesh, GeomPtr const &geometry)
+        void smoothByCircumcenter(MeshPtr const &mesh, GeomPtr const &geometry, VertexData<bool> *region)
         {
             geometry->requireFaceAreas();
             // smoothed vertex positions
@@ -546,7 +555,7 @@ namespace rsurfaces
             for (Vertex v : mesh->vertices())
             {
                 newVertexPosition[v] = geometry->inputVertexPositions[v]; // default
-                if(!v.isBoundary())
+                if(!v.isBoundary() && (!region || (*region)[v]))
                 {
                     Vector3 updateDirection = Vector3::zero();
                     //double totalD = 0;
@@ -631,7 +640,7 @@ namespace rsurfaces
             // return flatLength;
         }
         
-        bool adjustEdgeLengths(MeshPtr const &mesh, GeomPtr const &geometry, GeomPtr const &geometryOriginal, double flatLength, double epsilon, double minLength, bool curvatureAdaptive)
+        bool adjustEdgeLengths(MeshPtr const &mesh, GeomPtr const &geometry, GeomPtr const &geometryOriginal, double flatLength, double epsilon, double minLength, bool curvatureAdaptive, VertexData<bool> *region)
         {
             bool didSplitOrCollapse = false;
             // queues of edges to CHECK to change
@@ -640,7 +649,10 @@ namespace rsurfaces
             
             for(Edge e : mesh->edges())
             {
-                toSplit.push_back(e);
+                if(inRegion(region, e))
+                {
+                    toSplit.push_back(e);
+                }
             }
             
             // actually do it
@@ -660,6 +672,10 @@ namespace rsurfaces
                     Vertex newV = he.vertex();
                     geometry->inputVertexPositions[newV] = newPos;
                     geometryOriginal->inputVertexPositions[newV] = newPosOrig;
+                    if(region)
+                    {
+                        (*region)[newV] = true;
+                    }
                 }
                 else
                 {
@@ -697,6 +713,7 @@ namespace rsurfaces
             //std::cerr<<"hereeee"<<std::endl;
             mesh->compress();
             geometry->refreshQuantities();
+            GeometryCache::PositionsChanged(geometry);
             return didSplitOrCollapse;
         }
 
@@ -0,0 +1,285 @@
+#include "rsurfaces_api.h"
+
+#include "surface_flow.h"
+#include "energy/tpe_barnes_hut_0.h"
+#include "energy/tpe_all_pairs.h"
+#include "geometry_cache.h"
+#include "metric_term.h"
+#include "sobolev/hs.h"
+#include "flow_context.h"
+
+#include "geometrycentral/surface/surface_mesh_factories.h"
+
+#include <exception>
+#include <string>
+
+struct rsurfaces_flow
+{
+    rsurfaces::FlowContext context;
+    rsurfaces::MeshPtr mesh;
+    rsurfaces::GeomPtr geom;
+    rsurfaces::SurfaceEnergy *energy = nullptr;
+    rsurfaces::SurfaceFlow *flow = nullptr;
+    double *vertices = nullptr; // caller owned
+    int vertex_count = 0;
+
+    ~rsurfaces_flow()
+    {
+        delete flow;
+        delete energy;
+    }
+};
+
+namespace
+{
+    using namespace rsurfaces;
+
+    thread_local std::string last_error;
+
+    int Fail(const std::string &message)
+    {
+        last_error = message;
+        return 1;
+    }
+
+    // Copies the caller's array into the geometry if it differs, and invalidates everything derived from the positions.
+    void PullPositions(rsurfaces_flow *f)
+    {
+        bool changed = false;
+        for (int i = 0; i < f->vertex_count; ++i)
+        {
+            Vector3 p{f->vertices[3 * i + 0], f->vertices[3 * i + 1], f->vertices[3 * i + 2]};
+            if (p != f->geom->inputVertexPositions[i])
+            {
+                f->geom->inputVertexPositions[i] = p;
+                changed = true;
+            }
+        }
+        if (changed)
+        {
+            f->geom->refreshQuantities();
+            GeometryCache::PositionsChanged(f->geom);
+        }
+    }
+
+    void PushPositions(rsurfaces_flow *f)
+    {
+        for (int i = 0; i < f->vertex_count; ++i)
+        {
+            Vector3 p = f->geom->inputVertexPositions[i];
+            f->vertices[3 * i + 0] = p.x;
+            f->vertices[3 * i + 1] = p.y;
+            f->vertices[3 * i + 2] = p.z;
+        }
+    }
+
+    // Runs body and turns exceptions into error codes; nothing may propagate through the C interface.
+    template <typename F>
+    int Guarded(rsurfaces_flow *f, F body)
+    {
+        if (!f)
+        {
+            return Fail("rsurfaces: flow is NULL");
+        }
+        try
+        {
+            last_error.clear();
+            FlowContext::Scope scope(f->context);
+            body();
+            return 0;
+        }
+        catch (const std::exception &e)
+        {
+            return Fail(e.what());
+        }
+        catch (...)
+        {
+            return Fail("rsurfaces: unknown error");
+        }
+    }
+} // namespace
+
+extern "C"
+{
+    rsurfaces_flow *rsurfaces_flow_create(double *vertices, int vertex_count, const int *faces, int face_count,
+                                          double alpha, double beta, double theta)
+    {
+        if (!vertices || !faces || vertex_count <= 0 || face_count <= 0)
+        {
+            Fail("rsurfaces_flow_create: empty mesh");
+            return nullptr;
+        }
+
+        rsurfaces_flow *f = new rsurfaces_flow();
+        int status = Guarded(f, [&]() {
+            std::vector<std::vector<size_t>> polygons(face_count);
+            for (int k = 0; k < face_count; ++k)
+            {
+                for (int l = 0; l < 3; ++l)
+                {
+                    int v = faces[3 * k + l];
+                    if (v < 0 || v >= vertex_count)
+                    {
+                        throw std::runtime_error("rsurfaces_flow_create: face " + std::to_string(k) + " has invalid vertex index " + std::to_string(v));
+                    }
+                    polygons[k].push_back(static_cast<size_t>(v));
+                }
+            }
+            std::vector<Vector3> positions(vertex_count);
+            for (int i = 0; i < vertex_count; ++i)
+            {
+                positions[i] = Vector3{vertices[3 * i + 0], vertices[3 * i + 1], vertices[3 * i + 2]};
+            }
+
+            MeshUPtr u_mesh;
+            GeomUPtr u_geom;
+            std::tie(u_mesh, u_geom) = surface::makeManifoldSurfaceMeshAndGeometry(polygons, positions);
+            if (static_cast<int>(u_mesh->nVertices()) != vertex_count)
+            {
+                throw std::runtime_error("rsurfaces_flow_create: the faces do not reference every vertex");
+            }
+            f->mesh = std::move(u_mesh);
+            f->geom = std::move(u_geom);
+            f->vertices = vertices;
+            f->vertex_count = vertex_count;
+
+            f->geom->requireFaceNormals();
+            f->geom->requireFaceAreas();
+            f->geom->requireVertexNormals();
+            f->geom->requireVertexDualAreas();
+            f->geom->requireVertexGaussianCurvatures();
+
+            // Same energy choice as the GUI (see setUpFlow in main.cpp).
+            if (theta <= 0)
+            {
+                f->energy = new TPEnergyAllPairs(f->mesh, f->geom, alpha, beta);
+            }
+            else
+            {
+                f->energy = new TPEnergyBarnesHut0(f->mesh, f->geom, alpha, beta, theta);
+            }
+            f->flow = new SurfaceFlow(f->energy);
+            f->flow->allowBarycenterShift = false;
+            f->flow->disableNearField = false;
+        });
+
+        if (status != 0)
+        {
+            delete f;
+            return nullptr;
+        }
+        return f;
+    }
+
+    void rsurfaces_flow_destroy(rsurfaces_flow *flow)
+    {
+        delete flow;
+    }
+
+    int rsurfaces_flow_set_threads(rsurfaces_flow *flow, int thread_count, int first_core)
+    {
+        if (flow && thread_count <= 0)
+        {
+            return Fail("rsurfaces_flow_set_threads: thread_count has to be positive");
+        }
+        return Guarded(flow, [&]() {
+            flow->context.thread_count = thread_count;
+            flow->context.first_core = first_core;
+        });
+    }
+
+    int rsurfaces_flow_add_constraint(rsurfaces_flow *flow, rsurfaces_constraint type, double target_multiplier, int iterations)
+    {
+        return Guarded(flow, [&]() {
+            PullPositions(flow);
+            switch (type)
+            {
+            case RSURFACES_BARYCENTER:
+                flow->flow->addSimpleConstraint<Constraints::BarycenterConstraint3X>(flow->mesh, flow->geom);
+                break;
+            case RSURFACES_TOTAL_AREA:
+                flow->flow->addSchurConstraint<Constraints::TotalAreaConstraint>(flow->mesh, flow->geom, target_multiplier, iterations);
+                break;
+            case RSURFACES_TOTAL_VOLUME:
+                flow->flow->addSchurConstraint<Constraints::TotalVolumeConstraint>(flow->mesh, flow->geom, target_multiplier, iterations);
+                break;
+            default:
+                throw std::runtime_error("rsurfaces_flow_add_constraint: unknown constraint type");
+            }
+        });
+    }
+
+    int rsurfaces_flow_step(rsurfaces_flow *flow, rsurfaces_method method)
+    {
+        return Guarded(flow, [&]() {
+            PullPositions(flow);
+            switch (method)
+            {
+            case RSURFACES_HS_PROJECTED:
+                flow->flow->StepProjectedGradient();
+                break;
+            case RSURFACES_HS_PROJECTED_ITERATIVE:
+                flow->flow->StepProjectedGradientIterative();
+                break;
+            case RSURFACES_HS_NEWTON_KRYLOV:
+                flow->flow->StepNewtonKrylov();
+                break;
+            case RSURFACES_H1_PROJECTED:
+                flow->flow->StepH1ProjGrad();
+                break;
+            case RSURFACES_L2_PROJECTED:
+                flow->flow->StepL2Projected();
+                break;
+            default:
+                throw std::runtime_error("rsurfaces_flow_step: unknown method");
+            }
+            PushPositions(flow);
+        });
+    }
+
+    int rsurfaces_flow_energy(rsurfaces_flow *flow, double *energy)
+    {
+        return Guarded(flow, [&]() {
+            PullPositions(flow);
+            flow->flow->UpdateEnergies();
+            *energy = flow->flow->evaluateEnergy();
+        });
+    }
+
+    int rsurfaces_flow_differential(rsurfaces_flow *flow, double *differential)
+    {
+        return Guarded(flow, [&]() {
+            PullPositions(flow);
+            flow->flow->UpdateEnergies();
+            Eigen::MatrixXd diff;
+            diff.setZero(flow->vertex_count, 3);
+            flow->flow->AssembleGradients(diff);
+            Eigen::Map<EigenMatrixRM>(differential, flow->vertex_count, 3) = diff;
+        });
+    }
+
+    int rsurfaces_flow_metric_product(rsurfaces_flow *flow, const double *input, double *output)
+    {
+        return Guarded(flow, [&]() {
+            PullPositions(flow);
+            flow->flow->UpdateEnergies();
+            std::unique_ptr<Hs::HsMetric> hs = flow->flow->GetHsMetric();
+
+            // The metric terms take row-major (vertex_count x 3) vectors, which is exactly the caller's layout.
+            Eigen::VectorXd in = Eigen::Map<const Eigen::VectorXd>(input, 3 * flow->vertex_count);
+            Eigen::VectorXd out;
+            out.setZero(3 * flow->vertex_count);
+            for (MetricTerm *term : hs->getMetricTerms())
+            {
+                term->MultiplyAdd(in, out);
+            }
+            Eigen::Map<Eigen::VectorXd>(output, 3 * flow->vertex_count) = out;
+        });
+    }
+
+    const char *rsurfaces_last_error(void)
+    {
+        return last_error.c_str();
+    }
+
+} // extern "C"
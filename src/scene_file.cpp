@@ -1,5 +1,6 @@
 #include "scene_file.h"
 
+#include <algorithm>
 #include <fstream>
 
 namespace rsurfaces
@@ -95,6 +96,10 @@ namespace rsurfaces
             {
                 return GradientMethod::L2Projected;
             }
+            else if (name == "newton")
+            {
+                return GradientMethod::HsNewtonKrylov;
+            }
             else
             {
                 throw std::runtime_error("Unknown method name " + name);
@@ -323,6 +328,44 @@ namespace rsurfaces
                 data.obstacles.push_back(obsData);
             }
 
+            else if (parts[0] == "obstacle_keyframe")
+            {
+                if (data.obstacles.empty() || parts.size() < 5)
+                {
+                    throw std::runtime_error("obstacle_keyframe needs a preceding obstacle and at least an iteration and a translation.");
+                }
+                ObstacleKeyframe key;
+                key.iteration = stol(parts[1]);
+                key.translation = Vector3{stod(parts[2]), stod(parts[3]), stod(parts[4])};
+                key.axis = Vector3{0, 0, 1};
+                key.angle = 0;
+                if (parts.size() >= 9)
+                {
+                    key.axis = Vector3{stod(parts[5]), stod(parts[6]), stod(parts[7])};
+                    key.angle = stod(parts[8]);
+                }
+                std::vector<ObstacleKeyframe> &keyframes = data.obstacles.back().keyframes;
+                if (!keyframes.empty() && keyframes.back().iteration >= key.iteration)
+                {
+                    throw std::runtime_error("obstacle_keyframe: iterations have to be increasing.");
+                }
+                keyframes.push_back(key);
+            }
+
+            else if (parts[0] == "obstacle_frames")
+            {
+                if (data.obstacles.empty() || parts.size() < 3)
+                {
+                    throw std::runtime_error("obstacle_frames needs a preceding obstacle, the iterations per frame and at least one mesh.");
+                }
+                ObstacleData &obsData = data.obstacles.back();
+                obsData.iterationsPerFrame = std::max(1L, stol(parts[1]));
+                for (size_t i = 2; i < parts.size(); i++)
+                {
+                    obsData.frameNames.push_back(dir_root + parts[i]);
+                }
+            }
+
             else if (parts[0] == "implicit")
             {
                 ImplicitBarrierData implData;
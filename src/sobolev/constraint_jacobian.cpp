@@ -0,0 +1,203 @@
+#include "sobolev/constraint_jacobian.h"
+#include "geometry_cache.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace rsurfaces
+{
+    namespace Constraints
+    {
+        ConstraintBase::ConstraintBase() {}
+
+        ConstraintBase::~ConstraintBase() {}
+
+        void ConstraintBase::JacobianStructureChanged()
+        {
+            if (jacobian)
+            {
+                jacobian->dirty = true;
+            }
+        }
+
+        const ConstraintJacobian &ConstraintJacobian::Get(ConstraintBase &cs, const MeshPtr &mesh, const GeomPtr &geom)
+        {
+            if (!cs.jacobian)
+            {
+                cs.jacobian = std::unique_ptr<ConstraintJacobian>(new ConstraintJacobian());
+            }
+            ConstraintJacobian &J = *cs.jacobian;
+
+            unsigned long long v = GeometryCache::Version(geom);
+
+            if (J.dirty || J.geom_ptr != geom.get() || J.rows != cs.nRows() || J.cols != 3 * mesh->nVertices())
+            {
+                J.Build(cs, mesh, geom);
+            }
+            else if (J.version != v)
+            {
+                if (!J.Refresh(cs, mesh, geom))
+                {
+                    J.Build(cs, mesh, geom);
+                }
+            }
+            J.version = v;
+            return J;
+        } // Get
+
+        void ConstraintJacobian::Build(ConstraintBase &cs, const MeshPtr &mesh, const GeomPtr &geom)
+        {
+            ptic("ConstraintJacobian::Build");
+
+            rows = cs.nRows();
+            cols = 3 * mesh->nVertices();
+            geom_ptr = geom.get();
+            dirty = false;
+
+            buffer.clear();
+            cs.addTriplets(buffer, mesh, geom, 0);
+
+            int n = buffer.size();
+            triplet_rows.resize(n);
+            triplet_cols.resize(n);
+            triplet_values.resize(n);
+            for (int k = 0; k < n; k++)
+            {
+                triplet_rows[k] = buffer[k].row();
+                triplet_cols[k] = buffer[k].col();
+                triplet_values[k] = buffer[k].value();
+            }
+
+            // Sort the triplets by (row, col); runs of equal positions become one CSR entry.
+            gather.resize(n);
+            std::iota(gather.begin(), gather.end(), 0);
+            std::stable_sort(gather.begin(), gather.end(), [&](int a, int b) {
+                return triplet_rows[a] < triplet_rows[b] || (triplet_rows[a] == triplet_rows[b] && triplet_cols[a] < triplet_cols[b]);
+            });
+
+            outer.assign(rows + 1, 0);
+            inner.clear();
+            gather_begin.clear();
+            for (int p = 0; p < n; p++)
+            {
+                int k = gather[p];
+                if (p == 0 || triplet_rows[k] != triplet_rows[gather[p - 1]] || triplet_cols[k] != triplet_cols[gather[p - 1]])
+                {
+                    inner.push_back(triplet_cols[k]);
+                    gather_begin.push_back(p);
+                    outer[triplet_rows[k] + 1]++;
+                }
+            }
+            gather_begin.push_back(n);
+            std::partial_sum(outer.begin(), outer.end(), outer.begin());
+
+            values.resize(inner.size());
+            Gather();
+
+            ptoc("ConstraintJacobian::Build");
+        } // Build
+
+        bool ConstraintJacobian::Refresh(ConstraintBase &cs, const MeshPtr &mesh, const GeomPtr &geom)
+        {
+            ptic("ConstraintJacobian::Refresh");
+
+            if (!cs.refreshTripletValues(triplet_values.data(), mesh, geom))
+            {
+                buffer.clear();
+                cs.addTriplets(buffer, mesh, geom, 0);
+
+                int n = buffer.size();
+                if (n != static_cast<int>(triplet_values.size()))
+                {
+                    ptoc("ConstraintJacobian::Refresh");
+                    return false;
+                }
+
+                int mismatches = 0;
+                #pragma omp parallel for reduction(+ : mismatches)
+                for (int k = 0; k < n; k++)
+                {
+                    mismatches += (buffer[k].row() != triplet_rows[k] || buffer[k].col() != triplet_cols[k]);
+                    triplet_values[k] = buffer[k].value();
+                }
+                if (mismatches > 0)
+                {
+                    ptoc("ConstraintJacobian::Refresh");
+                    return false;
+                }
+            }
+
+            Gather();
+
+            ptoc("ConstraintJacobian::Refresh");
+            return true;
+        } // Refresh
+
+        void ConstraintJacobian::Gather()
+        {
+            int nnz = values.size();
+
+            #pragma omp parallel for
+            for (int k = 0; k < nnz; k++)
+            {
+                double sum = 0.;
+                for (int p = gather_begin[k]; p < gather_begin[k + 1]; p++)
+                {
+                    sum += triplet_values[gather[p]];
+                }
+                values[k] = sum;
+            }
+        } // Gather
+
+        void ConstraintJacobian::AddTriplets(std::vector<Triplet> &triplets, size_t baseRow, bool symmetric) const
+        {
+            triplets.reserve(triplets.size() + (symmetric ? 2 : 1) * values.size());
+            for (size_t i = 0; i < rows; i++)
+            {
+                for (int k = outer[i]; k < outer[i + 1]; k++)
+                {
+                    triplets.push_back(Triplet(baseRow + i, inner[k], values[k]));
+                    if (symmetric)
+                    {
+                        triplets.push_back(Triplet(inner[k], baseRow + i, values[k]));
+                    }
+                }
+            }
+        } // AddTriplets
+
+        Eigen::SparseMatrix<double, Eigen::RowMajor> ConstraintJacobian::stack(const std::vector<const ConstraintJacobian *> &blocks, size_t cols)
+        {
+            size_t nRows = 0;
+            size_t nnz = 0;
+            for (const ConstraintJacobian *J : blocks)
+            {
+                nRows += J->rows;
+                nnz += J->values.size();
+            }
+
+            Eigen::SparseMatrix<double, Eigen::RowMajor> C(nRows, cols);
+            C.resizeNonZeros(nnz);
+
+            int *C_outer = C.outerIndexPtr();
+            int *C_inner = C.innerIndexPtr();
+            double *C_values = C.valuePtr();
+
+            size_t row = 0;
+            int offset = 0;
+            C_outer[0] = 0;
+            for (const ConstraintJacobian *J : blocks)
+            {
+                for (size_t i = 0; i < J->rows; i++)
+                {
+                    C_outer[row + i + 1] = offset + J->outer[i + 1];
+                }
+                std::copy(J->inner.begin(), J->inner.end(), C_inner + offset);
+                std::copy(J->values.begin(), J->values.end(), C_values + offset);
+                row += J->rows;
+                offset += J->values.size();
+            }
+            return C;
+        } // stack
+
+    } // namespace Constraints
+} // namespace rsurfaces
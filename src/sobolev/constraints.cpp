@@ -1,4 +1,5 @@
 #include "sobolev/constraints.h"
+#include "sobolev/constraint_jacobian.h"
 
 namespace rsurfaces
 {
@@ -7,30 +8,26 @@ namespace rsurfaces
 
         void addEntriesToSymmetric(ConstraintBase &cs, Eigen::MatrixXd &M, const MeshPtr &mesh, const GeomPtr &geom, int baseRow)
         {
-            Eigen::MatrixXd block;
-            block.setZero(cs.nRows(), M.cols());
-            cs.addEntries(block, mesh, geom, 0);
-
-            for (int i = 0; i < block.rows(); i++)
+            // Same cached Jacobian as the sparse consumers; the rows and columns are overwritten, not added to.
+            const ConstraintJacobian &J = ConstraintJacobian::Get(cs, mesh, geom);
+            for (size_t i = 0; i < J.rows; i++)
+            {
+                M.row(baseRow + i).setZero();
+                M.col(baseRow + i).setZero();
+            }
+            for (size_t i = 0; i < J.rows; i++)
             {
-                for (int j = 0; j < block.cols(); j++)
+                for (int k = J.outer[i]; k < J.outer[i + 1]; k++)
                 {
-                    M(baseRow + i, j) = block(i, j);
-                    M(j, baseRow + i) = block(i, j);
+                    M(baseRow + i, J.inner[k]) = J.values[k];
+                    M(J.inner[k], baseRow + i) = J.values[k];
                 }
             }
         }
 
         void addTripletsToSymmetric(ConstraintBase &cs, std::vector<Triplet> &triplets, const MeshPtr &mesh, const GeomPtr &geom, int baseRow)
         {
-            std::vector<Triplet> block;
-            cs.addTriplets(block, mesh, geom, 0);
-
-            for (Triplet t : block)
-            {
-                triplets.push_back(Triplet(baseRow + t.row(), t.col(), t.value()));
-                triplets.push_back(Triplet(t.col(), baseRow + t.row(), t.value()));
-            }
+            ConstraintJacobian::Get(cs, mesh, geom).AddTriplets(triplets, baseRow, true);
         }
 
     } // namespace Constraints
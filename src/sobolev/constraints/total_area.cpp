@@ -1,6 +1,7 @@
 #include "sobolev/constraints/total_area.h"
 #include "surface_derivatives.h"
 #include "helpers.h"
+#include "geometry_cache.h"
 
 namespace rsurfaces
 {
@@ -13,7 +14,7 @@ namespace rsurfaces
 
         void TotalAreaConstraint::ResetFunction(const MeshPtr &mesh, const GeomPtr &geom)
         {
-            initValue = totalArea(geom, mesh);
+            initValue = GeometryCache::Get(geom).totalArea;
         }
 
         size_t TotalAreaConstraint::nRows()
@@ -36,6 +37,27 @@ namespace rsurfaces
             }
         }
 
+        bool TotalAreaConstraint::refreshTripletValues(double *values, const MeshPtr &mesh, const GeomPtr &geom)
+        {
+            std::vector<GCVertex> vertices;
+            vertices.reserve(mesh->nVertices());
+            for (GCVertex v : mesh->vertices())
+            {
+                vertices.push_back(v);
+            }
+
+            // Same order as in addTriplets; vertices are only read here, so this can run in parallel.
+            #pragma omp parallel for
+            for (size_t i = 0; i < vertices.size(); i++)
+            {
+                Vector3 normal_v = SurfaceDerivs::meanCurvatureNormal(vertices[i], geom);
+                values[3 * i] = normal_v.x;
+                values[3 * i + 1] = normal_v.y;
+                values[3 * i + 2] = normal_v.z;
+            }
+            return true;
+        }
+
         void TotalAreaConstraint::addEntries(Eigen::MatrixXd &M, const MeshPtr &mesh, const GeomPtr &geom, int baseRow)
         {
             VertexIndices indices = mesh->getVertexIndices();
@@ -52,7 +74,7 @@ namespace rsurfaces
 
         void TotalAreaConstraint::addErrorValues(Eigen::VectorXd &V, const MeshPtr &mesh, const GeomPtr &geom, int baseRow)
         {
-            double current = totalArea(geom, mesh);
+            double current = GeometryCache::Get(geom).totalArea;
             V(baseRow) = (current - initValue);
         }
 
@@ -1,5 +1,6 @@
 #include "sobolev/constraints/total_volume.h"
 #include "helpers.h"
+#include "geometry_cache.h"
 
 namespace rsurfaces
 {
@@ -13,7 +14,7 @@ namespace rsurfaces
 
         void TotalVolumeConstraint::ResetFunction(const MeshPtr &mesh, const GeomPtr &geom)
         {
-            initValue = totalVolume(geom, mesh);
+            initValue = GeometryCache::Get(geom).totalVolume;
         }
 
         size_t TotalVolumeConstraint::nRows()
@@ -25,9 +26,10 @@ namespace rsurfaces
         void TotalVolumeConstraint::addTriplets(std::vector<Triplet> &triplets, const MeshPtr &mesh, const GeomPtr &geom, int baseRow)
         {
             VertexIndices indices = mesh->getVertexIndices();
+            const GeometryCache & G = GeometryCache::Get(geom);
             for (GCVertex v : mesh->vertices())
             {
-                Vector3 normal_v = areaWeightedNormal(geom, v);
+                Vector3 normal_v = G.VertexNormal(indices[v]);
                 size_t i3 = 3 * indices[v];
                 // Fill constraint row with area normal in each vertex's 3 entries
                 triplets.push_back(Triplet(baseRow, i3, normal_v.x));
@@ -36,12 +38,27 @@ namespace rsurfaces
             }
         }
 
+        bool TotalVolumeConstraint::refreshTripletValues(double *values, const MeshPtr &mesh, const GeomPtr &geom)
+        {
+            // addTriplets visits the vertices in index order, so the values are just the cached normals.
+            const GeometryCache & G = GeometryCache::Get(geom);
+            size_t n = 3 * mesh->nVertices();
+
+            #pragma omp parallel for
+            for (size_t i = 0; i < n; i++)
+            {
+                values[i] = G.vertexNormals[i];
+            }
+            return true;
+        }
+
         void TotalVolumeConstraint::addEntries(Eigen::MatrixXd &M, const MeshPtr &mesh, const GeomPtr &geom, int baseRow)
         {
             VertexIndices indices = mesh->getVertexIndices();
+            const GeometryCache & G = GeometryCache::Get(geom);
             for (GCVertex v : mesh->vertices())
             {
-                Vector3 normal_v = areaWeightedNormal(geom, v);
+                Vector3 normal_v = G.VertexNormal(indices[v]);
                 size_t i3 = 3 * indices[v];
                 // Fill constraint row with area normal in each vertex's 3 entries
                 M(baseRow, i3) = normal_v.x;
@@ -52,7 +69,7 @@ namespace rsurfaces
 
         void TotalVolumeConstraint::addErrorValues(Eigen::VectorXd &V, const MeshPtr &mesh, const GeomPtr &geom, int baseRow)
         {
-            double current = totalVolume(geom, mesh);
+            double current = GeometryCache::Get(geom).totalVolume;
             V(baseRow) = (current - initValue);
         }
 
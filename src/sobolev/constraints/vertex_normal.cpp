@@ -15,6 +15,7 @@ namespace rsurfaces
                 indices.push_back(indices_[i]);
                 initNormals.push_back(vertexAreaNormal(geom, mesh->vertex(indices_[i])));
             }
+            JacobianStructureChanged();
         }
 
         void VertexNormalConstraint::ResetFunction(const MeshPtr &mesh, const GeomPtr &geom)
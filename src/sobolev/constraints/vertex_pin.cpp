@@ -1,4 +1,5 @@
 #include "sobolev/constraints/vertex_pin.h"
+#include "geometry_cache.h"
 
 namespace rsurfaces
 {
@@ -14,6 +15,7 @@ namespace rsurfaces
                 initPositions.push_back(geom->inputVertexPositions[mesh->vertex(pinData[i])]);
                 offsets.push_back(PinOffset{Vector3{0, 0, 0}, 0});
             }
+            JacobianStructureChanged();
         }
 
         void VertexPinConstraint::pinVertices(const MeshPtr &mesh, const GeomPtr &geom, std::vector<VertexPinData> &pinData)
@@ -33,6 +35,7 @@ namespace rsurfaces
                     offsets.push_back(PinOffset{offsetStep, pinData[i].iterations});
                 }
             }
+            JacobianStructureChanged();
         }
 
         void VertexPinConstraint::ResetFunction(const MeshPtr &mesh, const GeomPtr &geom)
@@ -54,6 +57,12 @@ namespace rsurfaces
             }
         }
 
+        bool VertexPinConstraint::refreshTripletValues(double *values, const MeshPtr &mesh, const GeomPtr &geom)
+        {
+            // The entries do not depend on the positions.
+            return true;
+        }
+
         void VertexPinConstraint::addEntries(Eigen::MatrixXd &M, const MeshPtr &mesh, const GeomPtr &geom, int baseRow)
         {
             // All we do is put a 1 in the index for all pinned vertices
@@ -95,6 +104,7 @@ namespace rsurfaces
                     offsets[i].numIterations--;
                 }
             }
+            GeometryCache::PositionsChanged(geom);
         }
 
     } // namespace Constraints
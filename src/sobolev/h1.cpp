@@ -98,6 +98,7 @@ namespace rsurfaces
                     Vector3 corr_i{errors(3 * i), errors(3 * i + 1), errors(3 * i + 2)};
                     geom->inputVertexPositions[v_i] -= corr_i;
                 }
+                GeometryCache::PositionsChanged(geom);
             }
         }
     } // namespace H1
@@ -2,6 +2,7 @@
 #include "helpers.h"
 #include "spatial/convolution.h"
 #include "spatial/convolution_kernel.h"
+#include "sobolev/constraint_jacobian.h"
 
 namespace rsurfaces
 {
@@ -294,27 +295,18 @@ namespace rsurfaces
 
         Eigen::SparseMatrix<double> HsMetric::GetConstraintBlock(bool includeNewton) const
         {
-            std::vector<Triplet> triplets;
-            size_t curRow = 0;
-
-            for (SimpleProjectorConstraint *cons : simpleConstraints)
-            {
-                cons->addTriplets(triplets, mesh, geom, curRow);
-                curRow += cons->nRows();
-            }
+            std::vector<Constraints::ConstraintBase *> constraints(simpleConstraints.begin(), simpleConstraints.end());
 
             if (includeNewton)
             {
                 for (const ConstraintPack &pack : newtonConstraints)
                 {
-                    pack.constraint->addTriplets(triplets, mesh, geom, curRow);
-                    curRow += pack.constraint->nRows();
+                    constraints.push_back(pack.constraint);
                 }
             }
 
-            Eigen::SparseMatrix<double> C(curRow, 3 * mesh->nVertices());
-            C.setFromTriplets(triplets.begin(), triplets.end());
-
+            // Stacked from the cached Jacobians of the constraints (see ConstraintJacobian).
+            Eigen::SparseMatrix<double> C = Constraints::ConstraintJacobian::Stack(constraints, mesh, geom);
             return C;
         }
 
@@ -392,6 +384,7 @@ namespace rsurfaces
                 Vector3 vertCorr{corr(base), corr(base + 1), corr(base + 2)};
                 geom->inputVertexPositions[v] -= vertCorr;
             }
+            GeometryCache::PositionsChanged(geom);
         }
     } // namespace Hs
 } // namespace rsurfaces
\ No newline at end of file
@@ -0,0 +1,166 @@
+#include "sobolev/hs_newton_krylov.h"
+#include "line_search.h"
+#include "bct_constructors.h"
+#include "geometry_cache.h"
+
+namespace rsurfaces
+{
+    namespace Hs
+    {
+        HsNewtonKrylov::HsNewtonKrylov(MeshPtr mesh_, GeomPtr geom_, std::vector<SurfaceEnergy *> &energies_)
+            : energies(energies_)
+        {
+            mesh = mesh_;
+            geom = geom_;
+        }
+
+        void HsNewtonKrylov::SetPositions(const Eigen::MatrixXd &positions)
+        {
+            VertexIndices inds = mesh->getVertexIndices();
+            for (GCVertex v : mesh->vertices())
+            {
+                geom->inputVertexPositions[v] = MatrixUtils::GetRowAsVector3(positions, inds[v]);
+            }
+            geom->refreshQuantities();
+            GeometryCache::PositionsChanged(geom);
+
+            if (frozenBCT)
+            {
+                // Keep the hierarchy and the block partition; only the cluster data follow the positions.
+                RefitOptimizedBVH(energies[0]->GetBVH(), mesh, geom);
+                energies[0]->SetBlockClusterTree(frozenBCT);
+            }
+        }
+
+        void HsNewtonKrylov::BeginProducts()
+        {
+            origPositions.setZero(mesh->nVertices(), 3);
+            VertexIndices inds = mesh->getVertexIndices();
+            for (GCVertex v : mesh->vertices())
+            {
+                MatrixUtils::SetRowFromVector3(origPositions, inds[v], geom->inputVertexPositions[v]);
+            }
+
+            frozenBCT = nullptr;
+            OptimizedClusterTree *bvh = energies[0]->GetBVH();
+            if (bvh)
+            {
+                Vector2 exps = energies[0]->GetExponents();
+                frozenBCT = CreateOptimizedBCTFromBVH(bvh, exps.x, exps.y, energies[0]->GetTheta(), energies[0]->GetWeight());
+            }
+        }
+
+        void HsNewtonKrylov::EndProducts()
+        {
+            SetPositions(origPositions);
+            frozenBCT = nullptr;
+            energies[0]->SetBlockClusterTree(BCTPtr());
+        }
+
+        void HsNewtonKrylov::HessianProduct(const Eigen::MatrixXd &v, Eigen::MatrixXd &dest)
+        {
+            ptic("HsNewtonKrylov::HessianProduct");
+
+            dest.setZero(v.rows(), v.cols());
+            double vMax = v.lpNorm<Eigen::Infinity>();
+            if (vMax <= 0)
+            {
+                ptoc("HsNewtonKrylov::HessianProduct");
+                return;
+            }
+
+            const GeometryCache &G = GeometryCache::Get(geom);
+            double h = sqrt(G.totalArea / G.face_count);
+            double eps = relativeStep * h / vMax;
+
+            Eigen::MatrixXd gPlus, gMinus;
+            gPlus.setZero(v.rows(), v.cols());
+            gMinus.setZero(v.rows(), v.cols());
+
+            SetPositions(origPositions + eps * v);
+            AddGradientsToMatrix(energies, gPlus);
+
+            SetPositions(origPositions - eps * v);
+            AddGradientsToMatrix(energies, gMinus);
+
+            dest = (gPlus - gMinus) / (2 * eps);
+
+            ptoc("HsNewtonKrylov::HessianProduct");
+        }
+
+        size_t HsNewtonKrylov::SolveNewtonSystem(const Eigen::MatrixXd &l2diff, const HsMetric &hs, Eigen::MatrixXd &dest)
+        {
+            ptic("HsNewtonKrylov::SolveNewtonSystem");
+
+            Eigen::MatrixXd r = l2diff;
+            Eigen::MatrixXd z, p, Hp;
+            z.setZero(r.rows(), r.cols());
+            dest.setZero(r.rows(), r.cols());
+
+            // The preconditioner also projects onto the tangent space of the constraints,
+            // so all iterates stay feasible to first order.
+            ProjectViaSchur<SparseInverse>(hs, r, z);
+            Eigen::MatrixXd z0 = z;
+
+            double rz = (r.transpose() * z).trace();
+            double rz0 = rz;
+            if (rz0 <= 0)
+            {
+                std::cout << "  * Preconditioned gradient is zero" << std::endl;
+                ptoc("HsNewtonKrylov::SolveNewtonSystem");
+                return 0;
+            }
+
+            // Eisenstat-Walker type forcing: solve more accurately close to the minimum.
+            double eta = std::min(forcingTerm, sqrt(sqrt(rz0)));
+
+            BeginProducts();
+            p = z;
+            size_t k = 0;
+            for (k = 0; k < maxIterations; k++)
+            {
+                HessianProduct(p, Hp);
+                double pHp = (p.transpose() * Hp).trace();
+
+                if (pHp <= 0)
+                {
+                    // Negative curvature: stop at the current iterate, or fall back to the
+                    // preconditioned gradient if nothing has been accumulated yet.
+                    std::cout << "  * Negative curvature detected after " << k << " CG iterations" << std::endl;
+                    if (k == 0)
+                    {
+                        dest = z0;
+                    }
+                    break;
+                }
+
+                double alpha = rz / pHp;
+                dest += alpha * p;
+                r -= alpha * Hp;
+
+                ProjectViaSchur<SparseInverse>(hs, r, z);
+                double rzNext = (r.transpose() * z).trace();
+
+                if (rzNext <= eta * eta * rz0)
+                {
+                    k++;
+                    break;
+                }
+
+                double beta = rzNext / rz;
+                rz = rzNext;
+                p = z + beta * p;
+            }
+
+            // The positions are restored once, after the last product.
+            EndProducts();
+
+            std::cout << "  * Newton-CG: " << k << " iterations, forcing term = " << eta << std::endl;
+            ptcounter("Newton-CG iterations", k);
+
+            ptoc("HsNewtonKrylov::SolveNewtonSystem");
+            return k;
+        }
+
+    } // namespace Hs
+} // namespace rsurfaces
@@ -0,0 +1,530 @@
+#include "solver_capture.h"
+#include "geometry_cache.h"
+#include "bct_constructors.h"
+#include "energy/tpe_barnes_hut_0.h"
+#include "sobolev/hs.h"
+
+#include "geometrycentral/surface/surface_mesh_factories.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <omp.h>
+
+namespace rsurfaces
+{
+    namespace
+    {
+        const char capture_magic[8] = {'R', 'S', 'C', 'A', 'P', 'T', 'U', 'R'};
+        const uint32_t capture_version = 1;
+
+        template <typename T>
+        void writePOD(std::ostream &os, const T &x)
+        {
+            os.write(reinterpret_cast<const char *>(&x), sizeof(T));
+        }
+
+        template <typename T>
+        void readPOD(std::istream &is, T &x)
+        {
+            is.read(reinterpret_cast<char *>(&x), sizeof(T));
+            if (!is)
+            {
+                throw std::runtime_error("SolverCapture: unexpected end of file.");
+            }
+        }
+
+        template <typename T, typename Alloc>
+        void writeArray(std::ostream &os, const std::vector<T, Alloc> &v)
+        {
+            writePOD(os, static_cast<int64_t>(v.size()));
+            os.write(reinterpret_cast<const char *>(v.data()), v.size() * sizeof(T));
+        }
+
+        template <typename T, typename Alloc>
+        void readArray(std::istream &is, std::vector<T, Alloc> &v)
+        {
+            int64_t n = 0;
+            readPOD(is, n);
+            if (n < 0)
+            {
+                throw std::runtime_error("SolverCapture: corrupt array size.");
+            }
+            v.resize(n);
+            is.read(reinterpret_cast<char *>(v.data()), n * sizeof(T));
+            if (!is)
+            {
+                throw std::runtime_error("SolverCapture: unexpected end of file.");
+            }
+        }
+
+        template <typename T>
+        void copyArray(std::vector<T> &dest, const T *src, mint count)
+        {
+            if (src && count > 0)
+            {
+                dest.assign(src, src + count);
+            }
+            else
+            {
+                dest.clear();
+            }
+        }
+
+        template <typename T>
+        bool sameArray(const std::vector<T> &captured, const T *current, mint count)
+        {
+            if (captured.empty())
+            {
+                return !current || count == 0;
+            }
+            return current && static_cast<mint>(captured.size()) == count && std::equal(captured.begin(), captured.end(), current);
+        }
+
+        void writeInteraction(std::ostream &os, const SolverCapture::Interaction &I)
+        {
+            writePOD(os, I.b_m);
+            writePOD(os, I.b_n);
+            writePOD(os, I.b_nnz);
+            writePOD(os, I.m);
+            writePOD(os, I.n);
+            writePOD(os, I.nnz);
+            writePOD(os, I.hi_factor);
+            writePOD(os, I.lo_factor);
+            writePOD(os, I.fr_factor);
+            writeArray(os, I.b_outer);
+            writeArray(os, I.b_inner);
+            writeArray(os, I.outer);
+            writeArray(os, I.inner);
+            writeArray(os, I.hi_values);
+            writeArray(os, I.lo_values);
+            writeArray(os, I.fr_values);
+        }
+
+        void readInteraction(std::istream &is, SolverCapture::Interaction &I)
+        {
+            readPOD(is, I.b_m);
+            readPOD(is, I.b_n);
+            readPOD(is, I.b_nnz);
+            readPOD(is, I.m);
+            readPOD(is, I.n);
+            readPOD(is, I.nnz);
+            readPOD(is, I.hi_factor);
+            readPOD(is, I.lo_factor);
+            readPOD(is, I.fr_factor);
+            readArray(is, I.b_outer);
+            readArray(is, I.b_inner);
+            readArray(is, I.outer);
+            readArray(is, I.inner);
+            readArray(is, I.hi_values);
+            readArray(is, I.lo_values);
+            readArray(is, I.fr_values);
+        }
+
+        // Columns are the primitives (or clusters); data[k] holds the k-th component of all of them.
+        void appendColumns(std::vector<mreal> &dest, const A_Vector<mreal *> &data, mint dim, mint count)
+        {
+            for (mint k = 0; k < dim; ++k)
+            {
+                dest.insert(dest.end(), data[k], data[k] + count);
+            }
+        }
+
+        mreal columnsDeviation(const std::vector<mreal> &captured, const A_Vector<mreal *> &data, mint dim, mint count)
+        {
+            mreal deviation = 0.;
+            for (mint k = 0; k < dim; ++k)
+            {
+                for (mint i = 0; i < count; ++i)
+                {
+                    deviation = std::max(deviation, std::abs(captured[k * count + i] - data[k][i]));
+                }
+            }
+            return deviation;
+        }
+    } // namespace
+
+    void SolverCapture::Interaction::From(const InteractionData &data)
+    {
+        b_m = data.b_m;
+        b_n = data.b_n;
+        b_nnz = data.b_nnz;
+        m = data.m;
+        n = data.n;
+        nnz = data.nnz;
+        hi_factor = data.hi_factor;
+        lo_factor = data.lo_factor;
+        fr_factor = data.fr_factor;
+        copyArray(b_outer, data.b_outer, b_m + 1);
+        copyArray(b_inner, data.b_inner, b_nnz);
+        copyArray(outer, data.outer, m + 1);
+        copyArray(inner, data.inner, nnz);
+        copyArray(hi_values, data.hi_values, nnz);
+        copyArray(lo_values, data.lo_values, nnz);
+        copyArray(fr_values, data.fr_values, nnz);
+    } // From
+
+    bool SolverCapture::Interaction::SameStructure(const InteractionData &data) const
+    {
+        return b_m == data.b_m && b_n == data.b_n && b_nnz == data.b_nnz && m == data.m && n == data.n && nnz == data.nnz
+            && sameArray(b_outer, data.b_outer, b_m + 1) && sameArray(b_inner, data.b_inner, b_nnz)
+            && sameArray(outer, data.outer, m + 1) && sameArray(inner, data.inner, nnz);
+    } // SameStructure
+
+    void SolverCapture::Interaction::Into(InteractionData &data) const
+    {
+        data.hi_factor = hi_factor;
+        data.lo_factor = lo_factor;
+        data.fr_factor = fr_factor;
+        if (data.hi_values && !hi_values.empty())
+        {
+            std::copy(hi_values.begin(), hi_values.end(), data.hi_values);
+        }
+        if (data.lo_values && !lo_values.empty())
+        {
+            std::copy(lo_values.begin(), lo_values.end(), data.lo_values);
+        }
+        if (data.fr_values && !fr_values.empty())
+        {
+            std::copy(fr_values.begin(), fr_values.end(), data.fr_values);
+        }
+    } // Into
+
+    SolverCapture SolverCapture::Take(long step_, const MeshPtr &mesh, const GeomPtr &geom, SurfaceEnergy *energy, BCTPtr bct,
+                                      const std::vector<Eigen::VectorXd> &rhs_)
+    {
+        ptic("SolverCapture::Take");
+
+        OptimizedClusterTree *bvh = energy->GetBVH();
+        if (!bvh || !bct)
+        {
+            throw std::runtime_error("SolverCapture::Take: needs an energy with a BVH and a block cluster tree.");
+        }
+
+        SolverCapture C;
+        C.step = step_;
+        Vector2 exps = energy->GetExponents();
+        C.alpha = exps.x;
+        C.beta = exps.y;
+        C.theta = energy->GetTheta();
+        C.weight = energy->GetWeight();
+        C.bvh_settings = bvh->settings;
+        C.bct_settings = bct->settings;
+
+        const GeometryCache &G = GeometryCache::Get(geom);
+        C.faces.assign(G.faceVertices.begin(), G.faceVertices.end());
+        C.positions.resize(3 * mesh->nVertices());
+        for (size_t i = 0; i < mesh->nVertices(); i++)
+        {
+            Vector3 p = geom->inputVertexPositions[i];
+            C.positions[3 * i + 0] = p.x;
+            C.positions[3 * i + 1] = p.y;
+            C.positions[3 * i + 2] = p.z;
+        }
+
+        C.primitive_count = bvh->primitive_count;
+        C.cluster_count = bvh->cluster_count;
+        C.near_dim = bvh->near_dim;
+        C.far_dim = bvh->far_dim;
+        C.P_ext_pos.assign(bvh->P_ext_pos, bvh->P_ext_pos + C.primitive_count);
+        C.C_begin.assign(bvh->C_begin, bvh->C_begin + C.cluster_count);
+        C.C_end.assign(bvh->C_end, bvh->C_end + C.cluster_count);
+        C.C_left.assign(bvh->C_left, bvh->C_left + C.cluster_count);
+        C.C_right.assign(bvh->C_right, bvh->C_right + C.cluster_count);
+        appendColumns(C.P_near, bvh->P_near, C.near_dim, C.primitive_count);
+        appendColumns(C.P_far, bvh->P_far, C.far_dim, C.primitive_count);
+        appendColumns(C.C_far, bvh->C_far, C.far_dim, C.cluster_count);
+
+        bct->RequireMetrics();
+        C.near.From(*bct->near);
+        C.far.From(*bct->far);
+
+        C.rhs = rhs_;
+
+        ptoc("SolverCapture::Take");
+        return C;
+    } // Take
+
+    void SolverCapture::Write(const std::string &filename) const
+    {
+        ptic("SolverCapture::Write");
+
+        std::ofstream os(filename, std::ios::binary);
+        if (!os)
+        {
+            throw std::runtime_error("SolverCapture: could not open " + filename + " for writing.");
+        }
+
+        os.write(capture_magic, sizeof(capture_magic));
+        writePOD(os, capture_version);
+        writePOD(os, static_cast<uint32_t>(sizeof(mint)));
+        writePOD(os, static_cast<uint32_t>(sizeof(mreal)));
+        writePOD(os, static_cast<uint32_t>(sizeof(BVHSettings)));
+        writePOD(os, static_cast<uint32_t>(sizeof(BCTSettings)));
+
+        writePOD(os, static_cast<int64_t>(step));
+        writePOD(os, alpha);
+        writePOD(os, beta);
+        writePOD(os, theta);
+        writePOD(os, weight);
+        writePOD(os, bvh_settings);
+        writePOD(os, bct_settings);
+
+        writeArray(os, faces);
+        writeArray(os, positions);
+
+        writePOD(os, primitive_count);
+        writePOD(os, cluster_count);
+        writePOD(os, near_dim);
+        writePOD(os, far_dim);
+        writeArray(os, P_ext_pos);
+        writeArray(os, C_begin);
+        writeArray(os, C_end);
+        writeArray(os, C_left);
+        writeArray(os, C_right);
+        writeArray(os, P_near);
+        writeArray(os, P_far);
+        writeArray(os, C_far);
+
+        writeInteraction(os, near);
+        writeInteraction(os, far);
+
+        writePOD(os, static_cast<int64_t>(rhs.size()));
+        for (const Eigen::VectorXd &b : rhs)
+        {
+            writePOD(os, static_cast<int64_t>(b.size()));
+            os.write(reinterpret_cast<const char *>(b.data()), b.size() * sizeof(double));
+        }
+
+        if (!os)
+        {
+            throw std::runtime_error("SolverCapture: writing " + filename + " failed.");
+        }
+        std::cout << "Captured the solver state of step " << step << " (" << faces.size() / 3 << " faces, near field nnz "
+                  << near.nnz << ", far field nnz " << far.nnz << ") to " << filename << "." << std::endl;
+
+        ptoc("SolverCapture::Write");
+    } // Write
+
+    SolverCapture SolverCapture::Read(const std::string &filename)
+    {
+        std::ifstream is(filename, std::ios::binary);
+        if (!is)
+        {
+            throw std::runtime_error("SolverCapture: could not open " + filename + ".");
+        }
+
+        char magic[sizeof(capture_magic)];
+        is.read(magic, sizeof(magic));
+        uint32_t version = 0, mint_size = 0, mreal_size = 0, bvh_size = 0, bct_size = 0;
+        if (!is || std::memcmp(magic, capture_magic, sizeof(magic)) != 0)
+        {
+            throw std::runtime_error("SolverCapture: " + filename + " is not a capture file.");
+        }
+        readPOD(is, version);
+        readPOD(is, mint_size);
+        readPOD(is, mreal_size);
+        readPOD(is, bvh_size);
+        readPOD(is, bct_size);
+        if (version != capture_version || mint_size != sizeof(mint) || mreal_size != sizeof(mreal)
+            || bvh_size != sizeof(BVHSettings) || bct_size != sizeof(BCTSettings))
+        {
+            throw std::runtime_error("SolverCapture: " + filename + " was written by an incompatible build.");
+        }
+
+        SolverCapture C;
+        int64_t step_ = 0;
+        readPOD(is, step_);
+        C.step = step_;
+        readPOD(is, C.alpha);
+        readPOD(is, C.beta);
+        readPOD(is, C.theta);
+        readPOD(is, C.weight);
+        readPOD(is, C.bvh_settings);
+        readPOD(is, C.bct_settings);
+
+        readArray(is, C.faces);
+        readArray(is, C.positions);
+
+        readPOD(is, C.primitive_count);
+        readPOD(is, C.cluster_count);
+        readPOD(is, C.near_dim);
+        readPOD(is, C.far_dim);
+        readArray(is, C.P_ext_pos);
+        readArray(is, C.C_begin);
+        readArray(is, C.C_end);
+        readArray(is, C.C_left);
+        readArray(is, C.C_right);
+        readArray(is, C.P_near);
+        readArray(is, C.P_far);
+        readArray(is, C.C_far);
+
+        readInteraction(is, C.near);
+        readInteraction(is, C.far);
+
+        int64_t rhs_count = 0;
+        readPOD(is, rhs_count);
+        C.rhs.resize(rhs_count);
+        for (Eigen::VectorXd &b : C.rhs)
+        {
+            int64_t n = 0;
+            readPOD(is, n);
+            b.resize(n);
+            is.read(reinterpret_cast<char *>(b.data()), n * sizeof(double));
+        }
+        if (!is)
+        {
+            throw std::runtime_error("SolverCapture: unexpected end of file.");
+        }
+        return C;
+    } // Read
+
+    mreal SolverCapture::TreeDeviation(const OptimizedClusterTree *bvh) const
+    {
+        if (bvh->primitive_count != primitive_count || bvh->cluster_count != cluster_count
+            || bvh->near_dim != near_dim || bvh->far_dim != far_dim
+            || !sameArray(P_ext_pos, bvh->P_ext_pos, primitive_count)
+            || !sameArray(C_begin, bvh->C_begin, cluster_count) || !sameArray(C_end, bvh->C_end, cluster_count)
+            || !sameArray(C_left, bvh->C_left, cluster_count) || !sameArray(C_right, bvh->C_right, cluster_count))
+        {
+            return std::numeric_limits<mreal>::infinity();
+        }
+        mreal deviation = columnsDeviation(P_near, bvh->P_near, near_dim, primitive_count);
+        deviation = std::max(deviation, columnsDeviation(P_far, bvh->P_far, far_dim, primitive_count));
+        deviation = std::max(deviation, columnsDeviation(C_far, bvh->C_far, far_dim, cluster_count));
+        return deviation;
+    } // TreeDeviation
+
+    bool SolverCapture::Replay(int repetitions, std::ostream &os) const
+    {
+        std::vector<std::vector<size_t>> polygons(faces.size() / 3);
+        for (size_t i = 0; i < polygons.size(); i++)
+        {
+            polygons[i] = {static_cast<size_t>(faces[3 * i]), static_cast<size_t>(faces[3 * i + 1]), static_cast<size_t>(faces[3 * i + 2])};
+        }
+        std::vector<Vector3> vertexPositions(positions.size() / 3);
+        for (size_t i = 0; i < vertexPositions.size(); i++)
+        {
+            vertexPositions[i] = Vector3{positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]};
+        }
+
+        MeshUPtr u_mesh;
+        GeomUPtr u_geom;
+        std::tie(u_mesh, u_geom) = surface::makeManifoldSurfaceMeshAndGeometry(polygons, vertexPositions);
+        MeshPtr mesh = std::move(u_mesh);
+        GeomPtr geom = std::move(u_geom);
+        geom->requireFaceNormals();
+        geom->requireFaceAreas();
+        geom->requireVertexNormals();
+        geom->requireVertexDualAreas();
+
+        // The energy and the metric build their trees with the default settings.
+        BVHSettings saved_bvh_settings = BVHDefaultSettings;
+        BCTSettings saved_bct_settings = BCTDefaultSettings;
+        BVHDefaultSettings = bvh_settings;
+        BCTDefaultSettings = bct_settings;
+
+        bool matches = false;
+        {
+            TPEnergyBarnesHut0 tpe(mesh, geom, alpha, beta, theta, weight);
+            OptimizedClusterTree *bvh = tpe.GetBVH();
+
+            mreal deviation = TreeDeviation(bvh);
+            os << "Replaying step " << step << ": " << polygons.size() << " faces, " << cluster_count << " clusters, theta = " << theta << std::endl;
+            os << "  cluster tree: max deviation from capture = " << deviation << std::endl;
+
+            BCTPtr bct = CreateOptimizedBCTFromBVH(bvh, alpha, beta, theta, weight, bct_settings);
+            bct->RequireMetrics();
+
+            matches = deviation < std::numeric_limits<mreal>::infinity() && near.SameStructure(*bct->near) && far.SameStructure(*bct->far);
+            if (!matches)
+            {
+                os << "  The rebuilt trees do not match the capture; nothing is timed." << std::endl;
+            }
+            else
+            {
+                near.Into(*bct->near);
+                far.Into(*bct->far);
+
+                auto time = [&](const std::string &name, const std::function<void()> &kernel) {
+                    kernel(); // warm-up, e.g. for MKL's inspector or the factorization in ProjectSparse
+                    double best = std::numeric_limits<double>::max();
+                    double total = 0.;
+                    for (int r = 0; r < repetitions; ++r)
+                    {
+                        double start = omp_get_wtime();
+                        kernel();
+                        double t = omp_get_wtime() - start;
+                        best = std::min(best, t);
+                        total += t;
+                    }
+                    os << name << "\t" << 1000. * best << "\t" << 1000. * total / repetitions << std::endl;
+                };
+
+                const mint cols = 3;
+                os << omp_get_max_threads() << " threads, " << repetitions << " repetitions, " << cols << " columns" << std::endl;
+                os << "kernel\tbest [ms]\tmean [ms]" << std::endl;
+
+                for (bool is_near : {true, false})
+                {
+                    InteractionData &D = is_near ? *bct->near : *bct->far;
+                    std::string field = is_near ? "near " : "far ";
+                    A_Vector<mreal> input(D.n * cols, 1.);
+                    A_Vector<mreal> output(D.m * cols, 0.);
+                    std::vector<std::pair<std::string, mreal *>> kernels = {{"hi", D.hi_values}, {"lo", D.lo_values}, {"fr", D.fr_values}};
+
+                    for (auto &k : kernels)
+                    {
+                        if (!k.second)
+                        {
+                            continue;
+                        }
+                        time(field + "ApplyKernel_CSR_MKL " + k.first, [&]() { D.ApplyKernel_CSR_MKL(k.second, &input[0], &output[0], cols); });
+                        time(field + "ApplyKernel_CSR_Eigen " + k.first, [&]() { D.ApplyKernel_CSR_Eigen(k.second, &input[0], &output[0], cols); });
+                        if (D.nnz != D.b_nnz && D.job_ptr)
+                        {
+                            time(field + "ApplyKernel_Hybrid " + k.first, [&]() { D.ApplyKernel_Hybrid(k.second, &input[0], &output[0], cols); });
+                        }
+                    }
+                }
+
+                time("FarFieldInteraction", [&]() { bct->FarFieldInteraction(); });
+                if (bct_settings.mult_alg != NearFieldMultiplicationAlgorithm::VBSR)
+                {
+                    time("NearFieldInteraction_CSR", [&]() { bct->NearFieldInteraction_CSR(); });
+                }
+                near.Into(*bct->near);
+                far.Into(*bct->far);
+
+                Eigen::MatrixXd diff(mesh->nVertices(), 3);
+                time("Barnes-Hut Differential", [&]() {
+                    diff.setZero();
+                    tpe.Differential(diff);
+                });
+
+                std::vector<SurfaceEnergy *> energies = {&tpe};
+                std::vector<Constraints::SimpleProjectorConstraint *> spcs;
+                std::vector<ConstraintPack> schurs;
+                Hs::HsMetric hs(energies, nullptr, spcs, schurs);
+                hs.SetBlockClusterTree(bct);
+
+                for (size_t k = 0; k < rhs.size(); k++)
+                {
+                    Eigen::VectorXd b, x;
+                    b.setZero(hs.getNumRows(false));
+                    mint len = std::min(b.size(), rhs[k].size());
+                    b.head(len) = rhs[k].head(len);
+                    x.setZero(b.size());
+                    time("ProjectSparse rhs " + std::to_string(k), [&]() { hs.InvertMetric(b, x); });
+                }
+            }
+        }
+
+        BVHDefaultSettings = saved_bvh_settings;
+        BCTDefaultSettings = saved_bct_settings;
+        return matches;
+    } // Replay
+
+} // namespace rsurfaces
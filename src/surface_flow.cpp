@@ -12,6 +12,8 @@
 #include "sobolev/hs_iterative.h"
 #include "sobolev/constraints.h"
 #include "spatial/convolution.h"
+#include "solver_capture.h"
+#include "mpi_context.h"
 
 #include <Eigen/SparseCholesky>
 
@@ -35,11 +37,14 @@ namespace rsurfaces
         verticesMutated = false;
         lbfgs = 0;
         bqn_B = 0;
+        sharedBCT = nullptr;
     }
 
     void SurfaceFlow::AddAdditionalEnergy(SurfaceEnergy *extraEnergy)
     {
         energies.push_back(extraEnergy);
+        // the coarse copies mirror the list of energies
+        lineSearchCoarse.Release();
     }
 
     void SurfaceFlow::AddObstacleEnergy(SurfaceEnergy *obsEnergy)
@@ -57,6 +62,61 @@ namespace rsurfaces
         }
     }
 
+    LineSearch::CoarseState *SurfaceFlow::CoarseLineSearchState()
+    {
+        // After remeshing, the coarse geometry and trees no longer match the mesh.
+        if (verticesMutated)
+        {
+            lineSearchCoarse.Release();
+        }
+        return &lineSearchCoarse;
+    }
+
+    void SurfaceFlow::BuildSharedBlockClusterTree()
+    {
+        sharedBCT = nullptr;
+        SurfaceEnergy *energy = energies[0];
+        OptimizedClusterTree *bvh = energy->GetBVH();
+
+        if (!shareBlockClusterTree || !bvh)
+        {
+            return;
+        }
+
+        ptic("SurfaceFlow::BuildSharedBlockClusterTree");
+        // Same configuration as the one HsMetric::getBlockClusterTree would use.
+        Vector2 exps = energy->GetExponents();
+        BCTSettings settings;
+        if (disableNearField)
+        {
+            settings.near_lo_modifier = 0.;
+            settings.far_lo_modifier = 0.;
+        }
+        sharedBCT = CreateOptimizedBCTFromBVH(bvh, exps.x, exps.y, energy->GetTheta(), energy->GetWeight(), settings);
+        // The energy keeps the partition until its next Update.
+        energy->SetBlockClusterTree(sharedBCT);
+        ptoc("SurfaceFlow::BuildSharedBlockClusterTree");
+    }
+
+    void SurfaceFlow::captureState(const Hs::HsMetric &hs, const Eigen::MatrixXd &l2diff)
+    {
+        if (!energies[0]->GetBVH())
+        {
+            wprint("SurfaceFlow::captureState: the first energy has no BVH; nothing captured.");
+            return;
+        }
+        if (MPIContext::Size() > 1)
+        {
+            wprint("SurfaceFlow::captureState: the block cluster tree is distributed over MPI ranks; nothing captured.");
+            return;
+        }
+        // The right-hand side as the metric solve gets it: the flattened gradient, zero in the constraint rows.
+        Eigen::VectorXd rhs;
+        rhs.setZero(hs.getNumRows(false));
+        MatrixUtils::MatrixIntoColumn(l2diff, rhs);
+        SolverCapture::Take(stepCount, mesh, geom, energies[0], hs.getBlockClusterTree(), {rhs}).Write(captureFile);
+    }
+
     inline double guessStepSize(double gProjNorm)
     {
         // double initGuess = (gProjNorm < 1) ? 1.0 / sqrt(gProjNorm) : 1.0 / gProjNorm;
@@ -75,7 +135,7 @@ namespace rsurfaces
         AssembleGradients(l2diff);
 
         double initGuess = guessStepSize(l2diff.norm());
-        LineSearch search(mesh, geom, energies, maxStepSize);
+        LineSearch search(mesh, geom, energies, maxStepSize, speculativeProbes, lineSearchCoarseTheta, CoarseLineSearchState());
         search.BacktrackingLineSearch(l2diff, initGuess, 1);
     }
 
@@ -115,7 +175,7 @@ namespace rsurfaces
         MatrixUtils::ColumnIntoMatrix(l2col, l2diff);
 
         double initGuess = guessStepSize(l2diff.norm());
-        LineSearch search(mesh, geom, energies, maxStepSize);
+        LineSearch search(mesh, geom, energies, maxStepSize, speculativeProbes, lineSearchCoarseTheta, CoarseLineSearchState());
         search.BacktrackingLineSearch(l2diff, initGuess, 1);
         
         // Constraint projection
@@ -145,6 +205,7 @@ namespace rsurfaces
         }
 
         geom->refreshQuantities();
+        GeometryCache::PositionsChanged(geom);
     }
 
 
@@ -162,6 +223,13 @@ namespace rsurfaces
     {
         std::unique_ptr<Hs::HsMetric> hs(new Hs::HsMetric(energies, obstacleEnergy, simpleConstraints, schurConstraints));
         hs->disableNearField = disableNearField;
+        if (sharedBCT)
+        {
+            // The metric may add obstacle corrections to the block cluster tree,
+            // so it is handed to the first metric of the step only.
+            hs->SetBlockClusterTree(sharedBCT);
+            sharedBCT = nullptr;
+        }
         return hs;
     }
 
@@ -209,9 +277,10 @@ namespace rsurfaces
         std::cout << "  * Initial step size guess = " << initGuess << std::endl;
 
         // Take the step using line search
-        LineSearch search(mesh, geom, energies, maxStepSize);
+        LineSearch search(mesh, geom, energies, maxStepSize, speculativeProbes, lineSearchCoarseTheta, CoarseLineSearchState());
         search.BacktrackingLineSearch(gradientProj, initGuess, gradDot);
         geom->refreshQuantities();
+        GeometryCache::PositionsChanged(geom);
 
         // Reuse factorized matrix for constraint projection
         gradientCol.setZero();
@@ -265,6 +334,7 @@ namespace rsurfaces
         std::cout << "=== Iteration " << stepCount << " ===" << std::endl;
         std::cout << "Using Hs projected gradient method..." << std::endl;
         UpdateEnergies();
+        BuildSharedBlockClusterTree();
 
         // Assemble sum of L2 differentials of all energies involved
         // (including tangent-point energy)
@@ -279,6 +349,11 @@ namespace rsurfaces
         hs->allowBarycenterShift = allowBarycenterShift;
         printSolveInfo(hs->newtonConstraints.size());
 
+        if (stepCount == captureStep)
+        {
+            captureState(*hs, l2diff);
+        }
+
         Vector3 shift{0, 0, 0};
         if (allowBarycenterShift)
         {
@@ -306,7 +381,7 @@ namespace rsurfaces
         std::cout << "  * Initial step size guess = " << initGuess << std::endl;
 
         // Take the step using line search
-        LineSearch search(mesh, geom, energies, maxStepSize);
+        LineSearch search(mesh, geom, energies, maxStepSize, speculativeProbes, lineSearchCoarseTheta, CoarseLineSearchState());
         double delta = search.BacktrackingLineSearch(gradientProj, initGuess, gradDot);
 
         if (schurConstraints.size() > 0)
@@ -326,6 +401,7 @@ namespace rsurfaces
 
         incrementSchurConstraints();
         geom->refreshQuantities();
+        GeometryCache::PositionsChanged(geom);
 
         long timeEnd = currentTimeMilliseconds();
         std::cout << "  Total time for gradient step = " << (timeEnd - timeStart) << " ms" << std::endl;
@@ -342,6 +418,7 @@ namespace rsurfaces
         std::cout << "=== Iteration " << stepCount << " ===" << std::endl;
         std::cout << "Using iterative Hs projected gradient method..." << std::endl;
         UpdateEnergies();
+        BuildSharedBlockClusterTree();
 
         // Assemble sum of L2 differentials of all energies involved
         // (including tangent-point energy)
@@ -354,6 +431,11 @@ namespace rsurfaces
         std::unique_ptr<Hs::HsMetric> hs = GetHsMetric();
         printSolveInfo(hs->newtonConstraints.size());
 
+        if (stepCount == captureStep)
+        {
+            captureState(*hs, l2diff);
+        }
+
         Vector3 shift{0, 0, 0};
         if (allowBarycenterShift)
         {
@@ -381,7 +463,7 @@ namespace rsurfaces
         std::cout << "  * Initial step size guess = " << initGuess << std::endl;
 
         // Take the step using line search
-        LineSearch search(mesh, geom, energies, maxStepSize);
+        LineSearch search(mesh, geom, energies, maxStepSize, speculativeProbes, lineSearchCoarseTheta, CoarseLineSearchState());
         double delta = search.BacktrackingLineSearch(gradientProj, initGuess, gradDot);
 
         // Constraint projection
@@ -403,6 +485,7 @@ namespace rsurfaces
 
         incrementSchurConstraints();
         geom->refreshQuantities();
+        GeometryCache::PositionsChanged(geom);
 
         long timeEnd = currentTimeMilliseconds();
         std::cout << "  Total time for gradient step = " << (timeEnd - timeStart) << " ms" << std::endl;
@@ -410,6 +493,81 @@ namespace rsurfaces
         ptoc("SurfaceFlow::StepProjectedGradientIterative");
     }
 
+    void SurfaceFlow::StepNewtonKrylov()
+    {
+        ptic("SurfaceFlow::StepNewtonKrylov");
+
+        long timeStart = currentTimeMilliseconds();
+        stepCount++;
+        std::cout << "=== Iteration " << stepCount << " ===" << std::endl;
+        std::cout << "Using Hs-preconditioned truncated Newton method..." << std::endl;
+        UpdateEnergies();
+        BuildSharedBlockClusterTree();
+
+        // Assemble sum of L2 differentials of all energies involved
+        // (including tangent-point energy)
+        Eigen::MatrixXd l2diff, newtonDir;
+        l2diff.setZero(mesh->nVertices(), 3);
+        newtonDir.setZero(mesh->nVertices(), 3);
+        AssembleGradients(l2diff);
+        double gNorm = l2diff.norm();
+
+        std::unique_ptr<Hs::HsMetric> hs = GetHsMetric();
+        hs->allowBarycenterShift = allowBarycenterShift;
+        printSolveInfo(hs->newtonConstraints.size());
+
+        Vector3 shift{0, 0, 0};
+        if (allowBarycenterShift)
+        {
+            shift = averageOfMatrixRows(geom, mesh, l2diff);
+            std::cout << "Average shift of L2 diff = " << shift << std::endl;
+        }
+
+        Hs::HsNewtonKrylov newton(mesh, geom, energies);
+        size_t cgIters = newton.SolveNewtonSystem(l2diff, *hs, newtonDir);
+
+        if (allowBarycenterShift)
+        {
+            addShiftToMatrixRows(newtonDir, mesh->nVertices(), shift);
+        }
+
+        double dirNorm = newtonDir.norm();
+        // Measure dot product of search direction with original gradient direction
+        double gradDot = (l2diff.transpose() * newtonDir).trace() / (gNorm * dirNorm);
+
+        // A converged Newton direction wants the full step; fall back to the
+        // gradient-style guess when CG stopped before doing anything.
+        double initGuess = (cgIters > 0) ? 1.0 : guessStepSize(dirNorm);
+        std::cout << "  * Initial step size guess = " << initGuess << std::endl;
+
+        // Take the step using line search
+        LineSearch search(mesh, geom, energies, maxStepSize, speculativeProbes, lineSearchCoarseTheta, CoarseLineSearchState());
+        double delta = search.BacktrackingLineSearch(newtonDir, initGuess, gradDot);
+
+        if (schurConstraints.size() > 0)
+        {
+            Hs::ProjectSchurConstraints<Hs::SparseInverse>(*hs, 1);
+        }
+
+        if (allowBarycenterShift)
+        {
+            // The barycenter goes wherever it wants.
+        }
+        else
+        {
+            hs->ProjectSimpleConstraints();
+        }
+
+        incrementSchurConstraints();
+        geom->refreshQuantities();
+        GeometryCache::PositionsChanged(geom);
+
+        long timeEnd = currentTimeMilliseconds();
+        std::cout << "  Total time for Newton step = " << (timeEnd - timeStart) << " ms" << std::endl;
+
+        ptoc("SurfaceFlow::StepNewtonKrylov");
+    }
+
     size_t SurfaceFlow::addConstraintTriplets(std::vector<Triplet> &triplets, bool includeSchur)
     {
         size_t curRow = 3 * mesh->nVertices();
@@ -506,7 +664,7 @@ namespace rsurfaces
         double initGuess = guessStepSize(gProjNorm);
         std::cout << "  * Initial step size guess = " << initGuess << std::endl;
         // Take the step using line search
-        LineSearch search(mesh, geom, energies, maxStepSize);
+        LineSearch search(mesh, geom, energies, maxStepSize, speculativeProbes, lineSearchCoarseTheta, CoarseLineSearchState());
         double delta = search.BacktrackingLineSearch(gradientProj, initGuess, gradDot);
 
         // Do corrective constraint projection by reusing the H1 metric
@@ -514,6 +672,7 @@ namespace rsurfaces
 
         incrementSchurConstraints();
         geom->refreshQuantities();
+        GeometryCache::PositionsChanged(geom);
 
         long timeEnd = currentTimeMilliseconds();
         std::cout << "  Total time for gradient step = " << (timeEnd - timeStart) << " ms" << std::endl;
@@ -555,6 +714,7 @@ namespace rsurfaces
                 geom->inputVertexPositions[v] = pos;
             }
             geom->refreshQuantities();
+            GeometryCache::PositionsChanged(geom);
         }
         stepCount++;
 
@@ -604,7 +764,7 @@ namespace rsurfaces
         double initGuess = guessStepSize(gProjNorm);
         std::cout << "  * Initial step size guess = " << initGuess << std::endl;
         // Take the step using line search
-        LineSearch search(mesh, geom, energies, maxStepSize);
+        LineSearch search(mesh, geom, energies, maxStepSize, speculativeProbes, lineSearchCoarseTheta, CoarseLineSearchState());
         double delta = search.BacktrackingLineSearch(gradientProj, initGuess, gradDot);
 
         // Make sure pins don't drift
@@ -616,6 +776,7 @@ namespace rsurfaces
         prevPositions2 = prevPositions1;
         savePositions(mesh, geom, prevPositions1);
         geom->refreshQuantities();
+        GeometryCache::PositionsChanged(geom);
 
         long timeEnd = currentTimeMilliseconds();
         std::cout << "  Total time for gradient step = " << (timeEnd - timeStart) << " ms" << std::endl;
@@ -666,7 +827,7 @@ namespace rsurfaces
         double gradDot = (l2diffvec.dot(lbfgs->direction())) / (gNorm * gProjNorm);
         std::cout << "  * Dot product = " << gradDot << std::endl;
 
-        LineSearch search(mesh, geom, energies, maxStepSize);
+        LineSearch search(mesh, geom, energies, maxStepSize, speculativeProbes, lineSearchCoarseTheta, CoarseLineSearchState());
         // Take the step using line search
         double initGuess = guessStepSize(gProjNorm);
         double delta = search.BacktrackingLineSearch(projected, initGuess, fmax(0, gradDot));
@@ -683,6 +844,7 @@ namespace rsurfaces
             spc->ProjectConstraint(mesh, geom);
         }
         geom->refreshQuantities();
+        GeometryCache::PositionsChanged(geom);
 
         long timeEnd = currentTimeMilliseconds();
         std::cout << "  Total time for gradient step = " << (timeEnd - timeStart) << " ms" << std::endl;
@@ -700,7 +862,7 @@ namespace rsurfaces
         {
             // B = (total area) ^ (2(d-1) / d) for d = 3
             // (equation 13 of BCQN / Zhu et al.)
-            double b = pow(totalArea(geom, mesh), 4.0 / 3.0);
+            double b = pow(GeometryCache::Get(geom).totalArea, 4.0 / 3.0);
             lbfgs = new BQN_LBFGS(20, simpleConstraints, b);
         }
 
@@ -736,7 +898,7 @@ namespace rsurfaces
         double gradDot = (l2diffvec.dot(lbfgs->direction())) / (gNorm * gProjNorm);
         std::cout << "  * Dot product = " << gradDot << std::endl;
 
-        LineSearch search(mesh, geom, energies, maxStepSize);
+        LineSearch search(mesh, geom, energies, maxStepSize, speculativeProbes, lineSearchCoarseTheta, CoarseLineSearchState());
         // Take the step using line search
         double initGuess = guessStepSize(gProjNorm);
         double delta = search.BacktrackingLineSearch(projected, initGuess, fmax(0, gradDot));
@@ -753,6 +915,7 @@ namespace rsurfaces
             spc->ProjectConstraint(mesh, geom);
         }
         geom->refreshQuantities();
+        GeometryCache::PositionsChanged(geom);
 
         long timeEnd = currentTimeMilliseconds();
         std::cout << "  Total time for gradient step = " << (timeEnd - timeStart) << " ms" << std::endl;
@@ -804,7 +967,7 @@ namespace rsurfaces
         double gradDot = (l2diff.transpose() * gradientProj).trace() / (gNorm * gProjNorm);
         double initGuess = guessStepSize(gProjNorm);
         std::cout << "  * Initial step size guess = " << initGuess << std::endl;
-        LineSearch search(mesh, geom, energies, maxStepSize);
+        LineSearch search(mesh, geom, energies, maxStepSize, speculativeProbes, lineSearchCoarseTheta, CoarseLineSearchState());
         double delta = search.BacktrackingLineSearch(gradientProj, initGuess, gradDot);
 
         // Do corrective constraint projection by reusing the metric
@@ -812,6 +975,7 @@ namespace rsurfaces
 
         incrementSchurConstraints();
         geom->refreshQuantities();
+        GeometryCache::PositionsChanged(geom);
 
         long timeEnd = currentTimeMilliseconds();
         std::cout << "  Total time for gradient step = " << (timeEnd - timeStart) << " ms" << std::endl;
@@ -0,0 +1,107 @@
+#include "thread_load.h"
+
+#include <fstream>
+#include <mutex>
+
+namespace rsurfaces
+{
+#ifdef LOAD_BALANCE_STATS
+
+    std::map<std::string, ThreadLoad::Record> ThreadLoad::records;
+
+    // guards records against flows that commit concurrently from different threads
+    static std::mutex records_mutex;
+
+    mreal ThreadLoad::Imbalance() const
+    {
+        mreal max = 0.;
+        mreal sum = 0.;
+        for (const Slot &s : slots)
+        {
+            max = std::max(max, s.busy);
+            sum += s.busy;
+        }
+        return sum > 0. ? max * slots.size() / sum : 1.;
+    } // Imbalance
+
+    void ThreadLoad::Commit()
+    {
+        mreal imbalance = Imbalance();
+
+        std::unique_lock<std::mutex> lock(records_mutex);
+        Record &r = records[tag];
+        if (r.busy.size() < slots.size())
+        {
+            r.busy.resize(slots.size(), 0.);
+            r.work.resize(slots.size(), 0);
+        }
+        r.calls++;
+        r.imbalance_sum += imbalance;
+        r.imbalance_max = std::max(r.imbalance_max, imbalance);
+        for (size_t thread = 0; thread < slots.size(); ++thread)
+        {
+            r.busy[thread] += slots[thread].busy;
+            r.work[thread] += slots[thread].work;
+        }
+        lock.unlock();
+
+        ptcounter("imbalance " + tag, imbalance);
+    } // Commit
+
+    void ThreadLoad::WriteSummary(std::ostream &os)
+    {
+        os << "Tag\tCalls\tMeanImbalance\tMaxImbalance\tBusyTotal\tWorkImbalance" << std::endl;
+        for (auto &it : records)
+        {
+            const Record &r = it.second;
+            mreal busy_total = 0.;
+            long long work_total = 0;
+            long long work_max = 0;
+            for (size_t thread = 0; thread < r.busy.size(); ++thread)
+            {
+                busy_total += r.busy[thread];
+                work_total += r.work[thread];
+                work_max = std::max(work_max, r.work[thread]);
+            }
+            mreal work_imbalance = work_total > 0 ? static_cast<mreal>(work_max) * r.work.size() / work_total : 1.;
+
+            os << it.first << "\t"
+               << r.calls << "\t"
+               << r.imbalance_sum / std::max(r.calls, 1LL) << "\t"
+               << r.imbalance_max << "\t"
+               << busy_total << "\t"
+               << work_imbalance << std::endl;
+        }
+
+        os << std::endl;
+        os << "Tag\tThread\tBusy\tWork" << std::endl;
+        for (auto &it : records)
+        {
+            const Record &r = it.second;
+            for (size_t thread = 0; thread < r.busy.size(); ++thread)
+            {
+                os << it.first << "\t" << thread << "\t" << r.busy[thread] << "\t" << r.work[thread] << std::endl;
+            }
+        }
+    } // WriteSummary
+
+    // Writes the summary next to the profile when the program exits.
+    static struct LoadBalanceSummaryWriter
+    {
+        ~LoadBalanceSummaryWriter()
+        {
+            if (!ThreadLoad::records.empty())
+            {
+                std::ofstream file("./LoadBalance.tsv");
+                ThreadLoad::WriteSummary(file);
+            }
+        }
+    } loadBalanceSummaryWriter;
+
+#else
+
+    void ThreadLoad::WriteSummary(std::ostream &os) {}
+
+#endif
+
+} // namespace rsurfaces